@@ -63,7 +63,14 @@ typedef struct _RArtifactRepo {
 	/** runtime information for different repo types */
 	union {
 		struct {
+			/** object name -> number of artifact instances using it */
 			GHashTable *local_store_objects;
+			/** artifact instances ("<name>-<digest>") included in the counts */
+			GHashTable *indexed_artifacts;
+			/** the persistent object index needs to be updated */
+			gboolean index_dirty;
+			/** objects copied to the store since the index was saved */
+			GHashTable *pending_objects;
 		} composefs;
 	};
 } RArtifactRepo;
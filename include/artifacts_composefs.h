@@ -9,7 +9,8 @@
  * Scan the composefs repo on disk for installed artifacts and load their
  * information.
  *
- * This also scans the object store.
+ * This also loads the persistent object index. If there is none, it is rebuilt
+ * by scanning the object store and the installed composefs images.
  *
  * @param repo RArtifactRepo to prepare
  * @param error a GError, or NULL
@@ -24,7 +25,8 @@ G_GNUC_WARN_UNUSED_RESULT;
  * Remove unreferenced artifacts and inconsistent data such as partial
  * downloads.
  *
- * This also removes unused objects from the object store.
+ * This also removes unused objects from the object store, based on the
+ * reference counts in the object index.
  *
  * @param repo RArtifactRepo to prune
  * @param error a GError, or NULL
@@ -34,10 +36,23 @@ G_GNUC_WARN_UNUSED_RESULT;
 gboolean r_composefs_artifact_repo_prune(RArtifactRepo *repo, GError **error)
 G_GNUC_WARN_UNUSED_RESULT;
 
+/**
+ * Write the object index of the composefs repo, if it was changed.
+ *
+ * @param repo RArtifactRepo to commit
+ * @param error a GError, or NULL
+ *
+ * @return TRUE if the commit was successful, otherwise FALSE
+ */
+gboolean r_composefs_artifact_repo_commit(RArtifactRepo *repo, GError **error)
+G_GNUC_WARN_UNUSED_RESULT;
+
 /**
  * Install a composefs artifact from the bundle into the repo.
  *
- * This also copies missing objects from the bundle into the local object store.
+ * This also copies missing objects from the bundle into the local object store
+ * and adds references to all objects used by the artifact to the in-memory
+ * object index. The index is persisted by r_composefs_artifact_repo_commit().
  *
  * @param artifact RArtifact to install to
  * @param image RaucImage to install from
@@ -61,6 +76,12 @@ static inline gboolean r_composefs_artifact_repo_prune(RArtifactRepo *repo, GErr
 	return FALSE;
 }
 
+static inline gboolean r_composefs_artifact_repo_commit(RArtifactRepo *repo, GError **error)
+{
+	g_error("composefs support not enabled at compile time");
+	return FALSE;
+}
+
 static inline gboolean r_composefs_artifact_install(const RArtifact *artifact, const RaucImage *image, const gchar *name, GError **error)
 {
 	g_error("composefs support not enabled at compile time");
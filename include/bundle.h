@@ -46,6 +46,8 @@ typedef struct {
 	GBytes *enveloped_data;
 	GBytes *sigdata;
 	gchar *mount_point;
+	/* decrypted and verified payload while mounted (verity and crypt only) */
+	gchar *payload_device;
 	RaucManifest *manifest;
 	gboolean verification_disabled;
 	gboolean signature_verified;
@@ -242,6 +244,36 @@ G_GNUC_WARN_UNUSED_RESULT;
 gboolean encrypt_bundle(RaucBundle *bundle, const gchar *outbundle, GError **error)
 G_GNUC_WARN_UNUSED_RESULT;
 
+typedef struct {
+	/** output location for the encrypted bundle */
+	gchar *outbundle;
+	/** NULL-terminated list of recipient certificate files */
+	gchar **recipients;
+} RaucEncryptTarget;
+
+void free_encrypt_target(RaucEncryptTarget *target);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC(RaucEncryptTarget, free_encrypt_target);
+
+/**
+ * Encrypt a crypt bundle for several sets of recipients at once.
+ *
+ * Each recipient certificate file is loaded only once. The outputs are
+ * written by multiple threads, each copying the payload (using reflinks where
+ * possible) and appending its own encrypted CMS. Recipients configured in
+ * the context (via --to) are added to each output.
+ *
+ * If any output fails, all outputs created so far are removed.
+ *
+ * @param bundle RaucBundle struct as returned by check_bundle()
+ * @param targets GPtrArray of RaucEncryptTarget
+ * @param error Return location for a GError
+ *
+ * @return TRUE on success, FALSE if an error occurred
+ */
+gboolean encrypt_bundle_batch(RaucBundle *bundle, GPtrArray *targets, GError **error)
+G_GNUC_WARN_UNUSED_RESULT;
+
 /**
  * Mount a bundle.
  *
@@ -52,6 +52,8 @@ typedef struct {
 	gint boot_attempts_primary;
 	gchar *grubenv_path;
 	gchar *custom_bootloader_backend;
+	/* keep custom bootloader backend running as coprocess */
+	gboolean custom_bootloader_persistent;
 	gboolean efi_use_bootnext;
 	/** prevent fallback after successfully booting into primary slot */
 	gboolean prevent_late_fallback;
@@ -59,8 +61,11 @@ typedef struct {
 	guint64 max_bundle_download_size;
 	/* maximum signature/CMS size in bytes */
 	guint64 max_bundle_signature_size;
+	/* maximum memory for block hash indices in bytes, 0 for unlimited */
+	guint64 hash_index_memory_limit;
 	/* path prefix where rauc may create mount directories */
 	gchar *mount_prefix;
+	gchar *trace_path;
 	gchar *store_path;
 	gchar *tmp_path;
 	gchar *casync_install_args;
@@ -68,6 +73,7 @@ typedef struct {
 	gboolean activate_installed;
 	gchar *data_directory;
 	gchar *statusfile_path;
+	gboolean statusfile_journal;
 	gchar *keyring_path;
 	gchar *keyring_directory;
 	gboolean keyring_allow_partial_chain;
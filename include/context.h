@@ -54,10 +54,17 @@ typedef struct {
 	gchar *encryption_key;
 	gchar *mksquashfs_args;
 	gchar *casync_args;
+	/* number of images processed in parallel during bundle creation
+	 * (0 means one per CPU) */
+	guint bundle_jobs;
+	/* create the bundle payload without calling mksquashfs */
+	gboolean builtin_squashfs;
 	gchar **recipients;
 	gchar **intermediatepaths;
 	/* optional global mount prefix overwrite */
 	gchar *mountprefix;
+	/* optional trace file overwrite */
+	gchar *tracepath;
 	gchar *bootslot;
 	gchar *boot_id;
 	gchar *machine_id;
@@ -91,6 +98,10 @@ typedef struct {
 	gfloat percent_total;
 	gfloat percent_done;
 	gint last_explicit_percent;
+
+	/* tracing state (see trace.h) */
+	gint64 trace_begin;
+	guint64 trace_bytes;
 } RaucProgressStep;
 
 /**
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <glib.h>
+
+#define R_EXT4_ERROR r_ext4_error_quark()
+GQuark r_ext4_error_quark(void);
+
+typedef enum {
+	R_EXT4_ERROR_FAILED,
+	R_EXT4_ERROR_INVALID,
+	R_EXT4_ERROR_UNSUPPORTED,
+	R_EXT4_ERROR_NOT_FOUND,
+} RExt4Error;
+
+/**
+ * Reads a regular file from the root directory of an ext2/3/4 filesystem
+ * without mounting it.
+ *
+ * Only a minimal read-only subset of the on-disk format is implemented
+ * (extents and direct/single-indirect block maps, linear directory scan).
+ * Filesystems which need journal recovery or use features which are not
+ * understood are rejected with R_EXT4_ERROR_UNSUPPORTED, so that the caller
+ * can fall back to mounting.
+ *
+ * @param device block device or image file containing the filesystem
+ * @param name name of the file in the root directory
+ * @param max_size maximum accepted file size
+ * @param error return location for a GError, or NULL
+ *
+ * @return file content, or NULL on error
+ */
+GBytes *r_ext4_read_root_file(const gchar *device, const gchar *name, gsize max_size, GError **error)
+G_GNUC_WARN_UNUSED_RESULT;
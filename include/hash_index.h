@@ -13,6 +13,7 @@ typedef enum {
 	R_HASH_INDEX_ERROR_SIZE,
 	R_HASH_INDEX_ERROR_NOT_FOUND,
 	R_HASH_INDEX_ERROR_MODIFIED,
+	R_HASH_INDEX_ERROR_MEMORY,
 } RHashIndexErrorError;
 
 typedef struct {
@@ -20,12 +21,21 @@ typedef struct {
 	guint8 hash[32];
 } RaucHashIndexChunk;
 
+/* entry of the lookup table in compact mode */
+typedef struct {
+	guint32 prefix; /* first bytes of the chunk hash */
+	guint32 chunk; /* chunk number */
+} RaucHashIndexEntry;
+
 typedef struct {
 	gchar *label; /* label for debugging */
 	int data_fd; /* file descriptor of the indexed data */
+	goffset data_offset; /* start of the indexed data in data_fd */
 	guint32 count; /* number of chunks */
-	GBytes *hashes; /* either GBytes in memory or GMappedFile */
+	GBytes *hashes; /* either GBytes in memory or GMappedFile, NULL for slots in compact mode */
 	guint32 *lookup; /* chunk numbers sorted by chunk hash */
+	RaucHashIndexEntry *entries; /* sorted by hash prefix and chunk number, instead of lookup in compact mode */
+	guint64 memory; /* bytes allocated for hashes and lookup table */
 	guint32 invalid_below; /* for old index of target */
 	guint32 invalid_from; /* for new index of target */
 	RaucStats *match_stats; /* how many searches were successful */
@@ -86,6 +96,7 @@ G_GNUC_WARN_UNUSED_RESULT;
  * Creates a hash index for the given image.
  *
  * Loads a previously stored `<image>.block-hash-index` file from the bundle.
+ * Uncompressed images with a payload device are read directly from it.
  *
  * @param label label for hash index (used for debugging/identification)
  * @param image image to open the hash index for
@@ -140,6 +151,15 @@ G_GNUC_WARN_UNUSED_RESULT;
 gboolean r_hash_index_get_chunk(const RaucHashIndex *idx, const guint8 *hash, RaucHashIndexChunk *chunk, GError **error)
 G_GNUC_WARN_UNUSED_RESULT;
 
+/**
+ * Returns the memory allocated by all currently open hash indices.
+ *
+ * Hashes loaded from an index file are mapped and not included.
+ *
+ * @return number of bytes
+ */
+guint64 r_hash_index_get_memory(void);
+
 /**
  * Frees the hash index.
  *
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <glib.h>
+#include <sys/types.h>
+
+#include "manifest.h"
+
+/**
+ * @file inspect_cache.h
+ * @brief Results of bundle inspections in the service
+ *
+ * Update agents often inspect the same bundle several times before installing
+ * it. The service keeps the manifest information of recently inspected local
+ * bundles, so that these calls do not need to verify the signature again.
+ *
+ * A cached result is only used while the bundle file and the configured
+ * keyring are unchanged and it is not older than R_INSPECT_CACHE_MAX_AGE, as
+ * the verification also depends on the current time.
+ */
+
+/* maximum number of cached bundles */
+#define R_INSPECT_CACHE_MAX_ENTRIES 8
+/* maximum age of a cached result (in microseconds) */
+#define R_INSPECT_CACHE_MAX_AGE (5 * 60 * G_USEC_PER_SEC)
+
+typedef struct {
+	/* identity of the bundle file */
+	dev_t dev;
+	ino_t ino;
+	goffset size;
+	gint64 mtime_nsec;
+	gint64 ctime_nsec;
+	/* state of the keyring used for verification */
+	gchar *keyring_stamp;
+	/* monotonic time of the verification */
+	gint64 created;
+	gchar *compatible;
+	gchar *version;
+	GVariant *info;
+} RaucInspectCacheEntry;
+
+/**
+ * Get the identity of a local bundle and of the configured keyring.
+ *
+ * This must be called before the bundle is checked, so that changes during
+ * the check invalidate the result.
+ *
+ * @param bundle bundle path (or URL)
+ * @param identity return location for the identity, to be cleared with
+ *        r_inspect_cache_identity_clear()
+ *
+ * @return TRUE if the bundle can be cached, FALSE if it is remote or cannot
+ *         be accessed
+ */
+gboolean r_inspect_cache_identity(const gchar *bundle, RaucInspectCacheEntry *identity);
+
+/**
+ * Free the contents of an identity returned by r_inspect_cache_identity().
+ *
+ * @param identity identity to clear
+ */
+void r_inspect_cache_identity_clear(RaucInspectCacheEntry *identity);
+
+/**
+ * Look up the cached result for a bundle.
+ *
+ * Outdated results are removed. For local bundles, each lookup is counted as
+ * hit or miss.
+ *
+ * @param bundle bundle path (or URL)
+ *
+ * @return the cached result (owned by the cache), or NULL
+ */
+const RaucInspectCacheEntry* r_inspect_cache_lookup(const gchar *bundle);
+
+/**
+ * Store the result of checking a bundle.
+ *
+ * @param bundle bundle path
+ * @param identity identity returned by r_inspect_cache_identity() before the
+ *        check, its contents are taken over by the cache
+ * @param manifest manifest of the verified bundle
+ */
+void r_inspect_cache_insert(const gchar *bundle, RaucInspectCacheEntry *identity, RaucManifest *manifest);
+
+/**
+ * Get the number of lookups for local bundles which used a cached result
+ * (hits) or not (misses).
+ *
+ * @param hits return location for the number of hits
+ * @param misses return location for the number of misses
+ */
+void r_inspect_cache_get_counters(guint64 *hits, guint64 *misses);
+
+/**
+ * Remove all cached results and reset the counters.
+ */
+void r_inspect_cache_clear(void);
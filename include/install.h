@@ -36,6 +36,9 @@ typedef struct {
 	gchar *require_manifest_hash;
 	gchar *transaction;
 	RaucBundleAccessArgs access_args;
+	/* already checked and mounted bundle (owned), e.g. from an inspection
+	 * session */
+	RaucBundle *bundle;
 } RaucInstallArgs;
 
 /**
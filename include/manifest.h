@@ -39,6 +39,12 @@ typedef struct {
 	GStrv convert;
 	/* String array of converted filenames. Not NULL-terminated! */
 	GPtrArray* converted;
+	/* store the image uncompressed at a block-aligned offset in the payload */
+	gboolean uncompressed;
+	/* offset of the uncompressed image in the bundle payload, 0 if unset */
+	guint64 payload_offset;
+	/* device to read the uncompressed image from during installation */
+	gchar* payload_device;
 } RaucImage;
 
 typedef enum {
@@ -199,7 +205,7 @@ G_DEFINE_AUTOPTR_CLEANUP_FUNC(RaucManifest, free_manifest);
 
 /**
  * Checks presence of image and hook files (defined in manifest) in bundle
- * content directory and updates checksums.
+ * content directory.
  *
  * @param manifest pointer to the manifest
  * @param dir Directory with the bundle content
@@ -207,7 +213,7 @@ G_DEFINE_AUTOPTR_CLEANUP_FUNC(RaucManifest, free_manifest);
  *
  * @return TRUE on success, FALSE if an error occurred
  */
-gboolean sync_manifest_with_contentdir(RaucManifest *manifest, const gchar *dir, GError **error)
+gboolean check_manifest_contentdir(const RaucManifest *manifest, const gchar *dir, GError **error)
 G_GNUC_WARN_UNUSED_RESULT;
 
 /**
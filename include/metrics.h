@@ -0,0 +1,104 @@
+#pragma once
+
+#include <glib.h>
+
+/**
+ * @file metrics.h
+ * @brief Live metrics of the running installation
+ *
+ * The copy loops count the written bytes by their source, progress steps
+ * report their elapsed time. r_metrics_to_variant() can be called from any
+ * thread to get a snapshot including the current throughput and an estimate
+ * of the remaining time.
+ *
+ * Data written by external programs (casync, install hooks, custom bundle
+ * handlers) cannot be counted. Once such a program is used, the total of
+ * written bytes and the values derived from it are reported as unknown.
+ */
+
+typedef enum {
+	/* image data read from the bundle */
+	R_METRICS_SOURCE_BUNDLE,
+	/* chunks reused from the target or active slot (adaptive updates) */
+	R_METRICS_SOURCE_SEED,
+	/* zero chunks, which are generated without reading */
+	R_METRICS_SOURCE_ZERO,
+} RMetricsSource;
+
+/* number of seconds used to calculate the current throughput */
+#define R_METRICS_THROUGHPUT_WINDOW 10
+
+/**
+ * Resets all metrics and starts collecting them.
+ */
+void r_metrics_start(void);
+
+/**
+ * Stops collecting metrics.
+ *
+ * The collected metrics are kept until the next call of r_metrics_start().
+ */
+void r_metrics_stop(void);
+
+/**
+ * Sets the number of bytes expected to be written by the installation.
+ *
+ * This is used to estimate the remaining time.
+ *
+ * @param bytes total size of all images to install
+ */
+void r_metrics_set_total(guint64 bytes);
+
+/**
+ * Adds to the number of written bytes.
+ *
+ * @param source where the written data was read from
+ * @param bytes number of bytes written
+ */
+void r_metrics_add_bytes(RMetricsSource source, guint64 bytes);
+
+/**
+ * Marks the installation as writing data which is not counted.
+ *
+ * Must be called before running an external program which writes to a slot.
+ * The number of written bytes, the throughput, the estimated remaining time
+ * and the dedup ratio are then omitted until the next r_metrics_start().
+ */
+void r_metrics_mark_untracked(void);
+
+/**
+ * Sets the block device used to access a streamed bundle.
+ *
+ * The bytes read via this device (and thus received by the NBD server) are
+ * reported as network bytes.
+ *
+ * @param dev block device (e.g. /dev/nbd0) or NULL when the device is
+ *        removed
+ */
+void r_metrics_set_network_device(const gchar *dev);
+
+/**
+ * Marks the start of an installation phase (progress step).
+ *
+ * The elapsed times of phases with the same name are summed up.
+ *
+ * @param name name of the phase
+ */
+void r_metrics_phase_begin(const gchar *name);
+
+/**
+ * Marks the end of an installation phase started by r_metrics_phase_begin().
+ *
+ * @param name name of the phase
+ */
+void r_metrics_phase_end(const gchar *name);
+
+/**
+ * Returns a snapshot of the metrics.
+ *
+ * See the documentation of the 'Metrics' D-Bus property for the contained
+ * keys.
+ *
+ * @return a new floating GVariant of type a{sv}
+ */
+GVariant *r_metrics_to_variant(void);
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <glib.h>
+
+#define R_MTD_ERROR r_mtd_error_quark()
+GQuark r_mtd_error_quark(void);
+
+typedef enum {
+	R_MTD_ERROR_FAILED,
+	R_MTD_ERROR_IOCTL,
+	R_MTD_ERROR_NO_SPACE,
+} RMtdError;
+
+/**
+ * Erases all good eraseblocks of an MTD device.
+ *
+ * Bad blocks (on NAND) are skipped. On NOR, blocks which are already erased
+ * are not erased again to reduce flash wear.
+ *
+ * @param device MTD character device (/dev/mtdX)
+ * @param error return location for a GError, or NULL
+ *
+ * @return TRUE if succeeded, FALSE if failed
+ */
+gboolean r_mtd_erase(const gchar *device, GError **error)
+G_GNUC_WARN_UNUSED_RESULT;
+
+/**
+ * Writes an image to an MTD device.
+ *
+ * Each eraseblock is erased just before it is written. On NOR, blocks which
+ * already contain the expected data are neither erased nor written. On NAND,
+ * all blocks are erased and written, as reading back a block cannot detect
+ * whether it was left unreliable by an interrupted erase or write. Bad NAND
+ * blocks are skipped (like nandwrite does) and the last page is padded with
+ * 0xFF. All remaining blocks after the image are erased.
+ *
+ * When called in a 'copy_image' progress step, the progress is updated
+ * according to the amount of data written.
+ *
+ * @param image image file to write
+ * @param device MTD character device (/dev/mtdX)
+ * @param error return location for a GError, or NULL
+ *
+ * @return TRUE if succeeded, FALSE if failed
+ */
+gboolean r_mtd_write_image(const gchar *image, const gchar *device, GError **error)
+G_GNUC_WARN_UNUSED_RESULT;
@@ -5,6 +5,8 @@
 
 /* FD used to pass the open NBD socket to the server process */
 #define RAUC_SOCKET_FD 3
+/* FD used by the server process to return its statistics */
+#define RAUC_STATS_FD 5
 
 #define R_NBD_ERROR r_nbd_error_quark()
 GQuark r_nbd_error_quark(void);
@@ -31,6 +33,7 @@ typedef struct {
 typedef struct {
 	gint sock; /* client side socket */
 	GSubprocess *sproc;
+	gint stats_fd; /* read end of the statistics pipe */
 
 	/* configuration */
 	gchar *url;
@@ -80,6 +80,32 @@ G_GNUC_WARN_UNUSED_RESULT;
 X509_STORE* setup_x509_store(const gchar *capath, const gchar *cadir, GError **error)
 G_GNUC_WARN_UNUSED_RESULT;
 
+/**
+ * Enable or disable caching of the configured keyring.
+ *
+ * While enabled, setup_x509_store() reuses the X509_STORE loaded from the
+ * configured keyring file and directory as long as their stat information
+ * and the keyring options are unchanged. Disabling the cache frees it.
+ *
+ * This is intended for the long-running service, which checks many bundles
+ * against the same keyring.
+ *
+ * @param enabled TRUE to enable the cache
+ */
+void r_signature_set_keyring_cache(gboolean enabled);
+
+/**
+ * Describe the current state of the configured keyring.
+ *
+ * The returned string changes whenever the configured keyring file or
+ * directory (including the files in it) or the keyring options change. It can
+ * be stored along with results that depend on the keyring to detect that they
+ * are outdated.
+ *
+ * @return newly allocated string
+ */
+gchar* r_signature_get_keyring_stamp(void);
+
 /**
  * Sign content with provided certificate and private key
  *
@@ -297,6 +323,34 @@ G_GNUC_WARN_UNUSED_RESULT;
  */
 GBytes *cms_encrypt(GBytes *content, gchar **recipients, GError **error);
 
+/**
+ * Load recipient certificates for encryption.
+ *
+ * @param[in] recipients NULL-terminated array of recipient certificate file
+ *                   name strings.
+ *                   If the file contains multiple concatenated
+ *                   certificates, all will be read.
+ * @param[out] error return location for a GError, or NULL
+ *
+ * @return stack of certificates (free with sk_X509_pop_free()), NULL if failed
+ */
+STACK_OF(X509) *cms_load_recipients(gchar **recipients, GError **error)
+G_GNUC_WARN_UNUSED_RESULT;
+
+/**
+ * Encrypt content for already loaded recipient certificates.
+ *
+ * This can be called from multiple threads with the same certificates.
+ *
+ * @param[in] content content to encrypt
+ * @param[in] recipcerts recipient certificates
+ * @param[out] error return location for a GError, or NULL
+ *
+ * @return encrypted CMS data, NULL if failed
+ */
+GBytes *cms_encrypt_certs(GBytes *content, STACK_OF(X509) *recipcerts, GError **error)
+G_GNUC_WARN_UNUSED_RESULT;
+
 /**
  * Decrypt content with provided keyfile.
  *
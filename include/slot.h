@@ -214,6 +214,43 @@ G_GNUC_WARN_UNUSED_RESULT;
  */
 void r_slot_clean_data_directory(const RaucSlot *slot);
 
+/**
+ * Records a fingerprint of the slot content after it was written with the
+ * image described by checksum.
+ *
+ * The fingerprint consists of the device identity, size and generation and
+ * a hash over samples distributed over the whole device. It is stored as
+ * 'fingerprint' in the slot's data directory. Nothing is done if no data
+ * directory is configured or the slot is neither a block device nor a file.
+ *
+ * @param slot slot which was written
+ * @param checksum checksum of the image written to the slot
+ * @param error return location for a GError, or NULL
+ *
+ * @return TRUE if succeeded, FALSE if failed
+ */
+gboolean r_slot_fingerprint_save(const RaucSlot *slot, const RaucChecksum *checksum, GError **error)
+G_GNUC_WARN_UNUSED_RESULT;
+
+/**
+ * Removes the fingerprint of a slot (before it is written).
+ *
+ * @param slot slot to remove fingerprint for
+ */
+void r_slot_fingerprint_clear(const RaucSlot *slot);
+
+/**
+ * Checks whether the slot still contains the image described by checksum
+ * according to the fingerprint recorded after the last write.
+ *
+ * @param slot slot to check
+ * @param checksum checksum of the image which should be installed
+ *
+ * @return TRUE if the fingerprint matches the current slot content, FALSE
+ *         otherwise
+ */
+gboolean r_slot_fingerprint_matches(const RaucSlot *slot, const RaucChecksum *checksum);
+
 /**
  * Gets all classes that do not have a parent
  *
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <glib.h>
+
+#define R_SQUASHFS_ERROR r_squashfs_error_quark()
+GQuark r_squashfs_error_quark(void);
+
+typedef enum {
+	R_SQUASHFS_ERROR_FAILED,
+	R_SQUASHFS_ERROR_UNSUPPORTED,
+} RSquashfsError;
+
+/* Files larger than one data block start at an offset aligned to this size */
+#define R_SQUASHFS_FILE_ALIGNMENT 4096
+
+/**
+ * Calculates where r_squashfs_write() will place uncompressed files.
+ *
+ * Uncompressed files are stored first, in the given order, each starting at
+ * an offset aligned to R_SQUASHFS_FILE_ALIGNMENT. As all of their blocks are
+ * stored as-is, the content of such a file is a contiguous range of the image.
+ *
+ * @param contentdir directory the image will be created from
+ * @param uncompressed NULL-terminated list of file names in the top-level
+ *        directory
+ * @param offsets return location for the offset of each file, must have room
+ *        for one entry per file name
+ * @param error return location for a GError, or NULL
+ *
+ * @return TRUE on success, FALSE if an error occurred
+ */
+gboolean r_squashfs_plan_uncompressed(const gchar *contentdir, const gchar * const *uncompressed, guint64 *offsets, GError **error)
+G_GNUC_WARN_UNUSED_RESULT;
+
+/**
+ * Writes a squashfs image of a directory tree without calling mksquashfs.
+ *
+ * The image uses gzip compression with 128 KiB blocks and no fragments.
+ * Ownership is set to root and xattrs are not stored (like mksquashfs with
+ * -all-root -no-xattrs). All timestamps are set to SOURCE_DATE_EPOCH (or 0 if
+ * unset), so the output only depends on the content, names and permissions
+ * of the input tree.
+ *
+ * Data blocks are compressed in parallel by the given number of threads.
+ * Files larger than one block start at an offset aligned to
+ * R_SQUASHFS_FILE_ALIGNMENT. The image is padded to a multiple of 4096 bytes.
+ * Files listed in 'uncompressed' are laid out as described for
+ * r_squashfs_plan_uncompressed().
+ *
+ * @param contentdir directory to create the image from
+ * @param outpath path of the image to create (must not exist)
+ * @param threads number of compression threads (0 means one per CPU)
+ * @param uncompressed NULL-terminated list of top-level files to store
+ *        uncompressed, or NULL
+ * @param error return location for a GError, or NULL
+ *
+ * @return TRUE on success, FALSE if an error occurred
+ */
+gboolean r_squashfs_write(const gchar *contentdir, const gchar *outpath, guint threads, const gchar * const *uncompressed, GError **error)
+G_GNUC_WARN_UNUSED_RESULT;
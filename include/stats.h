@@ -2,27 +2,143 @@
 
 #include <glib.h>
 
+#define R_STATS_ERROR r_stats_error_quark()
+GQuark r_stats_error_quark(void);
+
+typedef enum {
+	R_STATS_ERROR_INVALID,
+} RStatsError;
+
+/* The histogram uses 8 linear sub-buckets per power of two, so each bucket
+ * covers a value range of at most 12.5% (relative). Values below
+ * 2^R_STATS_HISTOGRAM_MIN_EXP (including zero and negative values) share the
+ * first bucket, values above 2^R_STATS_HISTOGRAM_MAX_EXP the last one. */
+#define R_STATS_HISTOGRAM_SUB_BITS 3
+#define R_STATS_HISTOGRAM_SUB_BUCKETS (1 << R_STATS_HISTOGRAM_SUB_BITS)
+#define R_STATS_HISTOGRAM_MIN_EXP (-30)
+#define R_STATS_HISTOGRAM_MAX_EXP 64
+#define R_STATS_HISTOGRAM_BUCKETS (1 + (R_STATS_HISTOGRAM_MAX_EXP - R_STATS_HISTOGRAM_MIN_EXP) * R_STATS_HISTOGRAM_SUB_BUCKETS)
+
 typedef struct {
 	gchar *label;
 	gdouble values[64];
 	guint64 count, next;
 	gdouble sum;
 	gdouble min, max;
+	/* monotonic time of the first and last value (in microseconds) */
+	gint64 first_time, last_time;
+	guint64 histogram[R_STATS_HISTOGRAM_BUCKETS];
 } RaucStats;
 
 RaucStats *r_stats_new(const gchar *label);
 
 void r_stats_add(RaucStats *stats, gdouble value);
 
+/**
+ * Merges the values collected in 'src' into 'dst'.
+ *
+ * Count, sum, min, max, time range and histogram are combined. The window of
+ * recent values of 'dst' is kept as is.
+ *
+ * @param dst stats to merge into
+ * @param src stats to merge
+ */
+void r_stats_merge(RaucStats *dst, const RaucStats *src);
+
 gdouble r_stats_get_avg(const RaucStats *stats);
 
 gdouble r_stats_get_recent_avg(const RaucStats *stats);
 
+/**
+ * Returns an approximation of the given percentile from the histogram.
+ *
+ * The result is accurate to the bucket width (see
+ * R_STATS_HISTOGRAM_SUB_BUCKETS) and limited to the range [min, max].
+ *
+ * @param stats stats to query
+ * @param percentile percentile to return (0-100)
+ *
+ * @return the approximated value, or 0.0 if no values were added
+ */
+gdouble r_stats_get_percentile(const RaucStats *stats, gdouble percentile);
+
+/**
+ * Returns the number of values added per second.
+ *
+ * The rate is calculated over the time between the first and last value.
+ *
+ * @return values per second, or 0.0 if less than two values were added
+ */
+gdouble r_stats_get_rate(const RaucStats *stats);
+
+/**
+ * Returns the sum of values added per second (e.g. bytes per second for
+ * transfer sizes).
+ *
+ * @return sum per second, or 0.0 if less than two values were added
+ */
+gdouble r_stats_get_sum_rate(const RaucStats *stats);
+
 void r_stats_show(const RaucStats *stats, const gchar *prefix);
 
+/**
+ * Converts the stats to a string-variant dictionary.
+ *
+ * The dictionary contains the label, count, sum, min, max, avg, recent-avg,
+ * p50, p90, p99, rate and sum-rate. If 'histogram' is set, the time range
+ * ('first-time', 'last-time') and the non-empty histogram buckets
+ * ('histogram' as array of (bucket, count) tuples) are included as well, which
+ * allows restoring mergeable stats with r_stats_from_variant().
+ *
+ * @param stats stats to convert
+ * @param histogram whether to include the histogram
+ *
+ * @return a new floating GVariant of type a{sv}
+ */
+GVariant *r_stats_to_variant(const RaucStats *stats, gboolean histogram);
+
+/**
+ * Creates stats from a dictionary created by r_stats_to_variant() with
+ * histogram.
+ *
+ * The window of recent values is not restored.
+ *
+ * @param variant dictionary of type a{sv}
+ * @param error return location for a GError, or NULL
+ *
+ * @return newly allocated RaucStats or NULL on error
+ */
+RaucStats *r_stats_from_variant(GVariant *variant, GError **error)
+G_GNUC_WARN_UNUSED_RESULT;
+
 void r_stats_free(RaucStats *stats);
 G_DEFINE_AUTOPTR_CLEANUP_FUNC(RaucStats, r_stats_free);
 
+/**
+ * Makes a copy of the stats available via r_stats_get_published().
+ *
+ * Stats published with the same label are merged, so stats from several
+ * images or processes are combined.
+ *
+ * @param stats stats to publish
+ */
+void r_stats_publish(const RaucStats *stats);
+
+/**
+ * Returns all published stats.
+ *
+ * @param histogram whether to include the histograms
+ *
+ * @return a new floating GVariant of type a{sa{sv}} (label to stats
+ *         dictionary)
+ */
+GVariant *r_stats_get_published(gboolean histogram);
+
+/**
+ * Removes all published stats (e.g. at the start of an installation).
+ */
+void r_stats_clear_published(void);
+
 /* additional functions for testing */
 void r_test_stats_start(void);
 void r_test_stats_stop(void);
@@ -0,0 +1,173 @@
+#pragma once
+
+#include <glib.h>
+#include <gio/gio.h>
+
+/**
+ * @file trace.h
+ * @brief Lightweight recording of timed spans for performance analysis
+ *
+ * While tracing is active, each span (progress step, hash index phase, NBD
+ * request, subprocess run, ...) is recorded with its begin and end time, the
+ * recording thread and an optional byte counter. The events are kept in
+ * memory and written to the trace file when tracing is stopped, so recording
+ * does not cause additional I/O during the traced operation.
+ *
+ * When tracing is inactive, r_trace_begin() returns 0 and all other recording
+ * functions return immediately.
+ */
+
+#define R_TRACE_ERROR r_trace_error_quark()
+GQuark r_trace_error_quark(void);
+
+typedef enum {
+	R_TRACE_ERROR_FAILED,
+	R_TRACE_ERROR_ACTIVE,
+} RTraceError;
+
+typedef enum {
+	/* Chrome trace-event JSON (loadable by chrome://tracing or Perfetto) */
+	R_TRACE_FORMAT_JSON,
+	/* compact binary log, see docs/advanced.rst for the layout */
+	R_TRACE_FORMAT_BINARY,
+} RTraceFormat;
+
+/* FD used to pass the trace file to the NBD server process */
+#define RAUC_TRACE_FD 4
+
+/* event categories */
+#define R_TRACE_CAT_STEP "step"
+#define R_TRACE_CAT_HASH_INDEX "hash-index"
+#define R_TRACE_CAT_NBD "nbd"
+#define R_TRACE_CAT_SUBPROCESS "subprocess"
+#define R_TRACE_CAT_IO "io"
+
+/**
+ * Returns the format used for a trace file.
+ *
+ * Paths ending in '.rtrace' use the compact binary format, all others use
+ * Chrome trace-event JSON.
+ *
+ * @param path path of the trace file
+ *
+ * @return the trace format
+ */
+RTraceFormat r_trace_format_for_path(const gchar *path);
+
+/**
+ * Starts recording trace events to a file.
+ *
+ * The file is created (or truncated) immediately, but only written by
+ * r_trace_stop().
+ *
+ * @param path path of the trace file, the format is selected by
+ *        r_trace_format_for_path()
+ * @param error return location for a GError, or NULL
+ *
+ * @return TRUE on success, FALSE if an error occurred
+ */
+gboolean r_trace_start(const gchar *path, GError **error)
+G_GNUC_WARN_UNUSED_RESULT;
+
+/**
+ * Starts recording trace events to an already open file descriptor.
+ *
+ * This is used by the NBD server process, which cannot open the trace file
+ * itself after dropping its privileges.
+ *
+ * @param fd file descriptor to write the events to (ownership is taken)
+ * @param format trace format
+ * @param error return location for a GError, or NULL
+ *
+ * @return TRUE on success, FALSE if an error occurred
+ */
+gboolean r_trace_start_fd(int fd, RTraceFormat format, GError **error)
+G_GNUC_WARN_UNUSED_RESULT;
+
+/**
+ * Returns whether trace events are currently recorded.
+ */
+gboolean r_trace_is_enabled(void);
+
+/**
+ * Returns the path of the active trace file.
+ *
+ * @return newly allocated path (free with g_free()) or NULL if tracing is
+ *         inactive or was started with r_trace_start_fd()
+ */
+gchar *r_trace_get_path(void);
+
+/**
+ * Returns a new path for an additional trace file, which is recorded by a
+ * subprocess.
+ *
+ * The path is the one of the active trace file, followed by the suffix and a
+ * number, which is incremented for each call during the same trace, so that
+ * consecutive or concurrent subprocesses do not overwrite each other's files.
+ *
+ * @param suffix suffix identifying the subprocess
+ *
+ * @return newly allocated path (free with g_free()) or NULL if tracing is
+ *         inactive or was started with r_trace_start_fd()
+ */
+gchar *r_trace_get_aux_path(const gchar *suffix);
+
+/**
+ * Returns the format of the active trace file.
+ */
+RTraceFormat r_trace_get_format(void);
+
+/**
+ * Returns the begin timestamp for a new span.
+ *
+ * @return monotonic time in microseconds, or 0 if tracing is inactive
+ */
+gint64 r_trace_begin(void);
+
+/**
+ * Records a span which started at 'begin' and ends now.
+ *
+ * @param category event category (must be a static string)
+ * @param name event name
+ * @param begin timestamp returned by r_trace_begin()
+ * @param bytes number of bytes processed in this span
+ */
+void r_trace_end(const gchar *category, const gchar *name, gint64 begin, guint64 bytes);
+
+/**
+ * Adds to the global counter of copied bytes.
+ *
+ * Progress steps record the number of bytes copied while they were active.
+ *
+ * @param bytes number of bytes copied
+ */
+void r_trace_add_bytes(guint64 bytes);
+
+/**
+ * Returns the current value of the global counter of copied bytes.
+ */
+guint64 r_trace_get_bytes(void);
+
+/**
+ * Records a span for a subprocess.
+ *
+ * The span ends when the GSubprocess is finalized, which normally happens
+ * directly after waiting for it to exit.
+ *
+ * @param sproc subprocess to trace (may be NULL if spawning failed)
+ * @param argv0 executable of the subprocess
+ * @param begin timestamp returned by r_trace_begin() before spawning
+ */
+void r_trace_subprocess(GSubprocess *sproc, const gchar *argv0, gint64 begin);
+
+/**
+ * Stops recording and writes all recorded events to the trace file.
+ *
+ * Does nothing if tracing is inactive.
+ *
+ * @param error return location for a GError, or NULL
+ *
+ * @return TRUE on success, FALSE if an error occurred
+ */
+gboolean r_trace_stop(GError **error)
+G_GNUC_WARN_UNUSED_RESULT;
@@ -63,3 +63,39 @@ G_GNUC_WARN_UNUSED_RESULT;
 gboolean r_copy_stream_with_progress(GInputStream *in_stream, GOutputStream *out_stream,
 		goffset size, GError **error)
 G_GNUC_WARN_UNUSED_RESULT;
+
+/**
+ * Copies exactly 'size' bytes from an input stream to an output stream, while
+ * generating progress updates.
+ *
+ * In contrast to r_copy_stream_with_progress(), this stops reading after
+ * 'size' bytes, so it can copy a range of a larger input (such as a device).
+ *
+ * @param in_stream input stream
+ * @param out_stream output stream
+ * @param size number of bytes to copy
+ * @param error return location for a GError, or NULL
+ *
+ * @return TRUE if copying was successful, FALSE otherwise
+ */
+gboolean r_copy_stream_range_with_progress(GInputStream *in_stream, GOutputStream *out_stream,
+		goffset size, GError **error)
+G_GNUC_WARN_UNUSED_RESULT;
+
+/**
+ * Checks if an area of a device or file looks cleared, i.e. contains only
+ * 0x00 or 0xFF bytes.
+ *
+ * The area is read in large chunks. For files, holes are detected using
+ * SEEK_DATA and skipped without reading.
+ *
+ * @param device the device or file to check
+ * @param start offset of the area in bytes
+ * @param size size of the area in bytes
+ * @param clear return location for the result
+ * @param error return location for a GError, or NULL
+ *
+ * @return TRUE if the area could be checked, FALSE otherwise
+ */
+gboolean r_check_area_is_clear(const gchar *device, goffset start, goffset size, gboolean *clear, GError **error)
+G_GNUC_WARN_UNUSED_RESULT;
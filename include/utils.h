@@ -3,6 +3,8 @@
 #include <gio/gio.h>
 #include <glib.h>
 
+#include "trace.h"
+
 #define R_UTILS_ERROR r_utils_error_quark()
 
 GQuark r_utils_error_quark(void);
@@ -50,9 +52,14 @@ static inline GSubprocess* r_subprocess_newv(GPtrArray *args, GSubprocessFlags f
 	g_return_val_if_fail(args->pdata[args->len-1] == NULL, NULL);
 	g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
 	g_autofree gchar *call = g_strjoinv(" ", (gchar**) args->pdata);
+	gint64 trace_begin = r_trace_begin();
+	GSubprocess *sproc = NULL;
 	g_log(R_LOG_DOMAIN_SUBPROCESS, G_LOG_LEVEL_DEBUG, "launching subprocess: %s", call);
 
-	return g_subprocess_newv((const gchar * const *) args->pdata, flags, error);
+	sproc = g_subprocess_newv((const gchar * const *) args->pdata, flags, error);
+	r_trace_subprocess(sproc, args->pdata[0], trace_begin);
+
+	return sproc;
 }
 
 static inline GSubprocess * r_subprocess_launcher_spawnv(GSubprocessLauncher *launcher, GPtrArray *args, GError **error)
@@ -63,10 +70,15 @@ static inline GSubprocess * r_subprocess_launcher_spawnv(GSubprocessLauncher *la
 	g_return_val_if_fail(args->pdata[args->len-1] == NULL, NULL);
 	g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
 	g_autofree gchar *call = g_strjoinv(" ", (gchar**) args->pdata);
+	gint64 trace_begin = r_trace_begin();
+	GSubprocess *sproc = NULL;
 	g_log(R_LOG_DOMAIN_SUBPROCESS, G_LOG_LEVEL_DEBUG, "launching subprocess: %s", call);
 
-	return g_subprocess_launcher_spawnv(launcher,
+	sproc = g_subprocess_launcher_spawnv(launcher,
 			(const gchar * const *)args->pdata, error);
+	r_trace_subprocess(sproc, args->pdata[0], trace_begin);
+
+	return sproc;
 }
 
 GSubprocess *r_subprocess_new(GSubprocessFlags flags, GError **error, const gchar *argv0, ...)
@@ -335,6 +347,52 @@ G_GNUC_WARN_UNUSED_RESULT;
 gboolean r_pwrite_lazy(const int fd, const guint8 *data, size_t size, off_t offset, GError **error)
 G_GNUC_WARN_UNUSED_RESULT;
 
+/**
+ * Copies the first bytes of a file to an empty file.
+ *
+ * This prefers a reflink (FICLONE) and falls back to copy_file_range() and
+ * then to plain reads and writes, so that data is only moved through user
+ * space if the file system cannot copy it by itself. No data past 'size' is
+ * read from the source.
+ *
+ * @param src_fd file descriptor to copy from
+ * @param dst_fd file descriptor of the empty file to copy to
+ * @param size number of bytes to copy, must not exceed the size of the source
+ * @param error return location for a GError, or NULL
+ *
+ * @return TRUE on success, FALSE if an error occurred
+ */
+gboolean r_copy_fd_data(int src_fd, int dst_fd, goffset size, GError **error)
+G_GNUC_WARN_UNUSED_RESULT;
+
+/**
+ * Checks if a buffer contains only zero bytes.
+ *
+ * The buffer is compared word-wise, so this is much faster than a simple
+ * byte loop for larger buffers.
+ *
+ * @param data buffer to check
+ * @param size size of the buffer
+ *
+ * @return TRUE if all bytes are 0x00, FALSE otherwise
+ */
+gboolean r_buffer_is_zero(const guint8 *data, gsize size)
+G_GNUC_WARN_UNUSED_RESULT;
+
+/**
+ * Checks if a buffer looks cleared, i.e. contains only 0x00 or 0xFF bytes.
+ *
+ * This is the state after erasing (0xFF for flash) or clearing (0x00) an
+ * area. Both values may be mixed.
+ *
+ * @param data buffer to check
+ * @param size size of the buffer
+ *
+ * @return TRUE if all bytes are either 0x00 or 0xFF, FALSE otherwise
+ */
+gboolean r_buffer_is_cleared(const guint8 *data, gsize size)
+G_GNUC_WARN_UNUSED_RESULT;
+
 guint get_sectorsize(gint fd)
 G_GNUC_WARN_UNUSED_RESULT;
 
@@ -76,6 +76,8 @@ void r_artifact_repo_free(gpointer value)
 
 	if (g_strcmp0(repo->type, "composefs") == 0) {
 		g_clear_pointer(&repo->composefs.local_store_objects, g_hash_table_destroy);
+		g_clear_pointer(&repo->composefs.indexed_artifacts, g_hash_table_destroy);
+		g_clear_pointer(&repo->composefs.pending_objects, g_hash_table_destroy);
 	}
 
 	g_free(repo->description);
@@ -430,7 +432,8 @@ gboolean r_artifact_repo_prune(RArtifactRepo *repo, GError **error)
 
 		/* allow repo type specific files and dirs */
 		if (g_strcmp0(repo->type, "composefs") == 0) {
-			if (g_strcmp0(name, ".rauc-cfs-store") == 0)
+			if (g_strcmp0(name, ".rauc-cfs-store") == 0 ||
+			    g_strcmp0(name, ".rauc-cfs-index") == 0)
 				continue;
 		}
 
@@ -568,6 +571,13 @@ gboolean r_artifact_repo_commit(RArtifactRepo *repo, GError **error)
 
 	/* TODO save additional meta-data for artifacts and instances here? */
 
+	if (g_strcmp0(repo->type, "composefs") == 0) {
+		if (!r_composefs_artifact_repo_commit(repo, &ierror)) {
+			g_propagate_error(error, ierror);
+			return FALSE;
+		}
+	}
+
 	if (!r_syncfs(repo->path, &ierror)) {
 		g_propagate_error(error, ierror);
 		return FALSE;
@@ -1,8 +1,10 @@
 #include <asm-generic/errno-base.h>
 #include <errno.h>
 #include <stdint.h>
+#include <string.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <sys/stat.h>
 
 #include <glib/gstdio.h>
 #include <libcomposefs/lcfs-writer.h>
@@ -82,31 +84,471 @@ static gboolean composefs_objects_from_image(GHashTable *objects, const gchar *i
 	return TRUE;
 }
 
-gboolean r_composefs_artifact_repo_prepare(RArtifactRepo *repo, GError **error)
+#define COMPOSEFS_INDEX_HEADER "# rauc composefs object index v1"
+
+/*
+ * The object index lives next to the object store (which is used as the
+ * composefs basedir and should only contain objects):
+ *
+ *   .rauc-cfs-index/objects: reference count of each object in the store and
+ *     the list of artifact instances accounted for in these counts
+ *   .rauc-cfs-index/artifacts/<name>-<digest>: objects used by an artifact
+ *     instance, one per line
+ *   .rauc-cfs-index/pending: objects which are copied to the store, but may
+ *     not be in the objects file yet, one per line
+ *
+ * The per-artifact lists are written during installation. The objects file is
+ * only replaced atomically when committing or pruning the repo. Artifact
+ * instances which were added or removed since then are detected by comparing
+ * the accounted instances with those on disk. Objects listed as pending, but
+ * not in the objects file, were left behind by an interrupted installation.
+ */
+static gchar *composefs_artifact_key(const RArtifact *artifact)
+{
+	return g_strdup_printf("%s-%s", artifact->name, artifact->checksum.digest);
+}
+
+static gchar *composefs_artifact_list_path(const RArtifactRepo *repo, const gchar *key)
+{
+	return g_build_filename(repo->path, ".rauc-cfs-index", "artifacts", key, NULL);
+}
+
+static void composefs_ref_objects(RArtifactRepo *repo, GPtrArray *objects)
+{
+	for (guint i = 0; i < objects->len; i++) {
+		const gchar *object_name = objects->pdata[i];
+		guint count = GPOINTER_TO_UINT(g_hash_table_lookup(repo->composefs.local_store_objects, object_name));
+
+		g_hash_table_replace(repo->composefs.local_store_objects, g_strdup(object_name), GUINT_TO_POINTER(count + 1));
+	}
+	repo->composefs.index_dirty = TRUE;
+}
+
+/*
+ * Objects are kept with a count of zero, so that they can be removed by the
+ * next prune.
+ */
+static void composefs_unref_objects(RArtifactRepo *repo, GPtrArray *objects)
+{
+	for (guint i = 0; i < objects->len; i++) {
+		const gchar *object_name = objects->pdata[i];
+		guint count = GPOINTER_TO_UINT(g_hash_table_lookup(repo->composefs.local_store_objects, object_name));
+
+		if (!count)
+			continue;
+
+		g_hash_table_replace(repo->composefs.local_store_objects, g_strdup(object_name), GUINT_TO_POINTER(count - 1));
+	}
+	repo->composefs.index_dirty = TRUE;
+}
+
+static GPtrArray *composefs_load_artifact_list(const RArtifactRepo *repo, const gchar *key, GError **error)
 {
 	GError *ierror = NULL;
+	g_autofree gchar *path = composefs_artifact_list_path(repo, key);
+	g_autofree gchar *contents = NULL;
+	g_auto(GStrv) lines = NULL;
+	GPtrArray *objects = NULL;
 
-	g_return_val_if_fail(repo, FALSE);
-	g_return_val_if_fail(g_strcmp0(repo->type, "composefs") == 0, FALSE);
-	g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
+	if (!g_file_get_contents(path, &contents, NULL, &ierror)) {
+		g_propagate_error(error, ierror);
+		return NULL;
+	}
 
-	if (repo->composefs.local_store_objects)
-		g_hash_table_destroy(repo->composefs.local_store_objects);
-	repo->composefs.local_store_objects = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+	lines = g_strsplit(contents, "\n", -1);
+	objects = g_ptr_array_new_with_free_func(g_free);
+	for (gchar **line = lines; *line; line++) {
+		if (!**line)
+			continue;
+		g_ptr_array_add(objects, g_strdup(*line));
+	}
 
-	g_autofree gchar *object_store_path = g_build_filename(repo->path, ".rauc-cfs-store", NULL);
-	if (g_mkdir_with_parents(object_store_path, 0700) != 0) {
+	return objects;
+}
+
+static gboolean composefs_save_artifact_list(const RArtifactRepo *repo, const gchar *key, GPtrArray *objects, GError **error)
+{
+	g_autofree gchar *path = composefs_artifact_list_path(repo, key);
+	g_autoptr(GString) contents = g_string_new(NULL);
+
+	for (guint i = 0; i < objects->len; i++) {
+		g_string_append(contents, objects->pdata[i]);
+		g_string_append_c(contents, '\n');
+	}
+
+	return g_file_set_contents(path, contents->str, contents->len, error);
+}
+
+/*
+ * Returns the sorted list of objects used by an installed artifact. If the
+ * list was not recorded during installation, the composefs image is parsed
+ * and the list is saved for the next time.
+ */
+static GPtrArray *composefs_artifact_objects(const RArtifactRepo *repo, const RArtifact *artifact, GError **error)
+{
+	GError *ierror = NULL;
+	g_autofree gchar *key = composefs_artifact_key(artifact);
+	g_autofree gchar *image_path = NULL;
+	g_autoptr(GHashTable) image_objects = NULL;
+	g_autoptr(GPtrArray) objects = NULL;
+
+	objects = composefs_load_artifact_list(repo, key, &ierror);
+	if (objects)
+		return g_steal_pointer(&objects);
+	if (!g_error_matches(ierror, G_FILE_ERROR, G_FILE_ERROR_NOENT)) {
+		g_propagate_error(error, ierror);
+		return NULL;
+	}
+	g_clear_error(&ierror);
+
+	image_path = g_build_filename(artifact->path, "image.cfs", NULL);
+	image_objects = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+	if (!composefs_objects_from_image(image_objects, image_path, &ierror)) {
+		g_propagate_error(error, ierror);
+		return NULL;
+	}
+
+	objects = get_objects_sorted(image_objects);
+	/* the names are owned by image_objects */
+	for (guint i = 0; i < objects->len; i++)
+		objects->pdata[i] = g_strdup(objects->pdata[i]);
+	g_ptr_array_set_free_func(objects, g_free);
+
+	if (!composefs_save_artifact_list(repo, key, objects, &ierror)) {
+		g_propagate_error(error, ierror);
+		return NULL;
+	}
+
+	return g_steal_pointer(&objects);
+}
+
+/*
+ * Accounts for the objects of artifact instances which are on disk, but not
+ * yet in the index, and drops the references of instances which were removed.
+ */
+static gboolean composefs_index_reconcile(RArtifactRepo *repo, GError **error)
+{
+	GError *ierror = NULL;
+	g_autoptr(GHashTable) present = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+	GHashTableIter iter;
+	GHashTable *inner = NULL;
+	const gchar *key = NULL;
+	guint added = 0;
+	guint dropped = 0;
+
+	g_hash_table_iter_init(&iter, repo->artifacts);
+	while (g_hash_table_iter_next(&iter, NULL, (gpointer*)&inner)) {
+		GHashTableIter inner_iter;
+		RArtifact *artifact = NULL;
+
+		g_hash_table_iter_init(&inner_iter, inner);
+		while (g_hash_table_iter_next(&inner_iter, NULL, (gpointer*)&artifact)) {
+			g_autofree gchar *artifact_key = composefs_artifact_key(artifact);
+			g_autoptr(GPtrArray) objects = NULL;
+
+			if (g_hash_table_contains(repo->composefs.indexed_artifacts, artifact_key)) {
+				g_hash_table_add(present, g_steal_pointer(&artifact_key));
+				continue;
+			}
+
+			/* interrupted installation */
+			if (!g_file_test(artifact->path, G_FILE_TEST_IS_DIR))
+				continue;
+
+			objects = composefs_artifact_objects(repo, artifact, &ierror);
+			if (!objects) {
+				g_propagate_prefixed_error(error, ierror,
+						"Failed to get composefs objects of artifact '%s' with hash '%s': ",
+						artifact->name, artifact->checksum.digest);
+				return FALSE;
+			}
+
+			composefs_ref_objects(repo, objects);
+			g_hash_table_add(repo->composefs.indexed_artifacts, g_strdup(artifact_key));
+			g_hash_table_add(present, g_steal_pointer(&artifact_key));
+			added++;
+		}
+	}
+
+	g_hash_table_iter_init(&iter, repo->composefs.indexed_artifacts);
+	while (g_hash_table_iter_next(&iter, (gpointer*)&key, NULL)) {
+		g_autofree gchar *list_path = NULL;
+		g_autoptr(GPtrArray) objects = NULL;
+
+		if (g_hash_table_contains(present, key))
+			continue;
+
+		objects = composefs_load_artifact_list(repo, key, &ierror);
+		if (!objects) {
+			g_propagate_prefixed_error(error, ierror,
+					"Failed to load composefs object list of removed artifact '%s': ", key);
+			return FALSE;
+		}
+		composefs_unref_objects(repo, objects);
+
+		list_path = composefs_artifact_list_path(repo, key);
+		if (g_unlink(list_path) != 0 && errno != ENOENT) {
+			int err = errno;
+			g_set_error(error,
+					G_FILE_ERROR,
+					g_file_error_from_errno(err),
+					"Failed to remove composefs object list '%s': %s",
+					list_path, g_strerror(err));
+			return FALSE;
+		}
+
+		g_hash_table_iter_remove(&iter);
+		repo->composefs.index_dirty = TRUE;
+		dropped++;
+	}
+
+	if (added || dropped)
+		g_debug("Updated composefs object index of repo '%s' (%u artifacts added, %u removed)",
+				repo->name, added, dropped);
+
+	return TRUE;
+}
+
+/*
+ * Loads the objects file of the index. Returns FALSE with the GError set to
+ * G_FILE_ERROR_NOENT if there is none yet.
+ */
+static gboolean composefs_index_load(RArtifactRepo *repo, GError **error)
+{
+	GError *ierror = NULL;
+	g_autofree gchar *path = g_build_filename(repo->path, ".rauc-cfs-index", "objects", NULL);
+	g_autofree gchar *contents = NULL;
+	gsize length = 0;
+	guint lineno = 0;
+	gchar *line;
+
+	if (!g_file_get_contents(path, &contents, &length, &ierror)) {
+		g_propagate_error(error, ierror);
+		return FALSE;
+	}
+
+	line = contents;
+	while (line < contents + length) {
+		gchar *end = strchr(line, '\n');
+		gchar *value;
+
+		if (!end) {
+			g_set_error(error, G_FILE_ERROR, G_FILE_ERROR_INVAL,
+					"Truncated composefs object index '%s'", path);
+			return FALSE;
+		}
+		*end = '\0';
+		lineno++;
+
+		if (lineno == 1) {
+			if (g_strcmp0(line, COMPOSEFS_INDEX_HEADER) != 0) {
+				g_set_error(error, G_FILE_ERROR, G_FILE_ERROR_INVAL,
+						"Unsupported composefs object index '%s'", path);
+				return FALSE;
+			}
+		} else if (g_str_has_prefix(line, "object ")) {
+			gchar *name = NULL;
+			guint64 count = 0;
+
+			value = line + strlen("object ");
+			count = g_ascii_strtoull(value, &name, 10);
+			if (name == value || *name != ' ' || !name[1] || count > G_MAXUINT)
+				goto invalid;
+			g_hash_table_replace(repo->composefs.local_store_objects, g_strdup(name + 1), GUINT_TO_POINTER((guint)count));
+		} else if (g_str_has_prefix(line, "artifact ")) {
+			value = line + strlen("artifact ");
+			if (!*value)
+				goto invalid;
+			g_hash_table_add(repo->composefs.indexed_artifacts, g_strdup(value));
+		} else {
+			goto invalid;
+		}
+
+		line = end + 1;
+	}
+
+	if (!lineno) {
+		g_set_error(error, G_FILE_ERROR, G_FILE_ERROR_INVAL,
+				"Empty composefs object index '%s'", path);
+		return FALSE;
+	}
+
+	return TRUE;
+
+invalid:
+	g_set_error(error, G_FILE_ERROR, G_FILE_ERROR_INVAL,
+			"Invalid line %u in composefs object index '%s'", lineno, path);
+	return FALSE;
+}
+
+static gchar *composefs_pending_path(const RArtifactRepo *repo)
+{
+	return g_build_filename(repo->path, ".rauc-cfs-index", "pending", NULL);
+}
+
+/*
+ * Writes the list of pending objects, which must be on disk before the
+ * objects are copied.
+ */
+static gboolean composefs_save_pending(RArtifactRepo *repo, GError **error)
+{
+	GError *ierror = NULL;
+	g_autofree gchar *path = composefs_pending_path(repo);
+	g_autoptr(GString) contents = g_string_new(NULL);
+	g_autoptr(GPtrArray) objects = get_objects_sorted(repo->composefs.pending_objects);
+	g_auto(filedesc) fd = -1;
+
+	for (guint i = 0; i < objects->len; i++) {
+		g_string_append(contents, objects->pdata[i]);
+		g_string_append_c(contents, '\n');
+	}
+
+	fd = g_open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+	if (fd < 0) {
 		int err = errno;
-		g_set_error(
-				error,
-				G_FILE_ERROR,
-				g_file_error_from_errno(err),
-				"Failed to create composefs object store '%s': %s",
-				object_store_path,
-				g_strerror(err));
+		g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(err),
+				"Failed to open '%s': %s", path, g_strerror(err));
+		return FALSE;
+	}
+
+	if (!r_write_exact(fd, (const guint8 *)contents->str, contents->len, &ierror)) {
+		g_propagate_prefixed_error(error, ierror, "Failed to write '%s': ", path);
+		return FALSE;
+	}
+
+	if (fsync(fd) != 0) {
+		int err = errno;
+		g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(err),
+				"Failed to sync '%s': %s", path, g_strerror(err));
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+static gboolean composefs_clear_pending(RArtifactRepo *repo, GError **error)
+{
+	g_autofree gchar *path = composefs_pending_path(repo);
+
+	if (g_unlink(path) != 0 && errno != ENOENT) {
+		int err = errno;
+		g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(err),
+				"Failed to remove '%s': %s", path, g_strerror(err));
 		return FALSE;
 	}
 
+	g_hash_table_remove_all(repo->composefs.pending_objects);
+
+	return TRUE;
+}
+
+/*
+ * Removes the objects which were copied by an interrupted installation, but
+ * never made it into the index. Only the objects listed as pending are
+ * checked, so this does not need to scan the store.
+ */
+static gboolean composefs_recover_pending(RArtifactRepo *repo, const gchar *object_store_path, GError **error)
+{
+	GError *ierror = NULL;
+	g_autofree gchar *path = composefs_pending_path(repo);
+	g_autofree gchar *contents = NULL;
+	g_auto(GStrv) lines = NULL;
+	guint removed = 0;
+
+	if (!g_file_get_contents(path, &contents, NULL, &ierror)) {
+		if (g_error_matches(ierror, G_FILE_ERROR, G_FILE_ERROR_NOENT)) {
+			g_clear_error(&ierror);
+			return TRUE;
+		}
+		g_propagate_error(error, ierror);
+		return FALSE;
+	}
+
+	lines = g_strsplit(contents, "\n", -1);
+	for (gchar **line = lines; *line; line++) {
+		g_autofree gchar *object_path = NULL;
+		g_autofree gchar *subdir_path = NULL;
+
+		/* only objects in the fan-out directories of the store */
+		if (!**line || **line == '/' || strstr(*line, ".."))
+			continue;
+
+		if (g_hash_table_contains(repo->composefs.local_store_objects, *line))
+			continue;
+
+		object_path = g_build_filename(object_store_path, *line, NULL);
+		if (unlink(object_path) == -1) {
+			int err = errno;
+			if (err == ENOENT)
+				continue;
+			g_set_error(error,
+					G_FILE_ERROR,
+					g_file_error_from_errno(err),
+					"Failed to remove composefs object '%s' of interrupted installation: %s",
+					*line, g_strerror(err));
+			return FALSE;
+		}
+		removed++;
+
+		/* the directory is kept if other objects use it */
+		subdir_path = g_path_get_dirname(object_path);
+		rmdir(subdir_path);
+	}
+
+	if (removed)
+		g_message("Removed %u composefs objects left by an interrupted installation in repo '%s'",
+				removed, repo->name);
+
+	return TRUE;
+}
+
+static gboolean composefs_index_save(RArtifactRepo *repo, GError **error)
+{
+	GError *ierror = NULL;
+	g_autofree gchar *path = NULL;
+	g_autoptr(GString) contents = NULL;
+	g_autoptr(GPtrArray) keys = NULL;
+	g_autoptr(GPtrArray) objects = NULL;
+
+	if (!repo->composefs.index_dirty)
+		return composefs_clear_pending(repo, error);
+
+	contents = g_string_sized_new(80 * (g_hash_table_size(repo->composefs.local_store_objects) + 1));
+	g_string_append(contents, COMPOSEFS_INDEX_HEADER "\n");
+
+	keys = get_objects_sorted(repo->composefs.indexed_artifacts);
+	for (guint i = 0; i < keys->len; i++)
+		g_string_append_printf(contents, "artifact %s\n", (const gchar *)keys->pdata[i]);
+
+	objects = get_objects_sorted(repo->composefs.local_store_objects);
+	for (guint i = 0; i < objects->len; i++) {
+		const gchar *object_name = objects->pdata[i];
+		guint count = GPOINTER_TO_UINT(g_hash_table_lookup(repo->composefs.local_store_objects, object_name));
+
+		g_string_append_printf(contents, "object %u %s\n", count, object_name);
+	}
+
+	/* replaced atomically via a temporary file */
+	path = g_build_filename(repo->path, ".rauc-cfs-index", "objects", NULL);
+	if (!g_file_set_contents(path, contents->str, contents->len, &ierror)) {
+		g_propagate_prefixed_error(error, ierror, "Failed to write composefs object index: ");
+		return FALSE;
+	}
+
+	repo->composefs.index_dirty = FALSE;
+
+	/* all copied objects are recorded in the saved index now */
+	return composefs_clear_pending(repo, error);
+}
+
+/*
+ * Rebuilds the index from scratch by walking the object store. The artifact
+ * references are added by composefs_index_reconcile() afterwards.
+ */
+static gboolean composefs_scan_store(RArtifactRepo *repo, const gchar *object_store_path, GError **error)
+{
+	GError *ierror = NULL;
+
 	g_autoptr(GDir) dir = g_dir_open(object_store_path, 0, &ierror);
 	if (dir == NULL) {
 		g_propagate_error(error, ierror);
@@ -143,19 +585,27 @@ gboolean r_composefs_artifact_repo_prepare(RArtifactRepo *repo, GError **error)
 				continue;
 			}
 
-			g_hash_table_add(repo->composefs.local_store_objects, g_steal_pointer(&object_name));
+			g_hash_table_insert(repo->composefs.local_store_objects, g_steal_pointer(&object_name), GUINT_TO_POINTER(0));
 		}
 	}
 
-	g_message("Found %d objects in composefs repo '%s'",
-			g_hash_table_size(repo->composefs.local_store_objects),
-			repo->name
-			);
+	repo->composefs.index_dirty = TRUE;
 
 	return TRUE;
 }
 
-gboolean r_composefs_artifact_repo_prune(RArtifactRepo *repo, GError **error)
+static void composefs_index_reset(RArtifactRepo *repo)
+{
+	g_clear_pointer(&repo->composefs.local_store_objects, g_hash_table_destroy);
+	g_clear_pointer(&repo->composefs.indexed_artifacts, g_hash_table_destroy);
+	g_clear_pointer(&repo->composefs.pending_objects, g_hash_table_destroy);
+	repo->composefs.local_store_objects = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+	repo->composefs.indexed_artifacts = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+	repo->composefs.pending_objects = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+	repo->composefs.index_dirty = FALSE;
+}
+
+gboolean r_composefs_artifact_repo_prepare(RArtifactRepo *repo, GError **error)
 {
 	GError *ierror = NULL;
 
@@ -163,51 +613,97 @@ gboolean r_composefs_artifact_repo_prune(RArtifactRepo *repo, GError **error)
 	g_return_val_if_fail(g_strcmp0(repo->type, "composefs") == 0, FALSE);
 	g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
 
-	g_autoptr(GHashTable) required_objects = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
-	GHashTableIter iter;
-	GHashTable *inner = NULL;
-	g_hash_table_iter_init(&iter, repo->artifacts);
-	while (g_hash_table_iter_next(&iter, NULL, (gpointer*)&inner)) {
-		GHashTableIter inner_iter;
-		RArtifact *artifact = NULL;
+	composefs_index_reset(repo);
 
-		g_hash_table_iter_init(&inner_iter, inner);
-		while (g_hash_table_iter_next(&inner_iter, NULL, (gpointer*)&artifact)) {
-			g_autofree const gchar *image_path = g_build_filename(artifact->path, "image.cfs", NULL);
-			if (!composefs_objects_from_image(required_objects, image_path, &ierror)) {
-				g_propagate_error(error, ierror);
-				return FALSE;
-			}
+	g_autofree gchar *object_store_path = g_build_filename(repo->path, ".rauc-cfs-store", NULL);
+	if (g_mkdir_with_parents(object_store_path, 0700) != 0) {
+		int err = errno;
+		g_set_error(
+				error,
+				G_FILE_ERROR,
+				g_file_error_from_errno(err),
+				"Failed to create composefs object store '%s': %s",
+				object_store_path,
+				g_strerror(err));
+		return FALSE;
+	}
+
+	g_autofree gchar *index_path = g_build_filename(repo->path, ".rauc-cfs-index", "artifacts", NULL);
+	if (g_mkdir_with_parents(index_path, 0700) != 0) {
+		int err = errno;
+		g_set_error(
+				error,
+				G_FILE_ERROR,
+				g_file_error_from_errno(err),
+				"Failed to create composefs object index '%s': %s",
+				index_path,
+				g_strerror(err));
+		return FALSE;
+	}
+
+	if (!composefs_index_load(repo, &ierror)) {
+		if (!g_error_matches(ierror, G_FILE_ERROR, G_FILE_ERROR_NOENT))
+			g_message("Rebuilding composefs object index of repo '%s': %s", repo->name, ierror->message);
+		g_clear_error(&ierror);
+
+		composefs_index_reset(repo);
+		if (!composefs_scan_store(repo, object_store_path, &ierror)) {
+			g_propagate_error(error, ierror);
+			return FALSE;
 		}
 	}
 
-	/* remove missing objects */
-	guint missing = 0;
-	const gchar *object_name = NULL;
-	g_hash_table_iter_init(&iter, required_objects);
-	while (g_hash_table_iter_next(&iter, (gpointer*)&object_name, NULL)) {
-		if (g_hash_table_contains(repo->composefs.local_store_objects, object_name))
-			continue;
+	if (!composefs_recover_pending(repo, object_store_path, &ierror)) {
+		g_propagate_error(error, ierror);
+		return FALSE;
+	}
 
-		g_debug("Failed to find required object '%s' in local composefs object store of repo '%s'",
-				object_name, repo->name);
-		g_hash_table_iter_remove(&iter);
-		missing++;
+	if (!composefs_index_reconcile(repo, &ierror)) {
+		g_propagate_error(error, ierror);
+		return FALSE;
+	}
+
+	if (!composefs_index_save(repo, &ierror)) {
+		g_propagate_error(error, ierror);
+		return FALSE;
+	}
+
+	g_message("Found %d objects in composefs repo '%s'",
+			g_hash_table_size(repo->composefs.local_store_objects),
+			repo->name
+			);
+
+	return TRUE;
+}
+
+gboolean r_composefs_artifact_repo_prune(RArtifactRepo *repo, GError **error)
+{
+	GError *ierror = NULL;
+
+	g_return_val_if_fail(repo, FALSE);
+	g_return_val_if_fail(g_strcmp0(repo->type, "composefs") == 0, FALSE);
+	g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
+
+	/* drop references of removed artifacts */
+	if (!composefs_index_reconcile(repo, &ierror)) {
+		g_propagate_error(error, ierror);
+		return FALSE;
 	}
-	if (missing)
-		g_warning("Failed to find %d required objects in local composefs object store of repo '%s'",
-				missing, repo->name);
 
 	/* remove unused objects */
 	guint removed = 0;
+	g_autoptr(GHashTable) subdirs = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
 	g_autofree gchar *object_store_path = g_build_filename(repo->path, ".rauc-cfs-store", NULL);
+	GHashTableIter iter;
+	const gchar *object_name = NULL;
+	gpointer count = NULL;
 	g_hash_table_iter_init(&iter, repo->composefs.local_store_objects);
-	while (g_hash_table_iter_next(&iter, (gpointer*)&object_name, NULL)) {
-		if (g_hash_table_contains(required_objects, object_name))
+	while (g_hash_table_iter_next(&iter, (gpointer*)&object_name, &count)) {
+		if (GPOINTER_TO_UINT(count))
 			continue;
 
 		g_autofree gchar *object_path = g_build_filename(object_store_path, object_name, NULL);
-		if (unlink(object_path) == -1) {
+		if (unlink(object_path) == -1 && errno != ENOENT) {
 			int err = errno;
 			g_set_error(error,
 					G_FILE_ERROR,
@@ -217,51 +713,248 @@ gboolean r_composefs_artifact_repo_prune(RArtifactRepo *repo, GError **error)
 			return FALSE;
 		}
 
+		g_hash_table_add(subdirs, g_path_get_dirname(object_path));
 		g_hash_table_iter_remove(&iter);
+		repo->composefs.index_dirty = TRUE;
 		removed++;
 	}
+
 	g_info("Removed %d unused objects in local composefs object store of repo '%s'",
 			removed, repo->name);
 
-	/* remove empty directories */
-	g_autoptr(GDir) dir = g_dir_open(object_store_path, 0, &ierror);
-	if (dir == NULL) {
+	/* remove directories which may have become empty */
+	const gchar *subdir_path = NULL;
+	g_hash_table_iter_init(&iter, subdirs);
+	while (g_hash_table_iter_next(&iter, (gpointer*)&subdir_path, NULL)) {
+		if (rmdir(subdir_path) == -1) {
+			int err = errno;
+			if (err == ENOTEMPTY || err == EEXIST || err == ENOENT)
+				continue;
+			g_set_error(error,
+					G_FILE_ERROR,
+					g_file_error_from_errno(err),
+					"Failed to remove empty composefs object directory: %s", g_strerror(err));
+			return FALSE;
+		}
+	}
+
+	if (!composefs_index_save(repo, &ierror)) {
 		g_propagate_error(error, ierror);
 		return FALSE;
 	}
 
-	const gchar *entry_name;
-	while ((entry_name = g_dir_read_name(dir))) {
-		g_autofree gchar *full_inner_path = g_build_filename(object_store_path, entry_name, NULL);
+	return TRUE;
+}
+
+gboolean r_composefs_artifact_repo_commit(RArtifactRepo *repo, GError **error)
+{
+	g_return_val_if_fail(repo, FALSE);
+	g_return_val_if_fail(g_strcmp0(repo->type, "composefs") == 0, FALSE);
+	g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
+
+	return composefs_index_save(repo, error);
+}
+
+/* The copy is I/O bound, so a few threads are enough to hide the latency of
+ * the per-object syscalls. */
+#define COMPOSEFS_IMPORT_MAX_THREADS 8
+
+typedef struct {
+	int src_dir_fd;
+	int dst_dir_fd;
+	gint failed;
+	GMutex lock;
+	GError *error;
+} ComposefsImport;
+
+typedef struct {
+	ComposefsImport *import;
+	const gchar *object_name;
+	gboolean copied;
+} ComposefsImportJob;
+
+static gboolean composefs_import_object(ComposefsImport *import, const gchar *object_name, GError **error)
+{
+	GError *ierror = NULL;
+	g_auto(filedesc) src_fd = -1;
+	g_auto(filedesc) dst_fd = -1;
+	struct stat st;
+
+	src_fd = openat(import->src_dir_fd, object_name, O_RDONLY | O_CLOEXEC);
+	if (src_fd < 0 || fstat(src_fd, &st) != 0) {
+		int err = errno;
+		g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(err),
+				"Failed to open composefs object '%s' in bundle: %s", object_name, g_strerror(err));
+		return FALSE;
+	}
+
+	dst_fd = openat(import->dst_dir_fd, object_name, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, st.st_mode & 0777);
+	if (dst_fd < 0 && errno == EEXIST) {
+		/* left over from an interrupted installation, so not in the index */
+		if (unlinkat(import->dst_dir_fd, object_name, 0) == 0)
+			dst_fd = openat(import->dst_dir_fd, object_name, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, st.st_mode & 0777);
+	}
+	if (dst_fd < 0) {
+		int err = errno;
+		g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(err),
+				"Failed to create composefs object '%s' in local store: %s", object_name, g_strerror(err));
+		return FALSE;
+	}
+
+	if (!r_copy_fd_data(src_fd, dst_fd, st.st_size, &ierror)) {
+		g_propagate_prefixed_error(error, ierror, "Failed to copy composefs object '%s': ", object_name);
+		unlinkat(import->dst_dir_fd, object_name, 0);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+static void composefs_import_func(gpointer data, gpointer user_data)
+{
+	ComposefsImportJob *job = data;
+	ComposefsImport *import = job->import;
+	GError *ierror = NULL;
+
+	/* stop early once a copy failed */
+	if (g_atomic_int_get(&import->failed))
+		return;
+
+	if (!composefs_import_object(import, job->object_name, &ierror)) {
+		g_atomic_int_set(&import->failed, TRUE);
+		g_mutex_lock(&import->lock);
+		if (!import->error)
+			import->error = g_steal_pointer(&ierror);
+		g_mutex_unlock(&import->lock);
+		g_clear_error(&ierror);
+		return;
+	}
+
+	job->copied = TRUE;
+}
+
+/*
+ * Copies the given objects from the bundle's object store to the local one.
+ *
+ * The fan-out directories are created up front and the objects are copied by
+ * a thread pool. No fsync is done per object, as the caller syncs the whole
+ * repo file system afterwards. Successfully copied objects are added to the
+ * repo's list of local objects, even if others failed.
+ */
+static gboolean composefs_import_objects(RArtifactRepo *repo, const gchar *src_store_path, const gchar *dst_store_path, GPtrArray *objects, GError **error)
+{
+	GError *ierror = NULL;
+	ComposefsImport import = {.src_dir_fd = -1, .dst_dir_fd = -1};
+	g_autofree ComposefsImportJob *jobs = NULL;
+	g_autofree gchar *last_subdir = NULL;
+	GThreadPool *pool = NULL;
+	gint64 start = g_get_monotonic_time();
+	guint copied = 0;
+	gboolean res = FALSE;
+
+	g_return_val_if_fail(repo, FALSE);
+	g_return_val_if_fail(src_store_path, FALSE);
+	g_return_val_if_fail(dst_store_path, FALSE);
+	g_return_val_if_fail(objects, FALSE);
+	g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
+
+	if (!objects->len)
+		return TRUE;
+
+	/* record the new objects, so that they can be removed if the
+	 * installation is interrupted before the index is saved */
+	for (guint i = 0; i < objects->len; i++) {
+		if (!g_hash_table_contains(repo->composefs.local_store_objects, objects->pdata[i]))
+			g_hash_table_add(repo->composefs.pending_objects, g_strdup(objects->pdata[i]));
+	}
+	if (!composefs_save_pending(repo, &ierror)) {
+		g_propagate_prefixed_error(error, ierror, "Failed to record pending composefs objects: ");
+		return FALSE;
+	}
+
+	/* objects are sorted, so each subdir only needs to be created once */
+	for (guint i = 0; i < objects->len; i++) {
+		g_autofree gchar *subdir = g_path_get_dirname(objects->pdata[i]);
+		g_autofree gchar *subdir_path = NULL;
 
-		if (!g_file_test(full_inner_path, G_FILE_TEST_IS_DIR))
+		if (g_strcmp0(subdir, last_subdir) == 0)
 			continue;
 
-		if (rmdir(full_inner_path) == -1) {
+		subdir_path = g_build_filename(dst_store_path, subdir, NULL);
+		if (g_mkdir(subdir_path, 0700) != 0 && errno != EEXIST) {
 			int err = errno;
-			if (err == ENOTEMPTY || err == EEXIST)
-				continue;
-			g_set_error(error,
+			g_set_error(
+					error,
 					G_FILE_ERROR,
 					g_file_error_from_errno(err),
-					"Failed to remove empty composefs object directory: %s", g_strerror(err));
+					"Failed to create composefs object store subdir '%s': %s",
+					subdir_path,
+					g_strerror(err));
 			return FALSE;
 		}
+		g_free(last_subdir);
+		last_subdir = g_steal_pointer(&subdir);
 	}
 
-	return TRUE;
-}
+	g_mutex_init(&import.lock);
+	import.src_dir_fd = g_open(src_store_path, O_RDONLY | O_DIRECTORY | O_CLOEXEC, 0);
+	import.dst_dir_fd = g_open(dst_store_path, O_RDONLY | O_DIRECTORY | O_CLOEXEC, 0);
+	if (import.src_dir_fd < 0 || import.dst_dir_fd < 0) {
+		int err = errno;
+		g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(err),
+				"Failed to open composefs object stores: %s", g_strerror(err));
+		goto out;
+	}
+	jobs = g_new0(ComposefsImportJob, objects->len);
+	pool = g_thread_pool_new(composefs_import_func, NULL,
+			CLAMP(g_get_num_processors(), 1, COMPOSEFS_IMPORT_MAX_THREADS), TRUE, &ierror);
+	if (!pool) {
+		g_propagate_prefixed_error(error, ierror, "Failed to create thread pool: ");
+		goto out;
+	}
+	for (guint i = 0; i < objects->len; i++) {
+		jobs[i].import = &import;
+		jobs[i].object_name = objects->pdata[i];
+		g_thread_pool_push(pool, &jobs[i], NULL);
+	}
+	/* waits for all queued jobs */
+	g_thread_pool_free(pool, FALSE, TRUE);
 
-static gboolean remove_existing(gpointer key, gpointer value, gpointer user_data)
-{
-	GHashTable *reference = user_data;
+	for (guint i = 0; i < objects->len; i++) {
+		if (!jobs[i].copied)
+			continue;
+		/* referenced once the artifact is complete, objects which were
+		 * missing on disk keep their count */
+		if (!g_hash_table_contains(repo->composefs.local_store_objects, jobs[i].object_name)) {
+			g_hash_table_insert(repo->composefs.local_store_objects, g_strdup(jobs[i].object_name), GUINT_TO_POINTER(0));
+			repo->composefs.index_dirty = TRUE;
+		}
+		copied++;
+	}
+
+	if (import.error) {
+		g_propagate_prefixed_error(error, g_steal_pointer(&import.error),
+				"Failed to copy composefs object from bundle to local store: ");
+		goto out;
+	}
 
-	return g_hash_table_contains(reference, key);
+	g_message("Copied %u composefs objects in %.3fs", copied, (g_get_monotonic_time() - start) / 1e6);
+
+	res = TRUE;
+
+out:
+	g_mutex_clear(&import.lock);
+	if (import.src_dir_fd >= 0)
+		close(import.src_dir_fd);
+	if (import.dst_dir_fd >= 0)
+		close(import.dst_dir_fd);
+	return res;
 }
 
 gboolean r_composefs_artifact_install(const RArtifact *artifact, const RaucImage *image, const gchar *name, GError **error)
 {
 	GError *ierror = NULL;
+	RArtifactRepo *repo = NULL;
 
 	g_return_val_if_fail(artifact, FALSE);
 	g_return_val_if_fail(artifact->repo, FALSE);
@@ -270,6 +963,8 @@ gboolean r_composefs_artifact_install(const RArtifact *artifact, const RaucImage
 	g_return_val_if_fail(name, FALSE);
 	g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
 
+	repo = artifact->repo;
+
 	/* copy image */
 	if (!r_tree_artifact_install_extracted(artifact, image, name, &ierror)) {
 		g_propagate_error(error, ierror);
@@ -285,41 +980,51 @@ gboolean r_composefs_artifact_install(const RArtifact *artifact, const RaucImage
 		return FALSE;
 	}
 
-	/* compute missing objects */
-	/* TODO perhaps use g_hash_table_iter_remove? */
-	const guint removed = g_hash_table_foreach_remove(image_objects, remove_existing,
-			artifact->repo->composefs.local_store_objects);
-	if (removed)
-		g_message("Skipping copy of %d existing composefs objects for image %s\n", removed, image->filename);
+	/* compute missing objects, indexed ones are only trusted if they are
+	 * still present in the store */
+	g_autofree const gchar *local_object_store_path = g_build_filename(repo->path, ".rauc-cfs-store", NULL);
+	g_autoptr(GPtrArray) image_objects_sorted = get_objects_sorted(image_objects);
+	g_autoptr(GPtrArray) missing_objects = g_ptr_array_sized_new(image_objects_sorted->len);
+	guint vanished = 0;
+	for (guint i = 0; i < image_objects_sorted->len; i++) {
+		const gchar *object_name = image_objects_sorted->pdata[i];
 
-	g_message("Need to get %d new composefs objects from bundle", g_hash_table_size(image_objects));
+		if (g_hash_table_contains(repo->composefs.local_store_objects, object_name)) {
+			g_autofree gchar *object_path = g_build_filename(local_object_store_path, object_name, NULL);
+
+			if (g_file_test(object_path, G_FILE_TEST_IS_REGULAR))
+				continue;
+			vanished++;
+		}
+		g_ptr_array_add(missing_objects, image_objects_sorted->pdata[i]);
+	}
+	const guint existing = image_objects_sorted->len - missing_objects->len;
+	if (existing)
+		g_message("Skipping copy of %d existing composefs objects for image %s\n", existing, image->filename);
+	if (vanished)
+		g_message("%u indexed composefs objects are missing from the local store", vanished);
+
+	g_message("Need to get %d new composefs objects from bundle", missing_objects->len);
 
 	/* copy missing objects */
-	g_autofree const gchar *local_object_store_path = g_build_filename(artifact->repo->path, ".rauc-cfs-store", NULL);
 	g_autofree const gchar *bundle_path = g_path_get_dirname(name);
 	g_autofree const gchar *bundle_object_store_path = g_build_filename(bundle_path, ".rauc-cfs-store", NULL);
-	g_autoptr(GPtrArray) image_objects_sorted = get_objects_sorted(image_objects);
-	for (guint i = 0; i < image_objects_sorted->len; i++) {
-		const gchar *object_name = image_objects_sorted->pdata[i];
-		g_autofree const gchar *object_subdir = g_path_get_dirname(object_name);
-		g_autofree const gchar *local_object_store_subdir_path = g_build_filename(local_object_store_path, object_subdir, NULL);
-		if (g_mkdir_with_parents(local_object_store_subdir_path, 0700) != 0) {
-			int err = errno;
-			g_set_error(
-					error,
-					G_FILE_ERROR,
-					g_file_error_from_errno(err),
-					"Failed to create composefs object store subdir '%s': %s",
-					local_object_store_subdir_path,
-					g_strerror(err));
-			return FALSE;
-		}
-		if (!copy_file(bundle_object_store_path, object_name, local_object_store_path, object_name, &ierror)) {
-			g_propagate_prefixed_error(error, ierror, "Failed to copy composefs object from bundle to local store: ");
-			return FALSE;
-		}
-		g_hash_table_add(artifact->repo->composefs.local_store_objects, g_strdup(object_name));
+	if (!composefs_import_objects(repo, bundle_object_store_path, local_object_store_path, missing_objects, &ierror)) {
+		g_propagate_error(error, ierror);
+		return FALSE;
+	}
+
+	/* record the references, the index itself is written on commit */
+	g_autofree gchar *key = composefs_artifact_key(artifact);
+	if (g_hash_table_contains(repo->composefs.indexed_artifacts, key))
+		return TRUE;
+
+	if (!composefs_save_artifact_list(repo, key, image_objects_sorted, &ierror)) {
+		g_propagate_prefixed_error(error, ierror, "Failed to save composefs object list: ");
+		return FALSE;
 	}
+	composefs_ref_objects(repo, image_objects_sorted);
+	g_hash_table_add(repo->composefs.indexed_artifacts, g_steal_pointer(&key));
 
 	return TRUE;
 }
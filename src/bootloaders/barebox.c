@@ -28,26 +28,45 @@ gchar *r_barebox_get_current_bootname(const gchar *cmdline, GError **error)
 			cmdline);
 }
 
-static gboolean barebox_state_get(const gchar *bootname, BareboxSlotState *bb_state, GError **error)
+static void barebox_slot_state_free(BareboxSlotState *state)
+{
+	g_free(state);
+}
+
+/* Reads priority and remaining attempts for all given bootnames with a
+ * single barebox-state invocation.
+ *
+ * bootnames: list of gchar
+ *
+ * Returns a snapshot of the state as hash table mapping bootnames to
+ * BareboxSlotState, which should be used for all queries belonging to the
+ * same operation. */
+static GHashTable *barebox_state_get_snapshot(GPtrArray *bootnames, GError **error)
 {
 	g_autoptr(GSubprocess) sub = NULL;
 	GError *ierror = NULL;
-	guint64 result[2] = {};
-	g_autoptr(GPtrArray) args = g_ptr_array_new_full(6, g_free);
+	g_autoptr(GPtrArray) args = NULL;
+	g_autoptr(GHashTable) snapshot = NULL;
 
-	g_return_val_if_fail(bootname, FALSE);
-	g_return_val_if_fail(bb_state, FALSE);
-	g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
+	g_return_val_if_fail(bootnames, NULL);
+	g_return_val_if_fail(error == NULL || *error == NULL, NULL);
+
+	g_assert_cmpuint(bootnames->len, >, 0);
 
+	args = g_ptr_array_new_full(4*bootnames->len+6, g_free);
 	g_ptr_array_add(args, g_strdup(BAREBOX_STATE_NAME));
 	if (r_context()->config->system_bb_statename) {
 		g_ptr_array_add(args, g_strdup("-n"));
 		g_ptr_array_add(args, g_strdup(r_context()->config->system_bb_statename));
 	}
-	g_ptr_array_add(args, g_strdup("-g"));
-	g_ptr_array_add(args, g_strdup_printf(BOOTSTATE_PREFIX ".%s.priority", bootname));
-	g_ptr_array_add(args, g_strdup("-g"));
-	g_ptr_array_add(args, g_strdup_printf(BOOTSTATE_PREFIX ".%s.remaining_attempts", bootname));
+	for (guint i = 0; i < bootnames->len; i++) {
+		const gchar *bootname = bootnames->pdata[i];
+
+		g_ptr_array_add(args, g_strdup("-g"));
+		g_ptr_array_add(args, g_strdup_printf(BOOTSTATE_PREFIX ".%s.priority", bootname));
+		g_ptr_array_add(args, g_strdup("-g"));
+		g_ptr_array_add(args, g_strdup_printf(BOOTSTATE_PREFIX ".%s.remaining_attempts", bootname));
+	}
 	if (r_context()->config->system_bb_dtbpath) {
 		g_ptr_array_add(args, g_strdup("-i"));
 		g_ptr_array_add(args, g_strdup(r_context()->config->system_bb_dtbpath));
@@ -60,7 +79,7 @@ static gboolean barebox_state_get(const gchar *bootname, BareboxSlotState *bb_st
 				error,
 				ierror,
 				"Failed to start " BAREBOX_STATE_NAME ": ");
-		return FALSE;
+		return NULL;
 	}
 
 	g_autoptr(GBytes) stdout_bytes = NULL;
@@ -69,7 +88,7 @@ static gboolean barebox_state_get(const gchar *bootname, BareboxSlotState *bb_st
 				error,
 				ierror,
 				"Failed to run " BAREBOX_STATE_NAME ": ");
-		return FALSE;
+		return NULL;
 	}
 
 	if (!g_subprocess_get_if_exited(sub)) {
@@ -78,7 +97,7 @@ static gboolean barebox_state_get(const gchar *bootname, BareboxSlotState *bb_st
 				G_SPAWN_ERROR,
 				G_SPAWN_ERROR_FAILED,
 				BAREBOX_STATE_NAME " did not exit normally");
-		return FALSE;
+		return NULL;
 	}
 
 	gint ret = g_subprocess_get_exit_status(sub);
@@ -88,51 +107,109 @@ static gboolean barebox_state_get(const gchar *bootname, BareboxSlotState *bb_st
 				G_SPAWN_EXIT_ERROR,
 				ret,
 				BAREBOX_STATE_NAME " failed with exit code: %i", ret);
-		return FALSE;
+		return NULL;
 	}
 
+	snapshot = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, (GDestroyNotify) barebox_slot_state_free);
+
 	g_autofree gchar *stdout_str = r_bytes_unref_to_string(&stdout_bytes);
-	g_auto(GStrv) outlines = g_strsplit (stdout_str, "\n", -1);
-	for (int i = 0; i < 2; i++) {
-		gchar *endptr = NULL;
-		const gchar *outline = outlines[i];
-		if (!outline) {
-			/* Having no error set there was means no content to read */
-			if (ierror == NULL) {
+	g_auto(GStrv) outlines = g_strsplit(stdout_str, "\n", -1);
+	guint line = 0;
+	for (guint i = 0; i < bootnames->len; i++) {
+		guint64 result[2] = {};
+
+		for (int j = 0; j < 2; j++, line++) {
+			gchar *endptr = NULL;
+			const gchar *outline = outlines[line];
+			if (!outline) {
 				g_set_error(
 						error,
 						R_BOOTCHOOSER_ERROR,
 						R_BOOTCHOOSER_ERROR_PARSE_FAILED,
 						"No content to read");
-			} else {
-				g_propagate_prefixed_error(
+				return NULL;
+			}
+
+			errno = 0;
+			result[j] = g_ascii_strtoull(outline, &endptr, 10);
+			if (result[j] == 0 && outline == endptr) {
+				g_set_error(
+						error,
+						R_BOOTCHOOSER_ERROR,
+						R_BOOTCHOOSER_ERROR_PARSE_FAILED,
+						"Failed to parse value: '%s'", outline);
+				return NULL;
+			} else if (result[j] == G_MAXUINT64 && errno != 0) {
+				g_set_error(
 						error,
-						ierror,
-						"Failed parsing " BAREBOX_STATE_NAME " output: ");
+						R_BOOTCHOOSER_ERROR,
+						R_BOOTCHOOSER_ERROR_PARSE_FAILED,
+						"Return value overflow: '%s', error: %d", outline, errno);
+				return NULL;
 			}
-			return FALSE;
 		}
 
-		result[i] = g_ascii_strtoull(outline, &endptr, 10);
-		if (result[i] == 0 && outline == endptr) {
-			g_set_error(
-					error,
-					R_BOOTCHOOSER_ERROR,
-					R_BOOTCHOOSER_ERROR_PARSE_FAILED,
-					"Failed to parse value: '%s'", outline);
-			return FALSE;
-		} else if (result[i] == G_MAXUINT64 && errno != 0) {
-			g_set_error(
-					error,
-					R_BOOTCHOOSER_ERROR,
-					R_BOOTCHOOSER_ERROR_PARSE_FAILED,
-					"Return value overflow: '%s', error: %d", outline, errno);
-			return FALSE;
-		}
+		BareboxSlotState *bb_state = g_new0(BareboxSlotState, 1);
+		bb_state->prio = result[0];
+		bb_state->attempts = result[1];
+		g_hash_table_insert(snapshot, g_strdup(bootnames->pdata[i]), bb_state);
+	}
+
+	return g_steal_pointer(&snapshot);
+}
+
+/* Returns a state snapshot of all slots with a bootname */
+static GHashTable *barebox_state_get_all(GError **error)
+{
+	GHashTableIter iter;
+	RaucSlot *slot;
+	g_autoptr(GPtrArray) bootnames = g_ptr_array_new();
+
+	g_return_val_if_fail(error == NULL || *error == NULL, NULL);
+
+	g_hash_table_iter_init(&iter, r_context()->config->slots);
+	while (g_hash_table_iter_next(&iter, NULL, (gpointer*) &slot)) {
+		if (!slot->bootname)
+			continue;
+
+		/* multiple slots may share a bootname */
+		if (g_ptr_array_find_with_equal_func(bootnames, slot->bootname, g_str_equal, NULL))
+			continue;
+
+		g_ptr_array_add(bootnames, slot->bootname);
+	}
+
+	if (bootnames->len == 0) {
+		g_set_error_literal(
+				error,
+				R_BOOTCHOOSER_ERROR,
+				R_BOOTCHOOSER_ERROR_FAILED,
+				"No slot with bootname configured");
+		return NULL;
+	}
+
+	return barebox_state_get_snapshot(bootnames, error);
+}
+
+static gboolean barebox_state_get(const gchar *bootname, BareboxSlotState *bb_state, GError **error)
+{
+	GError *ierror = NULL;
+	g_autoptr(GPtrArray) bootnames = g_ptr_array_new();
+	g_autoptr(GHashTable) snapshot = NULL;
+
+	g_return_val_if_fail(bootname, FALSE);
+	g_return_val_if_fail(bb_state, FALSE);
+	g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
+
+	g_ptr_array_add(bootnames, (gpointer) bootname);
+
+	snapshot = barebox_state_get_snapshot(bootnames, &ierror);
+	if (!snapshot) {
+		g_propagate_error(error, ierror);
+		return FALSE;
 	}
 
-	bb_state->prio = result[0];
-	bb_state->attempts = result[1];
+	*bb_state = *(BareboxSlotState *) g_hash_table_lookup(snapshot, bootname);
 
 	return TRUE;
 }
@@ -224,26 +301,31 @@ RaucSlot *r_barebox_get_primary(GError **error)
 	RaucSlot *primary = NULL;
 	guint32 top_prio = 0;
 	GError *ierror = NULL;
+	g_autoptr(GHashTable) snapshot = NULL;
+
+	snapshot = barebox_state_get_all(&ierror);
+	if (!snapshot) {
+		g_propagate_error(error, ierror);
+		return NULL;
+	}
 
 	g_hash_table_iter_init(&iter, r_context()->config->slots);
 	while (g_hash_table_iter_next(&iter, NULL, (gpointer*) &slot)) {
-		BareboxSlotState state;
+		BareboxSlotState *state;
 
 		if (!slot->bootname)
 			continue;
 
-		if (!barebox_state_get(slot->bootname, &state, &ierror)) {
-			g_propagate_error(error, ierror);
-			return NULL;
-		}
+		state = g_hash_table_lookup(snapshot, slot->bootname);
+		g_assert_nonnull(state);
 
-		if (state.attempts == 0)
+		if (state->attempts == 0)
 			continue;
 
 		/* We search for the slot with highest priority */
-		if (state.prio > top_prio) {
+		if (state->prio > top_prio) {
 			primary = slot;
-			top_prio = state.prio;
+			top_prio = state->prio;
 		}
 	}
 
@@ -284,30 +366,35 @@ gboolean r_barebox_set_primary(RaucSlot *slot, GError **error)
 	g_autoptr(GPtrArray) pairs = g_ptr_array_new_full(10, g_free);
 	GError *ierror = NULL;
 	g_autoptr(GList) slots = NULL;
+	g_autoptr(GHashTable) snapshot = NULL;
 	int attempts;
 
 	g_return_val_if_fail(slot, FALSE);
 	g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
 
+	snapshot = barebox_state_get_all(&ierror);
+	if (!snapshot) {
+		g_propagate_error(error, ierror);
+		return FALSE;
+	}
+
 	/* Iterate over class members */
 	slots = g_hash_table_get_values(r_context()->config->slots);
 	for (GList *l = slots; l != NULL; l = l->next) {
 		RaucSlot *s = l->data;
 		int prio;
-		BareboxSlotState bb_state;
+		BareboxSlotState *bb_state;
 
 		if (!s->bootname)
 			continue;
 
-		if (!barebox_state_get(s->bootname, &bb_state, &ierror)) {
-			g_propagate_error(error, ierror);
-			return FALSE;
-		}
+		bb_state = g_hash_table_lookup(snapshot, s->bootname);
+		g_assert_nonnull(bb_state);
 
 		if (s == slot) {
 			prio = BAREBOX_STATE_PRIORITY_PRIMARY;
 		} else {
-			if (bb_state.prio == 0)
+			if (bb_state->prio == 0)
 				prio = 0;
 			else
 				prio = BAREBOX_STATE_DEFAULT_PRIORITY;
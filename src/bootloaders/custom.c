@@ -1,8 +1,219 @@
+#include <errno.h>
+#include <gio/gunixinputstream.h>
+
 #include "custom.h"
 #include "bootchooser.h"
 #include "context.h"
 #include "utils.h"
 
+/* Time to wait for a response of the persistent worker */
+#define CUSTOM_WORKER_TIMEOUT_MS (30 * 1000)
+
+/* Persistent custom backend worker, started on first use if
+ * bootloader-custom-backend-persistent is enabled */
+static GSubprocess *worker = NULL;
+static GString *worker_stdout = NULL;
+static gchar *worker_backend = NULL;
+
+static void custom_worker_stop(void)
+{
+	if (!worker)
+		return;
+
+	/* closing stdin requests the worker to exit */
+	g_output_stream_close(g_subprocess_get_stdin_pipe(worker), NULL, NULL);
+	if (!g_subprocess_wait(worker, NULL, NULL))
+		g_subprocess_force_exit(worker);
+
+	if (worker_stdout) {
+		g_string_free(worker_stdout, TRUE);
+		worker_stdout = NULL;
+	}
+	g_clear_object(&worker);
+	g_clear_pointer(&worker_backend, g_free);
+}
+
+static gboolean custom_worker_start(GError **error)
+{
+	GError *ierror = NULL;
+	gchar *backend_name = r_context()->config->custom_bootloader_backend;
+
+	g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
+
+	/* restart the worker if the configuration changed */
+	if (worker && g_strcmp0(worker_backend, backend_name) == 0)
+		return TRUE;
+	custom_worker_stop();
+
+	worker = r_subprocess_new(G_SUBPROCESS_FLAGS_STDIN_PIPE | G_SUBPROCESS_FLAGS_STDOUT_PIPE, &ierror,
+			backend_name, "serve", NULL);
+	if (!worker) {
+		g_propagate_prefixed_error(
+				error,
+				ierror,
+				"Failed to start %s: ", backend_name);
+		return FALSE;
+	}
+
+	worker_stdout = g_string_new(NULL);
+	worker_backend = g_strdup(backend_name);
+
+	return TRUE;
+}
+
+/* Reads a single line from the persistent worker
+ *
+ * Data received after the line is kept for the next call.
+ *
+ * @param timeout_ms time to wait for the complete line
+ * @param error Return location for a GError
+ *
+ * @return the line without the newline, or NULL if the worker closed its
+ *         stdout (without setting error) or an error occurred
+ */
+static gchar *custom_worker_read_line(gint timeout_ms, GError **error)
+{
+	GInputStream *stdout_pipe = g_subprocess_get_stdout_pipe(worker);
+	gint64 deadline = g_get_monotonic_time() + (gint64)timeout_ms * 1000;
+	gchar *newline;
+	gchar *line;
+
+	g_return_val_if_fail(error == NULL || *error == NULL, NULL);
+
+	while (!(newline = memchr(worker_stdout->str, '\n', worker_stdout->len))) {
+		GPollFD pollfd = {
+			.fd = g_unix_input_stream_get_fd(G_UNIX_INPUT_STREAM(stdout_pipe)),
+			.events = G_IO_IN,
+		};
+		gint64 remaining = (deadline - g_get_monotonic_time()) / 1000;
+		gchar buf[512];
+		gssize len;
+		gint ret;
+
+		if (remaining <= 0) {
+			g_set_error(error,
+					G_IO_ERROR,
+					G_IO_ERROR_TIMED_OUT,
+					"No response within %d seconds", timeout_ms / 1000);
+			return NULL;
+		}
+
+		ret = g_poll(&pollfd, 1, (gint)remaining);
+		if (ret < 0) {
+			int err = errno;
+			if (err == EINTR)
+				continue;
+			g_set_error(error,
+					G_IO_ERROR,
+					g_io_error_from_errno(err),
+					"Failed to poll: %s", g_strerror(err));
+			return NULL;
+		} else if (ret == 0) {
+			continue;
+		}
+
+		len = g_input_stream_read(stdout_pipe, buf, sizeof(buf), NULL, error);
+		/* error is set on failure, EOF otherwise */
+		if (len <= 0)
+			return NULL;
+		g_string_append_len(worker_stdout, buf, len);
+	}
+
+	line = g_strndup(worker_stdout->str, newline - worker_stdout->str);
+	g_string_erase(worker_stdout, 0, newline - worker_stdout->str + 1);
+
+	return line;
+}
+
+/* Sends a single request to the persistent custom backend worker
+ *
+ * The request is written as one line containing the command and its
+ * arguments separated by spaces. The worker must answer each request with
+ * exactly one line of either 'ok [<value>]' or 'error [<message>]'.
+ *
+ * @param cmd command to send (as for the non-persistent backend)
+ * @param bootname slot.bootname (or NULL)
+ * @param arg extra argument (or NULL)
+ * @param ret_str Return location for the value of an 'ok' response, or NULL
+ * @param error Return location for a GError
+ */
+static gboolean custom_worker_call(const gchar *cmd, const gchar *bootname, const gchar *arg, gchar **ret_str, GError **error)
+{
+	GError *ierror = NULL;
+	g_autoptr(GString) request = NULL;
+	g_autofree gchar *response = NULL;
+	gchar *backend_name = r_context()->config->custom_bootloader_backend;
+
+	g_return_val_if_fail(cmd, FALSE);
+	g_return_val_if_fail(ret_str == NULL || *ret_str == NULL, FALSE);
+	g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
+
+	if (!custom_worker_start(&ierror)) {
+		g_propagate_error(error, ierror);
+		return FALSE;
+	}
+
+	request = g_string_new(cmd);
+	if (bootname)
+		g_string_append_printf(request, " %s", bootname);
+	if (arg)
+		g_string_append_printf(request, " %s", arg);
+	g_debug("Sending request to %s: %s", backend_name, request->str);
+	g_string_append_c(request, '\n');
+
+	if (!g_output_stream_write_all(g_subprocess_get_stdin_pipe(worker), request->str, request->len, NULL, NULL, &ierror)) {
+		custom_worker_stop();
+		g_propagate_prefixed_error(
+				error,
+				ierror,
+				"Failed to send request to %s: ", backend_name);
+		return FALSE;
+	}
+
+	response = custom_worker_read_line(CUSTOM_WORKER_TIMEOUT_MS, &ierror);
+	if (!response) {
+		/* a hung worker would not react to closing its stdin */
+		if (g_error_matches(ierror, G_IO_ERROR, G_IO_ERROR_TIMED_OUT))
+			g_subprocess_force_exit(worker);
+		custom_worker_stop();
+		if (ierror) {
+			g_propagate_prefixed_error(
+					error,
+					ierror,
+					"Failed to read response from %s: ", backend_name);
+		} else {
+			g_set_error(
+					error,
+					G_SPAWN_ERROR,
+					G_SPAWN_ERROR_FAILED,
+					"%s exited unexpectedly", backend_name);
+		}
+		return FALSE;
+	}
+
+	if (g_strcmp0(response, "ok") == 0 || g_str_has_prefix(response, "ok ")) {
+		if (ret_str)
+			*ret_str = g_strstrip(g_strdup(response + 2));
+		return TRUE;
+	} else if (g_strcmp0(response, "error") == 0 || g_str_has_prefix(response, "error ")) {
+		g_set_error(
+				error,
+				R_BOOTCHOOSER_ERROR,
+				R_BOOTCHOOSER_ERROR_FAILED,
+				"%s failed: %s", backend_name, g_strstrip(response + 5));
+		return FALSE;
+	}
+
+	/* we cannot know if following responses are in sync, so restart */
+	custom_worker_stop();
+	g_set_error(
+			error,
+			R_BOOTCHOOSER_ERROR,
+			R_BOOTCHOOSER_ERROR_PARSE_FAILED,
+			"Invalid response from %s: '%s'", backend_name, response);
+	return FALSE;
+}
+
 /* Wrapper for get commands accessing custom script
  *
  * @param cmd What to input as command to the custom backend. Mandatory.
@@ -25,6 +236,9 @@ static gboolean custom_backend_get(const gchar *cmd, const gchar *bootname, gcha
 	g_return_val_if_fail(ret_str && *ret_str == NULL, FALSE);
 	g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
 
+	if (r_context()->config->custom_bootloader_persistent)
+		return custom_worker_call(cmd, bootname, NULL, ret_str, error);
+
 	if (bootname)
 		sub = g_subprocess_new(G_SUBPROCESS_FLAGS_STDOUT_PIPE, &ierror, backend_name, cmd, bootname, NULL);
 	else
@@ -93,6 +307,9 @@ static gboolean custom_backend_set(const gchar *cmd, const gchar *bootname, cons
 	g_return_val_if_fail(bootname, FALSE);
 	g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
 
+	if (r_context()->config->custom_bootloader_persistent)
+		return custom_worker_call(cmd, bootname, arg, NULL, error);
+
 	if (arg)
 		sub = g_subprocess_new(G_SUBPROCESS_FLAGS_NONE, &ierror, backend_name, cmd, bootname, arg, NULL);
 	else
@@ -3,6 +3,7 @@
 #include <gio/gfiledescriptorbased.h>
 #include <gio/gunixmounts.h>
 #include <glib/gstdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <fcntl.h>
 #include <sys/stat.h>
@@ -19,6 +20,7 @@
 #include "context.h"
 #include "crypt.h"
 #include "manifest.h"
+#include "metrics.h"
 #include "mount.h"
 #include "signature.h"
 #include "utils.h"
@@ -27,6 +29,7 @@
 #include "verity_hash.h"
 #include "nbd.h"
 #include "hash_index.h"
+#include "squashfs.h"
 
 /* from statfs(2) man page, as linux/magic.h may not have all of them */
 #ifndef AFS_SUPER_MAGIC
@@ -106,7 +109,7 @@ r_bundle_error_quark(void)
 	return g_quark_from_static_string("r-bundle-error-quark");
 }
 
-static gboolean mksquashfs(const gchar *bundlename, const gchar *contentdir, gboolean keep_metadata, const gchar *fakeroot, GError **error)
+static gboolean mksquashfs(const gchar *bundlename, const gchar *contentdir, gboolean keep_metadata, const gchar *fakeroot, const gchar * const *uncompressed, GError **error)
 {
 	GError *ierror = NULL;
 	gboolean res = FALSE;
@@ -123,6 +126,32 @@ static gboolean mksquashfs(const gchar *bundlename, const gchar *contentdir, gbo
 		goto out;
 	}
 
+	/* only the built-in writer can place images at known offsets */
+	if (r_context()->builtin_squashfs || uncompressed) {
+#if ENABLE_SQUASHFS_WRITER == 1
+		/* The built-in writer stores all files as owned by root without
+		 * xattrs and cannot see metadata recorded by fakeroot. */
+		if (keep_metadata) {
+			g_set_error(error, R_BUNDLE_ERROR, R_BUNDLE_ERROR_UNSUPPORTED,
+					"Built-in squashfs writer does not support 'tar-extract' images, use mksquashfs instead");
+			goto out;
+		}
+		if (r_context()->mksquashfs_args) {
+			g_set_error(error, R_BUNDLE_ERROR, R_BUNDLE_ERROR_UNSUPPORTED,
+					"mksquashfs extra args cannot be used with the built-in squashfs writer");
+			goto out;
+		}
+
+		res = r_squashfs_write(contentdir, bundlename, r_context()->bundle_jobs, uncompressed, &ierror);
+		if (!res)
+			g_propagate_prefixed_error(error, ierror, "Failed to create squashfs: ");
+#else
+		g_set_error(error, R_BUNDLE_ERROR, R_BUNDLE_ERROR_UNSUPPORTED,
+				"Built-in squashfs writer not enabled, recompile with -Dsquashfs_writer=enabled");
+#endif
+		goto out;
+	}
+
 	r_fakeroot_add_args(args, fakeroot);
 
 	g_ptr_array_add(args, g_strdup("mksquashfs"));
@@ -396,78 +425,81 @@ static gboolean image_is_archive(RaucImage* image)
 	return FALSE;
 }
 
-static gboolean generate_adaptive_data(RaucManifest *manifest, const gchar *dir, GError **error)
+static gboolean generate_adaptive_data(RaucImage *image, const gchar *dir, GError **error)
 {
 	GError *ierror = NULL;
 
-	g_return_val_if_fail(manifest, FALSE);
+	g_return_val_if_fail(image, FALSE);
 	g_return_val_if_fail(dir, FALSE);
 	g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
 
-	for (GList *elem = manifest->images; elem != NULL; elem = elem->next) {
-		RaucImage *image = elem->data;
-		g_autofree gchar *imagepath = g_build_filename(dir, image->filename, NULL);
-
-		if (!image->adaptive)
-			continue;
+	if (!image->adaptive)
+		return TRUE;
 
-		for (gchar **method = image->adaptive; *method != NULL; method++) {
-			if (g_str_equal(*method, "block-hash-index")) {
-				/* Use a filename of bundle/<image-name>.block-hash-index. */
-				g_autofree gchar *indexname = g_strconcat(image->filename, ".block-hash-index", NULL);
-				g_autofree gchar *indexpath = g_build_filename(dir, indexname, NULL);
-				g_autoptr(RaucHashIndex) index = NULL;
-				g_auto(filedesc) fd = -1;
+	g_autofree gchar *imagepath = g_build_filename(dir, image->filename, NULL);
 
-				if (image_is_archive(image)) {
-					g_warning("Generating block hash index requires a block device image but %s looks like an archive", image->filename);
-				}
+	for (gchar **method = image->adaptive; *method != NULL; method++) {
+		if (g_str_equal(*method, "block-hash-index")) {
+			/* Use a filename of bundle/<image-name>.block-hash-index. */
+			g_autofree gchar *indexname = g_strconcat(image->filename, ".block-hash-index", NULL);
+			g_autofree gchar *indexpath = g_build_filename(dir, indexname, NULL);
+			g_autoptr(RaucHashIndex) index = NULL;
+			g_auto(filedesc) fd = -1;
 
-				fd = g_open(imagepath, O_RDONLY | O_CLOEXEC);
-				if (fd < 0) {
-					int err = errno;
-					g_set_error(
-							error,
-							G_IO_ERROR,
-							g_io_error_from_errno(err),
-							"Failed to open image: %s", image->filename);
-					return FALSE;
-				}
+			if (image_is_archive(image)) {
+				g_warning("Generating block hash index requires a block device image but %s looks like an archive", image->filename);
+			}
 
-				index = r_hash_index_open("image", fd, NULL, &ierror);
-				if (!index) {
-					g_propagate_prefixed_error(
-							error,
-							ierror,
-							"Failed to generate hash index for %s: ", image->filename);
-					return FALSE;
-				}
+			fd = g_open(imagepath, O_RDONLY | O_CLOEXEC);
+			if (fd < 0) {
+				int err = errno;
+				g_set_error(
+						error,
+						G_IO_ERROR,
+						g_io_error_from_errno(err),
+						"Failed to open image: %s", image->filename);
+				return FALSE;
+			}
 
-				if (!r_hash_index_export(index, indexpath, &ierror)) {
-					g_propagate_prefixed_error(
-							error,
-							ierror,
-							"Failed to write hash index for %s: ", image->filename);
-					return FALSE;
-				}
+			index = r_hash_index_open("image", fd, NULL, &ierror);
+			if (!index) {
+				g_propagate_prefixed_error(
+						error,
+						ierror,
+						"Failed to generate hash index for %s: ", image->filename);
+				return FALSE;
+			}
 
-				g_debug("Created block-hash-index for image %s", image->filename);
-			} else if (g_str_equal(*method, "adaptive-test-method")) {
-				g_debug("Ignoring adaptive-test-method for image %s", image->filename);
-			} else {
-				g_set_error(
+			if (!r_hash_index_export(index, indexpath, &ierror)) {
+				g_propagate_prefixed_error(
 						error,
-						R_BUNDLE_ERROR,
-						R_BUNDLE_ERROR_PAYLOAD,
-						"Unsupported adaptive method: %s", *method);
+						ierror,
+						"Failed to write hash index for %s: ", image->filename);
 				return FALSE;
 			}
+
+			g_debug("Created block-hash-index for image %s", image->filename);
+		} else if (g_str_equal(*method, "adaptive-test-method")) {
+			g_debug("Ignoring adaptive-test-method for image %s", image->filename);
+		} else {
+			g_set_error(
+					error,
+					R_BUNDLE_ERROR,
+					R_BUNDLE_ERROR_PAYLOAD,
+					"Unsupported adaptive method: %s", *method);
+			return FALSE;
 		}
 	}
 
 	return TRUE;
 }
 
+/* All tools run under the same fakeroot use a single state file, which is
+ * saved when they exit. Concurrent runs would drop each other's metadata. */
+static GMutex fakeroot_lock;
+/* mkcomposefs instances share the object store in the bundle. */
+static GMutex composefs_lock;
+
 static gchar *convert_tar_extract(RaucImage *image, const gchar *dir, const gchar *fakeroot, GError **error)
 {
 	GError *ierror = NULL;
@@ -499,9 +531,13 @@ static gchar *convert_tar_extract(RaucImage *image, const gchar *dir, const gcha
 	g_ptr_array_add(args, g_strdup(converted_path));
 	g_ptr_array_add(args, NULL);
 
-	if (!r_subprocess_runv(args, G_SUBPROCESS_FLAGS_NONE, &ierror)) {
-		g_propagate_prefixed_error(error, ierror, "failed to run tar extract: ");
-		return NULL;
+	{
+		g_autoptr(GMutexLocker) locker = fakeroot ? g_mutex_locker_new(&fakeroot_lock) : NULL;
+
+		if (!r_subprocess_runv(args, G_SUBPROCESS_FLAGS_NONE, &ierror)) {
+			g_propagate_prefixed_error(error, ierror, "failed to run tar extract: ");
+			return NULL;
+		}
 	}
 
 	return g_steal_pointer(&converted);
@@ -550,114 +586,321 @@ static gchar *convert_composefs(RaucImage *image, const gchar *dir, const gchar
 	g_ptr_array_add(args, g_strdup(converted_image_path));
 	g_ptr_array_add(args, NULL);
 
-	if (!r_subprocess_runv(args, G_SUBPROCESS_FLAGS_NONE, &ierror)) {
-		g_propagate_prefixed_error(error, ierror, "failed to run mkcomposefs: ");
-		return NULL;
+	{
+		g_autoptr(GMutexLocker) locker = g_mutex_locker_new(&composefs_lock);
+		g_autoptr(GMutexLocker) fakeroot_locker = fakeroot ? g_mutex_locker_new(&fakeroot_lock) : NULL;
+
+		if (!r_subprocess_runv(args, G_SUBPROCESS_FLAGS_NONE, &ierror)) {
+			g_propagate_prefixed_error(error, ierror, "failed to run mkcomposefs: ");
+			return NULL;
+		}
 	}
 
 	return g_steal_pointer(&converted);
 }
 #endif
 
-static gboolean convert_images(RaucManifest *manifest, const gchar *dir, const gchar *fakeroot, GError **error)
+static gboolean convert_image(RaucImage *image, const gchar *dir, const gchar *fakeroot, GError **error)
 {
 	GError *ierror = NULL;
 
-	g_return_val_if_fail(manifest, FALSE);
+	g_return_val_if_fail(image, FALSE);
 	g_return_val_if_fail(dir, FALSE);
 	g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
 
-	for (GList *elem = manifest->images; elem != NULL; elem = elem->next) {
-		RaucImage *image = elem->data;
+	if (!image->convert)
+		return TRUE;
 
-		if (image->converted && image->converted->len == 0) {
+	g_autofree gchar *tar_extracted = NULL;
+	g_autofree gchar *tar_extracted_path = NULL;
+	/* extract tar early if we need it for other outputs */
+	if (g_strv_contains((const gchar * const *)image->convert, "tar-extract") ||
+	    g_strv_contains((const gchar * const *)image->convert, "composefs")) {
+		g_debug("extracting tar artifact image '%s'", image->filename);
+		tar_extracted = convert_tar_extract(image, dir, fakeroot, &ierror);
+		if (!tar_extracted) {
+			g_propagate_error(error, ierror);
+			return FALSE;
+		}
+		tar_extracted_path = g_build_filename(dir, tar_extracted, NULL);
+	}
+
+	gboolean keep = FALSE;
+	g_autoptr(GPtrArray) converted = g_ptr_array_new_with_free_func(g_free);
+	for (gchar **method = image->convert; *method != NULL; method++) {
+		gchar *converted_filename = NULL;
+		if (g_str_equal(*method, "tar-extract")) {
+			converted_filename = g_strdup(tar_extracted);
+		} else if (g_str_equal(*method, "composefs")) {
+#if ENABLE_COMPOSEFS == 1
+			g_debug("converting '%s' to composefs image", tar_extracted_path);
+			converted_filename = convert_composefs(image, dir, tar_extracted_path, fakeroot, &ierror);
+			if (!converted_filename) {
+				g_propagate_error(error, ierror);
+				return FALSE;
+			}
+#else
+			g_set_error(error, R_BUNDLE_ERROR, R_BUNDLE_ERROR_UNSUPPORTED,
+					"Convert method 'composefs' not enabled, recompile with -Dcomposefs=enabled");
+			return FALSE;
+#endif
+		} else if (g_str_equal(*method, "keep")) {
+			g_debug("keeping input artifact image '%s'", image->filename);
+			keep = TRUE;
+			converted_filename = g_strdup(image->filename);
+		} else {
 			g_set_error(
 					error,
 					R_BUNDLE_ERROR,
 					R_BUNDLE_ERROR_PAYLOAD,
-					"Manifest already contains converted images for '%s'", image->slotclass);
+					"Unsupported convert method: %s", *method);
 			return FALSE;
 		}
 
-		if (!image->convert)
-			continue;
+		g_assert(converted_filename != NULL);
+		g_ptr_array_add(converted, converted_filename);
+	}
 
-		g_autofree gchar *tar_extracted = NULL;
-		g_autofree gchar *tar_extracted_path = NULL;
-		/* extract tar early if we need it for other outputs */
-		if (g_strv_contains((const gchar * const *)image->convert, "tar-extract") ||
-		    g_strv_contains((const gchar * const *)image->convert, "composefs")) {
-			g_debug("extracting tar artifact image '%s'", image->filename);
-			tar_extracted = convert_tar_extract(image, dir, fakeroot, &ierror);
-			if (!tar_extracted) {
-				g_propagate_error(error, ierror);
-				return FALSE;
-			}
-			tar_extracted_path = g_build_filename(dir, tar_extracted, NULL);
+	if (tar_extracted_path && !g_strv_contains((const gchar * const *)image->convert, "tar-extract")) {
+		if (!rm_tree(tar_extracted_path, &ierror)) {
+			g_propagate_prefixed_error(error, ierror, "Failed to remove files extracted from tar: ");
+			return FALSE;
 		}
+	}
 
-		gboolean keep = FALSE;
-		g_autoptr(GPtrArray) converted = g_ptr_array_new_with_free_func(g_free);
-		for (gchar **method = image->convert; *method != NULL; method++) {
-			gchar *converted_filename = NULL;
-			if (g_str_equal(*method, "tar-extract")) {
-				converted_filename = g_strdup(tar_extracted);
-			} else if (g_str_equal(*method, "composefs")) {
-#if ENABLE_COMPOSEFS == 1
-				g_debug("converting '%s' to composefs image", tar_extracted_path);
-				converted_filename = convert_composefs(image, dir, tar_extracted_path, fakeroot, &ierror);
-				if (!converted_filename) {
-					g_propagate_error(error, ierror);
-					return FALSE;
-				}
-#else
-				g_set_error(error, R_BUNDLE_ERROR, R_BUNDLE_ERROR_UNSUPPORTED,
-						"Convert method 'composefs' not enabled, recompile with -Dcomposefs=enabled");
-				return FALSE;
-#endif
-			} else if (g_str_equal(*method, "keep")) {
-				g_debug("keeping input artifact image '%s'", image->filename);
-				keep = TRUE;
-				converted_filename = g_strdup(image->filename);
-			} else {
-				g_set_error(
-						error,
-						R_BUNDLE_ERROR,
-						R_BUNDLE_ERROR_PAYLOAD,
-						"Unsupported convert method: %s", *method);
-				return FALSE;
-			}
-
-			g_assert(converted_filename != NULL);
-			g_ptr_array_add(converted, converted_filename);
+	if (!keep) {
+		g_autofree gchar *file_path = g_build_filename(dir, image->filename, NULL);
+		g_debug("removing input artifact image '%s' after conversion", image->filename);
+		if (g_unlink(file_path) != 0) {
+			int err = errno;
+			g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(err),
+					"Failed to remove input artifact image after conversion '%s': %s\n",
+					file_path, g_strerror(errno));
+			return FALSE;
 		}
+	}
+
+	g_clear_pointer(&image->converted, g_ptr_array_unref);
+	image->converted = g_steal_pointer(&converted);
+
+	return TRUE;
+}
 
-		if (tar_extracted_path && !g_strv_contains((const gchar * const *)image->convert, "tar-extract")) {
-			if (!rm_tree(tar_extracted_path, &ierror)) {
-				g_propagate_prefixed_error(error, ierror, "Failed to remove files extracted from tar: ");
+typedef enum {
+	IMAGE_STAGE_CHECKSUM,
+	IMAGE_STAGE_ADAPTIVE,
+	IMAGE_STAGE_CONVERT,
+	IMAGE_STAGE_COUNT
+} RaucImageStage;
+
+static const gchar *image_stage_names[IMAGE_STAGE_COUNT] = {
+	[IMAGE_STAGE_CHECKSUM] = "checksum",
+	[IMAGE_STAGE_ADAPTIVE] = "adaptive",
+	[IMAGE_STAGE_CONVERT] = "convert",
+};
+
+typedef struct {
+	RaucImage *image;
+	gint64 usec[IMAGE_STAGE_COUNT];
+} RaucImageJob;
+
+/* Images using the same file are processed by a single worker. */
+typedef struct {
+	/* RaucImageJob entries in manifest order */
+	GPtrArray *jobs;
+	const gchar *dir;
+	const gchar *fakeroot;
+	/* shared between all groups, set once any group failed */
+	gint *failed;
+
+	GError *error;
+} RaucImageGroup;
+
+/* Processes all images of a group. As converting an image can remove its
+ * input file, all images are checksummed and their adaptive data is
+ * generated before the first one is converted. */
+static gboolean process_image_group(RaucImageGroup *group, GError **error)
+{
+	GError *ierror = NULL;
+	gint64 start;
+
+	for (guint i = 0; i < group->jobs->len; i++) {
+		RaucImageJob *job = g_ptr_array_index(group->jobs, i);
+		RaucImage *image = job->image;
+
+		start = g_get_monotonic_time();
+		if (image->filename) {
+			g_autofree gchar *filename = g_build_filename(group->dir, image->filename, NULL);
+
+			if (!compute_checksum(&image->checksum, filename, &ierror)) {
+				g_propagate_prefixed_error(error, ierror, "Failed updating checksum: ");
 				return FALSE;
 			}
+		} else {
+			/* If no filename is set (valid for 'install' hook) explicitly set size to -1 */
+			image->checksum.size = -1;
 		}
+		job->usec[IMAGE_STAGE_CHECKSUM] = g_get_monotonic_time() - start;
 
-		if (!keep) {
-			g_autofree gchar *file_path = g_build_filename(dir, image->filename, NULL);
-			g_debug("removing input artifact image '%s' after conversion", image->filename);
-			if (g_unlink(file_path) != 0) {
-				int err = errno;
-				g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(err),
-						"Failed to remove input artifact image after conversion '%s': %s\n",
-						file_path, g_strerror(errno));
-				return FALSE;
-			}
+		if (g_atomic_int_get(group->failed))
+			return TRUE;
+
+		start = g_get_monotonic_time();
+		if (!generate_adaptive_data(image, group->dir, &ierror)) {
+			g_propagate_error(error, ierror);
+			return FALSE;
+		}
+		job->usec[IMAGE_STAGE_ADAPTIVE] = g_get_monotonic_time() - start;
+
+		if (g_atomic_int_get(group->failed))
+			return TRUE;
+	}
+
+	for (guint i = 0; i < group->jobs->len; i++) {
+		RaucImageJob *job = g_ptr_array_index(group->jobs, i);
+
+		start = g_get_monotonic_time();
+		if (!convert_image(job->image, group->dir, group->fakeroot, &ierror)) {
+			g_propagate_error(error, ierror);
+			return FALSE;
 		}
+		job->usec[IMAGE_STAGE_CONVERT] = g_get_monotonic_time() - start;
 
-		g_clear_pointer(&image->converted, g_ptr_array_unref);
-		image->converted = g_steal_pointer(&converted);
+		if (g_atomic_int_get(group->failed))
+			return TRUE;
 	}
 
 	return TRUE;
 }
 
+static void process_image_group_func(gpointer data, gpointer user_data)
+{
+	RaucImageGroup *group = data;
+
+	/* don't start new work once the bundle creation is known to fail */
+	if (g_atomic_int_get(group->failed))
+		return;
+
+	if (!process_image_group(group, &group->error))
+		g_atomic_int_set(group->failed, TRUE);
+}
+
+/* Computes checksums, generates adaptive data and converts all images of the
+ * manifest. Images using different files are independent of each other, so
+ * they are processed by a bounded pool of worker threads. */
+static gboolean process_images(RaucManifest *manifest, const gchar *dir, const gchar *fakeroot, GError **error)
+{
+	GError *ierror = NULL;
+	g_autofree RaucImageJob *jobs = NULL;
+	g_autofree RaucImageGroup *groups = NULL;
+	g_autoptr(GHashTable) groups_by_file = NULL;
+	gint64 total[IMAGE_STAGE_COUNT] = {0};
+	GThreadPool *pool = NULL;
+	gint failed = FALSE;
+	guint n_images, n_groups = 0, n_threads;
+	gboolean res = FALSE;
+	gint64 start;
+	guint i;
+
+	g_return_val_if_fail(manifest, FALSE);
+	g_return_val_if_fail(dir, FALSE);
+	g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
+
+	for (GList *elem = manifest->images; elem != NULL; elem = elem->next) {
+		RaucImage *image = elem->data;
+
+		if (image->converted && image->converted->len == 0) {
+			g_set_error(
+					error,
+					R_BUNDLE_ERROR,
+					R_BUNDLE_ERROR_PAYLOAD,
+					"Manifest already contains converted images for '%s'", image->slotclass);
+			return FALSE;
+		}
+	}
+
+	n_images = g_list_length(manifest->images);
+	if (n_images == 0)
+		return TRUE;
+
+	jobs = g_new0(RaucImageJob, n_images);
+	groups = g_new0(RaucImageGroup, n_images);
+	groups_by_file = g_hash_table_new(g_str_hash, g_str_equal);
+	i = 0;
+	for (GList *elem = manifest->images; elem != NULL; elem = elem->next) {
+		RaucImage *image = elem->data;
+		RaucImageGroup *group = NULL;
+
+		jobs[i].image = image;
+
+		if (image->filename)
+			group = g_hash_table_lookup(groups_by_file, image->filename);
+		if (!group) {
+			group = &groups[n_groups++];
+			group->jobs = g_ptr_array_new();
+			group->dir = dir;
+			group->fakeroot = fakeroot;
+			group->failed = &failed;
+			if (image->filename)
+				g_hash_table_insert(groups_by_file, image->filename, group);
+		}
+		g_ptr_array_add(group->jobs, &jobs[i]);
+		i++;
+	}
+
+	n_threads = r_context()->bundle_jobs ? r_context()->bundle_jobs : g_get_num_processors();
+	n_threads = CLAMP(n_threads, 1, n_groups);
+
+	g_debug("Processing %u images (%u files) with %u threads", n_images, n_groups, n_threads);
+	start = g_get_monotonic_time();
+
+	pool = g_thread_pool_new(process_image_group_func, NULL, n_threads, TRUE, &ierror);
+	if (!pool) {
+		g_propagate_prefixed_error(error, ierror, "Failed to create thread pool: ");
+		goto out;
+	}
+	/* the threads of an exclusive pool are started on creation, so pushing
+	 * cannot fail */
+	for (i = 0; i < n_groups; i++)
+		g_thread_pool_push(pool, &groups[i], NULL);
+	/* wait for all groups to finish */
+	g_thread_pool_free(pool, FALSE, TRUE);
+
+	/* report the error of the first failed group in manifest order */
+	for (i = 0; i < n_groups; i++) {
+		if (groups[i].error && !ierror)
+			ierror = g_steal_pointer(&groups[i].error);
+		else
+			g_clear_error(&groups[i].error);
+	}
+	if (ierror) {
+		g_propagate_error(error, ierror);
+		goto out;
+	}
+
+	for (i = 0; i < n_images; i++) {
+		g_debug("Image %s: checksum %.3fs, adaptive %.3fs, convert %.3fs",
+				jobs[i].image->filename ? jobs[i].image->filename : jobs[i].image->slotclass,
+				jobs[i].usec[IMAGE_STAGE_CHECKSUM] / 1e6,
+				jobs[i].usec[IMAGE_STAGE_ADAPTIVE] / 1e6,
+				jobs[i].usec[IMAGE_STAGE_CONVERT] / 1e6);
+		for (RaucImageStage stage = 0; stage < IMAGE_STAGE_COUNT; stage++)
+			total[stage] += jobs[i].usec[stage];
+	}
+
+	for (RaucImageStage stage = 0; stage < IMAGE_STAGE_COUNT; stage++)
+		g_debug("Image stage %s: %.3fs (summed over all images)", image_stage_names[stage], total[stage] / 1e6);
+	g_debug("Processed %u images in %.3fs", n_images, (g_get_monotonic_time() - start) / 1e6);
+
+	res = TRUE;
+
+out:
+	for (i = 0; i < n_groups; i++)
+		g_ptr_array_unref(groups[i].jobs);
+
+	return res;
+}
+
 static gboolean output_stream_write_uint64_all(GOutputStream *stream,
 		guint64 data,
 		GCancellable *cancellable,
@@ -1288,6 +1531,57 @@ static gboolean needs_fakeroot(const RaucManifest *manifest, gboolean *mksquashf
 	return TRUE;
 }
 
+/* Returns the NULL-terminated list of images to store uncompressed, or NULL
+ * if there are none (or on error). Sets the payload offset for each of them. */
+static GPtrArray *plan_uncompressed_images(RaucManifest *manifest, const gchar *dir, GError **error)
+{
+	g_autoptr(GPtrArray) names = g_ptr_array_new();
+	g_autoptr(GPtrArray) images = g_ptr_array_new();
+
+	g_return_val_if_fail(manifest != NULL, NULL);
+	g_return_val_if_fail(dir != NULL, NULL);
+	g_return_val_if_fail(error == NULL || *error == NULL, NULL);
+
+	for (GList *l = manifest->images; l != NULL; l = l->next) {
+		RaucImage *image = l->data;
+
+		if (!image->uncompressed)
+			continue;
+
+		g_ptr_array_add(names, image->filename);
+		g_ptr_array_add(images, image);
+	}
+
+	if (!names->len)
+		return NULL;
+
+#if ENABLE_SQUASHFS_WRITER == 1
+	{
+		GError *ierror = NULL;
+		g_autofree guint64 *offsets = g_new0(guint64, names->len);
+
+		g_ptr_array_add(names, NULL);
+		if (!r_squashfs_plan_uncompressed(dir, (const gchar * const *) names->pdata, offsets, &ierror)) {
+			g_propagate_prefixed_error(error, ierror, "Failed to place uncompressed images: ");
+			return NULL;
+		}
+
+		for (guint i = 0; i < images->len; i++) {
+			RaucImage *image = g_ptr_array_index(images, i);
+
+			image->payload_offset = offsets[i];
+			g_debug("Storing image %s uncompressed at offset %"G_GUINT64_FORMAT, image->filename, image->payload_offset);
+		}
+	}
+
+	return g_steal_pointer(&names);
+#else
+	g_set_error(error, R_BUNDLE_ERROR, R_BUNDLE_ERROR_UNSUPPORTED,
+			"Uncompressed images require the built-in squashfs writer, recompile with -Dsquashfs_writer=enabled");
+	return NULL;
+#endif
+}
+
 gboolean create_bundle(const gchar *bundlename, const gchar *contentdir, GError **error)
 {
 	GError *ierror = NULL;
@@ -1295,8 +1589,12 @@ gboolean create_bundle(const gchar *bundlename, const gchar *contentdir, GError
 	g_autoptr(RaucManifest) manifest = NULL;
 	g_autofree gchar *workdir = NULL;
 	g_autofree gchar *fakeroot = NULL;
+	g_autoptr(GPtrArray) uncompressed = NULL;
 	gboolean mksquashfs_metadata = FALSE;
 	gboolean res = FALSE;
+	gint64 create_start = g_get_monotonic_time();
+	gint64 stage_start;
+	gint64 images_usec = 0, squashfs_usec = 0, encrypt_usec = 0, sign_usec = 0;
 
 	g_return_val_if_fail(bundlename != NULL, FALSE);
 	g_return_val_if_fail(contentdir != NULL, FALSE);
@@ -1342,7 +1640,7 @@ gboolean create_bundle(const gchar *bundlename, const gchar *contentdir, GError
 		goto out;
 	}
 
-	res = sync_manifest_with_contentdir(manifest, workdir, &ierror);
+	res = check_manifest_contentdir(manifest, workdir, &ierror);
 	if (!res) {
 		g_propagate_error(error, ierror);
 		goto out;
@@ -1356,15 +1654,20 @@ gboolean create_bundle(const gchar *bundlename, const gchar *contentdir, GError
 		}
 	}
 
-	res = generate_adaptive_data(manifest, workdir, &ierror);
+	stage_start = g_get_monotonic_time();
+	res = process_images(manifest, workdir, fakeroot, &ierror);
 	if (!res) {
 		g_propagate_error(error, ierror);
 		goto out;
 	}
+	images_usec = g_get_monotonic_time() - stage_start;
 
-	res = convert_images(manifest, workdir, fakeroot, &ierror);
-	if (!res) {
+	/* The offsets are recorded in the manifest, which is part of the
+	 * squashfs, so they must be known before creating it. */
+	uncompressed = plan_uncompressed_images(manifest, workdir, &ierror);
+	if (ierror) {
 		g_propagate_error(error, ierror);
+		res = FALSE;
 		goto out;
 	}
 
@@ -1374,25 +1677,36 @@ gboolean create_bundle(const gchar *bundlename, const gchar *contentdir, GError
 		goto out;
 	}
 
-	res = mksquashfs(bundlename, workdir, mksquashfs_metadata, fakeroot, &ierror);
+	stage_start = g_get_monotonic_time();
+	res = mksquashfs(bundlename, workdir, mksquashfs_metadata, fakeroot,
+			uncompressed ? (const gchar * const *) uncompressed->pdata : NULL, &ierror);
 	if (!res) {
 		g_propagate_error(error, ierror);
 		goto out;
 	}
+	squashfs_usec = g_get_monotonic_time() - stage_start;
 
 	if (manifest->bundle_format == R_MANIFEST_FORMAT_CRYPT) {
+		stage_start = g_get_monotonic_time();
 		res = encrypt_bundle_payload(bundlename, manifest, &ierror);
 		if (!res) {
 			g_propagate_error(error, ierror);
 			goto out;
 		}
+		encrypt_usec = g_get_monotonic_time() - stage_start;
 	}
 
+	stage_start = g_get_monotonic_time();
 	res = sign_bundle(bundlename, manifest, &ierror);
 	if (!res) {
 		g_propagate_error(error, ierror);
 		goto out;
 	}
+	sign_usec = g_get_monotonic_time() - stage_start;
+
+	g_message("Bundle creation took %.3fs (images: %.3fs, squashfs: %.3fs, encryption: %.3fs, verity/signing: %.3fs)",
+			(g_get_monotonic_time() - create_start) / 1e6, images_usec / 1e6,
+			squashfs_usec / 1e6, encrypt_usec / 1e6, sign_usec / 1e6);
 
 	if (workdir && !rm_tree(workdir, &ierror)) {
 		g_propagate_prefixed_error(error, ierror, "Failed to remove workdir: ");
@@ -1413,47 +1727,36 @@ out:
 	return res;
 }
 
+/* Copies the payload of a bundle up to 'size', without reading the trailing
+ * signature. On file systems with reflink support, no data is copied. */
 static gboolean truncate_bundle(const gchar *inpath, const gchar *outpath, goffset size, GError **error)
 {
 	GError *ierror = NULL;
+	g_auto(filedesc) infd = -1;
+	g_auto(filedesc) outfd = -1;
 
 	g_return_val_if_fail(inpath != NULL, FALSE);
 	g_return_val_if_fail(outpath != NULL, FALSE);
 	g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
 
-	g_autoptr(GFile) infile = g_file_new_for_path(inpath);
-	g_autoptr(GFile) outfile = g_file_new_for_path(outpath);
-
-	g_autoptr(GFileInputStream) instream = g_file_read(infile, NULL, &ierror);
-	if (instream == NULL) {
-		g_propagate_prefixed_error(
-				error,
-				ierror,
-				"failed to open bundle for reading: ");
-		return FALSE;
-	}
-	g_autoptr(GFileOutputStream) outstream = g_file_create(outfile, G_FILE_CREATE_NONE, NULL,
-			&ierror);
-	if (outstream == NULL) {
-		g_propagate_prefixed_error(
-				error,
-				ierror,
-				"failed to open bundle for writing: ");
+	infd = g_open(inpath, O_RDONLY | O_CLOEXEC, 0);
+	if (infd < 0) {
+		int err = errno;
+		g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(err),
+				"failed to open bundle %s for reading: %s", inpath, g_strerror(err));
 		return FALSE;
 	}
 
-	gssize ssize = g_output_stream_splice(
-			(GOutputStream*)outstream,
-			(GInputStream*)instream,
-			G_OUTPUT_STREAM_SPLICE_CLOSE_SOURCE,
-			NULL, &ierror);
-	if (ssize == -1) {
-		g_propagate_error(error, ierror);
+	outfd = g_open(outpath, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0666);
+	if (outfd < 0) {
+		int err = errno;
+		g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(err),
+				"failed to open bundle %s for writing: %s", outpath, g_strerror(err));
 		return FALSE;
 	}
 
-	if (!g_seekable_truncate(G_SEEKABLE(outstream), size, NULL, &ierror)) {
-		g_propagate_error(error, ierror);
+	if (!r_copy_fd_data(infd, outfd, size, &ierror)) {
+		g_propagate_prefixed_error(error, ierror, "failed to copy bundle payload: ");
 		return FALSE;
 	}
 
@@ -1584,6 +1887,11 @@ static gboolean convert_to_casync_bundle(RaucBundle *bundle, const gchar *outbun
 
 		imgpath = g_build_filename(contentdir, image->filename, NULL);
 
+		/* the converted bundle is created by mksquashfs, so the payload
+		 * offsets of uncompressed images are no longer valid */
+		image->uncompressed = FALSE;
+		image->payload_offset = 0;
+
 		if (!image->filename)
 			continue;
 
@@ -1634,7 +1942,7 @@ static gboolean convert_to_casync_bundle(RaucBundle *bundle, const gchar *outbun
 		goto out;
 	}
 
-	res = mksquashfs(outbundle, contentdir, FALSE, NULL, &ierror);
+	res = mksquashfs(outbundle, contentdir, FALSE, NULL, NULL, &ierror);
 	if (!res) {
 		g_propagate_error(error, ierror);
 		goto out;
@@ -1687,14 +1995,8 @@ gboolean create_casync_bundle(RaucBundle *bundle, const gchar *outbundle, const
 	return TRUE;
 }
 
-gboolean encrypt_bundle(RaucBundle *bundle, const gchar *outbundle, GError **error)
+static gboolean check_bundle_encryptable(const RaucBundle *bundle, GError **error)
 {
-	GError *ierror = NULL;
-
-	g_return_val_if_fail(bundle != NULL, FALSE);
-	g_return_val_if_fail(outbundle != NULL, FALSE);
-	g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
-
 	/* Encrypting the CMS for a 'verity' bundle would technically possible,
 	 * but should be avoided as this will be misleading for the user who
 	 * receives an encrypted CMS but no encrypted payload (which is what we
@@ -1705,6 +2007,22 @@ gboolean encrypt_bundle(RaucBundle *bundle, const gchar *outbundle, GError **err
 		return FALSE;
 	}
 
+	return TRUE;
+}
+
+gboolean encrypt_bundle(RaucBundle *bundle, const gchar *outbundle, GError **error)
+{
+	GError *ierror = NULL;
+
+	g_return_val_if_fail(bundle != NULL, FALSE);
+	g_return_val_if_fail(outbundle != NULL, FALSE);
+	g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
+
+	if (!check_bundle_encryptable(bundle, &ierror)) {
+		g_propagate_error(error, ierror);
+		return FALSE;
+	}
+
 	if (g_file_test(outbundle, G_FILE_TEST_EXISTS)) {
 		g_set_error(error, G_FILE_ERROR, G_FILE_ERROR_EXIST, "bundle %s already exists", outbundle);
 		return FALSE;
@@ -1736,6 +2054,173 @@ gboolean encrypt_bundle(RaucBundle *bundle, const gchar *outbundle, GError **err
 	return TRUE;
 }
 
+void free_encrypt_target(RaucEncryptTarget *target)
+{
+	if (!target)
+		return;
+
+	g_free(target->outbundle);
+	g_strfreev(target->recipients);
+	g_free(target);
+}
+
+typedef struct {
+	RaucBundle *bundle;
+	const RaucEncryptTarget *target;
+	R_X509_STACK *recipcerts;
+	gint *failed;
+	gboolean created;
+	GError *error;
+} EncryptJob;
+
+static void encrypt_job_func(gpointer data, gpointer user_data)
+{
+	EncryptJob *job = data;
+	g_autoptr(GBytes) encdata = NULL;
+
+	/* stop early once an output failed */
+	if (g_atomic_int_get(job->failed))
+		return;
+
+	if (!truncate_bundle(job->bundle->path, job->target->outbundle, job->bundle->size, &job->error)) {
+		/* only remove the output if it was created by us */
+		job->created = !g_error_matches(job->error, G_FILE_ERROR, G_FILE_ERROR_EXIST);
+		goto fail;
+	}
+	job->created = TRUE;
+
+	encdata = cms_encrypt_certs(job->bundle->sigdata, job->recipcerts, &job->error);
+	if (!encdata) {
+		g_prefix_error(&job->error, "Failed to encrypt bundle: ");
+		goto fail;
+	}
+
+	if (!append_signature_to_bundle(job->target->outbundle, encdata, &job->error))
+		goto fail;
+
+	return;
+
+fail:
+	g_prefix_error(&job->error, "%s: ", job->target->outbundle);
+	g_atomic_int_set(job->failed, TRUE);
+}
+
+/* Adds the certificates from the given files to 'certs', loading each file
+ * only once for all targets. */
+static gboolean add_cached_recipients(GHashTable *cache, gchar **recipients, R_X509_STACK *certs, GError **error)
+{
+	GError *ierror = NULL;
+
+	for (gchar **path = recipients; path && *path; path++) {
+		STACK_OF(X509) *filecerts = g_hash_table_lookup(cache, *path);
+
+		if (!filecerts) {
+			gchar *single[] = {*path, NULL};
+
+			filecerts = cms_load_recipients(single, &ierror);
+			if (!filecerts) {
+				g_propagate_error(error, ierror);
+				return FALSE;
+			}
+			g_hash_table_insert(cache, g_strdup(*path), filecerts);
+		}
+
+		for (gint i = 0; i < sk_X509_num(filecerts); i++)
+			sk_X509_push(certs, sk_X509_value(filecerts, i));
+	}
+
+	return TRUE;
+}
+
+gboolean encrypt_bundle_batch(RaucBundle *bundle, GPtrArray *targets, GError **error)
+{
+	GError *ierror = NULL;
+	g_autoptr(GHashTable) cert_cache = NULL;
+	g_autoptr(GHashTable) outbundles = NULL;
+	g_autofree EncryptJob *jobs = NULL;
+	GThreadPool *pool = NULL;
+	gint failed = FALSE;
+	gint64 start = g_get_monotonic_time();
+	gboolean res = FALSE;
+
+	g_return_val_if_fail(bundle != NULL, FALSE);
+	g_return_val_if_fail(targets != NULL, FALSE);
+	g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
+
+	if (!check_bundle_encryptable(bundle, &ierror)) {
+		g_propagate_error(error, ierror);
+		return FALSE;
+	}
+
+	outbundles = g_hash_table_new(g_str_hash, g_str_equal);
+	for (guint i = 0; i < targets->len; i++) {
+		const RaucEncryptTarget *target = g_ptr_array_index(targets, i);
+
+		if (!g_hash_table_add(outbundles, target->outbundle)) {
+			g_set_error(error, G_FILE_ERROR, G_FILE_ERROR_EXIST, "bundle %s is listed more than once", target->outbundle);
+			return FALSE;
+		}
+		if (g_file_test(target->outbundle, G_FILE_TEST_EXISTS)) {
+			g_set_error(error, G_FILE_ERROR, G_FILE_ERROR_EXIST, "bundle %s already exists", target->outbundle);
+			return FALSE;
+		}
+	}
+
+	/* the same recipient files are often used for several outputs */
+	cert_cache = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, (GDestroyNotify)r_signature_free_x509_stack_pop);
+	jobs = g_new0(EncryptJob, targets->len);
+	for (guint i = 0; i < targets->len; i++) {
+		jobs[i].bundle = bundle;
+		jobs[i].target = g_ptr_array_index(targets, i);
+		jobs[i].recipcerts = sk_X509_new_null();
+		jobs[i].failed = &failed;
+
+		/* recipients given via --to are added to each output */
+		if (!add_cached_recipients(cert_cache, r_context()->recipients, jobs[i].recipcerts, &ierror) ||
+		    !add_cached_recipients(cert_cache, jobs[i].target->recipients, jobs[i].recipcerts, &ierror)) {
+			g_propagate_prefixed_error(error, ierror, "%s: ", jobs[i].target->outbundle);
+			goto out;
+		}
+		if (!sk_X509_num(jobs[i].recipcerts)) {
+			g_set_error(error, R_BUNDLE_ERROR, R_BUNDLE_ERROR_SIGNATURE, "%s: no recipients given", jobs[i].target->outbundle);
+			goto out;
+		}
+	}
+
+	/* each job copies the payload (reflinked where possible) and creates
+	 * its own envelope */
+	pool = g_thread_pool_new(encrypt_job_func, NULL, MAX(g_get_num_processors(), 1), TRUE, &ierror);
+	if (!pool) {
+		g_propagate_prefixed_error(error, ierror, "Failed to create thread pool: ");
+		goto out;
+	}
+	for (guint i = 0; i < targets->len; i++)
+		g_thread_pool_push(pool, &jobs[i], NULL);
+	/* waits for all queued jobs */
+	g_thread_pool_free(pool, FALSE, TRUE);
+
+	for (guint i = 0; i < targets->len; i++) {
+		if (jobs[i].error) {
+			g_propagate_error(error, g_steal_pointer(&jobs[i].error));
+			goto out;
+		}
+	}
+
+	g_message("Encrypted %u bundles in %.3fs", targets->len, (g_get_monotonic_time() - start) / 1e6);
+
+	res = TRUE;
+
+out:
+	for (guint i = 0; jobs && i < targets->len; i++) {
+		/* do not leave partial results behind */
+		if (!res && jobs[i].created)
+			g_unlink(jobs[i].target->outbundle);
+		g_clear_error(&jobs[i].error);
+		g_clear_pointer(&jobs[i].recipcerts, r_signature_free_x509_stack);
+	}
+	return res;
+}
+
 static gboolean is_remote_scheme(const gchar *scheme)
 {
 	return (g_strcmp0(scheme, "http") == 0) ||
@@ -2859,16 +3344,112 @@ out:
 	return res;
 }
 
+#define DM_DEVICE_READ_CHUNK_SIZE (1024*1024)
+#define DM_DEVICE_READ_THREADS 8
+
+typedef struct {
+	const gchar *dev;
+	int fd;
+	goffset size;
+	gint chunk_count;
+	/* next chunk to read, claimed atomically by the reader threads */
+	gint next_chunk;
+	gint failed;
+
+	GMutex lock;
+	GCond cond;
+	gint chunks_done;
+	gint threads_running;
+	GError *error;
+} DMDeviceReader;
+
+static void dm_device_reader_fail(DMDeviceReader *reader, GError *ierror)
+{
+	g_atomic_int_set(&reader->failed, TRUE);
+
+	g_mutex_lock(&reader->lock);
+	if (!reader->error)
+		reader->error = ierror;
+	else
+		g_error_free(ierror);
+	g_mutex_unlock(&reader->lock);
+}
+
+static gpointer dm_device_reader_thread(gpointer data)
+{
+	DMDeviceReader *reader = data;
+	void *buf = NULL;
+
+	/* O_DIRECT requires aligned buffers */
+	if (posix_memalign(&buf, 4096, DM_DEVICE_READ_CHUNK_SIZE) != 0) {
+		dm_device_reader_fail(reader, g_error_new(G_FILE_ERROR, G_FILE_ERROR_NOMEM,
+				"Failed to allocate read buffer for %s", reader->dev));
+		goto out;
+	}
+
+	while (!g_atomic_int_get(&reader->failed)) {
+		gint chunk = g_atomic_int_add(&reader->next_chunk, 1);
+		goffset offset = (goffset)chunk * DM_DEVICE_READ_CHUNK_SIZE;
+		gsize len;
+		gsize done = 0;
+
+		if (chunk >= reader->chunk_count)
+			break;
+
+		len = MIN(DM_DEVICE_READ_CHUNK_SIZE, reader->size - offset);
+		while (done < len) {
+			ssize_t r = pread(reader->fd, (guint8 *)buf + done, len - done, offset + done);
+			if (r < 0 && errno == EINTR) {
+				continue;
+			} else if (r <= 0) {
+				int err = r < 0 ? errno : EIO;
+				dm_device_reader_fail(reader, g_error_new(G_FILE_ERROR,
+						g_file_error_from_errno(err),
+						"Check %s device failed between %"G_GOFFSET_FORMAT " and %"G_GOFFSET_FORMAT " bytes with error: %s",
+						reader->dev, offset, offset + (goffset)len, g_strerror(err)));
+				goto out;
+			}
+			done += r;
+		}
+
+		g_mutex_lock(&reader->lock);
+		reader->chunks_done++;
+		g_cond_signal(&reader->cond);
+		g_mutex_unlock(&reader->lock);
+	}
+
+out:
+	free(buf);
+
+	g_mutex_lock(&reader->lock);
+	reader->threads_running--;
+	g_cond_signal(&reader->cond);
+	g_mutex_unlock(&reader->lock);
+
+	return NULL;
+}
+
+/* Reads the complete device to trigger verification of all blocks by the
+ * device-mapper target.
+ *
+ * To keep the storage queue busy, several threads read large chunks in
+ * parallel. O_DIRECT is used (if supported) to avoid filling the page cache
+ * with data that is not needed afterwards. */
 static gboolean read_complete_dm_device(gchar *dev, GError **error)
 {
-	const goffset chunk_size = 65536;
-	g_autofree void* buf = NULL;
-	ssize_t r;
+	DMDeviceReader reader = {0};
+	g_autoptr(GPtrArray) threads = g_ptr_array_new();
+	gboolean progress = r_context()->progress != NULL;
+	gboolean res = FALSE;
 
 	g_return_val_if_fail(dev != NULL, FALSE);
 	g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
 
-	g_auto(filedesc) fd = g_open(dev, O_RDONLY | O_CLOEXEC, 0);
+	g_auto(filedesc) fd = g_open(dev, O_RDONLY | O_CLOEXEC | O_DIRECT, 0);
+	if (fd < 0 && errno == EINVAL) {
+		g_debug("Opening %s with O_DIRECT not supported, falling back to buffered reads", dev);
+		fd = g_open(dev, O_RDONLY | O_CLOEXEC, 0);
+	}
 	if (fd < 0) {
 		int err = errno;
 		g_set_error(error,
@@ -2878,23 +3459,83 @@ static gboolean read_complete_dm_device(gchar *dev, GError **error)
 		return FALSE;
 	}
 
-	buf = g_malloc0(chunk_size);
+	reader.dev = dev;
+	reader.fd = fd;
+	reader.size = lseek(fd, 0, SEEK_END);
+	if (reader.size < 0) {
+		int err = errno;
+		g_set_error(error,
+				G_FILE_ERROR,
+				g_file_error_from_errno(err),
+				"Failed to determine size of %s: %s", dev, g_strerror(err));
+		return FALSE;
+	}
+	reader.chunk_count = (reader.size + DM_DEVICE_READ_CHUNK_SIZE - 1) / DM_DEVICE_READ_CHUNK_SIZE;
+	g_mutex_init(&reader.lock);
+	g_cond_init(&reader.cond);
+
+	if (progress)
+		r_context_begin_step("check_dm_device", "Checking bundle payload", 0);
+
+	for (guint i = 0; i < DM_DEVICE_READ_THREADS; i++) {
+		GError *ierror = NULL;
+		GThread *thread;
+
+		g_mutex_lock(&reader.lock);
+		reader.threads_running++;
+		g_mutex_unlock(&reader.lock);
+
+		thread = g_thread_try_new("dm-read", dm_device_reader_thread, &reader, &ierror);
+		if (!thread) {
+			g_mutex_lock(&reader.lock);
+			reader.threads_running--;
+			g_mutex_unlock(&reader.lock);
+
+			/* continue with the threads we already have */
+			if (threads->len) {
+				g_debug("Failed to start additional reader thread: %s", ierror->message);
+				g_clear_error(&ierror);
+				break;
+			}
 
-	for (goffset chunk = 0;; chunk++) {
-		r = pread(fd, buf, chunk_size, chunk*chunk_size);
-		if (r == 0)
+			dm_device_reader_fail(&reader, ierror);
 			break;
-		else if (r < 0)	{
-			int err = errno;
-			g_set_error(error,
-					G_FILE_ERROR,
-					g_file_error_from_errno(err),
-					"Check %s device failed between %"G_GOFFSET_FORMAT " and %"G_GOFFSET_FORMAT " bytes with error: %s", dev, chunk*chunk_size, (chunk+1)*chunk_size, g_strerror(err));
-			return FALSE;
 		}
+		g_ptr_array_add(threads, thread);
 	}
 
-	return TRUE;
+	g_mutex_lock(&reader.lock);
+	while (reader.threads_running > 0) {
+		gint percent;
+
+		g_cond_wait(&reader.cond, &reader.lock);
+		percent = reader.chunk_count ? (gint64)reader.chunks_done * 100 / reader.chunk_count : 100;
+
+		/* don't hold the lock while emitting progress */
+		g_mutex_unlock(&reader.lock);
+		if (progress)
+			r_context_set_step_percentage("check_dm_device", percent);
+		g_mutex_lock(&reader.lock);
+	}
+	g_mutex_unlock(&reader.lock);
+
+	for (guint i = 0; i < threads->len; i++)
+		g_thread_join(threads->pdata[i]);
+
+	if (reader.error) {
+		g_propagate_error(error, reader.error);
+		res = FALSE;
+	} else {
+		res = TRUE;
+	}
+
+	if (progress)
+		r_context_end_step("check_dm_device", res);
+
+	g_mutex_clear(&reader.lock);
+	g_cond_clear(&reader.cond);
+
+	return res;
 }
 
 /*
@@ -2958,6 +3599,9 @@ static gboolean prepare_verity(RaucBundle *bundle, gchar *loopname, gchar* mount
 		return FALSE;
 	}
 
+	/* removal is deferred until the bundle is unmounted */
+	bundle->payload_device = g_strdup(dm_verity->upper_dev);
+
 	return TRUE;
 }
 
@@ -3050,6 +3694,9 @@ static gboolean prepare_crypt(RaucBundle *bundle, gchar *loopname, gchar* mount_
 		return FALSE;
 	}
 
+	/* removal is deferred until the bundle is unmounted */
+	bundle->payload_device = g_strdup(dm_crypt->upper_dev);
+
 	return TRUE;
 }
 
@@ -3102,6 +3749,8 @@ gboolean mount_bundle(RaucBundle *bundle, GError **error)
 			goto out;
 		}
 		loopname = g_strdup(bundle->nbd_dev->dev);
+		/* all reads from the device are served by the nbd server */
+		r_metrics_set_network_device(bundle->nbd_dev->dev);
 	} else {
 		g_assert_not_reached();
 	}
@@ -3196,8 +3845,10 @@ gboolean umount_bundle(RaucBundle *bundle, GError **error)
 
 	g_rmdir(bundle->mount_point);
 	g_clear_pointer(&bundle->mount_point, g_free);
+	g_clear_pointer(&bundle->payload_device, g_free);
 
 	if (ENABLE_STREAMING && bundle->nbd_dev) {
+		r_metrics_set_network_device(NULL);
 		if (!r_nbd_remove_device(bundle->nbd_dev, &ierror)) {
 			g_propagate_error(error, ierror);
 			return FALSE;
@@ -3244,6 +3895,7 @@ void free_bundle(RaucBundle *bundle)
 	g_bytes_unref(bundle->sigdata);
 	g_bytes_unref(bundle->enveloped_data);
 	g_free(bundle->mount_point);
+	g_free(bundle->payload_device);
 	if (bundle->manifest)
 		free_manifest(bundle->manifest);
 	g_free(bundle->exclusive_check_error);
@@ -361,6 +361,15 @@ static gboolean parse_system_section(const gchar *filename, GKeyFile *key_file,
 					"No custom bootloader backend defined");
 			return FALSE;
 		}
+		c->custom_bootloader_persistent = g_key_file_get_boolean(key_file, "handlers", "bootloader-custom-backend-persistent", &ierror);
+		if (g_error_matches(ierror, G_KEY_FILE_ERROR, G_KEY_FILE_ERROR_KEY_NOT_FOUND)) {
+			c->custom_bootloader_persistent = FALSE;
+			g_clear_error(&ierror);
+		} else if (ierror) {
+			g_propagate_error(error, ierror);
+			return FALSE;
+		}
+		g_key_file_remove_key(key_file, "handlers", "bootloader-custom-backend-persistent", NULL);
 	}
 
 	c->boot_default_attempts = key_file_consume_integer(key_file, "system", "boot-attempts", &ierror);
@@ -434,12 +443,23 @@ static gboolean parse_system_section(const gchar *filename, GKeyFile *key_file,
 	}
 	g_key_file_remove_key(key_file, "system", "max-bundle-signature-size", NULL);
 
+	c->hash_index_memory_limit = key_file_consume_binary_suffixed_string(key_file, "system", "hash-index-memory-limit", &ierror);
+	if (g_error_matches(ierror, G_KEY_FILE_ERROR, G_KEY_FILE_ERROR_KEY_NOT_FOUND)) {
+		c->hash_index_memory_limit = 0;
+		g_clear_error(&ierror);
+	} else if (ierror) {
+		g_propagate_error(error, ierror);
+		return FALSE;
+	}
+
 	c->mount_prefix = key_file_consume_string(key_file, "system", "mountprefix", NULL);
 	if (!c->mount_prefix) {
 		g_debug("No mount prefix provided, using /mnt/rauc/ as default");
 		c->mount_prefix = g_strdup("/mnt/rauc/");
 	}
 
+	c->trace_path = key_file_consume_string(key_file, "system", "trace-path", NULL);
+
 	c->activate_installed = g_key_file_get_boolean(key_file, "system", "activate-installed", &ierror);
 	if (g_error_matches(ierror, G_KEY_FILE_ERROR, G_KEY_FILE_ERROR_KEY_NOT_FOUND)) {
 		c->activate_installed = TRUE;
@@ -568,6 +588,21 @@ static gboolean parse_system_section(const gchar *filename, GKeyFile *key_file,
 		g_message("Using central status file %s", c->statusfile_path);
 	}
 
+	c->statusfile_journal = g_key_file_get_boolean(key_file, "system", "statusfile-journal", &ierror);
+	if (g_error_matches(ierror, G_KEY_FILE_ERROR, G_KEY_FILE_ERROR_KEY_NOT_FOUND)) {
+		c->statusfile_journal = FALSE;
+		g_clear_error(&ierror);
+	} else if (ierror) {
+		g_propagate_error(error, ierror);
+		return FALSE;
+	}
+	g_key_file_remove_key(key_file, "system", "statusfile-journal", NULL);
+	if (c->statusfile_journal && g_strcmp0(c->statusfile_path, "per-slot") == 0) {
+		g_set_error(error, R_CONFIG_ERROR, R_CONFIG_ERROR_INVALID_FORMAT,
+				"statusfile-journal=true requires a central status file");
+		return FALSE;
+	}
+
 	/* parse bundle formats */
 	c->bundle_formats_mask =
 		1 << R_MANIFEST_FORMAT_PLAIN |
@@ -1428,6 +1463,7 @@ void free_config(RaucConfig *config)
 	g_free(config->system_bb_statename);
 	g_free(config->system_bb_dtbpath);
 	g_free(config->mount_prefix);
+	g_free(config->trace_path);
 	g_free(config->store_path);
 	g_free(config->tmp_path);
 	g_free(config->casync_install_args);
@@ -10,6 +10,7 @@
 #include "status_file.h"
 #include "network.h"
 #include "install.h"
+#include "metrics.h"
 #include "signature.h"
 #include "utils.h"
 
@@ -499,6 +500,10 @@ gboolean r_context_configure(GError **error)
 		r_replace_strdup(&context->config->mount_prefix, context->mountprefix);
 	}
 
+	if (context->tracepath) {
+		r_replace_strdup(&context->config->trace_path, context->tracepath);
+	}
+
 	if (context->keyringpath) {
 		r_replace_strdup(&context->config->keyring_path, context->keyringpath);
 	}
@@ -623,6 +628,9 @@ void r_context_begin_step_weighted(const gchar *name, const gchar *description,
 	step->substeps_done = 0;
 	step->percent_done = 0;
 	step->last_explicit_percent = 0;
+	step->trace_begin = r_trace_begin();
+	step->trace_bytes = r_trace_get_bytes();
+	r_metrics_phase_begin(step->name);
 
 	/* calculate percentage */
 	if (context->progress) {
@@ -720,6 +728,10 @@ void r_context_end_step(const gchar *name, gboolean success)
 	/* ensure that progress step nesting is done correctly */
 	g_assert_cmpstr(step->name, ==, name);
 
+	r_trace_end(R_TRACE_CAT_STEP, step->name, step->trace_begin,
+			r_trace_get_bytes() - step->trace_bytes);
+	r_metrics_phase_end(step->name);
+
 	/* increment step count and percentage on parent step */
 	if (g_list_next(context->progress)) {
 		parent = g_list_next(context->progress)->data;
@@ -892,6 +904,7 @@ void r_context_clean(void)
 		g_clear_pointer(&context->recipients, g_strfreev);
 		g_clear_pointer(&context->intermediatepaths, g_strfreev);
 		g_clear_pointer(&context->mountprefix, g_free);
+		g_clear_pointer(&context->tracepath, g_free);
 		g_clear_pointer(&context->bootslot, g_free);
 		g_clear_pointer(&context->boot_id, g_free);
 		g_clear_pointer(&context->machine_id, g_free);
@@ -0,0 +1,471 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <glib/gstdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "ext4.h"
+#include "utils.h"
+
+GQuark r_ext4_error_quark(void)
+{
+	return g_quark_from_static_string("r_ext4_error_quark");
+}
+
+#define EXT4_SUPERBLOCK_OFFSET 1024
+#define EXT4_SUPERBLOCK_SIZE 1024
+#define EXT4_MAGIC 0xEF53
+#define EXT4_ROOT_INO 2
+#define EXT4_GOOD_OLD_INODE_SIZE 128
+
+#define EXT4_FEATURE_INCOMPAT_COMPRESSION 0x0001
+#define EXT4_FEATURE_INCOMPAT_FILETYPE 0x0002
+#define EXT4_FEATURE_INCOMPAT_RECOVER 0x0004
+#define EXT4_FEATURE_INCOMPAT_JOURNAL_DEV 0x0008
+#define EXT4_FEATURE_INCOMPAT_META_BG 0x0010
+#define EXT4_FEATURE_INCOMPAT_EXTENTS 0x0040
+#define EXT4_FEATURE_INCOMPAT_64BIT 0x0080
+#define EXT4_FEATURE_INCOMPAT_MMP 0x0100
+#define EXT4_FEATURE_INCOMPAT_FLEX_BG 0x0200
+#define EXT4_FEATURE_INCOMPAT_EA_INODE 0x0400
+#define EXT4_FEATURE_INCOMPAT_CSUM_SEED 0x2000
+#define EXT4_FEATURE_INCOMPAT_LARGEDIR 0x4000
+#define EXT4_FEATURE_INCOMPAT_INLINE_DATA 0x8000
+
+/* features which do not change how we locate and read file data */
+#define EXT4_FEATURE_INCOMPAT_SUPPORTED \
+	(EXT4_FEATURE_INCOMPAT_FILETYPE | \
+	 EXT4_FEATURE_INCOMPAT_EXTENTS | \
+	 EXT4_FEATURE_INCOMPAT_64BIT | \
+	 EXT4_FEATURE_INCOMPAT_MMP | \
+	 EXT4_FEATURE_INCOMPAT_FLEX_BG | \
+	 EXT4_FEATURE_INCOMPAT_EA_INODE | \
+	 EXT4_FEATURE_INCOMPAT_CSUM_SEED | \
+	 EXT4_FEATURE_INCOMPAT_LARGEDIR | \
+	 EXT4_FEATURE_INCOMPAT_INLINE_DATA)
+
+#define EXT4_ENCRYPT_FL 0x00000800
+#define EXT4_EXTENTS_FL 0x00080000
+#define EXT4_INLINE_DATA_FL 0x10000000
+
+#define EXT4_S_IFMT 0xF000
+#define EXT4_S_IFDIR 0x4000
+#define EXT4_S_IFREG 0x8000
+
+#define EXT4_EXT_MAGIC 0xF30A
+#define EXT4_EXT_MAX_DEPTH 5
+#define EXT4_EXT_INIT_MAX_LEN 32768
+
+#define EXT4_NDIR_BLOCKS 12
+#define EXT4_IND_BLOCK 12
+#define EXT4_N_BLOCKS 15
+
+typedef struct {
+	int fd;
+	guint32 block_size;
+	guint32 inodes_per_group;
+	guint32 inodes_count;
+	guint32 inode_size;
+	guint32 desc_size;
+	guint64 gdt_offset;
+	guint32 incompat;
+} RaucExt4;
+
+typedef struct {
+	guint16 mode;
+	guint32 flags;
+	guint64 size;
+	guint8 block[EXT4_N_BLOCKS * 4];
+} RaucExt4Inode;
+
+static guint16 get_le16(const guint8 *p)
+{
+	guint16 v;
+	memcpy(&v, p, sizeof(v));
+	return GUINT16_FROM_LE(v);
+}
+
+static guint32 get_le32(const guint8 *p)
+{
+	guint32 v;
+	memcpy(&v, p, sizeof(v));
+	return GUINT32_FROM_LE(v);
+}
+
+static gboolean ext4_read(RaucExt4 *fs, guint8 *data, gsize size, guint64 offset, GError **error)
+{
+	if (offset > G_MAXINT64 - size) {
+		g_set_error(error, R_EXT4_ERROR, R_EXT4_ERROR_INVALID,
+				"Offset %"G_GUINT64_FORMAT " out of range", offset);
+		return FALSE;
+	}
+
+	return r_pread_exact(fs->fd, data, size, offset, error);
+}
+
+static gboolean ext4_open(RaucExt4 *fs, const gchar *device, GError **error)
+{
+	GError *ierror = NULL;
+	guint8 sb[EXT4_SUPERBLOCK_SIZE];
+	guint32 log_block_size, first_data_block, rev_level;
+
+	fs->fd = g_open(device, O_RDONLY | O_CLOEXEC);
+	if (fs->fd < 0) {
+		int err = errno;
+		g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(err),
+				"Failed to open %s: %s", device, g_strerror(err));
+		return FALSE;
+	}
+
+	if (!r_pread_exact(fs->fd, sb, sizeof(sb), EXT4_SUPERBLOCK_OFFSET, &ierror)) {
+		g_propagate_prefixed_error(error, ierror, "Failed to read superblock: ");
+		return FALSE;
+	}
+
+	if (get_le16(sb + 0x38) != EXT4_MAGIC) {
+		g_set_error(error, R_EXT4_ERROR, R_EXT4_ERROR_INVALID,
+				"No ext2/3/4 superblock found on %s", device);
+		return FALSE;
+	}
+
+	fs->incompat = get_le32(sb + 0x60);
+	if (fs->incompat & ~EXT4_FEATURE_INCOMPAT_SUPPORTED) {
+		g_set_error(error, R_EXT4_ERROR, R_EXT4_ERROR_UNSUPPORTED,
+				"Unsupported incompatible features 0x%x%s",
+				fs->incompat & ~EXT4_FEATURE_INCOMPAT_SUPPORTED,
+				(fs->incompat & EXT4_FEATURE_INCOMPAT_RECOVER) ? " (journal needs recovery)" : "");
+		return FALSE;
+	}
+
+	log_block_size = get_le32(sb + 0x18);
+	if (log_block_size > 6) {
+		g_set_error(error, R_EXT4_ERROR, R_EXT4_ERROR_INVALID,
+				"Invalid block size shift %u", log_block_size);
+		return FALSE;
+	}
+	fs->block_size = 1024 << log_block_size;
+
+	first_data_block = get_le32(sb + 0x14);
+	fs->inodes_count = get_le32(sb + 0x00);
+	fs->inodes_per_group = get_le32(sb + 0x28);
+	rev_level = get_le32(sb + 0x4C);
+	fs->inode_size = rev_level ? get_le16(sb + 0x58) : EXT4_GOOD_OLD_INODE_SIZE;
+	if (fs->incompat & EXT4_FEATURE_INCOMPAT_64BIT)
+		fs->desc_size = get_le16(sb + 0xFE);
+	else
+		fs->desc_size = 32;
+
+	if (fs->inodes_per_group == 0 ||
+	    fs->inode_size < EXT4_GOOD_OLD_INODE_SIZE || fs->inode_size > fs->block_size ||
+	    fs->desc_size < 32 || fs->desc_size > fs->block_size) {
+		g_set_error(error, R_EXT4_ERROR, R_EXT4_ERROR_INVALID,
+				"Inconsistent superblock on %s", device);
+		return FALSE;
+	}
+
+	/* the group descriptor table starts in the block after the superblock */
+	fs->gdt_offset = ((guint64)first_data_block + 1) * fs->block_size;
+
+	return TRUE;
+}
+
+static void ext4_close(RaucExt4 *fs)
+{
+	if (fs->fd >= 0)
+		g_close(fs->fd, NULL);
+	fs->fd = -1;
+}
+
+static gboolean ext4_read_inode(RaucExt4 *fs, guint32 ino, RaucExt4Inode *inode, GError **error)
+{
+	GError *ierror = NULL;
+	g_autofree guint8 *desc = NULL;
+	g_autofree guint8 *raw = NULL;
+	guint32 group, index;
+	guint64 inode_table;
+
+	if (ino == 0 || ino > fs->inodes_count) {
+		g_set_error(error, R_EXT4_ERROR, R_EXT4_ERROR_INVALID,
+				"Invalid inode number %u", ino);
+		return FALSE;
+	}
+
+	group = (ino - 1) / fs->inodes_per_group;
+	index = (ino - 1) % fs->inodes_per_group;
+
+	desc = g_malloc(fs->desc_size);
+	if (!ext4_read(fs, desc, fs->desc_size, fs->gdt_offset + (guint64)group * fs->desc_size, &ierror)) {
+		g_propagate_prefixed_error(error, ierror, "Failed to read group descriptor %u: ", group);
+		return FALSE;
+	}
+
+	inode_table = get_le32(desc + 0x08);
+	if (fs->desc_size >= 64)
+		inode_table |= (guint64)get_le32(desc + 0x28) << 32;
+
+	raw = g_malloc(fs->inode_size);
+	if (!ext4_read(fs, raw, fs->inode_size,
+			inode_table * fs->block_size + (guint64)index * fs->inode_size, &ierror)) {
+		g_propagate_prefixed_error(error, ierror, "Failed to read inode %u: ", ino);
+		return FALSE;
+	}
+
+	inode->mode = get_le16(raw + 0x00);
+	inode->flags = get_le32(raw + 0x20);
+	inode->size = get_le32(raw + 0x04) | ((guint64)get_le32(raw + 0x6C) << 32);
+	memcpy(inode->block, raw + 0x28, sizeof(inode->block));
+
+	if (inode->flags & (EXT4_INLINE_DATA_FL | EXT4_ENCRYPT_FL)) {
+		g_set_error(error, R_EXT4_ERROR, R_EXT4_ERROR_UNSUPPORTED,
+				"Inode %u uses inline data or encryption", ino);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+/* Maps a logical block of an extent-mapped inode to a physical block (0 for
+ * holes and uninitialized extents). */
+static gboolean ext4_map_extent(RaucExt4 *fs, const RaucExt4Inode *inode, guint32 lblock, guint64 *pblock, GError **error)
+{
+	GError *ierror = NULL;
+	g_autofree guint8 *node = NULL;
+	const guint8 *header = inode->block;
+	gsize node_size = sizeof(inode->block);
+
+	for (guint level = 0; level <= EXT4_EXT_MAX_DEPTH; level++) {
+		guint16 entries = get_le16(header + 2);
+		guint16 depth = get_le16(header + 6);
+		const guint8 *found = NULL;
+
+		if (get_le16(header) != EXT4_EXT_MAGIC || 12 + (gsize)entries * 12 > node_size) {
+			g_set_error(error, R_EXT4_ERROR, R_EXT4_ERROR_INVALID,
+					"Invalid extent header");
+			return FALSE;
+		}
+
+		/* entries are sorted by their first logical block */
+		for (guint16 i = 0; i < entries; i++) {
+			const guint8 *entry = header + 12 + i * 12;
+			if (get_le32(entry) > lblock)
+				break;
+			found = entry;
+		}
+
+		if (depth == 0) {
+			guint32 start, len;
+
+			*pblock = 0;
+			if (!found)
+				return TRUE;
+
+			start = get_le32(found);
+			len = get_le16(found + 4);
+			/* uninitialized extents read as zeroes */
+			if (len > EXT4_EXT_INIT_MAX_LEN)
+				return TRUE;
+			if (lblock - start >= len)
+				return TRUE;
+
+			*pblock = (((guint64)get_le16(found + 6) << 32) | get_le32(found + 8)) + (lblock - start);
+			return TRUE;
+		}
+
+		if (!found) {
+			*pblock = 0;
+			return TRUE;
+		}
+
+		if (!node)
+			node = g_malloc(fs->block_size);
+		if (!ext4_read(fs, node, fs->block_size,
+				(((guint64)get_le16(found + 8) << 32) | get_le32(found + 4)) * fs->block_size, &ierror)) {
+			g_propagate_prefixed_error(error, ierror, "Failed to read extent tree: ");
+			return FALSE;
+		}
+		header = node;
+		node_size = fs->block_size;
+	}
+
+	g_set_error(error, R_EXT4_ERROR, R_EXT4_ERROR_INVALID,
+			"Extent tree too deep");
+	return FALSE;
+}
+
+/* Maps a logical block of a block-mapped (ext2/3 style) inode. Only direct
+ * and single-indirect blocks are supported, which covers small files and
+ * directories. */
+static gboolean ext4_map_indirect(RaucExt4 *fs, const RaucExt4Inode *inode, guint32 lblock, guint64 *pblock, GError **error)
+{
+	GError *ierror = NULL;
+	guint32 per_block = fs->block_size / 4;
+	guint32 ind;
+	guint8 entry[4];
+
+	if (lblock < EXT4_NDIR_BLOCKS) {
+		*pblock = get_le32(inode->block + lblock * 4);
+		return TRUE;
+	}
+
+	lblock -= EXT4_NDIR_BLOCKS;
+	if (lblock >= per_block) {
+		g_set_error(error, R_EXT4_ERROR, R_EXT4_ERROR_UNSUPPORTED,
+				"Double-indirect blocks are not supported");
+		return FALSE;
+	}
+
+	ind = get_le32(inode->block + EXT4_IND_BLOCK * 4);
+	if (ind == 0) {
+		*pblock = 0;
+		return TRUE;
+	}
+
+	if (!ext4_read(fs, entry, sizeof(entry), (guint64)ind * fs->block_size + lblock * 4, &ierror)) {
+		g_propagate_prefixed_error(error, ierror, "Failed to read indirect block: ");
+		return FALSE;
+	}
+	*pblock = get_le32(entry);
+
+	return TRUE;
+}
+
+static gboolean ext4_read_block(RaucExt4 *fs, const RaucExt4Inode *inode, guint32 lblock, guint8 *data, GError **error)
+{
+	GError *ierror = NULL;
+	guint64 pblock = 0;
+	gboolean res;
+
+	if (inode->flags & EXT4_EXTENTS_FL)
+		res = ext4_map_extent(fs, inode, lblock, &pblock, &ierror);
+	else
+		res = ext4_map_indirect(fs, inode, lblock, &pblock, &ierror);
+	if (!res) {
+		g_propagate_error(error, ierror);
+		return FALSE;
+	}
+
+	if (pblock == 0) {
+		memset(data, 0, fs->block_size);
+		return TRUE;
+	}
+
+	return ext4_read(fs, data, fs->block_size, pblock * fs->block_size, error);
+}
+
+static gboolean ext4_lookup(RaucExt4 *fs, const RaucExt4Inode *dir, const gchar *name, guint32 *ino, GError **error)
+{
+	GError *ierror = NULL;
+	g_autofree guint8 *block = NULL;
+	gsize name_len = strlen(name);
+	guint64 blocks;
+
+	if ((dir->mode & EXT4_S_IFMT) != EXT4_S_IFDIR) {
+		g_set_error(error, R_EXT4_ERROR, R_EXT4_ERROR_INVALID,
+				"Root inode is not a directory");
+		return FALSE;
+	}
+
+	block = g_malloc(fs->block_size);
+	blocks = (dir->size + fs->block_size - 1) / fs->block_size;
+
+	/* A linear scan also works for hashed directories, as the htree nodes
+	 * are hidden in entries with inode 0. */
+	for (guint64 b = 0; b < blocks; b++) {
+		gsize pos = 0;
+
+		if (!ext4_read_block(fs, dir, b, block, &ierror)) {
+			g_propagate_error(error, ierror);
+			return FALSE;
+		}
+
+		while (pos + 8 <= fs->block_size) {
+			guint32 entry_ino = get_le32(block + pos);
+			guint16 rec_len = get_le16(block + pos + 4);
+			guint8 entry_name_len = block[pos + 6];
+
+			if (rec_len < 8 || pos + rec_len > fs->block_size || 8 + (gsize)entry_name_len > rec_len) {
+				g_set_error(error, R_EXT4_ERROR, R_EXT4_ERROR_INVALID,
+						"Corrupt directory entry in block %"G_GUINT64_FORMAT, b);
+				return FALSE;
+			}
+
+			if (entry_ino != 0 && entry_name_len == name_len &&
+			    memcmp(block + pos + 8, name, name_len) == 0) {
+				*ino = entry_ino;
+				return TRUE;
+			}
+
+			pos += rec_len;
+		}
+	}
+
+	g_set_error(error, R_EXT4_ERROR, R_EXT4_ERROR_NOT_FOUND,
+			"File '%s' not found", name);
+	return FALSE;
+}
+
+GBytes *r_ext4_read_root_file(const gchar *device, const gchar *name, gsize max_size, GError **error)
+{
+	GError *ierror = NULL;
+	RaucExt4 fs = {.fd = -1};
+	RaucExt4Inode root = {0};
+	RaucExt4Inode file = {0};
+	g_autofree guint8 *block = NULL;
+	g_autofree guint8 *data = NULL;
+	guint32 ino = 0;
+	GBytes *res = NULL;
+
+	g_return_val_if_fail(device, NULL);
+	g_return_val_if_fail(name, NULL);
+	g_return_val_if_fail(error == NULL || *error == NULL, NULL);
+
+	if (!ext4_open(&fs, device, &ierror)) {
+		g_propagate_error(error, ierror);
+		goto out;
+	}
+
+	if (!ext4_read_inode(&fs, EXT4_ROOT_INO, &root, &ierror)) {
+		g_propagate_error(error, ierror);
+		goto out;
+	}
+
+	if (!ext4_lookup(&fs, &root, name, &ino, &ierror)) {
+		g_propagate_error(error, ierror);
+		goto out;
+	}
+
+	if (!ext4_read_inode(&fs, ino, &file, &ierror)) {
+		g_propagate_error(error, ierror);
+		goto out;
+	}
+
+	if ((file.mode & EXT4_S_IFMT) != EXT4_S_IFREG) {
+		g_set_error(error, R_EXT4_ERROR, R_EXT4_ERROR_UNSUPPORTED,
+				"'%s' is not a regular file", name);
+		goto out;
+	}
+
+	if (file.size > max_size) {
+		g_set_error(error, R_EXT4_ERROR, R_EXT4_ERROR_FAILED,
+				"'%s' is too large (%"G_GUINT64_FORMAT " bytes)", name, file.size);
+		goto out;
+	}
+
+	block = g_malloc(fs.block_size);
+	data = g_malloc(file.size + 1);
+	for (guint64 pos = 0; pos < file.size; pos += fs.block_size) {
+		gsize len = MIN(fs.block_size, file.size - pos);
+
+		if (!ext4_read_block(&fs, &file, pos / fs.block_size, block, &ierror)) {
+			g_propagate_prefixed_error(error, ierror, "Failed to read '%s': ", name);
+			goto out;
+		}
+		memcpy(data + pos, block, len);
+	}
+
+	res = g_bytes_new_take(g_steal_pointer(&data), file.size);
+
+out:
+	ext4_close(&fs);
+	return res;
+}
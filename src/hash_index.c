@@ -12,11 +12,68 @@
 
 #define SHA256_LEN 32
 
+/* Memory allocated by all open hash indices. If a limit is configured, the
+ * compact mode is used. */
+static guint64 hash_index_memory = 0;
+G_LOCK_DEFINE_STATIC(hash_index_memory);
+
 GQuark r_hash_index_error_quark(void)
 {
 	return g_quark_from_static_string("r-hash-index-error-quark");
 }
 
+static guint64 get_memory_limit(void)
+{
+	const RaucConfig *config = r_context()->config;
+
+	return config ? config->hash_index_memory_limit : 0;
+}
+
+/**
+ * Accounts 'size' bytes to the hash index before allocating them.
+ *
+ * Fails if this would exceed the configured limit.
+ */
+static gboolean reserve_memory(RaucHashIndex *idx, guint64 size, GError **error)
+{
+	guint64 limit = get_memory_limit();
+
+	g_return_val_if_fail(idx, FALSE);
+	g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
+
+	G_LOCK(hash_index_memory);
+	if (limit && hash_index_memory + size > limit) {
+		g_autofree gchar *used_str = g_format_size_full(hash_index_memory, G_FORMAT_SIZE_IEC_UNITS);
+		g_autofree gchar *size_str = g_format_size_full(size, G_FORMAT_SIZE_IEC_UNITS);
+		g_autofree gchar *limit_str = g_format_size_full(limit, G_FORMAT_SIZE_IEC_UNITS);
+
+		G_UNLOCK(hash_index_memory);
+		g_set_error(error,
+				R_HASH_INDEX_ERROR,
+				R_HASH_INDEX_ERROR_MEMORY,
+				"hash index for %s needs %s, but %s of the limit of %s are already used",
+				idx->label, size_str, used_str, limit_str);
+		return FALSE;
+	}
+	hash_index_memory += size;
+	G_UNLOCK(hash_index_memory);
+
+	idx->memory += size;
+
+	return TRUE;
+}
+
+guint64 r_hash_index_get_memory(void)
+{
+	guint64 memory;
+
+	G_LOCK(hash_index_memory);
+	memory = hash_index_memory;
+	G_UNLOCK(hash_index_memory);
+
+	return memory;
+}
+
 /**
  * Hash a single chunk using OpenSSL's SHA256.
  *
@@ -48,29 +105,42 @@ static void hash_chunk(RaucHashIndexChunk *chunk)
 	EVP_MD_CTX_free(mdctx);
 }
 
+static guint32 hash_prefix(const guint8 *hash)
+{
+	guint32 prefix;
+
+	memcpy(&prefix, hash, sizeof(prefix));
+
+	return prefix;
+}
+
 /**
- * Build array of chunk hashes using SHA256.
+ * Hash 'count' chunks using SHA256.
+ *
+ * The hashes are stored in 'hashes' and/or as (unsorted) compact entries in
+ * 'entries', if not NULL.
  */
-static GBytes *hash_file(int data_fd, guint32 count, GError **error)
+static gboolean hash_range(int data_fd, off_t data_offset, guint32 count, guint8 *hashes, RaucHashIndexEntry *entries, GError **error)
 {
 	GError *ierror = NULL;
-	g_autoptr(GByteArray) hashes = g_byte_array_set_size(g_byte_array_new(), ((guint)count)*SHA256_LEN);
 	g_autofree RaucHashIndexChunk *chunk = g_new0(RaucHashIndexChunk, 1);
 
-	g_return_val_if_fail(data_fd >= 0, NULL);
-	g_return_val_if_fail(count > 0, NULL);
+	g_return_val_if_fail(data_fd >= 0, FALSE);
+	g_return_val_if_fail(count > 0, FALSE);
 	g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
 
-	if (lseek(data_fd, 0, SEEK_SET) != 0) {
+	if (lseek(data_fd, data_offset, SEEK_SET) != data_offset) {
 		int err = errno;
 		g_set_error(error,
 				G_FILE_ERROR,
 				g_file_error_from_errno(err),
-				"failed to seek to position 0: %s", g_strerror(err));
-		return NULL;
+				"failed to seek to position %"G_GINT64_FORMAT ": %s", (gint64)data_offset, g_strerror(err));
+		return FALSE;
 	}
 
 	for (guint32 i = 0; i < count; i++) {
+		const guint8 *hash;
+
 		if (!r_read_exact(data_fd, chunk->data, sizeof(chunk->data), &ierror)) {
 			if (ierror) {
 				g_propagate_error(error, ierror);
@@ -80,10 +150,22 @@ static GBytes *hash_file(int data_fd, guint32 count, GError **error)
 						R_HASH_INDEX_ERROR_SIZE,
 						"image/partition ended unexpectedly");
 			}
-			return NULL;
+			return FALSE;
+		}
+		/* zero chunks are common in filesystem images, so avoid hashing them */
+		if (r_buffer_is_zero(chunk->data, sizeof(chunk->data))) {
+			hash = (const guint8 *)R_HASH_INDEX_ZERO_CHUNK;
+		} else {
+			hash_chunk(chunk);
+			hash = chunk->hash;
+		}
+
+		if (hashes)
+			memcpy(&hashes[(gsize)i*SHA256_LEN], hash, SHA256_LEN);
+		if (entries) {
+			entries[i].prefix = hash_prefix(hash);
+			entries[i].chunk = i;
 		}
-		hash_chunk(chunk);
-		memcpy(&hashes->data[i*SHA256_LEN], chunk->hash, SHA256_LEN);
 
 		/* Split the overall hash index calculation into (R_HASH_INDEX_GEN_PROGRESS_SPAN - 1)
 		 * segments and increment the progress by one for each. */
@@ -92,6 +174,19 @@ static GBytes *hash_file(int data_fd, guint32 count, GError **error)
 				r_context_inc_step_percentage("copy_image");
 	}
 
+	return TRUE;
+}
+
+/**
+ * Build array of chunk hashes using SHA256.
+ */
+static GBytes *hash_file(int data_fd, off_t data_offset, guint32 count, GError **error)
+{
+	g_autoptr(GByteArray) hashes = g_byte_array_set_size(g_byte_array_new(), ((guint)count)*SHA256_LEN);
+
+	if (!hash_range(data_fd, data_offset, count, hashes->data, NULL, error))
+		return NULL;
+
 	return g_byte_array_free_to_bytes(g_steal_pointer(&hashes));
 }
 
@@ -155,10 +250,67 @@ static guint32 *build_lookup(GBytes *hashes)
 }
 
 /**
- * Calculate chunk count required for file.
+ * Compare two entries of a compact lookup table.
+ *
+ * Entries with the same prefix are sorted by chunk number (as for the full
+ * lookup table).
+ */
+static gint entry_compare_sort(gconstpointer a, gconstpointer b)
+{
+	const RaucHashIndexEntry *_a = a;
+	const RaucHashIndexEntry *_b = b;
+	gint res;
+
+	res = intcmp(_a->prefix, _b->prefix);
+	if (res)
+		return res;
+
+	return intcmp(_a->chunk, _b->chunk);
+}
+
+/**
+ * Calculate chunk count required for a data range of the given size.
  *
  * The chunk size is hard-coded to 4k.
  *
+ * @param size size of the data in bytes
+ * @param error return location for a GError, or NULL
+ *
+ * @return chunk count or 0 on error
+ */
+static guint32 get_chunk_count_for_size(off_t size, GError **error)
+{
+	g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
+
+	/* Verify that the data file has a reasonable size. */
+	if (size == 0) {
+		g_set_error(error,
+				R_HASH_INDEX_ERROR,
+				R_HASH_INDEX_ERROR_SIZE,
+				"image/partition is empty");
+		return 0;
+	} else if ((size / 4096) > (off_t)G_MAXUINT32) {
+		g_set_error(error,
+				R_HASH_INDEX_ERROR,
+				R_HASH_INDEX_ERROR_SIZE,
+				"image/partition size (%"G_GINT64_FORMAT ") is too large",
+				(gint64)size);
+		return 0;
+	} else if (size % 4096) {
+		g_set_error(error,
+				R_HASH_INDEX_ERROR,
+				R_HASH_INDEX_ERROR_SIZE,
+				"image/partition size (%"G_GINT64_FORMAT ") is not a multiple of 4096 bytes",
+				(gint64)size);
+		return 0;
+	}
+
+	return size / 4096;
+}
+
+/**
+ * Calculate chunk count required for file.
+ *
  * @param data_fd open file descriptor of file to get chunk count for
  * @param error return location for a GError, or NULL
  *
@@ -192,64 +344,85 @@ static guint32 get_chunk_count(int data_fd, GError **error)
 		return 0;
 	}
 
-	/* Verify that the data file has a reasonable size. */
-	if (size == 0) {
-		g_set_error(error,
-				R_HASH_INDEX_ERROR,
-				R_HASH_INDEX_ERROR_SIZE,
-				"image/partition is empty");
-		return 0;
-	} else if ((size / 4096) > (off_t)G_MAXUINT32) {
-		g_set_error(error,
-				R_HASH_INDEX_ERROR,
-				R_HASH_INDEX_ERROR_SIZE,
-				"image/partition size (%"G_GINT64_FORMAT ") is too large",
-				(gint64)size);
-		return 0;
-	} else if (size % 4096) {
-		g_set_error(error,
-				R_HASH_INDEX_ERROR,
-				R_HASH_INDEX_ERROR_SIZE,
-				"image/partition size (%"G_GINT64_FORMAT ") is not a multiple of 4096 bytes",
-				(gint64)size);
-		return 0;
-	}
-
-	return size / 4096;
+	return get_chunk_count_for_size(size, error);
 }
 
 /**
  * Build the lookup table and initialize the hash index with default values.
+ *
+ * In compact mode (if a memory limit is configured), the lookup table
+ * contains only a prefix of each hash, so it needs less memory and the
+ * binary search does not need to access the hashes.
  */
-static void hash_index_prepare(RaucHashIndex *idx)
+static gboolean hash_index_prepare(RaucHashIndex *idx, GError **error)
 {
-	/* prepare sorted lookup array */
-	idx->lookup = build_lookup(idx->hashes);
+	gint64 trace_begin = r_trace_begin();
+	g_autofree gchar *memory_str = NULL;
+
+	g_return_val_if_fail(idx, FALSE);
+	g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
+
+	if (get_memory_limit()) {
+		/* the entries might have been filled while hashing already */
+		if (!idx->entries) {
+			const guint8 *hashes = g_bytes_get_data(idx->hashes, NULL);
+
+			if (!reserve_memory(idx, (guint64)idx->count * sizeof(RaucHashIndexEntry), error))
+				return FALSE;
+			idx->entries = g_new(RaucHashIndexEntry, idx->count);
+			for (guint32 i = 0; i < idx->count; i++) {
+				idx->entries[i].prefix = hash_prefix(&hashes[(gsize)i * SHA256_LEN]);
+				idx->entries[i].chunk = i;
+			}
+		}
+		qsort(idx->entries, idx->count, sizeof(RaucHashIndexEntry), entry_compare_sort);
+	} else {
+		guint64 count = g_bytes_get_size(idx->hashes) / SHA256_LEN;
+
+		if (!reserve_memory(idx, count * sizeof(guint32), error))
+			return FALSE;
+		/* prepare sorted lookup array */
+		idx->lookup = build_lookup(idx->hashes);
+	}
+
+	if (trace_begin) {
+		g_autofree gchar *name = g_strdup_printf("sort %s", idx->label);
+		r_trace_end(R_TRACE_CAT_HASH_INDEX, name, trace_begin, (guint64)idx->count * SHA256_LEN);
+	}
+
+	memory_str = g_format_size_full(idx->memory, G_FORMAT_SIZE_IEC_UNITS);
+	g_info("hash index for %s uses %s of memory%s", idx->label, memory_str, idx->entries ? " (compact)" : "");
 
 	/* everything is valid by default */
 	idx->invalid_below = 0;
 	idx->invalid_from = G_MAXUINT32;
 
 	idx->match_stats = r_stats_new(idx->label);
+
+	return TRUE;
 }
 
-RaucHashIndex *r_hash_index_open(const gchar *label, int data_fd, const gchar *hashes_filename, GError **error)
+/**
+ * Creates a hash index for 'count' chunks starting at 'data_offset' of the
+ * given file descriptor.
+ *
+ * If 'need_hashes' is FALSE and the hashes are calculated in compact mode,
+ * only the compact lookup table is kept.
+ */
+static RaucHashIndex *hash_index_open_range(const gchar *label, int data_fd, off_t data_offset, guint32 count, const gchar *hashes_filename, gboolean need_hashes, GError **error)
 {
 	GError *ierror = NULL;
 	g_autoptr(RaucHashIndex) idx = g_new0(RaucHashIndex, 1);
 
 	g_return_val_if_fail(label, NULL);
 	g_return_val_if_fail(data_fd >= 0, NULL);
+	g_return_val_if_fail(count > 0, NULL);
 	g_return_val_if_fail(error == NULL || *error == NULL, NULL);
 
 	idx->label = g_strdup(label);
 	idx->data_fd = dup(data_fd);
-
-	idx->count = get_chunk_count(data_fd, &ierror);
-	if (!idx->count) {
-		g_propagate_error(error, ierror);
-		return NULL;
-	}
+	idx->data_offset = data_offset;
+	idx->count = count;
 
 	/* load or calculate chunk hashes */
 	if (hashes_filename && g_file_test(hashes_filename, G_FILE_TEST_IS_REGULAR)) {
@@ -279,19 +452,63 @@ RaucHashIndex *r_hash_index_open(const gchar *label, int data_fd, const gchar *h
 	}
 
 	if (!idx->hashes) {
+		gint64 trace_begin = r_trace_begin();
+
 		g_message("Building new hash index for %s with %"G_GUINT32_FORMAT " chunks", label, idx->count);
-		idx->hashes = hash_file(data_fd, idx->count, &ierror);
-		if (!idx->hashes) {
-			g_propagate_error(error, ierror);
-			return NULL;
+		if (get_memory_limit() && !need_hashes) {
+			if (!reserve_memory(idx, (guint64)idx->count * sizeof(RaucHashIndexEntry), &ierror)) {
+				g_propagate_error(error, ierror);
+				return NULL;
+			}
+			idx->entries = g_new(RaucHashIndexEntry, idx->count);
+			if (!hash_range(data_fd, data_offset, idx->count, NULL, idx->entries, &ierror)) {
+				g_propagate_error(error, ierror);
+				return NULL;
+			}
+		} else {
+			if (!reserve_memory(idx, (guint64)idx->count * SHA256_LEN, &ierror)) {
+				g_propagate_error(error, ierror);
+				return NULL;
+			}
+			idx->hashes = hash_file(data_fd, data_offset, idx->count, &ierror);
+			if (!idx->hashes) {
+				g_propagate_error(error, ierror);
+				return NULL;
+			}
+		}
+
+		if (trace_begin) {
+			g_autofree gchar *name = g_strdup_printf("build %s", label);
+			r_trace_end(R_TRACE_CAT_HASH_INDEX, name, trace_begin, (guint64)idx->count * 4096);
 		}
 	}
 
-	hash_index_prepare(idx);
+	if (!hash_index_prepare(idx, &ierror)) {
+		g_propagate_error(error, ierror);
+		return NULL;
+	}
 
 	return g_steal_pointer(&idx);
 }
 
+RaucHashIndex *r_hash_index_open(const gchar *label, int data_fd, const gchar *hashes_filename, GError **error)
+{
+	GError *ierror = NULL;
+	guint32 count;
+
+	g_return_val_if_fail(label, NULL);
+	g_return_val_if_fail(data_fd >= 0, NULL);
+	g_return_val_if_fail(error == NULL || *error == NULL, NULL);
+
+	count = get_chunk_count(data_fd, &ierror);
+	if (!count) {
+		g_propagate_error(error, ierror);
+		return NULL;
+	}
+
+	return hash_index_open_range(label, data_fd, 0, count, hashes_filename, TRUE, error);
+}
+
 RaucHashIndex *r_hash_index_reuse(const gchar *label, const RaucHashIndex *idx, int new_data_fd, GError **error)
 {
 	GError *ierror = NULL;
@@ -299,6 +516,7 @@ RaucHashIndex *r_hash_index_reuse(const gchar *label, const RaucHashIndex *idx,
 
 	g_return_val_if_fail(label, NULL);
 	g_return_val_if_fail(idx, FALSE);
+	g_return_val_if_fail(idx->hashes, FALSE);
 	g_return_val_if_fail(new_data_fd >= 0, NULL);
 	g_return_val_if_fail(error == NULL || *error == NULL, NULL);
 
@@ -317,7 +535,10 @@ RaucHashIndex *r_hash_index_reuse(const gchar *label, const RaucHashIndex *idx,
 	/* use a subsection of the original hashes */
 	new_idx->hashes = g_bytes_new_from_bytes(idx->hashes, 0, new_idx->count * SHA256_LEN);
 
-	hash_index_prepare(new_idx);
+	if (!hash_index_prepare(new_idx, &ierror)) {
+		g_propagate_error(error, ierror);
+		return NULL;
+	}
 
 	return g_steal_pointer(&new_idx);
 }
@@ -329,6 +550,7 @@ RaucHashIndex *r_hash_index_open_slot(const gchar *label, const RaucSlot *slot,
 	g_autofree gchar *dir = NULL;
 	g_autofree gchar *index_filename = NULL;
 	g_auto(filedesc) data_fd = -1;
+	guint32 count;
 
 	g_return_val_if_fail(label, NULL);
 	g_return_val_if_fail(slot, NULL);
@@ -352,8 +574,16 @@ RaucHashIndex *r_hash_index_open_slot(const gchar *label, const RaucSlot *slot,
 
 	index_filename = g_build_filename(dir, "block-hash-index", NULL);
 
-	/* r_hash_index_open handles missing index file */
-	idx = r_hash_index_open(label, data_fd, index_filename, &ierror);
+	count = get_chunk_count(data_fd, &ierror);
+	if (!count) {
+		g_propagate_error(error, ierror);
+		return NULL;
+	}
+
+	/* Missing index files are handled by building a new index. The hashes
+	 * of the slot contents are only used for lookups, so the compact mode
+	 * does not need to keep them. */
+	idx = hash_index_open_range(label, data_fd, 0, count, index_filename, FALSE, &ierror);
 	if (!idx) {
 		g_propagate_error(error, ierror);
 		return NULL;
@@ -375,6 +605,41 @@ RaucHashIndex *r_hash_index_open_image(const gchar *label, const RaucImage *imag
 	g_return_val_if_fail(image, NULL);
 	g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
 
+	index_filename = g_strdup_printf("%s.block-hash-index", image->filename);
+
+	/* Uncompressed images are read directly from the bundle payload, which
+	 * avoids going through the squashfs for each chunk. */
+	if (image->payload_device && image->payload_offset) {
+		guint32 count;
+
+		data_fd = g_open(image->payload_device, O_RDONLY | O_CLOEXEC);
+		if (data_fd < 0) {
+			int err = errno;
+			g_set_error(error,
+					G_FILE_ERROR,
+					g_file_error_from_errno(err),
+					"Failed to open payload device %s: %s", image->payload_device, g_strerror(err));
+			return NULL;
+		}
+
+		count = get_chunk_count_for_size(image->checksum.size, &ierror);
+		if (!count) {
+			g_propagate_error(error, ierror);
+			return NULL;
+		}
+
+		idx = hash_index_open_range(label, data_fd, image->payload_offset, count, index_filename, TRUE, &ierror);
+		if (!idx) {
+			g_propagate_error(error, ierror);
+			return NULL;
+		}
+
+		g_debug("opened hash index for image %s at offset %"G_GUINT64_FORMAT " of %s with index %s",
+				image->filename, image->payload_offset, image->payload_device, index_filename);
+
+		return g_steal_pointer(&idx);
+	}
+
 	data_fd = g_open(image->filename, O_RDONLY | O_CLOEXEC);
 	if (data_fd < 0) {
 		int err = errno;
@@ -385,8 +650,6 @@ RaucHashIndex *r_hash_index_open_image(const gchar *label, const RaucImage *imag
 		return NULL;
 	}
 
-	index_filename = g_strdup_printf("%s.block-hash-index", image->filename);
-
 	idx = r_hash_index_open(label, data_fd, index_filename, &ierror);
 	if (!idx) {
 		g_propagate_error(error, ierror);
@@ -401,6 +664,7 @@ RaucHashIndex *r_hash_index_open_image(const gchar *label, const RaucImage *imag
 gboolean r_hash_index_export(const RaucHashIndex *idx, const gchar *hashes_filename, GError **error)
 {
 	g_return_val_if_fail(idx, FALSE);
+	g_return_val_if_fail(idx->hashes, FALSE);
 	g_return_val_if_fail(hashes_filename, FALSE);
 	g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
 
@@ -414,6 +678,7 @@ gboolean r_hash_index_export_slot(const RaucHashIndex *idx, const RaucSlot *slot
 	g_autofree gchar *index_filename = NULL;
 
 	g_return_val_if_fail(idx, FALSE);
+	g_return_val_if_fail(idx->hashes, FALSE);
 	g_return_val_if_fail(slot, FALSE);
 	g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
 
@@ -428,6 +693,89 @@ gboolean r_hash_index_export_slot(const RaucHashIndex *idx, const RaucSlot *slot
 	return write_file(index_filename, idx->hashes, error);
 }
 
+static gboolean read_chunk(const RaucHashIndex *idx, guint32 number, RaucHashIndexChunk *chunk, GError **error)
+{
+	GError *ierror = NULL;
+	off_t offset = idx->data_offset + ((off_t)number) * sizeof(chunk->data);
+
+	if (!r_pread_exact(idx->data_fd, chunk->data, sizeof(chunk->data), offset, &ierror)) {
+		if (ierror) {
+			g_propagate_error(error, ierror);
+		} else {
+			g_set_error(error,
+					R_HASH_INDEX_ERROR,
+					R_HASH_INDEX_ERROR_SIZE,
+					"image/partition ended unexpectedly");
+		}
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+/**
+ * Search for hash using the compact lookup table.
+ *
+ * As the entries contain only a prefix of the hash, each candidate is
+ * verified using the full hash (if available) and by hashing the data read.
+ * Without the full hashes, a mismatch can also be caused by a different chunk
+ * with the same prefix, so the search continues with the next candidate.
+ */
+static gboolean get_chunk_compact(const RaucHashIndex *idx, const guint8 *hash, RaucHashIndexChunk *chunk, GError **error)
+{
+	const guint8(*hashes)[SHA256_LEN] = idx->hashes ? g_bytes_get_data(idx->hashes, NULL) : NULL;
+	guint32 prefix = hash_prefix(hash);
+	guint32 left = 0, right = idx->count;
+
+	/* find the first entry with this prefix */
+	while (left < right) {
+		guint32 middle = left + (right - left) / 2;
+
+		if (idx->entries[middle].prefix < prefix)
+			left = middle + 1;
+		else
+			right = middle;
+	}
+
+	/* entries with the same prefix are sorted by chunk number */
+	for (guint32 i = left; i < idx->count && idx->entries[i].prefix == prefix; i++) {
+		guint32 curr = idx->entries[i].chunk;
+
+		if (curr >= idx->invalid_from)
+			break; /* only invalid chunks remaining */
+		if (curr < idx->invalid_below)
+			continue;
+
+		if (hashes && memcmp(hashes[curr], hash, SHA256_LEN) != 0)
+			continue; /* different hash with the same prefix */
+
+		if (!read_chunk(idx, curr, chunk, error))
+			return FALSE;
+
+		if (hashes && idx->skip_hash_check)
+			return TRUE;
+
+		hash_chunk(chunk);
+		if (memcmp(chunk->hash, hash, SHA256_LEN) == 0)
+			return TRUE;
+
+		if (hashes) {
+			g_set_error(error,
+					R_HASH_INDEX_ERROR,
+					R_HASH_INDEX_ERROR_MODIFIED,
+					"data chunk hash differs from index");
+			return FALSE;
+		}
+	}
+
+	g_set_error(error,
+			R_HASH_INDEX_ERROR,
+			R_HASH_INDEX_ERROR_NOT_FOUND,
+			"hash not found in valid region [%"G_GUINT32_FORMAT "..%"G_GUINT32_FORMAT ") of index",
+			idx->invalid_below, idx->invalid_from);
+	return FALSE;
+}
+
 gboolean r_hash_index_get_chunk(const RaucHashIndex *idx, const guint8 *hash, RaucHashIndexChunk *chunk, GError **error)
 {
 	GError *ierror = NULL;
@@ -435,15 +783,19 @@ gboolean r_hash_index_get_chunk(const RaucHashIndex *idx, const guint8 *hash, Ra
 	const guint8(*hashes)[SHA256_LEN];
 	guint32 left, middle, right;
 	gboolean found = FALSE;
-	off_t offset;
 
 	g_return_val_if_fail(idx, FALSE);
-	g_return_val_if_fail(idx->hashes, FALSE);
+	g_return_val_if_fail(idx->hashes || idx->entries, FALSE);
 	g_return_val_if_fail(idx->count > 0, FALSE);
 	g_return_val_if_fail(hash, FALSE);
 	g_return_val_if_fail(chunk, FALSE);
 	g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
 
+	if (idx->entries) {
+		ret = get_chunk_compact(idx, hash, chunk, error);
+		goto out;
+	}
+
 	hashes = g_bytes_get_data(idx->hashes, NULL);
 
 	/* use a binary search over the sorted chunk hash indices */
@@ -523,16 +875,8 @@ gboolean r_hash_index_get_chunk(const RaucHashIndex *idx, const guint8 *hash, Ra
 		goto out;
 	}
 
-	offset = ((off_t)(idx->lookup[middle])) * sizeof(chunk->data);
-	if (!r_pread_exact(idx->data_fd, chunk->data, sizeof(chunk->data), offset, &ierror)) {
-		if (ierror) {
-			g_propagate_error(error, ierror);
-		} else {
-			g_set_error(error,
-					R_HASH_INDEX_ERROR,
-					R_HASH_INDEX_ERROR_SIZE,
-					"image/partition ended unexpectedly");
-		}
+	if (!read_chunk(idx, idx->lookup[middle], chunk, &ierror)) {
+		g_propagate_error(error, ierror);
 		ret = FALSE;
 		goto out;
 	}
@@ -568,6 +912,11 @@ void r_hash_index_free(RaucHashIndex *idx)
 
 	g_bytes_unref(idx->hashes);
 	g_free(idx->lookup);
+	g_free(idx->entries);
+
+	G_LOCK(hash_index_memory);
+	hash_index_memory -= idx->memory;
+	G_UNLOCK(hash_index_memory);
 
 	r_stats_free(idx->match_stats);
 
@@ -0,0 +1,126 @@
+#include <sys/stat.h>
+
+#include "inspect_cache.h"
+#include "signature.h"
+
+static GHashTable *inspect_cache = NULL;
+static guint64 inspect_cache_hits = 0;
+static guint64 inspect_cache_misses = 0;
+
+static void inspect_cache_entry_free(RaucInspectCacheEntry *entry)
+{
+	r_inspect_cache_identity_clear(entry);
+	g_free(entry);
+}
+
+gboolean r_inspect_cache_identity(const gchar *bundle, RaucInspectCacheEntry *identity)
+{
+	g_autofree gchar *scheme = NULL;
+	struct stat st;
+
+	g_return_val_if_fail(bundle, FALSE);
+	g_return_val_if_fail(identity, FALSE);
+
+	scheme = g_uri_parse_scheme(bundle);
+	if (scheme)
+		return FALSE;
+
+	if (stat(bundle, &st) != 0 || !S_ISREG(st.st_mode))
+		return FALSE;
+
+	/* the ctime also changes if the content or ownership is modified with
+	 * the mtime preserved */
+	identity->dev = st.st_dev;
+	identity->ino = st.st_ino;
+	identity->size = st.st_size;
+	identity->mtime_nsec = (gint64)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+	identity->ctime_nsec = (gint64)st.st_ctim.tv_sec * 1000000000 + st.st_ctim.tv_nsec;
+	identity->keyring_stamp = r_signature_get_keyring_stamp();
+
+	return TRUE;
+}
+
+void r_inspect_cache_identity_clear(RaucInspectCacheEntry *identity)
+{
+	g_return_if_fail(identity);
+
+	g_clear_pointer(&identity->keyring_stamp, g_free);
+	g_clear_pointer(&identity->compatible, g_free);
+	g_clear_pointer(&identity->version, g_free);
+	g_clear_pointer(&identity->info, g_variant_unref);
+}
+
+const RaucInspectCacheEntry* r_inspect_cache_lookup(const gchar *bundle)
+{
+	RaucInspectCacheEntry current = {0};
+	RaucInspectCacheEntry *entry = NULL;
+
+	g_return_val_if_fail(bundle, NULL);
+
+	if (!r_inspect_cache_identity(bundle, &current))
+		return NULL;
+
+	if (inspect_cache)
+		entry = g_hash_table_lookup(inspect_cache, bundle);
+
+	if (entry && (current.dev != entry->dev || current.ino != entry->ino ||
+	              current.size != entry->size ||
+	              current.mtime_nsec != entry->mtime_nsec ||
+	              current.ctime_nsec != entry->ctime_nsec ||
+	              g_strcmp0(current.keyring_stamp, entry->keyring_stamp) != 0 ||
+	              g_get_monotonic_time() - entry->created > R_INSPECT_CACHE_MAX_AGE)) {
+		g_hash_table_remove(inspect_cache, bundle);
+		entry = NULL;
+	}
+
+	r_inspect_cache_identity_clear(&current);
+
+	if (entry)
+		inspect_cache_hits++;
+	else
+		inspect_cache_misses++;
+
+	return entry;
+}
+
+void r_inspect_cache_insert(const gchar *bundle, RaucInspectCacheEntry *identity, RaucManifest *manifest)
+{
+	RaucInspectCacheEntry *entry;
+
+	g_return_if_fail(bundle);
+	g_return_if_fail(identity);
+	g_return_if_fail(manifest);
+
+	if (!inspect_cache)
+		inspect_cache = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+				(GDestroyNotify) inspect_cache_entry_free);
+
+	if (g_hash_table_size(inspect_cache) >= R_INSPECT_CACHE_MAX_ENTRIES)
+		g_hash_table_remove_all(inspect_cache);
+
+	entry = g_new0(RaucInspectCacheEntry, 1);
+	*entry = *identity;
+	identity->keyring_stamp = NULL;
+	entry->created = g_get_monotonic_time();
+	entry->compatible = g_strdup(manifest->update_compatible);
+	entry->version = g_strdup(manifest->update_version);
+	entry->info = g_variant_ref_sink(r_manifest_to_dict(manifest));
+
+	g_hash_table_insert(inspect_cache, g_strdup(bundle), entry);
+}
+
+void r_inspect_cache_get_counters(guint64 *hits, guint64 *misses)
+{
+	g_return_if_fail(hits);
+	g_return_if_fail(misses);
+
+	*hits = inspect_cache_hits;
+	*misses = inspect_cache_misses;
+}
+
+void r_inspect_cache_clear(void)
+{
+	g_clear_pointer(&inspect_cache, g_hash_table_destroy);
+	inspect_cache_hits = 0;
+	inspect_cache_misses = 0;
+}
@@ -20,12 +20,15 @@
 #include "install.h"
 #include "manifest.h"
 #include "mark.h"
+#include "metrics.h"
 #include "mount.h"
 #include "service.h"
 #include "shell.h"
 #include "signature.h"
 #include "slot.h"
+#include "stats.h"
 #include "status_file.h"
+#include "trace.h"
 #include "update_handler.h"
 #include "utils.h"
 
@@ -994,6 +997,7 @@ static gboolean launch_and_wait_custom_handler(RaucInstallArgs *args, gchar* bun
 	}
 	g_ptr_array_add(handler_args, NULL);
 
+	r_metrics_mark_untracked();
 	res = launch_and_wait_handler(args, handler_name, (gchar**) handler_args->pdata, env, error);
 
 out:
@@ -1124,6 +1128,7 @@ static gboolean handle_slot_install_plan(const RaucManifest *manifest, const RIm
 {
 	GError *ierror = NULL;
 	RaucSlotStatus *slot_state = NULL;
+	gboolean skip = FALSE;
 
 	install_args_update(args, "Checking slot %s", plan->target_slot->name);
 
@@ -1147,6 +1152,15 @@ static gboolean handle_slot_install_plan(const RaucManifest *manifest, const RIm
 
 	/* if explicitly enabled, skip update of up-to-date slots */
 	if (!plan->target_slot->install_same && g_strcmp0(slot_state->status, "ok") == 0 && g_strcmp0(plan->image->checksum.digest, slot_state->checksum.digest) == 0) {
+		skip = TRUE;
+	} else if (!plan->target_slot->install_same && r_slot_fingerprint_matches(plan->target_slot, &plan->image->checksum)) {
+		/* the status may be missing or 'pending' after an aborted
+		 * installation, but the slot content was verified to match */
+		g_message("Slot %s fingerprint matches image '%s'", plan->target_slot->name, plan->image->filename);
+		skip = TRUE;
+	}
+
+	if (skip) {
 		install_args_update(args, "Skipping update for correct image '%s'", plan->image->filename);
 		g_message("Skipping update for correct image '%s'", plan->image->filename);
 		r_context_end_step("check_slot", TRUE);
@@ -1191,6 +1205,9 @@ static gboolean handle_slot_install_plan(const RaucManifest *manifest, const RIm
 		}
 	}
 
+	/* the slot content will not match the fingerprint anymore */
+	r_slot_fingerprint_clear(plan->target_slot);
+
 	g_free(slot_state->status);
 	slot_state->status = g_strdup("update");
 
@@ -1236,6 +1253,12 @@ static gboolean handle_slot_install_plan(const RaucManifest *manifest, const RIm
 		return FALSE;
 	}
 
+	if (!plan->target_slot->install_same &&
+	    !r_slot_fingerprint_save(plan->target_slot, &plan->image->checksum, &ierror)) {
+		g_warning("Failed to record slot fingerprint: %s", ierror->message);
+		g_clear_error(&ierror);
+	}
+
 	install_args_update(args, "Updating slot %s done", plan->target_slot->name);
 	return TRUE;
 }
@@ -1298,6 +1321,8 @@ static void log_event_installation_started(RaucInstallArgs *args)
 static void log_event_installation_done(RaucInstallArgs *args, RaucManifest *manifest, const GError *error)
 {
 	g_autofree gchar *formatted = NULL;
+	g_autofree gchar *stats = NULL;
+	g_autoptr(GVariant) published = g_variant_ref_sink(r_stats_get_published(FALSE));
 	GLogField fields[] = {
 		{"MESSAGE", NULL, -1},
 		{"MESSAGE_ID", NULL, -1},
@@ -1308,6 +1333,7 @@ static void log_event_installation_done(RaucInstallArgs *args, RaucManifest *man
 		{"BUNDLE_DESCRIPTION", "", -1},
 		{"BUNDLE_VERSION", "", -1},
 		{"TRANSACTION_ID", args->transaction, -1},
+		{"INSTALL_STATS", NULL, -1},
 	};
 
 	g_return_if_fail(args);
@@ -1332,6 +1358,8 @@ static void log_event_installation_done(RaucInstallArgs *args, RaucManifest *man
 		fields[6].value = manifest->update_description ?: "";
 		fields[7].value = manifest->update_version ?: "";
 	}
+	stats = g_variant_print(published, FALSE);
+	fields[9].value = stats;
 
 	g_log_structured_array(G_LOG_LEVEL_MESSAGE, fields, G_N_ELEMENTS(fields));
 }
@@ -1486,6 +1514,16 @@ static gboolean launch_and_wait_default_handler(RaucInstallArgs *args, gchar* bu
 	if (manifest->hook_name)
 		hook_name = g_build_filename(bundledir, manifest->hook_name, NULL);
 
+	{
+		guint64 total = 0;
+
+		for (guint i = 0; i < install_plans->len; i++) {
+			const RImageInstallPlan *plan = g_ptr_array_index(install_plans, i);
+			total += plan->image->checksum.size;
+		}
+		r_metrics_set_total(total);
+	}
+
 	r_context_begin_step_weighted("update_slots", "Updating slots", install_plans->len * 10, 6);
 	install_args_update(args, "Updating slots...");
 
@@ -1541,6 +1579,7 @@ gboolean do_install_bundle(RaucInstallArgs *args, GError **error)
 	g_autoptr(RaucBundle) bundle = NULL;
 	g_autoptr(GHashTable) target_group = NULL;
 	g_auto(GStrv) handler_env = NULL;
+	gboolean payload_read = FALSE;
 
 	g_assert_nonnull(bundlefile);
 	g_assert_null(r_context()->install_info->mounted_bundle);
@@ -1549,7 +1588,9 @@ gboolean do_install_bundle(RaucInstallArgs *args, GError **error)
 	if (!args->transaction)
 		args->transaction = g_uuid_string_random();
 
-	r_context_begin_step("do_install_bundle", "Installing", 10);
+	/* reading the complete bundle during mounting is an extra step (which is
+	 * completed by a dummy step if the bundle is not read) */
+	r_context_begin_step("do_install_bundle", "Installing", r_context()->config->perform_pre_check ? 11 : 10);
 
 	log_event_installation_started(args);
 
@@ -1566,10 +1607,17 @@ gboolean do_install_bundle(RaucInstallArgs *args, GError **error)
 
 	args->access_args.http_info_headers = assemble_info_headers(args->transaction);
 
-	res = check_bundle(bundlefile, &bundle, CHECK_BUNDLE_DEFAULT, &args->access_args, &ierror);
-	if (!res) {
-		g_propagate_error(error, ierror);
-		goto out;
+	if (args->bundle) {
+		/* signature and payload were already verified while mounting */
+		r_context_begin_step("check_bundle", "Using bundle checked during inspection", 0);
+		bundle = g_steal_pointer(&args->bundle);
+		r_context_end_step("check_bundle", TRUE);
+	} else {
+		res = check_bundle(bundlefile, &bundle, CHECK_BUNDLE_DEFAULT, &args->access_args, &ierror);
+		if (!res) {
+			g_propagate_error(error, ierror);
+			goto out;
+		}
 	}
 
 	if (args->require_manifest_hash) {
@@ -1577,29 +1625,42 @@ gboolean do_install_bundle(RaucInstallArgs *args, GError **error)
 			/* only plain bundles have no manifest at this point */
 			g_set_error(error, R_INSTALL_ERROR, R_INSTALL_ERROR_REJECTED, "Refusing to install plain bundle when using require-manifest-hash");
 			res = FALSE;
-			goto out;
+			goto umount;
 		}
 		if (g_strcmp0(args->require_manifest_hash, bundle->manifest->hash) != 0) {
 			g_set_error(error, R_INSTALL_ERROR, R_INSTALL_ERROR_REJECTED, "Refusing to install bundle with unexpected hash (expected %s, got %s)",
 					args->require_manifest_hash, bundle->manifest->hash);
 			res = FALSE;
-			goto out;
+			goto umount;
 		}
 	}
 
 	if (bundle->manifest && bundle->manifest->bundle_format == R_MANIFEST_FORMAT_CRYPT && !bundle->was_encrypted) {
 		g_set_error(error, R_INSTALL_ERROR, R_INSTALL_ERROR_REJECTED, "Refusing to install unencrypted crypt bundles");
 		res = FALSE;
-		goto out;
+		goto umount;
 	}
 
-	res = mount_bundle(bundle, &ierror);
-	if (!res) {
-		g_propagate_prefixed_error(
-				error,
-				ierror,
-				"Failed mounting bundle: ");
-		goto umount;
+	if (!bundle->mount_point) {
+		/* only verity and crypt bundles (which have a manifest at this
+		 * point) are read completely while mounting */
+		payload_read = bundle->manifest != NULL;
+		res = mount_bundle(bundle, &ierror);
+		if (!res) {
+			g_propagate_prefixed_error(
+					error,
+					ierror,
+					"Failed mounting bundle: ");
+			goto umount;
+		}
+	}
+
+	if (r_context()->config->perform_pre_check && !payload_read) {
+		/* Dummy step to complete the substep reserved for reading the
+		 * payload, as plain bundles were checked completely already and
+		 * bundles handed over from inspection are mounted already */
+		r_context_begin_step("check_dm_device", "Checking bundle payload skipped", 0);
+		r_context_end_step("check_dm_device", TRUE);
 	}
 
 	r_context()->install_info->mounted_bundle = bundle;
@@ -1657,6 +1718,13 @@ gboolean do_install_bundle(RaucInstallArgs *args, GError **error)
 		res = launch_and_wait_custom_handler(args, bundle->mount_point, bundle->manifest, target_group, handler_env, &ierror);
 	} else {
 		g_debug("Using default installation handler");
+		/* uncompressed images can be read directly from the payload */
+		for (GList *l = bundle->manifest->images; l != NULL; l = l->next) {
+			RaucImage *image = l->data;
+
+			if (image->payload_offset && bundle->payload_device)
+				r_replace_strdup(&image->payload_device, bundle->payload_device);
+		}
 		res = launch_and_wait_default_handler(args, bundle->mount_point, bundle->manifest, target_group, &ierror);
 	}
 
@@ -1705,6 +1773,8 @@ static gpointer install_thread(gpointer data)
 {
 	GError *ierror = NULL;
 	RaucInstallArgs *args = data;
+	const gchar *trace_path = r_context()->config->trace_path;
+	gboolean traced = FALSE;
 	gint result;
 
 	/* clear LastError property */
@@ -1713,7 +1783,21 @@ static gpointer install_thread(gpointer data)
 	g_debug("thread started for %s", args->name);
 	install_args_update(args, "started");
 
+	/* only report the statistics of this installation */
+	r_stats_clear_published();
+	r_metrics_start();
+
+	/* when called from the command line, the whole command is traced already */
+	if (trace_path && !r_trace_is_enabled()) {
+		traced = r_trace_start(trace_path, &ierror);
+		if (!traced) {
+			g_warning("Failed to start tracing: %s", ierror->message);
+			g_clear_error(&ierror);
+		}
+	}
+
 	result = !do_install_bundle(args, &ierror);
+	r_metrics_stop();
 
 	if (result != 0) {
 		g_warning("%s", ierror->message);
@@ -1722,6 +1806,11 @@ static gpointer install_thread(gpointer data)
 		g_clear_error(&ierror);
 	}
 
+	if (traced && !r_trace_stop(&ierror)) {
+		g_warning("%s", ierror->message);
+		g_clear_error(&ierror);
+	}
+
 	g_mutex_lock(&args->status_mutex);
 	args->status_result = result;
 	g_mutex_unlock(&args->status_mutex);
@@ -1752,6 +1841,11 @@ void install_args_free(RaucInstallArgs *args)
 	g_assert_true(g_queue_is_empty(&args->status_messages));
 	g_free(args->require_manifest_hash);
 	clear_bundle_access_args(&args->access_args);
+	if (args->bundle) {
+		if (args->bundle->mount_point)
+			umount_bundle(args->bundle, NULL);
+		free_bundle(args->bundle);
+	}
 	g_free(args);
 }
 
@@ -26,6 +26,7 @@
 #include "signature.h"
 #include "slot.h"
 #include "status_file.h"
+#include "trace.h"
 #include "update_handler.h"
 #include "utils.h"
 #include "mark.h"
@@ -47,9 +48,12 @@ gchar *certpath = NULL;
 gchar **intermediate = NULL;
 gchar *signing_keyring = NULL;
 gchar *mksquashfs_args = NULL;
+gint bundle_jobs = 0;
+gboolean builtin_squashfs = FALSE;
 gchar *casync_args = NULL;
 gchar **convert_ignore_images = NULL;
 gchar **recipients = NULL;
+gchar *encrypt_batch = NULL;
 gchar *handler_args = NULL;
 gchar *keyring = NULL;
 gchar *bootslot = NULL;
@@ -854,6 +858,50 @@ out:
 	return TRUE;
 }
 
+/* Each non-empty line of the batch file contains the output bundle followed
+ * by its recipient certificate files, separated by whitespace (shell quoting
+ * is supported). Lines starting with '#' are ignored. */
+static GPtrArray *parse_encrypt_batch(const gchar *filename, GError **error)
+{
+	GError *ierror = NULL;
+	g_autofree gchar *contents = NULL;
+	g_auto(GStrv) lines = NULL;
+	g_autoptr(GPtrArray) targets = g_ptr_array_new_with_free_func((GDestroyNotify)free_encrypt_target);
+
+	if (!g_file_get_contents(filename, &contents, NULL, &ierror)) {
+		g_propagate_error(error, ierror);
+		return NULL;
+	}
+
+	lines = g_strsplit(contents, "\n", -1);
+	for (guint i = 0; lines[i]; i++) {
+		g_autoptr(RaucEncryptTarget) target = NULL;
+		g_auto(GStrv) argv = NULL;
+		gint argc = 0;
+
+		g_strstrip(lines[i]);
+		if (!lines[i][0] || lines[i][0] == '#')
+			continue;
+
+		if (!g_shell_parse_argv(lines[i], &argc, &argv, &ierror)) {
+			g_propagate_prefixed_error(error, ierror, "%s:%u: ", filename, i + 1);
+			return NULL;
+		}
+		if (argc < 2 && !r_context()->recipients) {
+			g_set_error(error, G_FILE_ERROR, G_FILE_ERROR_INVAL,
+					"%s:%u: no recipient certificate given for %s", filename, i + 1, argv[0]);
+			return NULL;
+		}
+
+		target = g_new0(RaucEncryptTarget, 1);
+		target->outbundle = g_strdup(argv[0]);
+		target->recipients = g_strdupv(argv + 1);
+		g_ptr_array_add(targets, g_steal_pointer(&target));
+	}
+
+	return g_steal_pointer(&targets);
+}
+
 G_GNUC_UNUSED
 static gboolean encrypt_start(int argc, char **argv)
 {
@@ -861,6 +909,47 @@ static gboolean encrypt_start(int argc, char **argv)
 	GError *ierror = NULL;
 	g_debug("encrypt start");
 
+	if (encrypt_batch) {
+		g_autoptr(GPtrArray) targets = NULL;
+
+		if (argc < 3) {
+			g_printerr("An input bundle must be provided\n");
+			r_exit_status = 1;
+			goto out;
+		}
+
+		if (argc > 3) {
+			g_printerr("Excess argument: %s (output bundles are given in the batch file)\n", argv[3]);
+			r_exit_status = 1;
+			goto out;
+		}
+
+		targets = parse_encrypt_batch(encrypt_batch, &ierror);
+		if (!targets) {
+			g_printerr("Failed to read batch file: %s\n", ierror->message);
+			g_clear_error(&ierror);
+			r_exit_status = 1;
+			goto out;
+		}
+
+		if (!check_bundle(argv[2], &bundle, CHECK_BUNDLE_DEFAULT, NULL, &ierror)) {
+			g_printerr("%s\n", ierror->message);
+			g_clear_error(&ierror);
+			r_exit_status = 1;
+			goto out;
+		}
+
+		if (!encrypt_bundle_batch(bundle, targets, &ierror)) {
+			g_printerr("Failed to create bundles: %s\n", ierror->message);
+			g_clear_error(&ierror);
+			r_exit_status = 1;
+			goto out;
+		}
+
+		g_print("%u encrypted bundles written\n", targets->len);
+		goto out;
+	}
+
 	if (r_context()->recipients == NULL) {
 		g_printerr("One or multiple recipient certificates must be provided (via --to)\n");
 		r_exit_status = 1;
@@ -1150,6 +1239,8 @@ static gchar *info_formatter_readable(RaucManifest *manifest)
 			}
 			g_string_append_c(text, '\n');
 		}
+		if (img->payload_offset)
+			g_string_append_printf(text, "    Payload:   uncompressed at offset %"G_GUINT64_FORMAT "\n", img->payload_offset);
 
 		cnt++;
 	}
@@ -1264,6 +1355,10 @@ static gchar* info_formatter_json_base(RaucManifest *manifest, gboolean pretty)
 			json_builder_set_member_name(builder, "converted");
 			ptrarray_to_json_array(builder, img->converted);
 		}
+		if (img->payload_offset) {
+			json_builder_set_member_name(builder, "payload-offset");
+			json_builder_add_int_value(builder, img->payload_offset);
+		}
 		json_builder_end_object(builder);
 		json_builder_end_object(builder);
 	}
@@ -2587,6 +2682,8 @@ static GOptionEntry entries_install[] = {
 
 static GOptionEntry entries_bundle[] = {
 	{"mksquashfs-args", '\0', 0, G_OPTION_ARG_STRING, &mksquashfs_args, "mksquashfs extra args", "ARGS"},
+	{"jobs", '\0', 0, G_OPTION_ARG_INT, &bundle_jobs, "number of images to process in parallel (default: number of CPUs)", "N"},
+	{"builtin-squashfs", '\0', 0, G_OPTION_ARG_NONE, &builtin_squashfs, "create squashfs without calling mksquashfs", NULL},
 	{0}
 };
 
@@ -2682,6 +2779,7 @@ static GOptionEntry entries_bundle_access[] = {
 static GOptionEntry entries_encryption[] = {
 	{"to", '\0', 0, G_OPTION_ARG_FILENAME_ARRAY, &recipients, "recipient cert(s)", "PEMFILE"},
 	{"keyring", '\0', G_OPTION_FLAG_NOALIAS, G_OPTION_ARG_FILENAME, &keyring, "keyring file", "PEMFILE"},
+	{"batch", '\0', 0, G_OPTION_ARG_FILENAME, &encrypt_batch, "create one output per line: OUTBUNDLE PEMFILE...", "FILE"},
 	{0}
 };
 
@@ -2777,7 +2875,7 @@ static gboolean collect_config_values(const gchar *option_name, const gchar *val
 static void cmdline_handler(int argc, char **argv)
 {
 	gboolean help = FALSE, debug = FALSE, version = FALSE;
-	g_autofree gchar *confpath = NULL, *mount = NULL;
+	g_autofree gchar *confpath = NULL, *mount = NULL, *trace = NULL;
 	char *cmdarg = NULL;
 	g_autoptr(GOptionContext) context = NULL;
 	GOptionEntry entries[] = {
@@ -2790,6 +2888,7 @@ static void cmdline_handler(int argc, char **argv)
 		{"keyring", '\0', G_OPTION_FLAG_HIDDEN, G_OPTION_ARG_FILENAME, &keyring, "keyring file", "PEMFILE"},
 		{"intermediate", '\0', G_OPTION_FLAG_HIDDEN, G_OPTION_ARG_FILENAME_ARRAY, &intermediate, "intermediate CA file or PKCS#11 URL", "PEMFILE|PKCS11-URL"},
 		{"mount", '\0', 0, G_OPTION_ARG_FILENAME, &mount, "mount prefix", "PATH"},
+		{"trace", '\0', 0, G_OPTION_ARG_FILENAME, &trace, "record a trace of the command", "PATH"},
 		{"debug", 'd', 0, G_OPTION_ARG_NONE, &debug, "enable debug output", NULL},
 		{"version", '\0', 0, G_OPTION_ARG_NONE, &version, "display version", NULL},
 		{"help", 'h', 0, G_OPTION_ARG_NONE, &help, "display help and exit", NULL},
@@ -2979,6 +3078,12 @@ static void cmdline_handler(int argc, char **argv)
 		goto print_help;
 	}
 
+	if (bundle_jobs < 0) {
+		g_printerr("Invalid number of jobs: %d\n", bundle_jobs);
+		r_exit_status = 1;
+		goto print_help;
+	}
+
 	/* configuration updates are handled here */
 	if (!r_context_get_busy()) {
 		r_context_conf();
@@ -3009,12 +3114,17 @@ static void cmdline_handler(int argc, char **argv)
 			r_context_conf()->mksquashfs_args = mksquashfs_args;
 		if (casync_args)
 			r_context_conf()->casync_args = casync_args;
+		if (bundle_jobs > 0)
+			r_context_conf()->bundle_jobs = bundle_jobs;
+		r_context_conf()->builtin_squashfs = builtin_squashfs;
 		if (recipients)
 			r_context_conf()->recipients = recipients;
 		if (intermediate)
 			r_context_conf()->intermediatepaths = intermediate;
 		if (mount)
 			r_context_conf()->mountprefix = g_steal_pointer(&mount);
+		if (trace)
+			r_context_conf()->tracepath = g_steal_pointer(&trace);
 		if (bootslot)
 			r_context_conf()->bootslot = bootslot;
 		if (handler_args)
@@ -3042,10 +3152,27 @@ static void cmdline_handler(int argc, char **argv)
 		return;
 	}
 
+	/* 'trace-path' from the system config only applies to installations,
+	 * the service traces each of them separately */
+	if (r_context()->tracepath && rcommand->type != SERVICE) {
+		if (!r_trace_start(r_context()->tracepath, &error)) {
+			g_printerr("%s\n", error->message);
+			g_clear_error(&error);
+			r_exit_status = 1;
+			return;
+		}
+	}
+
 	/* real commands are handled here */
 	if (rcommand->cmd_handler) {
 		rcommand->cmd_handler(argc, argv);
 	}
+
+	if (!r_trace_stop(&error)) {
+		g_printerr("%s\n", error->message);
+		g_clear_error(&error);
+		r_exit_status = 1;
+	}
 	return;
 
 print_help:
@@ -3082,8 +3209,28 @@ int main(int argc, char **argv)
 
 	if (ENABLE_STREAMING && g_getenv("RAUC_NBD_SERVER")) {
 		g_autoptr(GError) ierror = NULL;
+		const gchar *trace_format = g_getenv("RAUC_NBD_TRACE");
+		gboolean res;
+
 		pthread_setname_np(pthread_self(), "rauc-nbd");
-		if (r_nbd_run_server(RAUC_SOCKET_FD, &ierror)) {
+
+		if (trace_format) {
+			RTraceFormat format = g_str_equal(trace_format, "binary") ? R_TRACE_FORMAT_BINARY : R_TRACE_FORMAT_JSON;
+			if (!r_trace_start_fd(RAUC_TRACE_FD, format, &ierror)) {
+				g_message("nbd server failed to start tracing: %s", ierror->message);
+				g_clear_error(&ierror);
+			}
+		}
+
+		res = r_nbd_run_server(RAUC_SOCKET_FD, &ierror);
+
+		if (trace_format) {
+			g_autoptr(GError) trace_error = NULL;
+			if (!r_trace_stop(&trace_error))
+				g_message("nbd server failed to write trace: %s", trace_error->message);
+		}
+
+		if (res) {
 			return 0;
 		} else {
 			if (ierror) {
@@ -201,6 +201,26 @@ static gboolean parse_image(GKeyFile *key_file, const gchar *group, RaucImage **
 		r_ptr_array_addv(iimage->converted, converted, TRUE);
 	}
 
+	iimage->uncompressed = g_key_file_get_boolean(key_file, group, "uncompressed", &ierror);
+	if (g_error_matches(ierror, G_KEY_FILE_ERROR, G_KEY_FILE_ERROR_KEY_NOT_FOUND)) {
+		iimage->uncompressed = FALSE;
+		g_clear_error(&ierror);
+	} else if (ierror) {
+		g_propagate_error(error, ierror);
+		return FALSE;
+	}
+	g_key_file_remove_key(key_file, group, "uncompressed", NULL);
+
+	iimage->payload_offset = g_key_file_get_uint64(key_file, group, "payload-offset", &ierror);
+	if (g_error_matches(ierror, G_KEY_FILE_ERROR, G_KEY_FILE_ERROR_KEY_NOT_FOUND)) {
+		iimage->payload_offset = 0;
+		g_clear_error(&ierror);
+	} else if (ierror) {
+		g_propagate_error(error, ierror);
+		return FALSE;
+	}
+	g_key_file_remove_key(key_file, group, "payload-offset", NULL);
+
 	if (!check_remaining_keys(key_file, group, &ierror)) {
 		g_propagate_error(error, ierror);
 		return FALSE;
@@ -588,6 +608,10 @@ static gboolean check_manifest_plain(const RaucManifest *mf, GError **error)
 			g_set_error(error, R_MANIFEST_ERROR, R_MANIFEST_CHECK_ERROR, "Image converters are not supported in plain bundles");
 			return FALSE;
 		}
+		if (image->uncompressed || image->payload_offset) {
+			g_set_error(error, R_MANIFEST_ERROR, R_MANIFEST_CHECK_ERROR, "Uncompressed images are not supported in plain bundles");
+			return FALSE;
+		}
 	}
 
 	return TRUE;
@@ -651,6 +675,15 @@ static gboolean check_manifest_bundled(const RaucManifest *mf, GError **error)
 				return FALSE;
 			}
 		}
+
+		if (image->uncompressed && !image->payload_offset) {
+			g_set_error(error, R_MANIFEST_ERROR, R_MANIFEST_CHECK_ERROR, "Missing payload offset for uncompressed image %s", image->filename);
+			return FALSE;
+		}
+		if (image->payload_offset % 4096) {
+			g_set_error(error, R_MANIFEST_ERROR, R_MANIFEST_CHECK_ERROR, "Payload offset of image %s is not a multiple of 4096 bytes", image->filename);
+			return FALSE;
+		}
 	}
 
 	return TRUE;
@@ -711,6 +744,22 @@ gboolean check_manifest_input(const RaucManifest *mf, GError **error)
 					"Unexpected 'converted' option in input manifest");
 			return FALSE;
 		}
+		if (image->payload_offset) {
+			g_set_error(error, R_MANIFEST_ERROR, R_MANIFEST_CHECK_ERROR,
+					"Unexpected 'payload-offset' option in input manifest");
+			return FALSE;
+		}
+		if (image->uncompressed && !image->filename) {
+			g_set_error(error, R_MANIFEST_ERROR, R_MANIFEST_CHECK_ERROR,
+					"Option 'uncompressed' requires an image file for slot class %s", image->slotclass);
+			return FALSE;
+		}
+		if (image->uncompressed && image->convert &&
+		    !g_strv_contains((const gchar * const *)image->convert, "keep")) {
+			g_set_error(error, R_MANIFEST_ERROR, R_MANIFEST_CHECK_ERROR,
+					"Option 'uncompressed' requires keeping the image file, but %s is only converted (add 'keep' to 'convert')", image->filename);
+			return FALSE;
+		}
 	}
 
 	return TRUE;
@@ -1019,6 +1068,11 @@ static GKeyFile *prepare_manifest(const RaucManifest *mf)
 		if (image->converted && image->converted->len)
 			g_key_file_set_string_list(key_file, group, "converted",
 					(const gchar * const *)image->converted->pdata, image->converted->len);
+
+		if (image->uncompressed)
+			g_key_file_set_boolean(key_file, group, "uncompressed", TRUE);
+		if (image->payload_offset)
+			g_key_file_set_uint64(key_file, group, "payload-offset", image->payload_offset);
 	}
 
 	if (mf->meta) {
@@ -1176,6 +1230,8 @@ GVariant* r_manifest_to_dict(const RaucManifest *manifest)
 			g_variant_builder_add(&builder, "{sv}", "convert", g_variant_new_strv((const gchar * const*)(img->convert), -1));
 		if (img->converted)
 			g_variant_builder_add(&builder, "{sv}", "converted", g_variant_new_strv((const gchar * const*)(img->converted->pdata), img->converted->len));
+		if (img->payload_offset)
+			g_variant_builder_add(&builder, "{sv}", "payload-offset", g_variant_new_uint64(img->payload_offset));
 
 		g_variant_builder_close(&builder);
 	}
@@ -1261,6 +1317,7 @@ void r_free_image(gpointer data)
 	g_strfreev(image->adaptive);
 	g_strfreev(image->convert);
 	g_clear_pointer(&image->converted, g_ptr_array_unref);
+	g_free(image->payload_device);
 	g_free(image);
 }
 
@@ -1287,55 +1344,7 @@ void free_manifest(RaucManifest *manifest)
 	g_free(manifest);
 }
 
-/**
- * Updates checksums for images listed in the manifest and found in
- * the bundle directory.
- *
- * @param manifest pointer to the manifest
- * @param dir Directory with the bundle content
- * @param error return location for a GError, or NULL
- *
- * @return TRUE on success, FALSE if an error occurred
- */
-static gboolean update_manifest_checksums(RaucManifest *manifest, const gchar *dir, GError **error)
-{
-	GError *ierror = NULL;
-	gboolean res = TRUE;
-	gboolean had_errors = FALSE;
-
-	g_return_val_if_fail(manifest, FALSE);
-	g_return_val_if_fail(dir, FALSE);
-	g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
-
-	for (GList *elem = manifest->images; elem != NULL; elem = elem->next) {
-		RaucImage *image = elem->data;
-		g_autofree gchar *filename = NULL;
-
-		/* If no filename is set (valid for 'install' hook) explicitly set size to -1 */
-		if (!image->filename) {
-			image->checksum.size = -1;
-			continue;
-		}
-
-		filename = g_build_filename(dir, image->filename, NULL);
-		res = compute_checksum(&image->checksum, filename, &ierror);
-		if (!res) {
-			g_warning("Failed updating checksum: %s", ierror->message);
-			g_clear_error(&ierror);
-			had_errors = TRUE;
-			break;
-		}
-	}
-
-	if (had_errors) {
-		res = FALSE;
-		g_set_error(error, R_MANIFEST_ERROR, R_MANIFEST_ERROR_CHECKSUM, "Failed updating all checksums");
-	}
-
-	return res;
-}
-
-gboolean sync_manifest_with_contentdir(RaucManifest *manifest, const gchar *dir, GError **error)
+gboolean check_manifest_contentdir(const RaucManifest *manifest, const gchar *dir, GError **error)
 {
 	g_return_val_if_fail(manifest, FALSE);
 	g_return_val_if_fail(dir, FALSE);
@@ -1361,5 +1370,5 @@ gboolean sync_manifest_with_contentdir(RaucManifest *manifest, const gchar *dir,
 		}
 	}
 
-	return update_manifest_checksums(manifest, dir, error);
+	return TRUE;
 }
@@ -0,0 +1,301 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "metrics.h"
+
+#define R_METRICS_SAMPLES (R_METRICS_THROUGHPUT_WINDOW + 1)
+
+typedef struct {
+	gint64 time;
+	guint64 written;
+} RMetricsSample;
+
+typedef struct {
+	gint64 elapsed; /* sum of finished runs */
+	gint64 begin; /* start of the current run, 0 if not running */
+	guint depth;
+} RMetricsPhase;
+
+static struct {
+	gboolean active;
+	gboolean untracked; /* some data was written by external programs */
+	gint64 start; /* monotonic */
+	gint64 stop;
+	guint64 total;
+	guint64 bytes[R_METRICS_SOURCE_ZERO + 1];
+	gchar *network_dev;
+	guint64 network_base; /* device counter when the device was set */
+	guint64 network_bytes; /* read via previously used devices */
+	GHashTable *phases; /* name -> RMetricsPhase */
+	RMetricsSample samples[R_METRICS_SAMPLES];
+	guint sample_count, sample_next;
+} metrics;
+G_LOCK_DEFINE_STATIC(metrics);
+
+/* Returns the number of bytes read from a block device since it was set up. */
+static guint64 read_device_bytes(const gchar *dev)
+{
+	g_autofree gchar *name = g_path_get_basename(dev);
+	g_autofree gchar *path = g_build_filename("/sys/block", name, "stat", NULL);
+	g_autofree gchar *contents = NULL;
+	guint64 sectors = 0;
+
+	if (!g_file_get_contents(path, &contents, NULL, NULL))
+		return 0;
+
+	/* read I/Os, read merges, read sectors (in units of 512 bytes), ... */
+	if (sscanf(contents, "%*u %*u %"G_GUINT64_FORMAT, &sectors) != 1)
+		return 0;
+
+	return sectors * 512;
+}
+
+static guint64 network_bytes(void)
+{
+	guint64 bytes = metrics.network_bytes;
+
+	if (metrics.network_dev) {
+		guint64 current = read_device_bytes(metrics.network_dev);
+		if (current > metrics.network_base)
+			bytes += current - metrics.network_base;
+	}
+
+	return bytes;
+}
+
+static guint64 written_bytes(void)
+{
+	guint64 written = 0;
+
+	for (guint i = 0; i < G_N_ELEMENTS(metrics.bytes); i++)
+		written += metrics.bytes[i];
+
+	return written;
+}
+
+static void add_sample(gint64 now, guint64 written)
+{
+	metrics.samples[metrics.sample_next].time = now;
+	metrics.samples[metrics.sample_next].written = written;
+	metrics.sample_next = (metrics.sample_next + 1) % R_METRICS_SAMPLES;
+	if (metrics.sample_count < R_METRICS_SAMPLES)
+		metrics.sample_count++;
+}
+
+void r_metrics_start(void)
+{
+	gint64 now = g_get_monotonic_time();
+
+	G_LOCK(metrics);
+
+	metrics.active = TRUE;
+	metrics.start = now;
+	metrics.stop = 0;
+	metrics.untracked = FALSE;
+	metrics.total = 0;
+	memset(metrics.bytes, 0, sizeof(metrics.bytes));
+	/* a bundle might already be mounted */
+	if (metrics.network_dev)
+		metrics.network_base = read_device_bytes(metrics.network_dev);
+	metrics.network_bytes = 0;
+	if (metrics.phases)
+		g_hash_table_remove_all(metrics.phases);
+	else
+		metrics.phases = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+	metrics.sample_count = 0;
+	metrics.sample_next = 0;
+	add_sample(now, 0);
+
+	G_UNLOCK(metrics);
+}
+
+void r_metrics_stop(void)
+{
+	GHashTableIter iter;
+	RMetricsPhase *phase;
+
+	G_LOCK(metrics);
+
+	if (!metrics.active) {
+		G_UNLOCK(metrics);
+		return;
+	}
+
+	metrics.active = FALSE;
+	metrics.stop = g_get_monotonic_time();
+
+	/* phases left open by an error */
+	g_hash_table_iter_init(&iter, metrics.phases);
+	while (g_hash_table_iter_next(&iter, NULL, (gpointer *)&phase)) {
+		if (phase->begin)
+			phase->elapsed += metrics.stop - phase->begin;
+		phase->begin = 0;
+		phase->depth = 0;
+	}
+
+	G_UNLOCK(metrics);
+}
+
+void r_metrics_set_total(guint64 bytes)
+{
+	G_LOCK(metrics);
+	metrics.total = bytes;
+	G_UNLOCK(metrics);
+}
+
+void r_metrics_add_bytes(RMetricsSource source, guint64 bytes)
+{
+	g_return_if_fail(source < G_N_ELEMENTS(metrics.bytes));
+
+	G_LOCK(metrics);
+	if (metrics.active)
+		metrics.bytes[source] += bytes;
+	G_UNLOCK(metrics);
+}
+
+void r_metrics_mark_untracked(void)
+{
+	G_LOCK(metrics);
+	if (metrics.active)
+		metrics.untracked = TRUE;
+	G_UNLOCK(metrics);
+}
+
+void r_metrics_set_network_device(const gchar *dev)
+{
+	G_LOCK(metrics);
+
+	/* keep the bytes read via the previous device */
+	metrics.network_bytes = network_bytes();
+	g_clear_pointer(&metrics.network_dev, g_free);
+
+	if (dev) {
+		metrics.network_dev = g_strdup(dev);
+		metrics.network_base = read_device_bytes(dev);
+	}
+
+	G_UNLOCK(metrics);
+}
+
+void r_metrics_phase_begin(const gchar *name)
+{
+	RMetricsPhase *phase;
+
+	g_return_if_fail(name);
+
+	G_LOCK(metrics);
+
+	if (!metrics.active) {
+		G_UNLOCK(metrics);
+		return;
+	}
+
+	phase = g_hash_table_lookup(metrics.phases, name);
+	if (!phase) {
+		phase = g_new0(RMetricsPhase, 1);
+		g_hash_table_insert(metrics.phases, g_strdup(name), phase);
+	}
+	/* only the outermost of nested phases with the same name counts */
+	if (!phase->depth++)
+		phase->begin = g_get_monotonic_time();
+
+	G_UNLOCK(metrics);
+}
+
+void r_metrics_phase_end(const gchar *name)
+{
+	RMetricsPhase *phase;
+
+	g_return_if_fail(name);
+
+	G_LOCK(metrics);
+
+	if (!metrics.active) {
+		G_UNLOCK(metrics);
+		return;
+	}
+
+	phase = g_hash_table_lookup(metrics.phases, name);
+	if (phase && phase->depth && !--phase->depth) {
+		phase->elapsed += g_get_monotonic_time() - phase->begin;
+		phase->begin = 0;
+	}
+
+	G_UNLOCK(metrics);
+}
+
+GVariant *r_metrics_to_variant(void)
+{
+	g_auto(GVariantDict) dict = G_VARIANT_DICT_INIT(NULL);
+	g_autoptr(GList) names = NULL;
+	GVariantBuilder phases;
+	gint64 now = g_get_monotonic_time();
+	gint64 end;
+	guint64 written, reused;
+	gdouble throughput = 0.0;
+
+	G_LOCK(metrics);
+
+	/* nothing was installed yet */
+	if (!metrics.start) {
+		G_UNLOCK(metrics);
+		return g_variant_dict_end(&dict);
+	}
+
+	end = metrics.active ? now : metrics.stop;
+	written = written_bytes();
+	reused = metrics.bytes[R_METRICS_SOURCE_SEED] + metrics.bytes[R_METRICS_SOURCE_ZERO];
+
+	if (metrics.active) {
+		/* throughput over the last R_METRICS_THROUGHPUT_WINDOW samples,
+		 * which are taken at most once per second */
+		const RMetricsSample *last = &metrics.samples[(metrics.sample_next + R_METRICS_SAMPLES - 1) % R_METRICS_SAMPLES];
+		const RMetricsSample *oldest;
+
+		if (now - last->time >= G_USEC_PER_SEC)
+			add_sample(now, written);
+		oldest = &metrics.samples[metrics.sample_count < R_METRICS_SAMPLES ? 0 : metrics.sample_next];
+		if (now > oldest->time)
+			throughput = (written - oldest->written) * (gdouble)G_USEC_PER_SEC / (now - oldest->time);
+	} else if (end > metrics.start) {
+		/* average over the whole installation */
+		throughput = written * (gdouble)G_USEC_PER_SEC / (end - metrics.start);
+	}
+
+	g_variant_dict_insert(&dict, "active", "b", metrics.active);
+	g_variant_dict_insert(&dict, "elapsed", "d", (gdouble)(end - metrics.start) / G_USEC_PER_SEC);
+	if (metrics.total)
+		g_variant_dict_insert(&dict, "bytes-total", "t", metrics.total);
+	g_variant_dict_insert(&dict, "bytes-bundle", "t", metrics.bytes[R_METRICS_SOURCE_BUNDLE]);
+	g_variant_dict_insert(&dict, "bytes-seed", "t", metrics.bytes[R_METRICS_SOURCE_SEED]);
+	g_variant_dict_insert(&dict, "bytes-zero", "t", metrics.bytes[R_METRICS_SOURCE_ZERO]);
+	g_variant_dict_insert(&dict, "bytes-network", "t", network_bytes());
+	/* the bytes written by external programs are unknown, so anything
+	 * based on the total would be misleading */
+	if (!metrics.untracked) {
+		g_variant_dict_insert(&dict, "bytes-written", "t", written);
+		g_variant_dict_insert(&dict, "throughput", "d", throughput);
+		if (metrics.active && metrics.total && throughput > 0.0)
+			g_variant_dict_insert(&dict, "eta", "d",
+					metrics.total > written ? (metrics.total - written) / throughput : 0.0);
+		if (written)
+			g_variant_dict_insert(&dict, "dedup-ratio", "d", (gdouble)reused / written);
+	}
+
+	g_variant_builder_init(&phases, G_VARIANT_TYPE("a{sd}"));
+	names = g_hash_table_get_keys(metrics.phases);
+	names = g_list_sort(names, (GCompareFunc)g_strcmp0);
+	for (GList *l = names; l != NULL; l = l->next) {
+		const RMetricsPhase *phase = g_hash_table_lookup(metrics.phases, l->data);
+		gint64 elapsed = phase->elapsed;
+
+		if (phase->begin)
+			elapsed += end - phase->begin;
+		g_variant_builder_add(&phases, "{sd}", (const gchar *)l->data, (gdouble)elapsed / G_USEC_PER_SEC);
+	}
+	g_variant_dict_insert_value(&dict, "phases", g_variant_builder_end(&phases));
+
+	G_UNLOCK(metrics);
+
+	return g_variant_dict_end(&dict);
+}
@@ -15,6 +15,16 @@
 #define LOOP_SET_BLOCK_SIZE 0x4C09
 #endif
 
+#ifndef LOOP_CONFIGURE
+#define LOOP_CONFIGURE 0x4C0A
+struct loop_config {
+	__u32 fd;
+	__u32 block_size;
+	struct loop_info64 info;
+	__u64 __reserved[8];
+};
+#endif
+
 gboolean r_mount_bundle(const gchar *source, const gchar *mountpoint, GError **error)
 {
 	const unsigned long flags = MS_NODEV | MS_NOSUID | MS_RDONLY;
@@ -103,14 +113,133 @@ gboolean r_mount_full(const gchar *source, const gchar *mountpoint, const gchar*
 	return TRUE;
 }
 
+/* Loop devices are always configured with a 4096 byte block size */
+#define LOOP_BLOCK_SIZE 4096
+
+/* Whether the kernel supports LOOP_CONFIGURE (>= 5.8), determined on the
+ * first use */
+enum {
+	LOOP_CONFIGURE_UNKNOWN = 0,
+	LOOP_CONFIGURE_SUPPORTED,
+	LOOP_CONFIGURE_UNSUPPORTED,
+};
+static gint loop_configure_support = LOOP_CONFIGURE_UNKNOWN;
+
+/* Attaches fd to an unbound loop device.
+ *
+ * Uses a single LOOP_CONFIGURE ioctl if supported, which also avoids the
+ * page cache flushes caused by changing the status and block size of an
+ * already bound device. Falls back to LOOP_SET_FD + LOOP_SET_STATUS64 +
+ * LOOP_SET_BLOCK_SIZE otherwise.
+ *
+ * If the device was claimed by someone else in the meantime, busy is set to
+ * TRUE.
+ */
+static gboolean loop_attach(gint loopfd, gint fd, goffset size, gboolean *busy, GError **error)
+{
+	gint looprc;
+
+	*busy = FALSE;
+
+	if (g_atomic_int_get(&loop_configure_support) != LOOP_CONFIGURE_UNSUPPORTED) {
+		struct loop_config config = {0};
+		int err;
+
+		config.fd = fd;
+		config.block_size = LOOP_BLOCK_SIZE;
+		config.info.lo_sizelimit = size;
+		config.info.lo_flags = LO_FLAGS_READ_ONLY | LO_FLAGS_AUTOCLEAR;
+
+		looprc = ioctl(loopfd, LOOP_CONFIGURE, &config);
+		if (looprc == 0) {
+			g_atomic_int_set(&loop_configure_support, LOOP_CONFIGURE_SUPPORTED);
+			return TRUE;
+		}
+
+		err = errno;
+		if (err == EBUSY) {
+			*busy = TRUE;
+			g_set_error(error, G_FILE_ERROR, G_FILE_ERROR_FAILED,
+					"Loop device is already in use");
+			return FALSE;
+		}
+		if (err != EINVAL && err != ENOTTY) {
+			g_set_error(error,
+					G_FILE_ERROR,
+					g_file_error_from_errno(err),
+					"Failed to configure loop device: %s", g_strerror(err));
+			return FALSE;
+		}
+
+		/* Older kernels return ENOTTY for unknown loop ioctls. EINVAL
+		 * only indicates missing support if LOOP_CONFIGURE never worked
+		 * before, otherwise it is caused by this configuration, so only
+		 * this attempt uses the separate ioctls. */
+		if (err == ENOTTY || g_atomic_int_get(&loop_configure_support) == LOOP_CONFIGURE_UNKNOWN) {
+			g_debug("LOOP_CONFIGURE not supported by kernel, using separate ioctls");
+			g_atomic_int_set(&loop_configure_support, LOOP_CONFIGURE_UNSUPPORTED);
+		} else {
+			g_debug("LOOP_CONFIGURE failed: %s, retrying with separate ioctls", g_strerror(err));
+		}
+	}
+
+	looprc = ioctl(loopfd, LOOP_SET_FD, fd);
+	if (looprc < 0) {
+		int err = errno;
+		/* is this loop dev is already in use by someone else? */
+		if (err == EBUSY) {
+			*busy = TRUE;
+			g_set_error(error, G_FILE_ERROR, G_FILE_ERROR_FAILED,
+					"Loop device is already in use");
+			return FALSE;
+		}
+		g_set_error(error,
+				G_FILE_ERROR,
+				g_file_error_from_errno(err),
+				"Failed to set loop device file descriptor: %s", g_strerror(err));
+		return FALSE;
+	}
+
+	{
+		struct loop_info64 loopinfo = {0};
+
+		loopinfo.lo_sizelimit = size;
+		loopinfo.lo_flags = LO_FLAGS_READ_ONLY | LO_FLAGS_AUTOCLEAR;
+
+		do {
+			looprc = ioctl(loopfd, LOOP_SET_STATUS64, &loopinfo);
+		} while (looprc && errno == EAGAIN);
+		if (looprc < 0) {
+			int err = errno;
+			g_set_error(error,
+					G_FILE_ERROR,
+					g_file_error_from_errno(err),
+					"Failed to set loop device configuration: %s", g_strerror(err));
+			ioctl(loopfd, LOOP_CLR_FD, 0);
+			return FALSE;
+		}
+	}
+
+	do {
+		looprc = ioctl(loopfd, LOOP_SET_BLOCK_SIZE, LOOP_BLOCK_SIZE);
+	} while (looprc < 0 && errno == EAGAIN);
+	if (looprc < 0) {
+		g_warning("Failed to set loop device block size to %d: %s, continuing",
+				LOOP_BLOCK_SIZE, g_strerror(errno));
+	}
+
+	return TRUE;
+}
+
 gboolean r_setup_loop(gint fd, gint *loopfd_out, gchar **loopname_out, goffset size, GError **error)
 {
+	GError *ierror = NULL;
 	gboolean res = FALSE;
 	gint controlfd = -1;
 	g_autofree gchar *loopname = NULL;
-	gint loopfd = -1, looprc;
+	gint loopfd = -1;
+	gboolean busy = FALSE;
 	guint tries;
-	struct loop_info64 loopinfo = {0};
 
 	g_return_val_if_fail(fd >= 0, FALSE);
 	g_return_val_if_fail(loopfd_out != NULL, FALSE);
@@ -165,21 +294,14 @@ gboolean r_setup_loop(gint fd, gint *loopfd_out, gchar **loopname_out, goffset s
 			goto out;
 		}
 
-		looprc = ioctl(loopfd, LOOP_SET_FD, fd);
-		if (looprc < 0) {
-			int err = errno;
-			/* is this loop dev is already in use by someone else? */
-			if (err == EBUSY)
-				continue; /* retry */
-			g_set_error(error,
-					G_FILE_ERROR,
-					g_file_error_from_errno(err),
-					"Failed to set loop device file descriptor: %s", g_strerror(err));
+		if (loop_attach(loopfd, fd, size, &busy, &ierror))
+			break; /* claimed a loop dev */
+		if (!busy) {
+			g_propagate_error(error, ierror);
 			res = FALSE;
 			goto out;
-		} else {
-			break; /* claimed a loop dev */
 		}
+		g_clear_error(&ierror);
 	}
 
 	if (!tries) {
@@ -191,31 +313,6 @@ gboolean r_setup_loop(gint fd, gint *loopfd_out, gchar **loopname_out, goffset s
 		goto out;
 	}
 
-	loopinfo.lo_sizelimit = size;
-	loopinfo.lo_flags = LO_FLAGS_READ_ONLY | LO_FLAGS_AUTOCLEAR;
-
-	do {
-		looprc = ioctl(loopfd, LOOP_SET_STATUS64, &loopinfo);
-	} while (looprc && errno == EAGAIN);
-	if (looprc < 0) {
-		int err = errno;
-		g_set_error(error,
-				G_FILE_ERROR,
-				g_file_error_from_errno(err),
-				"Failed to set loop device configuration: %s", g_strerror(err));
-		ioctl(loopfd, LOOP_CLR_FD, 0);
-		res = FALSE;
-		goto out;
-	}
-
-	do {
-		looprc = ioctl(loopfd, LOOP_SET_BLOCK_SIZE, 4096);
-	} while (looprc < 0 && errno == EAGAIN);
-	if (looprc < 0) {
-		g_warning("Failed to set loop device block size to 4096: %s, continuing",
-				g_strerror(errno));
-	}
-
 	g_message("Configured loop device '%s' for %" G_GOFFSET_FORMAT " bytes", loopname, size);
 
 	*loopfd_out = loopfd;
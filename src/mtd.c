@@ -0,0 +1,411 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <glib/gstdio.h>
+#include <mtd/mtd-user.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <unistd.h>
+
+#include "context.h"
+#include "metrics.h"
+#include "mtd.h"
+#include "utils.h"
+
+GQuark r_mtd_error_quark(void)
+{
+	return g_quark_from_static_string("r_mtd_error_quark");
+}
+
+typedef struct {
+	const gchar *device;
+	int fd;
+	struct mtd_info_user info;
+	/* mtd_info_user.size is only 32 bit wide */
+	guint64 size;
+	gboolean is_nand;
+	/* buffer for one eraseblock */
+	guint8 *read_buf;
+	/* expected content of an erased block */
+	guint8 *erased_buf;
+} RaucMtd;
+
+static void mtd_close(RaucMtd *mtd)
+{
+	if (mtd->fd >= 0)
+		g_close(mtd->fd, NULL);
+	mtd->fd = -1;
+	g_clear_pointer(&mtd->read_buf, g_free);
+	g_clear_pointer(&mtd->erased_buf, g_free);
+}
+
+/* Reads the size of the MTD device from sysfs, which is also correct for
+ * devices of 4 GiB or more. */
+static gboolean mtd_read_size(RaucMtd *mtd, GError **error)
+{
+	GError *ierror = NULL;
+	g_autofree gchar *path = NULL;
+	g_autofree gchar *contents = NULL;
+	struct stat st;
+	gchar *end = NULL;
+
+	if (fstat(mtd->fd, &st) != 0) {
+		int err = errno;
+		g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(err),
+				"Failed to stat %s: %s", mtd->device, g_strerror(err));
+		return FALSE;
+	}
+
+	/* links to /sys/class/mtd/mtdX for the character device */
+	path = g_strdup_printf("/sys/dev/char/%u:%u/size", major(st.st_rdev), minor(st.st_rdev));
+	if (!g_file_get_contents(path, &contents, NULL, &ierror)) {
+		g_propagate_prefixed_error(error, ierror,
+				"Failed to get size of %s: ", mtd->device);
+		return FALSE;
+	}
+
+	mtd->size = g_ascii_strtoull(contents, &end, 10);
+	if (end == contents || (*end != '\0' && *end != '\n')) {
+		g_set_error(error, R_MTD_ERROR, R_MTD_ERROR_FAILED,
+				"Invalid size of %s in %s", mtd->device, path);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+static gboolean mtd_open(RaucMtd *mtd, const gchar *device, GError **error)
+{
+	GError *ierror = NULL;
+
+	g_return_val_if_fail(mtd, FALSE);
+	g_return_val_if_fail(device, FALSE);
+	g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
+
+	mtd->device = device;
+	mtd->fd = g_open(device, O_RDWR | O_CLOEXEC);
+	if (mtd->fd < 0) {
+		int err = errno;
+		g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(err),
+				"Failed to open %s: %s", device, g_strerror(err));
+		return FALSE;
+	}
+
+	if (ioctl(mtd->fd, MEMGETINFO, &mtd->info) < 0) {
+		int err = errno;
+		g_set_error(error, R_MTD_ERROR, R_MTD_ERROR_IOCTL,
+				"Failed to get MTD info for %s: %s", device, g_strerror(err));
+		mtd_close(mtd);
+		return FALSE;
+	}
+
+	if (mtd->info.erasesize == 0 || mtd->info.writesize == 0 ||
+	    mtd->info.erasesize % mtd->info.writesize) {
+		g_set_error(error, R_MTD_ERROR, R_MTD_ERROR_FAILED,
+				"Invalid geometry of %s (erasesize %u, writesize %u)",
+				device, mtd->info.erasesize, mtd->info.writesize);
+		mtd_close(mtd);
+		return FALSE;
+	}
+
+	if (!mtd_read_size(mtd, &ierror)) {
+		g_propagate_error(error, ierror);
+		mtd_close(mtd);
+		return FALSE;
+	}
+
+	mtd->is_nand = mtd->info.type == MTD_NANDFLASH || mtd->info.type == MTD_MLCNANDFLASH;
+	mtd->read_buf = g_malloc(mtd->info.erasesize);
+	mtd->erased_buf = g_malloc(mtd->info.erasesize);
+	memset(mtd->erased_buf, 0xff, mtd->info.erasesize);
+
+	g_debug("Opened %s: %s, size %"G_GUINT64_FORMAT ", erasesize %u, writesize %u", device,
+			mtd->is_nand ? "NAND" : "NOR", mtd->size,
+			mtd->info.erasesize, mtd->info.writesize);
+
+	return TRUE;
+}
+
+static gboolean mtd_block_is_bad(RaucMtd *mtd, loff_t offset, gboolean *bad, GError **error)
+{
+	int ret;
+
+	*bad = FALSE;
+
+	if (!mtd->is_nand)
+		return TRUE;
+
+	ret = ioctl(mtd->fd, MEMGETBADBLOCK, &offset);
+	if (ret < 0) {
+		int err = errno;
+		if (err == EOPNOTSUPP)
+			return TRUE;
+		g_set_error(error, R_MTD_ERROR, R_MTD_ERROR_IOCTL,
+				"Failed to get bad block status at 0x%llx on %s: %s",
+				(unsigned long long)offset, mtd->device, g_strerror(err));
+		return FALSE;
+	}
+
+	*bad = ret > 0;
+
+	return TRUE;
+}
+
+/* Reads the eraseblock at offset and compares it to the expected content.
+ * Read errors are treated as a mismatch.
+ *
+ * Note that read() succeeds for NAND pages with corrected bit flips, and that
+ * a NAND block from an interrupted erase or program operation may read back
+ * correctly while still being unreliable. So this must not be used to skip
+ * erasing or writing NAND blocks. */
+static gboolean mtd_block_matches(RaucMtd *mtd, loff_t offset, const guint8 *expected)
+{
+	GError *ierror = NULL;
+
+	if (!r_pread_exact(mtd->fd, mtd->read_buf, mtd->info.erasesize, offset, &ierror)) {
+		g_debug("Failed to read block at 0x%llx on %s, rewriting it: %s",
+				(unsigned long long)offset, mtd->device, ierror->message);
+		g_clear_error(&ierror);
+		return FALSE;
+	}
+
+	return memcmp(mtd->read_buf, expected, mtd->info.erasesize) == 0;
+}
+
+static gboolean mtd_erase_block(RaucMtd *mtd, loff_t offset, GError **error)
+{
+	struct erase_info_user ei = {
+		.start = offset,
+		.length = mtd->info.erasesize,
+	};
+
+	if (ioctl(mtd->fd, MEMERASE, &ei) < 0) {
+		int err = errno;
+		g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(err),
+				"Failed to erase block at 0x%llx on %s: %s",
+				(unsigned long long)offset, mtd->device, g_strerror(err));
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+/* Erases the block at offset. If erasing a NAND block fails with an I/O
+ * error, the block is marked bad and *bad is set. */
+static gboolean mtd_erase_block_or_mark_bad(RaucMtd *mtd, loff_t offset, gboolean *bad, GError **error)
+{
+	GError *ierror = NULL;
+
+	*bad = FALSE;
+
+	if (mtd_erase_block(mtd, offset, &ierror))
+		return TRUE;
+
+	if (!mtd->is_nand || !g_error_matches(ierror, G_FILE_ERROR, G_FILE_ERROR_IO)) {
+		g_propagate_error(error, ierror);
+		return FALSE;
+	}
+
+	g_warning("%s, marking it bad", ierror->message);
+	g_clear_error(&ierror);
+
+	if (ioctl(mtd->fd, MEMSETBADBLOCK, &offset) < 0) {
+		int err = errno;
+		g_set_error(error, R_MTD_ERROR, R_MTD_ERROR_IOCTL,
+				"Failed to mark block at 0x%llx on %s as bad: %s",
+				(unsigned long long)offset, mtd->device, g_strerror(err));
+		return FALSE;
+	}
+
+	*bad = TRUE;
+
+	return TRUE;
+}
+
+/* Erases all good blocks starting at offset. On NOR, blocks which are already
+ * erased are skipped. */
+static gboolean mtd_erase_from(RaucMtd *mtd, loff_t offset, GError **error)
+{
+	GError *ierror = NULL;
+
+	for (; (guint64)offset < mtd->size; offset += mtd->info.erasesize) {
+		gboolean bad;
+
+		if (!mtd_block_is_bad(mtd, offset, &bad, &ierror)) {
+			g_propagate_error(error, ierror);
+			return FALSE;
+		}
+		if (bad) {
+			g_message("Skipping bad block at 0x%llx", (unsigned long long)offset);
+			continue;
+		}
+
+		if (!mtd->is_nand && mtd_block_matches(mtd, offset, mtd->erased_buf))
+			continue;
+
+		if (!mtd_erase_block_or_mark_bad(mtd, offset, &bad, &ierror)) {
+			g_propagate_error(error, ierror);
+			return FALSE;
+		}
+	}
+
+	return TRUE;
+}
+
+gboolean r_mtd_erase(const gchar *device, GError **error)
+{
+	GError *ierror = NULL;
+	RaucMtd mtd = {.fd = -1};
+	gboolean res;
+
+	g_return_val_if_fail(device, FALSE);
+	g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
+
+	if (!mtd_open(&mtd, device, &ierror)) {
+		g_propagate_error(error, ierror);
+		return FALSE;
+	}
+
+	res = mtd_erase_from(&mtd, 0, &ierror);
+	if (!res)
+		g_propagate_error(error, ierror);
+
+	mtd_close(&mtd);
+
+	return res;
+}
+
+gboolean r_mtd_write_image(const gchar *image, const gchar *device, GError **error)
+{
+	GError *ierror = NULL;
+	RaucMtd mtd = {.fd = -1};
+	g_autofree guint8 *data = NULL;
+	g_auto(filedesc) image_fd = -1;
+	struct stat st;
+	goffset image_size;
+	goffset written = 0;
+	loff_t offset = 0;
+	guint blocks_skipped = 0;
+	guint blocks_written = 0;
+	gboolean res = FALSE;
+
+	g_return_val_if_fail(image, FALSE);
+	g_return_val_if_fail(device, FALSE);
+	g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
+
+	image_fd = g_open(image, O_RDONLY | O_CLOEXEC);
+	if (image_fd < 0) {
+		int err = errno;
+		g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(err),
+				"Failed to open %s: %s", image, g_strerror(err));
+		return FALSE;
+	}
+
+	if (fstat(image_fd, &st) != 0) {
+		int err = errno;
+		g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(err),
+				"Failed to stat %s: %s", image, g_strerror(err));
+		return FALSE;
+	}
+	image_size = st.st_size;
+
+	if (!mtd_open(&mtd, device, &ierror)) {
+		g_propagate_error(error, ierror);
+		return FALSE;
+	}
+
+	if ((guint64)image_size > mtd.size) {
+		g_set_error(error, R_MTD_ERROR, R_MTD_ERROR_NO_SPACE,
+				"Image %s (%"G_GOFFSET_FORMAT " bytes) is larger than %s (%"G_GUINT64_FORMAT " bytes)",
+				image, image_size, device, mtd.size);
+		goto out;
+	}
+
+	data = g_malloc(mtd.info.erasesize);
+
+	while (written < image_size) {
+		gsize len;
+		gboolean bad;
+
+		if ((guint64)offset >= mtd.size) {
+			g_set_error(error, R_MTD_ERROR, R_MTD_ERROR_NO_SPACE,
+					"Not enough good blocks on %s to write %s", device, image);
+			goto out;
+		}
+
+		if (!mtd_block_is_bad(&mtd, offset, &bad, &ierror)) {
+			g_propagate_error(error, ierror);
+			goto out;
+		}
+		if (bad) {
+			g_message("Skipping bad block at 0x%llx", (unsigned long long)offset);
+			offset += mtd.info.erasesize;
+			continue;
+		}
+
+		len = MIN((goffset)mtd.info.erasesize, image_size - written);
+		if (!r_pread_exact(image_fd, data, len, written, &ierror)) {
+			g_propagate_prefixed_error(error, ierror, "Failed to read %s: ", image);
+			goto out;
+		}
+		/* pad with the erased state */
+		memset(data + len, 0xff, mtd.info.erasesize - len);
+
+		/* NAND blocks are always erased and written, see mtd_block_matches() */
+		if (!mtd.is_nand && mtd_block_matches(&mtd, offset, data)) {
+			blocks_skipped++;
+		} else {
+			/* only full pages can be written on NAND */
+			gsize write_len = (len + mtd.info.writesize - 1) / mtd.info.writesize * mtd.info.writesize;
+
+			if (!mtd_erase_block_or_mark_bad(&mtd, offset, &bad, &ierror)) {
+				g_propagate_error(error, ierror);
+				goto out;
+			}
+			if (bad) {
+				/* retry the same data on the next block */
+				offset += mtd.info.erasesize;
+				continue;
+			}
+
+			if (!r_pwrite_exact(mtd.fd, data, write_len, offset, &ierror)) {
+				g_propagate_prefixed_error(error, ierror,
+						"Failed to write block at 0x%llx on %s: ",
+						(unsigned long long)offset, device);
+				goto out;
+			}
+
+			if (!mtd_block_matches(&mtd, offset, data)) {
+				g_set_error(error, R_MTD_ERROR, R_MTD_ERROR_FAILED,
+						"Verification of block at 0x%llx on %s failed",
+						(unsigned long long)offset, device);
+				goto out;
+			}
+			blocks_written++;
+		}
+
+		written += len;
+		offset += mtd.info.erasesize;
+		r_metrics_add_bytes(R_METRICS_SOURCE_BUNDLE, len);
+
+		/* emit progress info (but only when in progress context) */
+		if (r_context()->progress)
+			r_context_set_step_percentage("copy_image", written * 100 / image_size);
+	}
+
+	/* the remaining blocks are expected to be erased */
+	if (!mtd_erase_from(&mtd, offset, &ierror)) {
+		g_propagate_error(error, ierror);
+		goto out;
+	}
+
+	g_message("Wrote %s to %s (%u blocks written, %u blocks unchanged)",
+			image, device, blocks_written, blocks_skipped);
+
+	res = TRUE;
+
+out:
+	mtd_close(&mtd);
+	return res;
+}
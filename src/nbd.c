@@ -67,6 +67,7 @@ RaucNBDServer *r_nbd_new_server(void)
 	RaucNBDServer *nbd_srv = g_malloc0(sizeof(RaucNBDServer));
 
 	nbd_srv->sock = -1;
+	nbd_srv->stats_fd = -1;
 
 	return nbd_srv;
 }
@@ -82,6 +83,9 @@ void r_nbd_free_server(RaucNBDServer *nbd_srv)
 		}
 	}
 
+	if (nbd_srv->stats_fd >= 0)
+		g_close(nbd_srv->stats_fd, NULL);
+
 	g_free(nbd_srv->url);
 	g_free(nbd_srv->tls_cert);
 	g_free(nbd_srv->tls_key);
@@ -340,6 +344,7 @@ struct RaucNBDTransfer {
 	struct nbd_reply reply;
 	gboolean done;
 	guint errors;
+	gint64 trace_begin; /* first attempt, kept across retries */
 
 	guint8 *buffer;
 	curl_off_t buffer_size;
@@ -681,6 +686,9 @@ static void start_configure(struct RaucNBDContext *ctx, struct RaucNBDTransfer *
 
 static void start_request(struct RaucNBDContext *ctx, struct RaucNBDTransfer *xfer)
 {
+	if (!xfer->trace_begin)
+		xfer->trace_begin = r_trace_begin();
+
 	switch (xfer->request.type) {
 		case NBD_CMD_READ: {
 			start_read(ctx, xfer);
@@ -863,10 +871,14 @@ static gboolean finish_request(struct RaucNBDContext *ctx, struct RaucNBDTransfe
 	switch (xfer->request.type) {
 		case NBD_CMD_READ: {
 			res = finish_read(ctx, xfer);
+			if (xfer->done)
+				r_trace_end(R_TRACE_CAT_NBD, "read", xfer->trace_begin, xfer->request.len);
 			break;
 		}
 		case RAUC_NBD_CMD_CONFIGURE: {
 			res = finish_configure(ctx, xfer);
+			if (xfer->done)
+				r_trace_end(R_TRACE_CAT_NBD, "configure", xfer->trace_begin, 0);
 			break;
 		}
 		default: {
@@ -884,6 +896,27 @@ static gboolean finish_request(struct RaucNBDContext *ctx, struct RaucNBDTransfe
 	return res;
 }
 
+/* Sends the statistics to the parent process, which publishes them. */
+static void send_stats(struct RaucNBDContext *ctx)
+{
+	g_autoptr(GError) ierror = NULL;
+	g_auto(filedesc) fd = RAUC_STATS_FD;
+	g_autoptr(GVariant) v = NULL;
+	GVariantBuilder builder;
+	const RaucStats *all[] = {
+		ctx->dl_size, ctx->dl_speed, ctx->namelookup,
+		ctx->connect, ctx->starttransfer, ctx->total,
+	};
+
+	g_variant_builder_init(&builder, G_VARIANT_TYPE("aa{sv}"));
+	for (guint i = 0; i < G_N_ELEMENTS(all); i++)
+		g_variant_builder_add_value(&builder, r_stats_to_variant(all[i], TRUE));
+	v = g_variant_ref_sink(g_variant_builder_end(&builder));
+
+	if (!r_write_exact(fd, g_variant_get_data(v), g_variant_get_size(v), &ierror))
+		g_message("failed to send nbd statistics: %s", ierror->message);
+}
+
 gboolean r_nbd_run_server(gint sock, GError **error)
 {
 	GError *ierror = NULL;
@@ -1033,6 +1066,9 @@ out:
 		g_message("downloaded %.1f%% of the full bundle", percent_dl);
 	}
 
+	if (g_getenv("RAUC_NBD_STATS"))
+		send_stats(&ctx);
+
 	g_clear_pointer(&ctx.url, g_free);
 	g_clear_pointer(&ctx.tls_cert, g_free);
 	g_clear_pointer(&ctx.tls_key, g_free);
@@ -1326,8 +1362,10 @@ gboolean r_nbd_start_server(RaucNBDServer *nbd_srv, GError **error)
 	if (1) { /* subprocess */
 		g_auto(child_setup_args) child_args = {0};
 		g_autofree gchar *executable = NULL;
+		g_autofree gchar *trace_path = NULL;
 		g_autoptr(GSubprocessLauncher) launcher = NULL;
 		g_autoptr(GPtrArray) args = g_ptr_array_new_full(3, g_free);
+		int stats_pipe[2];
 
 		if (!nbd_server_child_prepare(&child_args, &ierror)) {
 			g_propagate_prefixed_error(
@@ -1348,9 +1386,39 @@ gboolean r_nbd_start_server(RaucNBDServer *nbd_srv, GError **error)
 		launcher = g_subprocess_launcher_new(G_SUBPROCESS_FLAGS_NONE);
 		g_subprocess_launcher_set_child_setup(launcher, nbd_server_child_setup, &child_args, NULL);
 		g_subprocess_launcher_setenv(launcher, "RAUC_NBD_SERVER", "", TRUE);
+
+		/* the server process records its requests to a separate trace file */
+		trace_path = r_trace_get_aux_path("nbd");
+		if (trace_path) {
+			int trace_fd = g_open(trace_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+
+			if (trace_fd < 0) {
+				int err = errno;
+				g_warning("Failed to open NBD trace file %s: %s", trace_path, g_strerror(err));
+			} else {
+				g_subprocess_launcher_take_fd(launcher, trace_fd, RAUC_TRACE_FD);
+				g_subprocess_launcher_setenv(launcher, "RAUC_NBD_TRACE",
+						r_trace_get_format() == R_TRACE_FORMAT_BINARY ? "binary" : "json", TRUE);
+			}
+		}
 		g_subprocess_launcher_take_fd(launcher, sockets[0], RAUC_SOCKET_FD);
 		sockets[0] = -1; /* GSubprocessLauncher takes ownership */
 
+		/* the server process returns its statistics when exiting */
+		if (pipe2(stats_pipe, O_CLOEXEC) < 0) {
+			int err = errno;
+			g_set_error(
+					error,
+					G_IO_ERROR, g_io_error_from_errno(err),
+					"failed to create statistics pipe: %s",
+					g_strerror(err));
+			res = FALSE;
+			goto out;
+		}
+		g_subprocess_launcher_take_fd(launcher, stats_pipe[1], RAUC_STATS_FD);
+		g_subprocess_launcher_setenv(launcher, "RAUC_NBD_STATS", "", TRUE);
+		nbd_srv->stats_fd = stats_pipe[0];
+
 		nbd_srv->sproc = r_subprocess_launcher_spawnv(launcher, args, &ierror);
 		if (nbd_srv->sproc == NULL) {
 			g_propagate_prefixed_error(
@@ -1387,6 +1455,62 @@ out:
 	return res;
 }
 
+/* Receives the statistics sent by send_stats() and publishes them. */
+/* far more than the statistics of the server process need */
+#define NBD_STATS_MAX_SIZE (1024 * 1024)
+
+static void receive_stats(int fd)
+{
+	g_autoptr(GByteArray) buf = g_byte_array_new();
+	g_autoptr(GBytes) data = NULL;
+	g_autoptr(GVariant) v = NULL;
+	gsize discarded = 0;
+	GVariantIter iter;
+	GVariant *dict;
+
+	while (TRUE) {
+		guint8 tmp[4096];
+		ssize_t len = read(fd, tmp, sizeof(tmp));
+		if (len < 0 && errno == EINTR) {
+			continue;
+		} else if (len < 0) {
+			g_message("failed to receive nbd statistics: %s", g_strerror(errno));
+			return;
+		} else if (len == 0) {
+			break;
+		}
+		/* keep reading until EOF, but do not store more than the limit */
+		if (discarded || buf->len + len > NBD_STATS_MAX_SIZE)
+			discarded += len;
+		else
+			g_byte_array_append(buf, tmp, len);
+	}
+
+	if (discarded) {
+		g_message("ignoring nbd statistics larger than %d bytes", NBD_STATS_MAX_SIZE);
+		return;
+	}
+
+	if (!buf->len)
+		return;
+
+	data = g_byte_array_free_to_bytes(g_steal_pointer(&buf));
+	/* the data comes from the unprivileged process, so it is not trusted */
+	v = g_variant_ref_sink(g_variant_new_from_bytes(G_VARIANT_TYPE("aa{sv}"), data, FALSE));
+
+	g_variant_iter_init(&iter, v);
+	while ((dict = g_variant_iter_next_value(&iter))) {
+		g_autoptr(GError) ierror = NULL;
+		g_autoptr(RaucStats) stats = r_stats_from_variant(dict, &ierror);
+
+		if (stats)
+			r_stats_publish(stats);
+		else
+			g_message("ignoring invalid nbd statistics: %s", ierror->message);
+		g_variant_unref(dict);
+	}
+}
+
 gboolean r_nbd_stop_server(RaucNBDServer *nbd_srv, GError **error)
 {
 	GError *ierror = NULL;
@@ -1417,6 +1541,13 @@ gboolean r_nbd_stop_server(RaucNBDServer *nbd_srv, GError **error)
 		nbd_srv->sock = -1;
 	}
 
+	/* the pipe is closed when the server process exits */
+	if (nbd_srv->stats_fd >= 0) {
+		receive_stats(nbd_srv->stats_fd);
+		g_close(nbd_srv->stats_fd, NULL);
+		nbd_srv->stats_fd = -1;
+	}
+
 	res = g_subprocess_wait_check(nbd_srv->sproc, NULL, &ierror);
 	if (!res) {
 		g_propagate_prefixed_error(
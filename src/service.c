@@ -8,18 +8,45 @@
 #include "bootchooser.h"
 #include "config_file.h"
 #include "context.h"
+#include "inspect_cache.h"
 #include "install.h"
 #include "mark.h"
+#include "metrics.h"
 #include "rauc-installer-generated.h"
 #include "service.h"
+#include "signature.h"
+#include "stats.h"
 #include "status_file.h"
 #include "utils.h"
 
 G_DEFINE_QUARK(r-service-error-quark, r_service_error)
 
+/* interval (in seconds) for updating the Metrics property while installing */
+#define METRICS_UPDATE_INTERVAL 1
+
 GMainLoop *service_loop = NULL;
 RInstaller *r_installer = NULL;
 guint r_bus_name_id = 0;
+static guint metrics_timeout_id = 0;
+
+static void update_metrics(void)
+{
+	r_installer_set_metrics(r_installer, r_metrics_to_variant());
+	g_dbus_interface_skeleton_flush(G_DBUS_INTERFACE_SKELETON(r_installer));
+}
+
+static gboolean metrics_timeout(gpointer user_data)
+{
+	update_metrics();
+
+	return G_SOURCE_CONTINUE;
+}
+
+static void start_metrics_updates(void)
+{
+	if (!metrics_timeout_id)
+		metrics_timeout_id = g_timeout_add_seconds(METRICS_UPDATE_INTERVAL, metrics_timeout, NULL);
+}
 
 static gboolean service_install_notify(gpointer data)
 {
@@ -45,6 +72,9 @@ static gboolean service_install_cleanup(gpointer data)
 	} else {
 		g_message("installing `%s` failed: %d", args->name, args->status_result);
 	}
+	g_clear_handle_id(&metrics_timeout_id, g_source_remove);
+	/* publish the final metrics before signaling completion */
+	update_metrics();
 	r_installer_emit_completed(r_installer, args->status_result);
 	r_installer_set_operation(r_installer, "idle");
 	g_dbus_interface_skeleton_flush(G_DBUS_INTERFACE_SKELETON(r_installer));
@@ -77,6 +107,105 @@ static void convert_dict_to_bundle_access_args(
 		g_variant_dict_remove(dict, "http-headers");
 }
 
+/* A bundle which was checked and mounted by InspectBundle with
+ * 'open-session', to be used by a following InstallBundle */
+typedef struct {
+	gchar *token;
+	gchar *source;
+	RaucBundle *bundle;
+	guint timeout_id;
+} RaucInspectSession;
+
+/* time after which an unused session is closed */
+#define INSPECT_SESSION_TIMEOUT_SECONDS (10 * 60)
+
+static RaucInspectSession *inspect_session = NULL;
+
+/* Closes the current session. The bundle is unmounted unless it was taken
+ * over by an installation. */
+static void inspect_session_close(void)
+{
+	GError *ierror = NULL;
+
+	if (!inspect_session)
+		return;
+
+	if (inspect_session->timeout_id)
+		g_source_remove(inspect_session->timeout_id);
+
+	if (inspect_session->bundle) {
+		g_message("Closing inspection session for %s", inspect_session->source);
+		if (inspect_session->bundle->mount_point && !umount_bundle(inspect_session->bundle, &ierror)) {
+			g_warning("Failed to unmount bundle: %s", ierror->message);
+			g_clear_error(&ierror);
+		}
+		free_bundle(inspect_session->bundle);
+	}
+
+	g_free(inspect_session->token);
+	g_free(inspect_session->source);
+	g_clear_pointer(&inspect_session, g_free);
+}
+
+static gboolean inspect_session_timeout(gpointer user_data)
+{
+	inspect_session->timeout_id = 0;
+	inspect_session_close();
+
+	return G_SOURCE_REMOVE;
+}
+
+/* Mounts the bundle and keeps it open in a new session. Takes ownership of
+ * the bundle and returns the session token. */
+static gchar *inspect_session_open(const gchar *source, RaucBundle *bundle, GError **error)
+{
+	GError *ierror = NULL;
+	g_autoptr(RaucBundle) owned = bundle;
+
+	/* only one bundle can be mounted at a time */
+	inspect_session_close();
+
+	/* plain bundles only provide their manifest after mounting, which
+	 * would bypass the checks done by install before mounting */
+	if (!owned->manifest) {
+		g_set_error_literal(error, R_SERVICE_ERROR, R_SERVICE_ERROR_FAILED,
+				"Sessions are not supported for plain bundles");
+		return NULL;
+	}
+
+	if (!mount_bundle(owned, &ierror)) {
+		g_propagate_prefixed_error(error, ierror, "Failed mounting bundle: ");
+		return NULL;
+	}
+
+	inspect_session = g_new0(RaucInspectSession, 1);
+	inspect_session->token = g_uuid_string_random();
+	inspect_session->source = g_strdup(source);
+	inspect_session->bundle = g_steal_pointer(&owned);
+	inspect_session->timeout_id = g_timeout_add_seconds(INSPECT_SESSION_TIMEOUT_SECONDS,
+			inspect_session_timeout, NULL);
+
+	g_message("Opened inspection session for %s", source);
+
+	return g_strdup(inspect_session->token);
+}
+
+/* Takes the bundle from the session matching token and source. */
+static RaucBundle *inspect_session_take(const gchar *token, const gchar *source)
+{
+	RaucBundle *bundle;
+
+	if (!inspect_session ||
+	    g_strcmp0(inspect_session->token, token) != 0 ||
+	    g_strcmp0(inspect_session->source, source) != 0)
+		return NULL;
+
+	bundle = g_steal_pointer(&inspect_session->bundle);
+	inspect_session_close();
+
+	return bundle;
+}
+
 static gboolean r_on_handle_install_bundle(
 		RInstaller *interface,
 		GDBusMethodInvocation *invocation,
@@ -89,6 +218,7 @@ static gboolean r_on_handle_install_bundle(
 	GVariantIter iter;
 	gchar *key;
 	g_autofree gchar *message = NULL;
+	g_autofree gchar *session = NULL;
 	gboolean res;
 
 	g_print("input bundle: %s\n", source);
@@ -116,6 +246,9 @@ static gboolean r_on_handle_install_bundle(
 	if (g_variant_dict_lookup(&dict, "require-manifest-hash", "s", &args->require_manifest_hash))
 		g_variant_dict_remove(&dict, "require-manifest-hash");
 
+	if (g_variant_dict_lookup(&dict, "session", "s", &session))
+		g_variant_dict_remove(&dict, "session");
+
 	convert_dict_to_bundle_access_args(&dict, &args->access_args);
 
 	/* Check for unhandled keys */
@@ -129,10 +262,24 @@ static gboolean r_on_handle_install_bundle(
 		goto out;
 	}
 
+	if (session) {
+		args->bundle = inspect_session_take(session, source);
+		if (!args->bundle) {
+			message = g_strdup("Unknown or expired session");
+			res = FALSE;
+			args->status_result = 2;
+			goto out;
+		}
+	} else {
+		/* the session's bundle would block mounting another one */
+		inspect_session_close();
+	}
+
 	r_config_file_modified_check();
 
 	r_installer_set_operation(r_installer, "installing");
 	g_dbus_interface_skeleton_flush(G_DBUS_INTERFACE_SKELETON(r_installer));
+	start_metrics_updates();
 	install_run(args);
 	args = NULL;
 
@@ -171,6 +318,11 @@ static gboolean r_on_handle_inspect_bundle(RInstaller *interface,
 	g_autoptr(RaucManifest) manifest = NULL;
 	g_autoptr(RaucBundle) bundle = NULL;
 	g_autofree gchar *message = NULL;
+	RaucInspectCacheEntry identity = {0};
+	const RaucInspectCacheEntry *cached = NULL;
+	gboolean cacheable = FALSE;
+	gboolean open_session = FALSE;
+	g_autoptr(GVariant) session_info = NULL;
 	GError *error = NULL;
 	gboolean res = TRUE;
 
@@ -182,6 +334,9 @@ static gboolean r_on_handle_inspect_bundle(RInstaller *interface,
 		goto out;
 	}
 
+	if (g_variant_dict_lookup(&dict, "open-session", "b", &open_session))
+		g_variant_dict_remove(&dict, "open-session");
+
 	convert_dict_to_bundle_access_args(&dict, &access_args);
 
 	/* Check for unhandled keys */
@@ -194,6 +349,14 @@ static gboolean r_on_handle_inspect_bundle(RInstaller *interface,
 		goto out;
 	}
 
+	if (!open_session)
+		cached = r_inspect_cache_lookup(arg_bundle);
+	if (cached) {
+		g_message("Using cached inspection result for %s", arg_bundle);
+		goto out;
+	}
+	cacheable = r_inspect_cache_identity(arg_bundle, &identity);
+
 	g_assert(access_args.http_info_headers == NULL);
 	access_args.http_info_headers = assemble_info_headers(NULL);
 
@@ -204,6 +367,28 @@ static gboolean r_on_handle_inspect_bundle(RInstaller *interface,
 		goto out;
 	}
 
+	if (open_session) {
+		g_autofree gchar *token = NULL;
+		g_autoptr(GVariant) info = NULL;
+		GVariantDict info_dict;
+
+		if (bundle->manifest)
+			info = g_variant_ref_sink(r_manifest_to_dict(bundle->manifest));
+
+		token = inspect_session_open(arg_bundle, g_steal_pointer(&bundle), &error);
+		if (!token) {
+			message = g_strdup(error->message);
+			g_clear_error(&error);
+			res = FALSE;
+			goto out;
+		}
+
+		g_variant_dict_init(&info_dict, info);
+		g_variant_dict_insert(&info_dict, "session", "s", token);
+		session_info = g_variant_ref_sink(g_variant_dict_end(&info_dict));
+		goto out;
+	}
+
 	if (bundle->manifest) {
 		manifest = g_steal_pointer(&bundle->manifest);
 	} else {
@@ -215,7 +400,12 @@ static gboolean r_on_handle_inspect_bundle(RInstaller *interface,
 		}
 	}
 
+	if (cacheable)
+		r_inspect_cache_insert(arg_bundle, &identity, manifest);
+
 out:
+	r_inspect_cache_identity_clear(&identity);
+
 	if (!res) {
 		g_dbus_method_invocation_return_error(invocation,
 				G_IO_ERROR,
@@ -224,7 +414,15 @@ out:
 		return TRUE;
 	}
 
-	if (arg_args) {
+	if (session_info) {
+		r_installer_complete_inspect_bundle(interface, invocation, session_info);
+	} else if (cached) {
+		if (arg_args)
+			r_installer_complete_inspect_bundle(interface, invocation, cached->info);
+		else
+			r_installer_complete_info(interface, invocation,
+					cached->compatible, cached->version ? cached->version : "");
+	} else if (arg_args) {
 		GVariant *info_variant;
 
 		info_variant = r_manifest_to_dict(manifest);
@@ -499,6 +697,16 @@ static gboolean r_on_handle_get_primary(RInstaller *interface,
 	return TRUE;
 }
 
+static gboolean r_on_handle_get_statistics(RInstaller *interface,
+		GDBusMethodInvocation  *invocation)
+{
+	/* the published statistics are only read, so this is allowed while
+	 * an installation is running */
+	r_installer_complete_get_statistics(interface, invocation, r_stats_get_published(TRUE));
+
+	return TRUE;
+}
+
 static gboolean auto_install(const gchar *source)
 {
 	RaucInstallArgs *args = install_args_new();
@@ -517,6 +725,7 @@ static gboolean auto_install(const gchar *source)
 	args->notify = service_install_notify;
 	args->cleanup = service_install_cleanup;
 
+	start_metrics_updates();
 	install_run(args);
 	args = NULL;
 
@@ -582,6 +791,10 @@ static void r_on_bus_acquired(GDBusConnection *connection,
 			G_CALLBACK(r_on_handle_get_primary),
 			NULL);
 
+	g_signal_connect(r_installer, "handle-get-statistics",
+			G_CALLBACK(r_on_handle_get_statistics),
+			NULL);
+
 	r_context_register_progress_callback(send_progress_callback);
 
 	// Set initial Operation status to "idle"
@@ -598,6 +811,7 @@ static void r_on_bus_acquired(GDBusConnection *connection,
 	r_installer_set_compatible(r_installer, r_context()->config->system_compatible);
 	r_installer_set_variant(r_installer, r_context()->config->system_variant);
 	r_installer_set_boot_slot(r_installer, r_context()->bootslot);
+	r_installer_set_metrics(r_installer, r_metrics_to_variant());
 }
 
 static void r_on_name_acquired(GDBusConnection *connection,
@@ -655,6 +869,9 @@ gboolean r_service_run(GError **error)
 	service_loop = g_main_loop_new(NULL, FALSE);
 	g_unix_signal_add(SIGTERM, r_on_signal, NULL);
 
+	/* avoid reloading the keyring for each bundle check */
+	r_signature_set_keyring_cache(TRUE);
+
 	r_installer = r_installer_skeleton_new();
 
 	r_bus_name_id = g_bus_own_name(bus_type,
@@ -677,6 +894,9 @@ gboolean r_service_run(GError **error)
 	if (r_bus_name_id)
 		g_bus_unown_name(r_bus_name_id);
 
+	inspect_session_close();
+	r_signature_set_keyring_cache(FALSE);
+
 	g_clear_pointer(&service_loop, g_main_loop_unref);
 
 	g_clear_pointer(&r_installer, g_object_unref);
@@ -10,6 +10,7 @@
 #endif
 #include <openssl/x509.h>
 #include <string.h>
+#include <sys/stat.h>
 
 #include "context.h"
 #include "signature.h"
@@ -492,18 +493,12 @@ static gboolean contains_crl(const gchar *load_capath, const gchar *load_cadir)
 	return FALSE;
 }
 
-X509_STORE* setup_x509_store(const gchar *capath, const gchar *cadir, GError **error)
+/* Creates an empty store with the configured verification parameters. */
+static X509_STORE *new_x509_store(GError **error)
 {
-	const gchar *load_capath = r_context()->config->keyring_path;
-	const gchar *load_cadir = r_context()->config->keyring_directory;
 	const gchar *check_purpose = r_context()->config->keyring_check_purpose;
 	g_autoptr(X509_STORE) store = NULL;
 
-	if (capath)
-		load_capath = strlen(capath) ? capath : NULL;
-	if (cadir)
-		load_cadir = strlen(cadir) ? cadir : NULL;
-
 	if (!(store = X509_STORE_new())) {
 		g_set_error_literal(
 				error,
@@ -512,20 +507,10 @@ X509_STORE* setup_x509_store(const gchar *capath, const gchar *cadir, GError **e
 				"failed to allocate new X509 store");
 		return NULL;
 	}
-	if (!X509_STORE_load_locations(store, load_capath, load_cadir)) {
-		g_set_error(
-				error,
-				R_SIGNATURE_ERROR,
-				R_SIGNATURE_ERROR_CA_LOAD,
-				"failed to load CA file '%s' and/or directory '%s'", load_capath, load_cadir);
-		return NULL;
-	}
 
 	/* Enable CRL checking if configured */
 	if (r_context()->config->keyring_check_crl)
 		X509_STORE_set_flags(store, X509_V_FLAG_CRL_CHECK | X509_V_FLAG_CRL_CHECK_ALL | X509_V_FLAG_EXTENDED_CRL_SUPPORT);
-	else if (contains_crl(load_capath, load_cadir))
-		g_warning("Detected CRL but CRL checking is disabled!");
 
 	/* Allow partial chain if configured */
 	if (r_context()->config->keyring_allow_partial_chain)
@@ -547,6 +532,251 @@ X509_STORE* setup_x509_store(const gchar *capath, const gchar *cadir, GError **e
 	return g_steal_pointer(&store);
 }
 
+static X509_STORE *load_x509_store(const gchar *load_capath, const gchar *load_cadir, GError **error)
+{
+	GError *ierror = NULL;
+	g_autoptr(X509_STORE) store = NULL;
+
+	if (!(store = new_x509_store(&ierror))) {
+		g_propagate_error(error, ierror);
+		return NULL;
+	}
+	if (!X509_STORE_load_locations(store, load_capath, load_cadir)) {
+		g_set_error(
+				error,
+				R_SIGNATURE_ERROR,
+				R_SIGNATURE_ERROR_CA_LOAD,
+				"failed to load CA file '%s' and/or directory '%s'", load_capath, load_cadir);
+		return NULL;
+	}
+
+	return g_steal_pointer(&store);
+}
+
+/* The parsed keyring file, kept by the service between bundle checks. Each
+ * caller gets its own X509_STORE sharing these certificates and CRLs, as the
+ * verification parameters are adjusted per bundle. */
+static struct {
+	gboolean enabled;
+	gchar *stamp;
+	X509_STORE *store;
+	gboolean has_crl;
+} keyring_cache;
+G_LOCK_DEFINE_STATIC(keyring_cache);
+
+static void keyring_stamp_append(GString *stamp, const gchar *path)
+{
+	struct stat st;
+
+	if (stat(path, &st) != 0) {
+		g_string_append_printf(stamp, "%s missing\n", path);
+		return;
+	}
+
+	/* the ctime also changes if the content is modified with the mtime
+	 * preserved */
+	g_string_append_printf(stamp, "%s %" G_GUINT64_FORMAT " %" G_GUINT64_FORMAT " %" G_GINT64_FORMAT " %" G_GINT64_FORMAT ".%09ld %" G_GINT64_FORMAT ".%09ld\n",
+			path, (guint64)st.st_dev, (guint64)st.st_ino, (gint64)st.st_size,
+			(gint64)st.st_mtim.tv_sec, st.st_mtim.tv_nsec,
+			(gint64)st.st_ctim.tv_sec, st.st_ctim.tv_nsec);
+}
+
+/*
+ * Describes the current state of the keyring files and the options used to
+ * load them, so that any change invalidates the cache. Files added to or
+ * removed from the directory change its mtime, files modified in place are
+ * detected by their own stat information.
+ */
+static gchar *keyring_stamp(const gchar *load_capath, const gchar *load_cadir)
+{
+	GString *stamp = g_string_new(NULL);
+
+	g_string_append_printf(stamp, "crl=%d partial=%d purpose=%s\n",
+			r_context()->config->keyring_check_crl,
+			r_context()->config->keyring_allow_partial_chain,
+			r_context()->config->keyring_check_purpose);
+
+	if (load_capath)
+		keyring_stamp_append(stamp, load_capath);
+
+	if (load_cadir) {
+		g_autoptr(GDir) dir = NULL;
+		const gchar *filename;
+
+		keyring_stamp_append(stamp, load_cadir);
+
+		dir = g_dir_open(load_cadir, 0, NULL);
+		while (dir && (filename = g_dir_read_name(dir))) {
+			g_autofree gchar *path = g_build_filename(load_cadir, filename, NULL);
+
+			keyring_stamp_append(stamp, path);
+		}
+	}
+
+	return g_string_free(stamp, FALSE);
+}
+
+/* Creates a new store with the certificates, CRLs and verification parameters
+ * of the given one. */
+static X509_STORE *copy_x509_store(X509_STORE *src, GError **error)
+{
+	g_autoptr(X509_STORE) store = NULL;
+	STACK_OF(X509_OBJECT) *objects = X509_STORE_get0_objects(src);
+
+	if (!(store = X509_STORE_new())) {
+		g_set_error_literal(
+				error,
+				R_SIGNATURE_ERROR,
+				R_SIGNATURE_ERROR_X509_NEW,
+				"failed to allocate new X509 store");
+		return NULL;
+	}
+
+	for (int i = 0; i < sk_X509_OBJECT_num(objects); i++) {
+		X509_OBJECT *obj = sk_X509_OBJECT_value(objects, i);
+		X509 *cert = X509_OBJECT_get0_X509(obj);
+		X509_CRL *crl = X509_OBJECT_get0_X509_CRL(obj);
+
+		if ((cert && !X509_STORE_add_cert(store, cert)) ||
+		    (crl && !X509_STORE_add_crl(store, crl))) {
+			g_set_error_literal(
+					error,
+					R_SIGNATURE_ERROR,
+					R_SIGNATURE_ERROR_CA_LOAD,
+					"failed to copy cached keyring");
+			return NULL;
+		}
+	}
+
+	if (!X509_VERIFY_PARAM_set1(X509_STORE_get0_param(store), X509_STORE_get0_param(src))) {
+		g_set_error_literal(
+				error,
+				R_SIGNATURE_ERROR,
+				R_SIGNATURE_ERROR_X509_NEW,
+				"failed to copy keyring verification parameters");
+		return NULL;
+	}
+
+	return g_steal_pointer(&store);
+}
+
+/* Only the keyring file is cached. Certificates in the keyring directory are
+ * looked up by hash during verification, so adding the directory to the new
+ * store is cheap. */
+static X509_STORE *keyring_cache_get(const gchar *load_capath, const gchar *load_cadir, gboolean *has_crl, GError **error)
+{
+	GError *ierror = NULL;
+	g_autofree gchar *stamp = keyring_stamp(load_capath, load_cadir);
+	g_autoptr(X509_STORE) store = NULL;
+
+	if (!load_capath && !load_cadir) {
+		g_set_error(
+				error,
+				R_SIGNATURE_ERROR,
+				R_SIGNATURE_ERROR_CA_LOAD,
+				"failed to load CA file '%s' and/or directory '%s'", load_capath, load_cadir);
+		return NULL;
+	}
+
+	G_LOCK(keyring_cache);
+
+	if (!keyring_cache.store || g_strcmp0(stamp, keyring_cache.stamp) != 0) {
+		g_clear_pointer(&keyring_cache.store, X509_STORE_free);
+		g_clear_pointer(&keyring_cache.stamp, g_free);
+
+		g_debug("Loading keyring");
+		keyring_cache.store = new_x509_store(&ierror);
+		if (!keyring_cache.store) {
+			G_UNLOCK(keyring_cache);
+			g_propagate_error(error, ierror);
+			return NULL;
+		}
+		if (load_capath && !X509_STORE_load_locations(keyring_cache.store, load_capath, NULL)) {
+			g_clear_pointer(&keyring_cache.store, X509_STORE_free);
+			G_UNLOCK(keyring_cache);
+			g_set_error(
+					error,
+					R_SIGNATURE_ERROR,
+					R_SIGNATURE_ERROR_CA_LOAD,
+					"failed to load CA file '%s'", load_capath);
+			return NULL;
+		}
+		keyring_cache.stamp = g_steal_pointer(&stamp);
+		keyring_cache.has_crl = !r_context()->config->keyring_check_crl &&
+		                        contains_crl(load_capath, load_cadir);
+	}
+
+	store = copy_x509_store(keyring_cache.store, &ierror);
+	*has_crl = keyring_cache.has_crl;
+
+	G_UNLOCK(keyring_cache);
+
+	if (!store) {
+		g_propagate_error(error, ierror);
+		return NULL;
+	}
+
+	if (load_cadir && !X509_STORE_load_locations(store, NULL, load_cadir)) {
+		g_set_error(
+				error,
+				R_SIGNATURE_ERROR,
+				R_SIGNATURE_ERROR_CA_LOAD,
+				"failed to load CA directory '%s'", load_cadir);
+		return NULL;
+	}
+
+	return g_steal_pointer(&store);
+}
+
+void r_signature_set_keyring_cache(gboolean enabled)
+{
+	G_LOCK(keyring_cache);
+
+	keyring_cache.enabled = enabled;
+	if (!enabled) {
+		g_clear_pointer(&keyring_cache.store, X509_STORE_free);
+		g_clear_pointer(&keyring_cache.stamp, g_free);
+	}
+
+	G_UNLOCK(keyring_cache);
+}
+
+gchar* r_signature_get_keyring_stamp(void)
+{
+	return keyring_stamp(r_context()->config->keyring_path,
+			r_context()->config->keyring_directory);
+}
+
+X509_STORE* setup_x509_store(const gchar *capath, const gchar *cadir, GError **error)
+{
+	const gchar *load_capath = r_context()->config->keyring_path;
+	const gchar *load_cadir = r_context()->config->keyring_directory;
+	g_autoptr(X509_STORE) store = NULL;
+	gboolean has_crl = FALSE;
+
+	if (!capath && !cadir && g_atomic_int_get(&keyring_cache.enabled)) {
+		store = keyring_cache_get(load_capath, load_cadir, &has_crl, error);
+		if (!store)
+			return NULL;
+	} else {
+		if (capath)
+			load_capath = strlen(capath) ? capath : NULL;
+		if (cadir)
+			load_cadir = strlen(cadir) ? cadir : NULL;
+
+		store = load_x509_store(load_capath, load_cadir, error);
+		if (!store)
+			return NULL;
+		has_crl = !r_context()->config->keyring_check_crl &&
+		          contains_crl(load_capath, load_cadir);
+	}
+
+	if (has_crl)
+		g_warning("Detected CRL but CRL checking is disabled!");
+
+	return g_steal_pointer(&store);
+}
+
 GBytes *cms_sign(GBytes *content, gboolean detached, const gchar *certfile, const gchar *keyfile, gchar **interfiles, GError **error)
 {
 	GError *ierror = NULL;
@@ -1705,21 +1935,14 @@ out:
 	return res;
 }
 
-GBytes *cms_encrypt(GBytes *content, gchar **recipients, GError **error)
+STACK_OF(X509) *cms_load_recipients(gchar **recipients, GError **error)
 {
 	GError *ierror = NULL;
-	BIO *incontent = NULL;
-	BIO *outsig = BIO_new(BIO_s_mem());
 	g_autoptr(R_X509_STACK_POP) recipcerts = NULL;
-	g_autoptr(CMS_ContentInfo) cms = NULL;
-	GBytes *res = NULL;
 
-	g_return_val_if_fail(content, NULL);
 	g_return_val_if_fail(recipients, NULL);
 	g_return_val_if_fail(error == NULL || *error == NULL, NULL);
 
-	incontent = bytes_as_bio(content);
-
 	recipcerts = sk_X509_new_null();
 
 	/* load all recipient certificates from all provided PEM files */
@@ -1727,7 +1950,7 @@ GBytes *cms_encrypt(GBytes *content, gchar **recipients, GError **error)
 		g_autoptr(R_X509_STACK) filecerts = load_certs_from_file(*recipcertpath, &ierror);
 		if (filecerts == NULL) {
 			g_propagate_error(error, ierror);
-			goto out;
+			return NULL;
 		}
 
 		/* add all recipient certs from recent file */
@@ -1736,6 +1959,22 @@ GBytes *cms_encrypt(GBytes *content, gchar **recipients, GError **error)
 		}
 	}
 
+	return g_steal_pointer(&recipcerts);
+}
+
+GBytes *cms_encrypt_certs(GBytes *content, STACK_OF(X509) *recipcerts, GError **error)
+{
+	BIO *incontent = NULL;
+	BIO *outsig = BIO_new(BIO_s_mem());
+	g_autoptr(CMS_ContentInfo) cms = NULL;
+	GBytes *res = NULL;
+
+	g_return_val_if_fail(content, NULL);
+	g_return_val_if_fail(recipcerts, NULL);
+	g_return_val_if_fail(error == NULL || *error == NULL, NULL);
+
+	incontent = bytes_as_bio(content);
+
 	cms = CMS_encrypt(recipcerts, incontent, EVP_aes_256_cbc(), CMS_BINARY);
 	if (cms == NULL) {
 		g_set_error(
@@ -1764,8 +2003,6 @@ GBytes *cms_encrypt(GBytes *content, gchar **recipients, GError **error)
 		goto out;
 	}
 
-	g_message("Encrypted for %d recipient%s", sk_X509_num(recipcerts), sk_X509_num(recipcerts) > 1 ? "s" : "");
-
 out:
 	ERR_print_errors_fp(stdout);
 	BIO_free_all(incontent);
@@ -1773,6 +2010,33 @@ out:
 	return res;
 }
 
+GBytes *cms_encrypt(GBytes *content, gchar **recipients, GError **error)
+{
+	GError *ierror = NULL;
+	g_autoptr(R_X509_STACK_POP) recipcerts = NULL;
+	GBytes *res = NULL;
+
+	g_return_val_if_fail(content, NULL);
+	g_return_val_if_fail(recipients, NULL);
+	g_return_val_if_fail(error == NULL || *error == NULL, NULL);
+
+	recipcerts = cms_load_recipients(recipients, &ierror);
+	if (recipcerts == NULL) {
+		g_propagate_error(error, ierror);
+		return NULL;
+	}
+
+	res = cms_encrypt_certs(content, recipcerts, &ierror);
+	if (res == NULL) {
+		g_propagate_error(error, ierror);
+		return NULL;
+	}
+
+	g_message("Encrypted for %d recipient%s", sk_X509_num(recipcerts), sk_X509_num(recipcerts) > 1 ? "s" : "");
+
+	return res;
+}
+
 GBytes *cms_decrypt(GBytes *content, const gchar *certfile, const gchar *keyfile, GError **error)
 {
 	GError *ierror = NULL;
@@ -1,5 +1,11 @@
 #include <errno.h>
+#include <fcntl.h>
+#include <glib/gstdio.h>
+#include <linux/fs.h>
 #include <stdio.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
 
 #include "slot.h"
 
@@ -322,6 +328,233 @@ void r_slot_clean_data_directory(const RaucSlot *slot)
 	}
 }
 
+#ifndef BLKGETDISKSEQ
+#define BLKGETDISKSEQ _IOR(0x12, 128, __u64)
+#endif
+
+#define FINGERPRINT_GROUP "fingerprint"
+#define FINGERPRINT_SAMPLE_SIZE 4096
+#define FINGERPRINT_SAMPLE_COUNT 256
+
+typedef struct {
+	gchar *device_id;
+	gchar *generation;
+	guint64 device_size;
+	gchar *sampled_digest;
+} RaucSlotFingerprint;
+
+static void slot_fingerprint_clear(RaucSlotFingerprint *fp)
+{
+	g_free(fp->device_id);
+	g_free(fp->generation);
+	g_free(fp->sampled_digest);
+}
+
+G_DEFINE_AUTO_CLEANUP_CLEAR_FUNC(RaucSlotFingerprint, slot_fingerprint_clear);
+
+static gchar *slot_fingerprint_path(const RaucSlot *slot)
+{
+	if (!slot->data_directory)
+		return NULL;
+
+	return g_build_filename(slot->data_directory, "fingerprint", NULL);
+}
+
+/* Determines the identity of the slot device and hashes samples spread over
+ * the whole device. The samples are not meant to detect deliberate
+ * modification, but partially written or overwritten slots. */
+static gboolean slot_fingerprint_compute(const RaucSlot *slot, RaucSlotFingerprint *fp, GError **error)
+{
+	GError *ierror = NULL;
+	g_auto(filedesc) fd = -1;
+	g_autoptr(GChecksum) sha = g_checksum_new(G_CHECKSUM_SHA256);
+	g_autofree guint8 *buf = NULL;
+	struct stat st;
+	guint64 samples, step;
+
+	fd = g_open(slot->device, O_RDONLY | O_CLOEXEC, 0);
+	if (fd < 0) {
+		int err = errno;
+		g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(err),
+				"Failed to open %s: %s", slot->device, g_strerror(err));
+		return FALSE;
+	}
+
+	if (fstat(fd, &st) != 0) {
+		int err = errno;
+		g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(err),
+				"Failed to stat %s: %s", slot->device, g_strerror(err));
+		return FALSE;
+	}
+
+	if (S_ISBLK(st.st_mode)) {
+		guint64 diskseq = 0;
+
+		fp->device_size = get_device_size(fd, &ierror);
+		if (ierror) {
+			g_propagate_error(error, ierror);
+			return FALSE;
+		}
+		fp->device_id = g_strdup_printf("blk:%u:%u", major(st.st_rdev), minor(st.st_rdev));
+		/* changes when the medium is replaced (Linux 5.15+) */
+		if (ioctl(fd, BLKGETDISKSEQ, &diskseq) != 0)
+			diskseq = 0;
+		fp->generation = g_strdup_printf("%"G_GUINT64_FORMAT, diskseq);
+	} else if (S_ISREG(st.st_mode)) {
+		fp->device_size = st.st_size;
+		fp->device_id = g_strdup_printf("file:%u:%u:%"G_GUINT64_FORMAT,
+				major(st.st_dev), minor(st.st_dev), (guint64) st.st_ino);
+		fp->generation = g_strdup_printf("%"G_GINT64_FORMAT ".%09ld",
+				(gint64) st.st_mtim.tv_sec, st.st_mtim.tv_nsec);
+	} else {
+		g_set_error(error, G_FILE_ERROR, G_FILE_ERROR_NODEV,
+				"%s is neither a block device nor a regular file", slot->device);
+		return FALSE;
+	}
+
+	buf = g_malloc(FINGERPRINT_SAMPLE_SIZE);
+	samples = fp->device_size / FINGERPRINT_SAMPLE_SIZE;
+	step = MAX(samples / FINGERPRINT_SAMPLE_COUNT, 1);
+	for (guint64 i = 0; i < samples; i += step) {
+		guint64 offset = i * FINGERPRINT_SAMPLE_SIZE;
+
+		if (!r_pread_exact(fd, buf, FINGERPRINT_SAMPLE_SIZE, offset, &ierror)) {
+			g_propagate_prefixed_error(error, ierror, "Failed to read %s: ", slot->device);
+			return FALSE;
+		}
+		g_checksum_update(sha, (const guchar *) &offset, sizeof(offset));
+		g_checksum_update(sha, buf, FINGERPRINT_SAMPLE_SIZE);
+	}
+
+	/* always include the end of the device, as images are written from
+	 * the start */
+	if (samples > 0) {
+		guint64 offset = (samples - 1) * FINGERPRINT_SAMPLE_SIZE;
+
+		if (!r_pread_exact(fd, buf, FINGERPRINT_SAMPLE_SIZE, offset, &ierror)) {
+			g_propagate_prefixed_error(error, ierror, "Failed to read %s: ", slot->device);
+			return FALSE;
+		}
+		g_checksum_update(sha, buf, FINGERPRINT_SAMPLE_SIZE);
+	}
+
+	fp->sampled_digest = g_strdup(g_checksum_get_string(sha));
+
+	return TRUE;
+}
+
+gboolean r_slot_fingerprint_save(const RaucSlot *slot, const RaucChecksum *checksum, GError **error)
+{
+	GError *ierror = NULL;
+	g_autofree gchar *path = NULL;
+	g_autoptr(GKeyFile) key_file = NULL;
+	g_auto(RaucSlotFingerprint) fp = {0};
+
+	g_return_val_if_fail(slot, FALSE);
+	g_return_val_if_fail(checksum, FALSE);
+	g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
+
+	path = slot_fingerprint_path(slot);
+	if (!path || !checksum->digest)
+		return TRUE;
+
+	if (!slot_fingerprint_compute(slot, &fp, &ierror)) {
+		if (g_error_matches(ierror, G_FILE_ERROR, G_FILE_ERROR_NODEV)) {
+			g_debug("Not recording fingerprint: %s", ierror->message);
+			g_clear_error(&ierror);
+			return TRUE;
+		}
+		g_propagate_error(error, ierror);
+		return FALSE;
+	}
+
+	key_file = g_key_file_new();
+	g_key_file_set_string(key_file, FINGERPRINT_GROUP, "device", slot->device);
+	g_key_file_set_string(key_file, FINGERPRINT_GROUP, "device-id", fp.device_id);
+	g_key_file_set_string(key_file, FINGERPRINT_GROUP, "generation", fp.generation);
+	g_key_file_set_uint64(key_file, FINGERPRINT_GROUP, "device-size", fp.device_size);
+	g_key_file_set_string(key_file, FINGERPRINT_GROUP, "sampled-sha256", fp.sampled_digest);
+	g_key_file_set_string(key_file, FINGERPRINT_GROUP, "sha256", checksum->digest);
+	g_key_file_set_uint64(key_file, FINGERPRINT_GROUP, "size", checksum->size);
+
+	if (g_mkdir_with_parents(slot->data_directory, 0700) != 0) {
+		int err = errno;
+		g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(err),
+				"Failed to create slot data directory '%s': %s", slot->data_directory, g_strerror(err));
+		return FALSE;
+	}
+
+	if (!g_key_file_save_to_file(key_file, path, &ierror)) {
+		g_propagate_prefixed_error(error, ierror, "Failed to save slot fingerprint: ");
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+void r_slot_fingerprint_clear(const RaucSlot *slot)
+{
+	g_autofree gchar *path = NULL;
+
+	g_return_if_fail(slot);
+
+	path = slot_fingerprint_path(slot);
+	if (!path)
+		return;
+
+	if (g_unlink(path) != 0 && errno != ENOENT)
+		g_warning("Failed to remove slot fingerprint %s: %s", path, g_strerror(errno));
+}
+
+gboolean r_slot_fingerprint_matches(const RaucSlot *slot, const RaucChecksum *checksum)
+{
+	GError *ierror = NULL;
+	g_autofree gchar *path = NULL;
+	g_autoptr(GKeyFile) key_file = NULL;
+	g_auto(RaucSlotFingerprint) fp = {0};
+	g_autofree gchar *device = NULL;
+	g_autofree gchar *device_id = NULL;
+	g_autofree gchar *generation = NULL;
+	g_autofree gchar *sampled_digest = NULL;
+	g_autofree gchar *digest = NULL;
+
+	g_return_val_if_fail(slot, FALSE);
+	g_return_val_if_fail(checksum, FALSE);
+
+	path = slot_fingerprint_path(slot);
+	if (!path || !checksum->digest)
+		return FALSE;
+
+	key_file = g_key_file_new();
+	if (!g_key_file_load_from_file(key_file, path, G_KEY_FILE_NONE, NULL))
+		return FALSE;
+
+	/* the recorded image must be the one to install */
+	digest = g_key_file_get_string(key_file, FINGERPRINT_GROUP, "sha256", NULL);
+	if (g_strcmp0(digest, checksum->digest) != 0 ||
+	    g_key_file_get_uint64(key_file, FINGERPRINT_GROUP, "size", NULL) != (guint64) checksum->size)
+		return FALSE;
+
+	device = g_key_file_get_string(key_file, FINGERPRINT_GROUP, "device", NULL);
+	if (g_strcmp0(device, slot->device) != 0)
+		return FALSE;
+
+	if (!slot_fingerprint_compute(slot, &fp, &ierror)) {
+		g_debug("Failed to compute fingerprint for slot %s: %s", slot->name, ierror->message);
+		g_clear_error(&ierror);
+		return FALSE;
+	}
+
+	device_id = g_key_file_get_string(key_file, FINGERPRINT_GROUP, "device-id", NULL);
+	generation = g_key_file_get_string(key_file, FINGERPRINT_GROUP, "generation", NULL);
+	sampled_digest = g_key_file_get_string(key_file, FINGERPRINT_GROUP, "sampled-sha256", NULL);
+
+	return g_strcmp0(device_id, fp.device_id) == 0 &&
+	       g_strcmp0(generation, fp.generation) == 0 &&
+	       g_key_file_get_uint64(key_file, FINGERPRINT_GROUP, "device-size", NULL) == fp.device_size &&
+	       g_strcmp0(sampled_digest, fp.sampled_digest) == 0;
+}
+
 gchar** r_slot_get_root_classes(GHashTable *slots)
 {
 	GPtrArray *slotclasses = NULL;
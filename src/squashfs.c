@@ -0,0 +1,882 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <glib/gstdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include "squashfs.h"
+#include "utils.h"
+
+GQuark r_squashfs_error_quark(void)
+{
+	return g_quark_from_static_string("r_squashfs_error_quark");
+}
+
+#define SQUASHFS_MAGIC 0x73717368
+#define SQUASHFS_SUPERBLOCK_SIZE 96
+#define SQUASHFS_BLOCK_LOG 17
+#define SQUASHFS_BLOCK_SIZE (1 << SQUASHFS_BLOCK_LOG)
+#define SQUASHFS_METADATA_SIZE 8192
+#define SQUASHFS_COMPRESSION_GZIP 1
+#define SQUASHFS_PADDING 4096
+#define SQUASHFS_DIR_COUNT 256
+#define SQUASHFS_NAME_LEN 256
+
+#define SQUASHFS_FLAG_NO_FRAGMENTS 0x0010
+#define SQUASHFS_FLAG_NO_XATTRS 0x0200
+
+#define SQUASHFS_METADATA_UNCOMPRESSED 0x8000
+#define SQUASHFS_DATA_UNCOMPRESSED (1 << 24)
+#define SQUASHFS_INVALID_FRAGMENT 0xffffffffU
+#define SQUASHFS_INVALID_XATTR 0xffffffffU
+#define SQUASHFS_INVALID_TABLE G_GUINT64_CONSTANT(0xffffffffffffffff)
+
+/* inode types, the basic types are also used in directory entries */
+#define SQUASHFS_DIR_TYPE 1
+#define SQUASHFS_REG_TYPE 2
+#define SQUASHFS_SYMLINK_TYPE 3
+#define SQUASHFS_BLKDEV_TYPE 4
+#define SQUASHFS_CHRDEV_TYPE 5
+#define SQUASHFS_FIFO_TYPE 6
+#define SQUASHFS_SOCKET_TYPE 7
+#define SQUASHFS_LDIR_TYPE 8
+#define SQUASHFS_LREG_TYPE 9
+
+typedef struct _SquashfsNode SquashfsNode;
+
+struct _SquashfsNode {
+	gchar *name;
+	gchar *path;
+	struct stat st;
+	guint16 type;
+	SquashfsNode *parent;
+	/* sorted by name, only for directories */
+	GPtrArray *children;
+	/* for additional hardlinks to an already contained file */
+	SquashfsNode *link_target;
+	guint32 nlink;
+	/* stored uncompressed at the start of the data area */
+	gboolean uncompressed;
+
+	guint64 data_start;
+	GArray *block_sizes;
+	gchar *symlink;
+
+	guint32 inode_number;
+	guint64 inode_ref;
+};
+
+static void squashfs_node_free(gpointer data)
+{
+	SquashfsNode *node = data;
+
+	if (!node)
+		return;
+
+	g_free(node->name);
+	g_free(node->path);
+	g_clear_pointer(&node->children, g_ptr_array_unref);
+	g_clear_pointer(&node->block_sizes, g_array_unref);
+	g_free(node->symlink);
+	g_free(node);
+}
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC(SquashfsNode, squashfs_node_free);
+
+/* A metadata table (inodes, directories, ids) is built in memory as a
+ * sequence of compressed blocks of up to 8 KiB uncompressed data. */
+typedef struct {
+	GByteArray *blocks;
+	GByteArray *pending;
+} SquashfsTable;
+
+typedef struct {
+	guint8 *in;
+	guint8 *out;
+	gsize len;
+	/* 0 if the block is stored uncompressed */
+	gsize out_len;
+} SquashfsBlock;
+
+typedef struct {
+	int fd;
+	guint64 offset;
+	guint32 mtime;
+	guint32 inode_count;
+
+	SquashfsTable inodes;
+	SquashfsTable dirs;
+
+	GThreadPool *pool;
+	SquashfsBlock *blocks;
+	guint n_blocks;
+	GMutex lock;
+	GCond cond;
+	guint pending;
+} SquashfsWriter;
+
+/* Returns the compressed size, or 0 if compression does not save space. */
+static gsize squashfs_compress(const guint8 *in, gsize len, guint8 *out)
+{
+	uLongf out_len = len;
+
+	if (compress2(out, &out_len, in, len, Z_BEST_COMPRESSION) != Z_OK)
+		return 0;
+	if (out_len >= len)
+		return 0;
+
+	return out_len;
+}
+
+static void put_le16(GByteArray *buf, guint16 value)
+{
+	value = GUINT16_TO_LE(value);
+	g_byte_array_append(buf, (const guint8 *) &value, sizeof(value));
+}
+
+static void put_le32(GByteArray *buf, guint32 value)
+{
+	value = GUINT32_TO_LE(value);
+	g_byte_array_append(buf, (const guint8 *) &value, sizeof(value));
+}
+
+static void put_le64(GByteArray *buf, guint64 value)
+{
+	value = GUINT64_TO_LE(value);
+	g_byte_array_append(buf, (const guint8 *) &value, sizeof(value));
+}
+
+static void squashfs_table_init(SquashfsTable *table)
+{
+	table->blocks = g_byte_array_new();
+	table->pending = g_byte_array_sized_new(SQUASHFS_METADATA_SIZE);
+}
+
+static void squashfs_table_clear(SquashfsTable *table)
+{
+	g_clear_pointer(&table->blocks, g_byte_array_unref);
+	g_clear_pointer(&table->pending, g_byte_array_unref);
+}
+
+static void squashfs_table_flush(SquashfsTable *table)
+{
+	guint8 out[SQUASHFS_METADATA_SIZE];
+	gsize out_len;
+
+	if (!table->pending->len)
+		return;
+
+	out_len = squashfs_compress(table->pending->data, table->pending->len, out);
+	if (out_len) {
+		put_le16(table->blocks, out_len);
+		g_byte_array_append(table->blocks, out, out_len);
+	} else {
+		put_le16(table->blocks, table->pending->len | SQUASHFS_METADATA_UNCOMPRESSED);
+		g_byte_array_append(table->blocks, table->pending->data, table->pending->len);
+	}
+	g_byte_array_set_size(table->pending, 0);
+}
+
+/* Returns the reference to the next byte appended to the table (start of
+ * the containing block in the table and offset in the uncompressed block). */
+static guint64 squashfs_table_position(const SquashfsTable *table)
+{
+	return ((guint64) table->blocks->len << 16) | table->pending->len;
+}
+
+static void squashfs_table_append(SquashfsTable *table, const guint8 *data, gsize len)
+{
+	while (len) {
+		gsize chunk = MIN(len, SQUASHFS_METADATA_SIZE - table->pending->len);
+
+		g_byte_array_append(table->pending, data, chunk);
+		data += chunk;
+		len -= chunk;
+		if (table->pending->len == SQUASHFS_METADATA_SIZE)
+			squashfs_table_flush(table);
+	}
+}
+
+static gboolean squashfs_write(SquashfsWriter *writer, const guint8 *data, gsize len, GError **error)
+{
+	GError *ierror = NULL;
+
+	if (!r_write_exact(writer->fd, data, len, &ierror)) {
+		g_propagate_prefixed_error(error, ierror, "Failed to write squashfs image: ");
+		return FALSE;
+	}
+	writer->offset += len;
+
+	return TRUE;
+}
+
+static gboolean squashfs_pad(SquashfsWriter *writer, guint64 alignment, GError **error)
+{
+	static const guint8 zeros[SQUASHFS_PADDING] = {0};
+	guint64 rem = writer->offset % alignment;
+
+	g_assert(alignment <= SQUASHFS_PADDING);
+
+	if (!rem)
+		return TRUE;
+
+	return squashfs_write(writer, zeros, alignment - rem, error);
+}
+
+static guint64 squashfs_align(guint64 offset)
+{
+	return (offset + R_SQUASHFS_FILE_ALIGNMENT - 1) / R_SQUASHFS_FILE_ALIGNMENT * R_SQUASHFS_FILE_ALIGNMENT;
+}
+
+static gint squashfs_node_compare(gconstpointer a, gconstpointer b)
+{
+	const SquashfsNode *node_a = *(SquashfsNode * const *) a;
+	const SquashfsNode *node_b = *(SquashfsNode * const *) b;
+
+	/* the kernel expects entries sorted by their raw bytes */
+	return strcmp(node_a->name, node_b->name);
+}
+
+static SquashfsNode *squashfs_scan(const gchar *path, const gchar *name, SquashfsNode *parent, GError **error)
+{
+	GError *ierror = NULL;
+	g_autoptr(SquashfsNode) node = g_new0(SquashfsNode, 1);
+
+	node->name = g_strdup(name);
+	node->path = g_strdup(path);
+	node->parent = parent;
+	node->nlink = 1;
+
+	if (g_lstat(path, &node->st) != 0) {
+		int err = errno;
+		g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(err),
+				"Failed to stat '%s': %s", path, g_strerror(err));
+		return NULL;
+	}
+
+	if (strlen(name) > SQUASHFS_NAME_LEN) {
+		g_set_error(error, R_SQUASHFS_ERROR, R_SQUASHFS_ERROR_UNSUPPORTED,
+				"File name of '%s' is too long", path);
+		return NULL;
+	}
+
+	switch (node->st.st_mode & S_IFMT) {
+		case S_IFDIR: {
+			g_autoptr(GDir) dir = NULL;
+			const gchar *entry;
+
+			node->type = SQUASHFS_DIR_TYPE;
+			node->children = g_ptr_array_new_with_free_func(squashfs_node_free);
+
+			dir = g_dir_open(path, 0, &ierror);
+			if (!dir) {
+				g_propagate_error(error, ierror);
+				return NULL;
+			}
+			/* GDir skips '.' and '..' */
+			while ((entry = g_dir_read_name(dir))) {
+				g_autofree gchar *child_path = g_build_filename(path, entry, NULL);
+				SquashfsNode *child = squashfs_scan(child_path, entry, node, &ierror);
+
+				if (!child) {
+					g_propagate_error(error, ierror);
+					return NULL;
+				}
+				g_ptr_array_add(node->children, child);
+			}
+			g_ptr_array_sort(node->children, squashfs_node_compare);
+			return g_steal_pointer(&node);
+		}
+		case S_IFREG:
+			node->type = SQUASHFS_REG_TYPE;
+			break;
+		case S_IFLNK:
+			node->type = SQUASHFS_SYMLINK_TYPE;
+			node->symlink = g_file_read_link(path, &ierror);
+			if (!node->symlink) {
+				g_propagate_error(error, ierror);
+				return NULL;
+			}
+			break;
+		case S_IFBLK:
+			node->type = SQUASHFS_BLKDEV_TYPE;
+			break;
+		case S_IFCHR:
+			node->type = SQUASHFS_CHRDEV_TYPE;
+			break;
+		case S_IFIFO:
+			node->type = SQUASHFS_FIFO_TYPE;
+			break;
+		case S_IFSOCK:
+			node->type = SQUASHFS_SOCKET_TYPE;
+			break;
+		default:
+			g_set_error(error, R_SQUASHFS_ERROR, R_SQUASHFS_ERROR_UNSUPPORTED,
+					"Unsupported file type of '%s'", path);
+			return NULL;
+	}
+
+	return g_steal_pointer(&node);
+}
+
+static void squashfs_compress_func(gpointer data, gpointer user_data)
+{
+	SquashfsBlock *block = data;
+	SquashfsWriter *writer = user_data;
+
+	block->out_len = squashfs_compress(block->in, block->len, block->out);
+
+	g_mutex_lock(&writer->lock);
+	if (--writer->pending == 0)
+		g_cond_signal(&writer->cond);
+	g_mutex_unlock(&writer->lock);
+}
+
+static gboolean squashfs_write_file_data(SquashfsWriter *writer, SquashfsNode *node, GError **error)
+{
+	GError *ierror = NULL;
+	g_auto(filedesc) fd = -1;
+	guint64 remaining = node->st.st_size;
+
+	node->block_sizes = g_array_new(FALSE, FALSE, sizeof(guint32));
+
+	/* make the blocks of large files addressable at 4 KiB granularity */
+	if ((remaining > SQUASHFS_BLOCK_SIZE || node->uncompressed) &&
+	    !squashfs_pad(writer, R_SQUASHFS_FILE_ALIGNMENT, error))
+		return FALSE;
+	node->data_start = writer->offset;
+
+	if (!remaining)
+		return TRUE;
+
+	fd = g_open(node->path, O_RDONLY | O_CLOEXEC, 0);
+	if (fd < 0) {
+		int err = errno;
+		g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(err),
+				"Failed to open '%s': %s", node->path, g_strerror(err));
+		return FALSE;
+	}
+
+	while (remaining) {
+		guint n;
+
+		for (n = 0; n < writer->n_blocks && remaining; n++) {
+			SquashfsBlock *block = &writer->blocks[n];
+
+			block->len = MIN(remaining, SQUASHFS_BLOCK_SIZE);
+			if (!r_read_exact(fd, block->in, block->len, &ierror)) {
+				g_propagate_prefixed_error(error, ierror, "Failed to read '%s': ", node->path);
+				return FALSE;
+			}
+			remaining -= block->len;
+		}
+
+		if (node->uncompressed) {
+			/* keeps the file contiguous in the image */
+			for (guint i = 0; i < n; i++)
+				writer->blocks[i].out_len = 0;
+		} else {
+			g_mutex_lock(&writer->lock);
+			writer->pending = n;
+			g_mutex_unlock(&writer->lock);
+			for (guint i = 0; i < n; i++)
+				g_thread_pool_push(writer->pool, &writer->blocks[i], NULL);
+			g_mutex_lock(&writer->lock);
+			while (writer->pending)
+				g_cond_wait(&writer->cond, &writer->lock);
+			g_mutex_unlock(&writer->lock);
+		}
+
+		/* write in order, so the output does not depend on scheduling */
+		for (guint i = 0; i < n; i++) {
+			SquashfsBlock *block = &writer->blocks[i];
+			guint32 size;
+
+			if (block->out_len) {
+				size = block->out_len;
+				if (!squashfs_write(writer, block->out, block->out_len, error))
+					return FALSE;
+			} else {
+				size = block->len | SQUASHFS_DATA_UNCOMPRESSED;
+				if (!squashfs_write(writer, block->in, block->len, error))
+					return FALSE;
+			}
+			g_array_append_val(node->block_sizes, size);
+		}
+	}
+
+	return TRUE;
+}
+
+static gboolean squashfs_write_data(SquashfsWriter *writer, SquashfsNode *dir, GError **error)
+{
+	for (guint i = 0; i < dir->children->len; i++) {
+		SquashfsNode *child = g_ptr_array_index(dir->children, i);
+
+		if (child->type == SQUASHFS_DIR_TYPE) {
+			if (!squashfs_write_data(writer, child, error))
+				return FALSE;
+		} else if (child->type == SQUASHFS_REG_TYPE && !child->link_target && !child->uncompressed) {
+			if (!squashfs_write_file_data(writer, child, error))
+				return FALSE;
+		}
+	}
+
+	return TRUE;
+}
+
+/* Inodes are numbered in the order they are written to the inode table:
+ * children before their directory, so the root comes last. Hardlinked files
+ * are only stored once, at their first occurrence in this order. Files stored
+ * uncompressed always get their own copy of the data. */
+static void squashfs_number_inodes(SquashfsWriter *writer, SquashfsNode *dir, GHashTable *files)
+{
+	for (guint i = 0; i < dir->children->len; i++) {
+		SquashfsNode *child = g_ptr_array_index(dir->children, i);
+
+		if (child->type == SQUASHFS_DIR_TYPE) {
+			squashfs_number_inodes(writer, child, files);
+			continue;
+		}
+
+		if (child->st.st_nlink > 1 && !child->uncompressed) {
+			g_autofree gchar *key = g_strdup_printf("%"G_GUINT64_FORMAT ":%"G_GUINT64_FORMAT,
+					(guint64) child->st.st_dev, (guint64) child->st.st_ino);
+			SquashfsNode *target = g_hash_table_lookup(files, key);
+
+			if (target) {
+				child->link_target = target;
+				target->nlink++;
+				continue;
+			}
+			g_hash_table_insert(files, g_steal_pointer(&key), child);
+		}
+
+		child->inode_number = ++writer->inode_count;
+	}
+
+	dir->inode_number = ++writer->inode_count;
+}
+
+static void squashfs_inode_header(const SquashfsWriter *writer, GByteArray *buf, const SquashfsNode *node, guint16 type)
+{
+	put_le16(buf, type);
+	/* only permission bits, the file type is given by the inode type */
+	put_le16(buf, node->st.st_mode & 07777);
+	/* all files are owned by root (id index 0) */
+	put_le16(buf, 0);
+	put_le16(buf, 0);
+	put_le32(buf, writer->mtime);
+	put_le32(buf, node->inode_number);
+}
+
+static void squashfs_write_inode(SquashfsWriter *writer, SquashfsNode *node)
+{
+	g_autoptr(GByteArray) buf = g_byte_array_new();
+
+	switch (node->type) {
+		case SQUASHFS_REG_TYPE:
+			if (node->nlink > 1 || node->data_start > G_MAXUINT32 || (guint64) node->st.st_size > G_MAXUINT32) {
+				squashfs_inode_header(writer, buf, node, SQUASHFS_LREG_TYPE);
+				put_le64(buf, node->data_start);
+				put_le64(buf, node->st.st_size);
+				put_le64(buf, 0); /* sparse bytes */
+				put_le32(buf, node->nlink);
+				put_le32(buf, SQUASHFS_INVALID_FRAGMENT);
+				put_le32(buf, 0);
+				put_le32(buf, SQUASHFS_INVALID_XATTR);
+			} else {
+				squashfs_inode_header(writer, buf, node, SQUASHFS_REG_TYPE);
+				put_le32(buf, node->data_start);
+				put_le32(buf, SQUASHFS_INVALID_FRAGMENT);
+				put_le32(buf, 0);
+				put_le32(buf, node->st.st_size);
+			}
+			for (guint i = 0; i < node->block_sizes->len; i++)
+				put_le32(buf, g_array_index(node->block_sizes, guint32, i));
+			break;
+		case SQUASHFS_SYMLINK_TYPE:
+			squashfs_inode_header(writer, buf, node, SQUASHFS_SYMLINK_TYPE);
+			put_le32(buf, node->nlink);
+			put_le32(buf, strlen(node->symlink));
+			g_byte_array_append(buf, (const guint8 *) node->symlink, strlen(node->symlink));
+			break;
+		case SQUASHFS_BLKDEV_TYPE:
+		case SQUASHFS_CHRDEV_TYPE: {
+			guint32 maj = major(node->st.st_rdev);
+			guint32 min = minor(node->st.st_rdev);
+
+			squashfs_inode_header(writer, buf, node, node->type);
+			put_le32(buf, node->nlink);
+			/* same encoding as the kernel's new_encode_dev() */
+			put_le32(buf, (min & 0xff) | (maj << 8) | ((min & ~0xffU) << 12));
+			break;
+		}
+		case SQUASHFS_FIFO_TYPE:
+		case SQUASHFS_SOCKET_TYPE:
+			squashfs_inode_header(writer, buf, node, node->type);
+			put_le32(buf, node->nlink);
+			break;
+		default:
+			g_assert_not_reached();
+	}
+
+	node->inode_ref = squashfs_table_position(&writer->inodes);
+	squashfs_table_append(&writer->inodes, buf->data, buf->len);
+}
+
+static gboolean squashfs_write_dir(SquashfsWriter *writer, SquashfsNode *dir, guint32 parent_inode, GError **error)
+{
+	g_autoptr(GByteArray) listing = g_byte_array_new();
+	g_autoptr(GByteArray) buf = g_byte_array_new();
+	guint header_offset = 0;
+	guint32 header_count = 0;
+	guint64 header_block = 0;
+	guint32 header_inode = 0;
+	guint32 count_le;
+	guint32 subdirs = 0;
+	guint64 listing_ref;
+
+	for (guint i = 0; i < dir->children->len; i++) {
+		SquashfsNode *child = g_ptr_array_index(dir->children, i);
+
+		if (child->type == SQUASHFS_DIR_TYPE) {
+			if (!squashfs_write_dir(writer, child, dir->inode_number, error))
+				return FALSE;
+			subdirs++;
+		} else if (!child->link_target) {
+			squashfs_write_inode(writer, child);
+		}
+	}
+
+	/* Entries are grouped under headers which share the inode table block
+	 * and an inode number base. */
+	for (guint i = 0; i < dir->children->len; i++) {
+		SquashfsNode *child = g_ptr_array_index(dir->children, i);
+		SquashfsNode *target = child->link_target ? child->link_target : child;
+		guint64 block = target->inode_ref >> 16;
+		gint64 delta = (gint64) target->inode_number - header_inode;
+		guint16 name_len = strlen(child->name);
+
+		if (!header_count || header_count == SQUASHFS_DIR_COUNT ||
+		    block != header_block || delta < G_MININT16 || delta > G_MAXINT16) {
+			if (block > G_MAXUINT32) {
+				g_set_error(error, R_SQUASHFS_ERROR, R_SQUASHFS_ERROR_UNSUPPORTED,
+						"Inode table too large");
+				return FALSE;
+			}
+			header_offset = listing->len;
+			header_count = 0;
+			header_block = block;
+			header_inode = target->inode_number;
+			delta = 0;
+			put_le32(listing, 0);
+			put_le32(listing, block);
+			put_le32(listing, header_inode);
+		}
+
+		put_le16(listing, target->inode_ref & 0xffff);
+		put_le16(listing, (guint16) (gint16) delta);
+		put_le16(listing, target->type);
+		put_le16(listing, name_len - 1);
+		g_byte_array_append(listing, (const guint8 *) child->name, name_len);
+
+		/* the header stores the number of entries minus one */
+		header_count++;
+		count_le = GUINT32_TO_LE(header_count - 1);
+		memcpy(listing->data + header_offset, &count_le, sizeof(count_le));
+	}
+
+	listing_ref = squashfs_table_position(&writer->dirs);
+	squashfs_table_append(&writer->dirs, listing->data, listing->len);
+
+	if ((listing_ref >> 16) > G_MAXUINT32) {
+		g_set_error(error, R_SQUASHFS_ERROR, R_SQUASHFS_ERROR_UNSUPPORTED,
+				"Directory table too large");
+		return FALSE;
+	}
+
+	/* the size includes the implicit '.' and '..' entries */
+	if (listing->len + 3 <= G_MAXUINT16) {
+		squashfs_inode_header(writer, buf, dir, SQUASHFS_DIR_TYPE);
+		put_le32(buf, listing_ref >> 16);
+		put_le32(buf, 2 + subdirs);
+		put_le16(buf, listing->len + 3);
+		put_le16(buf, listing_ref & 0xffff);
+		put_le32(buf, parent_inode);
+	} else {
+		squashfs_inode_header(writer, buf, dir, SQUASHFS_LDIR_TYPE);
+		put_le32(buf, 2 + subdirs);
+		put_le32(buf, listing->len + 3);
+		put_le32(buf, listing_ref >> 16);
+		put_le32(buf, parent_inode);
+		put_le16(buf, 0); /* no directory index */
+		put_le16(buf, listing_ref & 0xffff);
+		put_le32(buf, SQUASHFS_INVALID_XATTR);
+	}
+
+	dir->inode_ref = squashfs_table_position(&writer->inodes);
+	squashfs_table_append(&writer->inodes, buf->data, buf->len);
+
+	return TRUE;
+}
+
+static gboolean squashfs_write_uncompressed(SquashfsWriter *writer, SquashfsNode *root, const gchar * const *uncompressed, GError **error)
+{
+	GError *ierror = NULL;
+	guint64 offset = R_SQUASHFS_FILE_ALIGNMENT;
+
+	for (const gchar * const *name = uncompressed; name && *name; name++) {
+		SquashfsNode *node = NULL;
+
+		for (guint i = 0; i < root->children->len; i++) {
+			SquashfsNode *child = g_ptr_array_index(root->children, i);
+
+			if (g_strcmp0(child->name, *name) == 0) {
+				node = child;
+				break;
+			}
+		}
+		if (!node || node->type != SQUASHFS_REG_TYPE) {
+			g_set_error(error, R_SQUASHFS_ERROR, R_SQUASHFS_ERROR_FAILED,
+					"'%s' is not a regular file in the top-level directory", *name);
+			return FALSE;
+		}
+		if (node->block_sizes) {
+			g_set_error(error, R_SQUASHFS_ERROR, R_SQUASHFS_ERROR_FAILED,
+					"'%s' is listed more than once", *name);
+			return FALSE;
+		}
+
+		if (!squashfs_write_file_data(writer, node, &ierror)) {
+			g_propagate_error(error, ierror);
+			return FALSE;
+		}
+		/* must match the layout from r_squashfs_plan_uncompressed() */
+		if (node->data_start != offset) {
+			g_set_error(error, R_SQUASHFS_ERROR, R_SQUASHFS_ERROR_FAILED,
+					"'%s' was written at offset %"G_GUINT64_FORMAT " instead of the planned offset %"G_GUINT64_FORMAT,
+					*name, node->data_start, offset);
+			return FALSE;
+		}
+		offset = squashfs_align(offset + node->st.st_size);
+	}
+
+	return TRUE;
+}
+
+static guint32 squashfs_get_mtime(void)
+{
+	const gchar *epoch = g_getenv("SOURCE_DATE_EPOCH");
+	guint64 value = 0;
+
+	if (epoch && !g_ascii_string_to_unsigned(epoch, 10, 0, G_MAXUINT32, &value, NULL))
+		g_warning("Ignoring invalid SOURCE_DATE_EPOCH '%s'", epoch);
+
+	return value;
+}
+
+static gboolean squashfs_write_image(SquashfsWriter *writer, const gchar *contentdir, const gchar * const *uncompressed, GError **error)
+{
+	GError *ierror = NULL;
+	g_autoptr(GHashTable) files = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+	g_autoptr(SquashfsNode) root = NULL;
+	g_autoptr(GByteArray) ids = g_byte_array_new();
+	g_autoptr(GByteArray) super = g_byte_array_new();
+	guint64 inode_table_start, directory_table_start, fragment_table_start;
+	guint64 id_block_start, id_table_start, bytes_used;
+	static const guint8 zeros[SQUASHFS_SUPERBLOCK_SIZE] = {0};
+
+	root = squashfs_scan(contentdir, "", NULL, &ierror);
+	if (!root) {
+		g_propagate_error(error, ierror);
+		return FALSE;
+	}
+	if (root->type != SQUASHFS_DIR_TYPE) {
+		g_set_error(error, R_SQUASHFS_ERROR, R_SQUASHFS_ERROR_FAILED,
+				"'%s' is not a directory", contentdir);
+		return FALSE;
+	}
+
+	/* the superblock is written last */
+	if (!squashfs_write(writer, zeros, sizeof(zeros), error))
+		return FALSE;
+
+	for (const gchar * const *name = uncompressed; name && *name; name++) {
+		for (guint i = 0; i < root->children->len; i++) {
+			SquashfsNode *child = g_ptr_array_index(root->children, i);
+
+			if (g_strcmp0(child->name, *name) == 0)
+				child->uncompressed = TRUE;
+		}
+	}
+
+	squashfs_number_inodes(writer, root, files);
+
+	/* the uncompressed files come first, so their offsets are predictable */
+	if (!squashfs_write_uncompressed(writer, root, uncompressed, error))
+		return FALSE;
+
+	if (!squashfs_write_data(writer, root, error))
+		return FALSE;
+
+	/* the root's parent is one past the last inode, like mksquashfs */
+	if (!squashfs_write_dir(writer, root, writer->inode_count + 1, error))
+		return FALSE;
+	squashfs_table_flush(&writer->inodes);
+	squashfs_table_flush(&writer->dirs);
+
+	inode_table_start = writer->offset;
+	if (!squashfs_write(writer, writer->inodes.blocks->data, writer->inodes.blocks->len, error))
+		return FALSE;
+	directory_table_start = writer->offset;
+	if (!squashfs_write(writer, writer->dirs.blocks->data, writer->dirs.blocks->len, error))
+		return FALSE;
+	/* there are no fragments, so the fragment table is empty */
+	fragment_table_start = writer->offset;
+
+	/* the id table only contains root, followed by its index */
+	id_block_start = writer->offset;
+	put_le16(ids, sizeof(guint32) | SQUASHFS_METADATA_UNCOMPRESSED);
+	put_le32(ids, 0);
+	id_table_start = id_block_start + ids->len;
+	put_le64(ids, id_block_start);
+	if (!squashfs_write(writer, ids->data, ids->len, error))
+		return FALSE;
+	bytes_used = writer->offset;
+
+	if (!squashfs_pad(writer, SQUASHFS_PADDING, error))
+		return FALSE;
+
+	put_le32(super, SQUASHFS_MAGIC);
+	put_le32(super, writer->inode_count);
+	put_le32(super, writer->mtime);
+	put_le32(super, SQUASHFS_BLOCK_SIZE);
+	put_le32(super, 0); /* fragments */
+	put_le16(super, SQUASHFS_COMPRESSION_GZIP);
+	put_le16(super, SQUASHFS_BLOCK_LOG);
+	put_le16(super, SQUASHFS_FLAG_NO_FRAGMENTS | SQUASHFS_FLAG_NO_XATTRS);
+	put_le16(super, 1); /* ids */
+	put_le16(super, 4); /* major version */
+	put_le16(super, 0); /* minor version */
+	put_le64(super, root->inode_ref);
+	put_le64(super, bytes_used);
+	put_le64(super, id_table_start);
+	put_le64(super, SQUASHFS_INVALID_TABLE); /* xattr table */
+	put_le64(super, inode_table_start);
+	put_le64(super, directory_table_start);
+	put_le64(super, fragment_table_start);
+	put_le64(super, SQUASHFS_INVALID_TABLE); /* export table */
+	g_assert(super->len == SQUASHFS_SUPERBLOCK_SIZE);
+
+	if (!r_pwrite_exact(writer->fd, super->data, super->len, 0, &ierror)) {
+		g_propagate_prefixed_error(error, ierror, "Failed to write squashfs superblock: ");
+		return FALSE;
+	}
+
+	if (fsync(writer->fd) != 0) {
+		int err = errno;
+		g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(err),
+				"Failed to sync squashfs image: %s", g_strerror(err));
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+gboolean r_squashfs_plan_uncompressed(const gchar *contentdir, const gchar * const *uncompressed, guint64 *offsets, GError **error)
+{
+	guint64 offset = R_SQUASHFS_FILE_ALIGNMENT;
+
+	g_return_val_if_fail(contentdir, FALSE);
+	g_return_val_if_fail(uncompressed, FALSE);
+	g_return_val_if_fail(offsets, FALSE);
+	g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
+
+	for (guint i = 0; uncompressed[i]; i++) {
+		g_autofree gchar *path = g_build_filename(contentdir, uncompressed[i], NULL);
+		struct stat st;
+
+		if (g_lstat(path, &st) != 0) {
+			int err = errno;
+			g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(err),
+					"Failed to stat '%s': %s", path, g_strerror(err));
+			return FALSE;
+		}
+		if (!S_ISREG(st.st_mode)) {
+			g_set_error(error, R_SQUASHFS_ERROR, R_SQUASHFS_ERROR_FAILED,
+					"'%s' is not a regular file", path);
+			return FALSE;
+		}
+
+		offsets[i] = offset;
+		offset = squashfs_align(offset + st.st_size);
+	}
+
+	return TRUE;
+}
+
+gboolean r_squashfs_write(const gchar *contentdir, const gchar *outpath, guint threads, const gchar * const *uncompressed, GError **error)
+{
+	GError *ierror = NULL;
+	SquashfsWriter writer = {0};
+	gboolean res = FALSE;
+
+	g_return_val_if_fail(contentdir, FALSE);
+	g_return_val_if_fail(outpath, FALSE);
+	g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
+
+	if (!threads)
+		threads = g_get_num_processors();
+
+	writer.fd = g_open(outpath, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+	if (writer.fd < 0) {
+		int err = errno;
+		g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(err),
+				"Failed to create '%s': %s", outpath, g_strerror(err));
+		return FALSE;
+	}
+
+	writer.mtime = squashfs_get_mtime();
+	squashfs_table_init(&writer.inodes);
+	squashfs_table_init(&writer.dirs);
+	g_mutex_init(&writer.lock);
+	g_cond_init(&writer.cond);
+
+	/* keep a few blocks per thread in flight */
+	writer.n_blocks = threads * 4;
+	writer.blocks = g_new0(SquashfsBlock, writer.n_blocks);
+	for (guint i = 0; i < writer.n_blocks; i++) {
+		writer.blocks[i].in = g_malloc(SQUASHFS_BLOCK_SIZE);
+		writer.blocks[i].out = g_malloc(SQUASHFS_BLOCK_SIZE);
+	}
+
+	writer.pool = g_thread_pool_new(squashfs_compress_func, &writer, threads, TRUE, &ierror);
+	if (!writer.pool) {
+		g_propagate_prefixed_error(error, ierror, "Failed to create thread pool: ");
+		goto out;
+	}
+
+	res = squashfs_write_image(&writer, contentdir, uncompressed, error);
+
+out:
+	if (writer.pool)
+		g_thread_pool_free(writer.pool, FALSE, TRUE);
+	for (guint i = 0; i < writer.n_blocks; i++) {
+		g_free(writer.blocks[i].in);
+		g_free(writer.blocks[i].out);
+	}
+	g_free(writer.blocks);
+	g_mutex_clear(&writer.lock);
+	g_cond_clear(&writer.cond);
+	squashfs_table_clear(&writer.inodes);
+	squashfs_table_clear(&writer.dirs);
+	close(writer.fd);
+	if (!res)
+		g_unlink(outpath);
+
+	return res;
+}
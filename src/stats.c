@@ -1,25 +1,87 @@
+#include <string.h>
+
 #include "stats.h"
 
 gboolean test_stats_enabled = FALSE;
 GList *test_stats_queue = NULL;
 
+/* label -> RaucStats */
+static GHashTable *published_stats = NULL;
+G_LOCK_DEFINE_STATIC(published_stats);
+
+G_DEFINE_QUARK(r-stats-error-quark, r_stats_error)
+
+/**
+ * Returns the histogram bucket for a value.
+ *
+ * The bucket is calculated from the exponent and the top mantissa bits of the
+ * IEEE 754 representation, which avoids depending on libm.
+ */
+static guint histogram_bucket(gdouble value)
+{
+	guint64 bits;
+	gint exp;
+
+	/* also catches NaN */
+	if (!(value > 0.0))
+		return 0;
+
+	memcpy(&bits, &value, sizeof(bits));
+	exp = (gint)((bits >> 52) & 0x7ff) - 1023;
+
+	if (exp < R_STATS_HISTOGRAM_MIN_EXP)
+		return 0;
+	if (exp >= R_STATS_HISTOGRAM_MAX_EXP)
+		return R_STATS_HISTOGRAM_BUCKETS - 1;
+
+	return 1 + (exp - R_STATS_HISTOGRAM_MIN_EXP) * R_STATS_HISTOGRAM_SUB_BUCKETS +
+	       ((bits >> (52 - R_STATS_HISTOGRAM_SUB_BITS)) & (R_STATS_HISTOGRAM_SUB_BUCKETS - 1));
+}
+
+/**
+ * Returns the value in the middle of a histogram bucket.
+ */
+static gdouble histogram_value(guint bucket)
+{
+	guint64 bits;
+	gdouble value;
+	gint exp;
+
+	if (bucket == 0)
+		return 0.0;
+
+	bucket--;
+	exp = (gint)(bucket / R_STATS_HISTOGRAM_SUB_BUCKETS) + R_STATS_HISTOGRAM_MIN_EXP;
+	bits = ((guint64)(exp + 1023) << 52) |
+	       ((guint64)(bucket % R_STATS_HISTOGRAM_SUB_BUCKETS) << (52 - R_STATS_HISTOGRAM_SUB_BITS)) |
+	       (G_GUINT64_CONSTANT(1) << (52 - R_STATS_HISTOGRAM_SUB_BITS - 1));
+	memcpy(&value, &bits, sizeof(value));
+
+	return value;
+}
+
 RaucStats *r_stats_new(const gchar *label)
 {
 	RaucStats *stats = g_new0(RaucStats, 1);
 
 	stats->label = g_strdup(label);
 	stats->min = G_MAXDOUBLE;
-	stats->max = G_MINDOUBLE;
+	stats->max = -G_MAXDOUBLE;
 
 	return stats;
 }
 
 void r_stats_add(RaucStats *stats, gdouble value)
 {
+	gint64 now = g_get_monotonic_time();
+
 	g_return_if_fail(stats);
 
 	stats->values[stats->next] = value;
 	stats->next = (stats->next + 1) % 64;
+	if (!stats->count)
+		stats->first_time = now;
+	stats->last_time = now;
 	stats->count++;
 
 	stats->sum += value;
@@ -28,6 +90,33 @@ void r_stats_add(RaucStats *stats, gdouble value)
 		stats->min = value;
 	if (value > stats->max)
 		stats->max = value;
+
+	stats->histogram[histogram_bucket(value)]++;
+}
+
+void r_stats_merge(RaucStats *dst, const RaucStats *src)
+{
+	g_return_if_fail(dst);
+	g_return_if_fail(src);
+
+	if (!src->count)
+		return;
+
+	if (!dst->count || src->first_time < dst->first_time)
+		dst->first_time = src->first_time;
+	if (!dst->count || src->last_time > dst->last_time)
+		dst->last_time = src->last_time;
+
+	dst->count += src->count;
+	dst->sum += src->sum;
+
+	if (src->min < dst->min)
+		dst->min = src->min;
+	if (src->max > dst->max)
+		dst->max = src->max;
+
+	for (guint i = 0; i < R_STATS_HISTOGRAM_BUCKETS; i++)
+		dst->histogram[i] += src->histogram[i];
 }
 
 gdouble r_stats_get_avg(const RaucStats *stats)
@@ -43,12 +132,14 @@ gdouble r_stats_get_avg(const RaucStats *stats)
 gdouble r_stats_get_recent_avg(const RaucStats *stats)
 {
 	gdouble sum = 0.0;
-	guint64 count = stats->count;
+	guint64 count;
 
 	g_return_val_if_fail(stats, 0.0);
 
-	if (count > 64)
-		count = 64;
+	/* Until the ring buffer wraps, the values are stored in
+	 * values[0..count). Afterwards, all 64 entries are the most recent
+	 * values. */
+	count = MIN(stats->count, G_N_ELEMENTS(stats->values));
 
 	for (unsigned int i = 0; i < count; i++)
 		sum += stats->values[i];
@@ -59,6 +150,48 @@ gdouble r_stats_get_recent_avg(const RaucStats *stats)
 		return 0.0;
 }
 
+gdouble r_stats_get_percentile(const RaucStats *stats, gdouble percentile)
+{
+	gdouble rank;
+	guint64 seen = 0;
+
+	g_return_val_if_fail(stats, 0.0);
+	g_return_val_if_fail(percentile >= 0.0 && percentile <= 100.0, 0.0);
+
+	if (!stats->count)
+		return 0.0;
+
+	rank = percentile * stats->count / 100.0;
+
+	for (guint i = 0; i < R_STATS_HISTOGRAM_BUCKETS; i++) {
+		seen += stats->histogram[i];
+		if (seen && seen >= rank)
+			return CLAMP(histogram_value(i), stats->min, stats->max);
+	}
+
+	return stats->max;
+}
+
+gdouble r_stats_get_rate(const RaucStats *stats)
+{
+	g_return_val_if_fail(stats, 0.0);
+
+	if (stats->count < 2 || stats->last_time <= stats->first_time)
+		return 0.0;
+
+	return stats->count * 1000000.0 / (stats->last_time - stats->first_time);
+}
+
+gdouble r_stats_get_sum_rate(const RaucStats *stats)
+{
+	g_return_val_if_fail(stats, 0.0);
+
+	if (stats->count < 2 || stats->last_time <= stats->first_time)
+		return 0.0;
+
+	return stats->sum * 1000000.0 / (stats->last_time - stats->first_time);
+}
+
 void r_stats_show(const RaucStats *stats, const gchar *prefix)
 {
 	g_autofree gchar *prefix_label = NULL;
@@ -78,11 +211,127 @@ void r_stats_show(const RaucStats *stats, const gchar *prefix)
 	g_string_append_printf(msg, " sum=%.3f min=%.3f max=%.3f avg=%.3f",
 			stats->sum, stats->min, stats->max, r_stats_get_avg(stats));
 	g_string_append_printf(msg, " recent-avg=%.3f", r_stats_get_recent_avg(stats));
+	g_string_append_printf(msg, " p50=%.3f p90=%.3f p99=%.3f",
+			r_stats_get_percentile(stats, 50), r_stats_get_percentile(stats, 90),
+			r_stats_get_percentile(stats, 99));
+	g_string_append_printf(msg, " rate=%.3f/s", r_stats_get_rate(stats));
 
 out:
 	g_message("%s", msg->str);
 }
 
+GVariant *r_stats_to_variant(const RaucStats *stats, gboolean histogram)
+{
+	g_auto(GVariantDict) dict = G_VARIANT_DICT_INIT(NULL);
+
+	g_return_val_if_fail(stats, NULL);
+
+	g_variant_dict_insert(&dict, "label", "s", stats->label);
+	g_variant_dict_insert(&dict, "count", "t", stats->count);
+	g_variant_dict_insert(&dict, "sum", "d", stats->sum);
+	if (stats->count) {
+		g_variant_dict_insert(&dict, "min", "d", stats->min);
+		g_variant_dict_insert(&dict, "max", "d", stats->max);
+		g_variant_dict_insert(&dict, "avg", "d", r_stats_get_avg(stats));
+		g_variant_dict_insert(&dict, "recent-avg", "d", r_stats_get_recent_avg(stats));
+		g_variant_dict_insert(&dict, "p50", "d", r_stats_get_percentile(stats, 50));
+		g_variant_dict_insert(&dict, "p90", "d", r_stats_get_percentile(stats, 90));
+		g_variant_dict_insert(&dict, "p99", "d", r_stats_get_percentile(stats, 99));
+		g_variant_dict_insert(&dict, "rate", "d", r_stats_get_rate(stats));
+		g_variant_dict_insert(&dict, "sum-rate", "d", r_stats_get_sum_rate(stats));
+	}
+
+	if (histogram) {
+		GVariantBuilder builder;
+
+		g_variant_builder_init(&builder, G_VARIANT_TYPE("a(ut)"));
+		for (guint i = 0; i < R_STATS_HISTOGRAM_BUCKETS; i++) {
+			if (stats->histogram[i])
+				g_variant_builder_add(&builder, "(ut)", i, stats->histogram[i]);
+		}
+		g_variant_dict_insert_value(&dict, "histogram", g_variant_builder_end(&builder));
+		g_variant_dict_insert(&dict, "first-time", "x", stats->first_time);
+		g_variant_dict_insert(&dict, "last-time", "x", stats->last_time);
+	}
+
+	return g_variant_dict_end(&dict);
+}
+
+RaucStats *r_stats_from_variant(GVariant *variant, GError **error)
+{
+	g_auto(GVariantDict) dict = G_VARIANT_DICT_INIT(NULL);
+	g_autoptr(RaucStats) stats = NULL;
+	g_autoptr(GVariant) histogram = NULL;
+	g_autofree gchar *label = NULL;
+	GVariantIter iter;
+	guint64 bucket_count, total = 0;
+	guint32 bucket;
+
+	g_return_val_if_fail(variant, NULL);
+	g_return_val_if_fail(error == NULL || *error == NULL, NULL);
+
+	if (!g_variant_is_of_type(variant, G_VARIANT_TYPE_VARDICT)) {
+		g_set_error(error, R_STATS_ERROR, R_STATS_ERROR_INVALID,
+				"Invalid stats type '%s'", g_variant_get_type_string(variant));
+		return NULL;
+	}
+
+	g_variant_dict_init(&dict, variant);
+
+	if (!g_variant_dict_lookup(&dict, "label", "s", &label)) {
+		g_set_error(error, R_STATS_ERROR, R_STATS_ERROR_INVALID,
+				"Missing stats label");
+		return NULL;
+	}
+
+	stats = r_stats_new(label);
+
+	histogram = g_variant_dict_lookup_value(&dict, "histogram", G_VARIANT_TYPE("a(ut)"));
+	if (!histogram ||
+	    !g_variant_dict_lookup(&dict, "count", "t", &stats->count) ||
+	    !g_variant_dict_lookup(&dict, "sum", "d", &stats->sum) ||
+	    !g_variant_dict_lookup(&dict, "first-time", "x", &stats->first_time) ||
+	    !g_variant_dict_lookup(&dict, "last-time", "x", &stats->last_time)) {
+		g_set_error(error, R_STATS_ERROR, R_STATS_ERROR_INVALID,
+				"Incomplete stats '%s'", label);
+		return NULL;
+	}
+
+	if (stats->count &&
+	    (!g_variant_dict_lookup(&dict, "min", "d", &stats->min) ||
+	     !g_variant_dict_lookup(&dict, "max", "d", &stats->max))) {
+		g_set_error(error, R_STATS_ERROR, R_STATS_ERROR_INVALID,
+				"Missing range of stats '%s'", label);
+		return NULL;
+	}
+
+	g_variant_iter_init(&iter, histogram);
+	while (g_variant_iter_next(&iter, "(ut)", &bucket, &bucket_count)) {
+		if (bucket >= R_STATS_HISTOGRAM_BUCKETS) {
+			g_set_error(error, R_STATS_ERROR, R_STATS_ERROR_INVALID,
+					"Invalid histogram bucket %"G_GUINT32_FORMAT " in stats '%s'", bucket, label);
+			return NULL;
+		}
+		stats->histogram[bucket] += bucket_count;
+		total += bucket_count;
+	}
+
+	if (total != stats->count) {
+		g_set_error(error, R_STATS_ERROR, R_STATS_ERROR_INVALID,
+				"Histogram of stats '%s' does not match count", label);
+		return NULL;
+	}
+
+	return g_steal_pointer(&stats);
+}
+
+static void stats_free(RaucStats *stats)
+{
+	g_free(stats->label);
+
+	g_free(stats);
+}
+
 void r_stats_free(RaucStats *stats)
 {
 	if (!stats)
@@ -94,9 +343,59 @@ void r_stats_free(RaucStats *stats)
 		return;
 	}
 
-	g_free(stats->label);
+	stats_free(stats);
+}
 
-	g_free(stats);
+void r_stats_publish(const RaucStats *stats)
+{
+	RaucStats *published;
+
+	g_return_if_fail(stats);
+
+	G_LOCK(published_stats);
+
+	if (!published_stats)
+		published_stats = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, (GDestroyNotify)stats_free);
+
+	published = g_hash_table_lookup(published_stats, stats->label);
+	if (!published) {
+		published = r_stats_new(stats->label);
+		g_hash_table_insert(published_stats, published->label, published);
+	}
+	r_stats_merge(published, stats);
+
+	G_UNLOCK(published_stats);
+}
+
+GVariant *r_stats_get_published(gboolean histogram)
+{
+	GVariantBuilder builder;
+	g_autoptr(GList) labels = NULL;
+
+	g_variant_builder_init(&builder, G_VARIANT_TYPE("a{sa{sv}}"));
+
+	G_LOCK(published_stats);
+
+	if (published_stats) {
+		labels = g_hash_table_get_keys(published_stats);
+		labels = g_list_sort(labels, (GCompareFunc)g_strcmp0);
+	}
+
+	for (GList *l = labels; l != NULL; l = l->next) {
+		const RaucStats *stats = g_hash_table_lookup(published_stats, l->data);
+		g_variant_builder_add(&builder, "{s@a{sv}}", stats->label, r_stats_to_variant(stats, histogram));
+	}
+
+	G_UNLOCK(published_stats);
+
+	return g_variant_builder_end(&builder);
+}
+
+void r_stats_clear_published(void)
+{
+	G_LOCK(published_stats);
+	g_clear_pointer(&published_stats, g_hash_table_destroy);
+	G_UNLOCK(published_stats);
 }
 
 void r_test_stats_start(void)
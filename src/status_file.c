@@ -1,8 +1,12 @@
 #include <errno.h>
+#include <fcntl.h>
 #include <glib.h>
 #include <glib/gstdio.h>
+#include <string.h>
+#include <unistd.h>
 
 #include "context.h"
+#include "ext4.h"
 #include "mount.h"
 #include "status_file.h"
 #include "utils.h"
@@ -172,6 +176,48 @@ gboolean r_slot_status_write(const gchar *filename, RaucSlotStatus *ss, GError *
 	return TRUE;
 }
 
+/* slot.raucs only contains a few lines, anything larger is not ours */
+#define SLOT_STATUS_MAX_SIZE (64 * 1024)
+
+/* Reads slot.raucs directly from the slot device without mounting it.
+ *
+ * Returns FALSE with R_EXT4_ERROR_UNSUPPORTED if the filesystem can only be
+ * accessed by mounting it (e.g. the journal needs to be replayed). */
+static gboolean load_slot_status_from_device(RaucSlot *dest_slot, GError **error)
+{
+	GError *ierror = NULL;
+	g_autoptr(GBytes) data = NULL;
+	g_autoptr(GKeyFile) key_file = NULL;
+	gsize size;
+	const gchar *content;
+
+	g_return_val_if_fail(dest_slot, FALSE);
+	g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
+
+	if (g_strcmp0(dest_slot->type, "ext4") != 0) {
+		g_set_error(error, R_EXT4_ERROR, R_EXT4_ERROR_UNSUPPORTED,
+				"Slot type %s not supported", dest_slot->type);
+		return FALSE;
+	}
+
+	data = r_ext4_read_root_file(dest_slot->device, "slot.raucs", SLOT_STATUS_MAX_SIZE, &ierror);
+	if (!data) {
+		g_propagate_error(error, ierror);
+		return FALSE;
+	}
+
+	content = g_bytes_get_data(data, &size);
+	key_file = g_key_file_new();
+	if (!g_key_file_load_from_data(key_file, content, size, G_KEY_FILE_NONE, &ierror)) {
+		g_propagate_error(error, ierror);
+		return FALSE;
+	}
+
+	status_file_get_slot_status(key_file, "slot", dest_slot->status);
+
+	return TRUE;
+}
+
 static void load_slot_status_locally(RaucSlot *dest_slot)
 {
 	GError *ierror = NULL;
@@ -187,6 +233,21 @@ static void load_slot_status_locally(RaucSlot *dest_slot)
 	if (!r_slot_is_mountable(dest_slot))
 		return;
 
+	/* try to read slot status without mounting first */
+	if (!dest_slot->ext_mount_point) {
+		if (load_slot_status_from_device(dest_slot, &ierror))
+			return;
+
+		if (g_error_matches(ierror, R_EXT4_ERROR, R_EXT4_ERROR_NOT_FOUND)) {
+			g_message("No status file found on slot %s", dest_slot->device);
+			g_clear_error(&ierror);
+			return;
+		}
+
+		g_debug("Failed to read status of slot %s without mounting: %s", dest_slot->device, ierror->message);
+		g_clear_error(&ierror);
+	}
+
 	/* read slot status */
 	if (!dest_slot->ext_mount_point) {
 		g_message("mounting slot %s", dest_slot->device);
@@ -215,6 +276,279 @@ static void load_slot_status_locally(RaucSlot *dest_slot)
 	}
 }
 
+/* The status journal is stored next to the central status file. Each record
+ * consists of a header (magic, payload length and CRC-32 of the payload) and
+ * a key file fragment. All groups contained in a record replace the
+ * corresponding groups of the status file, a group without keys removes it.
+ */
+#define STATUS_JOURNAL_MAGIC "RSJ1"
+#define STATUS_JOURNAL_HEADER_SIZE 12
+/* rewrite the status file once the journal grows beyond this size */
+#define STATUS_JOURNAL_COMPACT_SIZE (16 * 1024)
+
+static gchar *status_journal_path(const gchar *filename)
+{
+	return g_strconcat(filename, ".journal", NULL);
+}
+
+static guint32 status_journal_crc32(const guint8 *data, gsize len)
+{
+	guint32 crc = 0xffffffff;
+
+	for (gsize i = 0; i < len; i++) {
+		crc ^= data[i];
+		for (guint bit = 0; bit < 8; bit++)
+			crc = (crc >> 1) ^ ((crc & 1) ? 0xedb88320 : 0);
+	}
+
+	return ~crc;
+}
+
+static void status_journal_apply(GKeyFile *key_file, GKeyFile *record)
+{
+	g_auto(GStrv) groups = g_key_file_get_groups(record, NULL);
+
+	for (gchar **group = groups; *group != NULL; group++) {
+		g_auto(GStrv) keys = g_key_file_get_keys(record, *group, NULL, NULL);
+
+		g_key_file_remove_group(key_file, *group, NULL);
+		for (gchar **key = keys; key && *key != NULL; key++) {
+			g_autofree gchar *value = g_key_file_get_value(record, *group, *key, NULL);
+			g_key_file_set_value(key_file, *group, *key, value);
+		}
+	}
+}
+
+/* Applies all complete records of the journal to key_file.
+ *
+ * A torn or corrupted record (e.g. after a power cut during an append) ends
+ * the replay. The size of the valid part is returned in valid_size, so that
+ * the next append can overwrite the rest.
+ */
+static gboolean status_journal_replay(const gchar *filename, GKeyFile *key_file, goffset *valid_size, GError **error)
+{
+	GError *ierror = NULL;
+	g_autofree gchar *path = status_journal_path(filename);
+	g_autofree gchar *contents = NULL;
+	gsize len = 0;
+	gsize pos = 0;
+
+	g_return_val_if_fail(filename, FALSE);
+	g_return_val_if_fail(key_file, FALSE);
+	g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
+
+	if (valid_size)
+		*valid_size = 0;
+
+	if (!g_file_get_contents(path, &contents, &len, &ierror)) {
+		if (g_error_matches(ierror, G_FILE_ERROR, G_FILE_ERROR_NOENT)) {
+			g_clear_error(&ierror);
+			return TRUE;
+		}
+		g_propagate_prefixed_error(error, ierror, "Failed to read status journal: ");
+		return FALSE;
+	}
+
+	while (len - pos >= STATUS_JOURNAL_HEADER_SIZE) {
+		const guint8 *header = (const guint8 *) contents + pos;
+		g_autoptr(GKeyFile) record = NULL;
+		guint32 payload_len, crc;
+
+		if (memcmp(header, STATUS_JOURNAL_MAGIC, 4) != 0)
+			break;
+		memcpy(&payload_len, header + 4, sizeof(payload_len));
+		payload_len = GUINT32_FROM_LE(payload_len);
+		memcpy(&crc, header + 8, sizeof(crc));
+		crc = GUINT32_FROM_LE(crc);
+
+		if (payload_len > len - pos - STATUS_JOURNAL_HEADER_SIZE)
+			break;
+		if (status_journal_crc32(header + STATUS_JOURNAL_HEADER_SIZE, payload_len) != crc)
+			break;
+
+		record = g_key_file_new();
+		if (!g_key_file_load_from_data(record, contents + pos + STATUS_JOURNAL_HEADER_SIZE, payload_len, G_KEY_FILE_NONE, NULL))
+			break;
+
+		status_journal_apply(key_file, record);
+		pos += STATUS_JOURNAL_HEADER_SIZE + payload_len;
+	}
+
+	if (pos != len)
+		g_message("Ignoring %"G_GSIZE_FORMAT " bytes of incomplete status journal %s", len - pos, path);
+
+	if (valid_size)
+		*valid_size = pos;
+
+	return TRUE;
+}
+
+/* Appends a record to the journal and waits until it is stored persistently.
+ * Data after valid_size (from an interrupted append) is overwritten. */
+static gboolean status_journal_append(const gchar *filename, GKeyFile *record, goffset valid_size, GError **error)
+{
+	GError *ierror = NULL;
+	g_autofree gchar *path = status_journal_path(filename);
+	g_autofree gchar *payload = NULL;
+	g_autoptr(GByteArray) buf = g_byte_array_new();
+	g_auto(filedesc) fd = -1;
+	gsize payload_len = 0;
+	guint32 le;
+
+	payload = g_key_file_to_data(record, &payload_len, NULL);
+	if (payload_len > G_MAXUINT32) {
+		g_set_error(error, G_FILE_ERROR, G_FILE_ERROR_FAILED,
+				"Status journal record too large");
+		return FALSE;
+	}
+
+	g_byte_array_append(buf, (const guint8 *) STATUS_JOURNAL_MAGIC, 4);
+	le = GUINT32_TO_LE(payload_len);
+	g_byte_array_append(buf, (const guint8 *) &le, sizeof(le));
+	le = GUINT32_TO_LE(status_journal_crc32((const guint8 *) payload, payload_len));
+	g_byte_array_append(buf, (const guint8 *) &le, sizeof(le));
+	g_byte_array_append(buf, (const guint8 *) payload, payload_len);
+
+	fd = g_open(path, O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+	if (fd < 0) {
+		int err = errno;
+		g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(err),
+				"Failed to open status journal %s: %s", path, g_strerror(err));
+		return FALSE;
+	}
+
+	if (ftruncate(fd, valid_size) != 0) {
+		int err = errno;
+		g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(err),
+				"Failed to truncate status journal %s: %s", path, g_strerror(err));
+		return FALSE;
+	}
+
+	if (!r_pwrite_exact(fd, buf->data, buf->len, valid_size, &ierror)) {
+		g_propagate_prefixed_error(error, ierror, "Failed to write status journal %s: ", path);
+		return FALSE;
+	}
+
+	if (fsync(fd) != 0) {
+		int err = errno;
+		g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(err),
+				"Failed to sync status journal %s: %s", path, g_strerror(err));
+		return FALSE;
+	}
+
+	/* make sure a newly created journal is found after a power cut */
+	if (valid_size == 0) {
+		g_autofree gchar *dirname = g_path_get_dirname(path);
+		g_auto(filedesc) dir_fd = g_open(dirname, O_RDONLY | O_DIRECTORY | O_CLOEXEC, 0);
+
+		if (dir_fd >= 0)
+			(void) fsync(dir_fd);
+	}
+
+	return TRUE;
+}
+
+/* Writes the complete status file and drops the (now merged) journal.
+ *
+ * key_file must not contain changes which are not recorded in the journal, so
+ * that replaying a journal left over by an interruption before removing it
+ * results in the same state. */
+static gboolean status_file_write(const gchar *filename, GKeyFile *key_file, GError **error)
+{
+	GError *ierror = NULL;
+	g_autofree gchar *path = status_journal_path(filename);
+
+	if (!g_key_file_save_to_file(key_file, filename, &ierror)) {
+		g_propagate_error(error, ierror);
+		return FALSE;
+	}
+
+	if (g_unlink(path) != 0 && errno != ENOENT) {
+		int err = errno;
+		g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(err),
+				"Failed to remove status journal %s: %s", path, g_strerror(err));
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+/* Checks whether a group has the same keys and values in both key files */
+static gboolean status_file_group_equal(GKeyFile *a, GKeyFile *b, const gchar *group)
+{
+	g_auto(GStrv) keys_a = g_key_file_get_keys(a, group, NULL, NULL);
+	g_auto(GStrv) keys_b = g_key_file_get_keys(b, group, NULL, NULL);
+
+	guint len_a = keys_a ? g_strv_length(keys_a) : 0;
+	guint len_b = keys_b ? g_strv_length(keys_b) : 0;
+
+	/* a missing group and an empty group are equivalent */
+	if (len_a != len_b)
+		return FALSE;
+	if (len_a == 0)
+		return TRUE;
+
+	for (gchar **key = keys_a; *key != NULL; key++) {
+		g_autofree gchar *value_a = g_key_file_get_value(a, group, *key, NULL);
+		g_autofree gchar *value_b = g_key_file_get_value(b, group, *key, NULL);
+
+		if (g_strcmp0(value_a, value_b) != 0)
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+/* Adds the group from new_key_file to the record if it differs from the
+ * currently stored state in key_file. */
+static void status_journal_record_group(GKeyFile *record, GKeyFile *key_file, GKeyFile *new_key_file, const gchar *group)
+{
+	g_auto(GStrv) keys = NULL;
+
+	if (status_file_group_equal(key_file, new_key_file, group))
+		return;
+
+	/* create the group even if it is empty, as that marks its removal */
+	g_key_file_set_value(record, group, "_", "");
+	g_key_file_remove_key(record, group, "_", NULL);
+
+	keys = g_key_file_get_keys(new_key_file, group, NULL, NULL);
+	for (gchar **key = keys; key && *key != NULL; key++) {
+		g_autofree gchar *value = g_key_file_get_value(new_key_file, group, *key, NULL);
+		g_key_file_set_value(record, group, *key, value);
+	}
+}
+
+/* Stores the changes in record by appending them to the journal. If there is
+ * no status file yet or the journal has grown too large, the status file is
+ * rewritten afterwards. */
+static gboolean status_journal_commit(GKeyFile *key_file, GKeyFile *record, goffset journal_size, gboolean rewrite, GError **error)
+{
+	const gchar *filename = r_context()->config->statusfile_path;
+	g_auto(GStrv) groups = g_key_file_get_groups(record, NULL);
+	g_autofree gchar *payload = NULL;
+	gsize payload_len = 0;
+
+	if (!groups || !groups[0]) {
+		g_debug("Status unchanged, not writing status journal");
+		return TRUE;
+	}
+
+	/* the record is appended even if compacting, see status_file_write() */
+	if (!status_journal_append(filename, record, journal_size, error))
+		return FALSE;
+
+	payload = g_key_file_to_data(record, &payload_len, NULL);
+	if (rewrite ||
+	    journal_size + STATUS_JOURNAL_HEADER_SIZE + (goffset)payload_len > STATUS_JOURNAL_COMPACT_SIZE) {
+		g_debug("Compacting status journal into %s", filename);
+		status_journal_apply(key_file, record);
+		return status_file_write(filename, key_file, error);
+	}
+
+	return TRUE;
+}
+
 void r_slot_status_load_globally(const gchar *filename, GHashTable *slots)
 {
 	GError *ierror = NULL;
@@ -233,6 +567,11 @@ void r_slot_status_load_globally(const gchar *filename, GHashTable *slots)
 		g_clear_error(&ierror);
 	}
 
+	if (!status_journal_replay(filename, key_file, NULL, &ierror)) {
+		g_message("%s", ierror->message);
+		g_clear_error(&ierror);
+	}
+
 	/* Load all slot states included in the statusfile */
 	groups = g_key_file_get_groups(key_file, NULL);
 	for (group = groups; *group != NULL; group++) {
@@ -310,27 +649,22 @@ static gboolean save_slot_status_locally(RaucSlot *dest_slot, GError **error)
 	return TRUE;
 }
 
-/**
- * Returns a new GKeyFile optionally pre-populated form a (shared) key file.
+/* Loads the shared status file including all journal records.
  *
- * With keep_prefix, one can define groups to keep in the returned GKeyFile.
- * All other groups will be removed and can be newly populated.
- *
- * @param path Path to key file
- * @param keep_prefix prefix for groups to keep when loading the file
- * @param error Return location for a GError, or NULL
- *
- * @return newly-allocated GKeyFile or NULL on error
+ * journal_size is set to the size of the valid journal. rewrite is set if
+ * there is no usable status file yet.
  */
-static GKeyFile* key_file_init_from_shared_status_file(const gchar *keep_prefix, GError **error)
+static GKeyFile* load_shared_status_file(goffset *journal_size, gboolean *rewrite, GError **error)
 {
 	g_autoptr(GKeyFile) key_file = NULL;
-	g_auto(GStrv) groups = NULL;
 	GError *ierror = NULL;
 
 	key_file = g_key_file_new();
+	*journal_size = 0;
+	*rewrite = FALSE;
 
 	if (!g_key_file_load_from_file(key_file, r_context()->config->statusfile_path, G_KEY_FILE_NONE, &ierror)) {
+		*rewrite = TRUE;
 		if (g_error_matches(ierror, G_FILE_ERROR, G_FILE_ERROR_NOENT)) {
 			g_info("Status file does not exist yet, ignore loading");
 			g_clear_error(&ierror);
@@ -349,6 +683,50 @@ static GKeyFile* key_file_init_from_shared_status_file(const gchar *keep_prefix,
 		}
 	}
 
+	if (!status_journal_replay(r_context()->config->statusfile_path, key_file, journal_size, &ierror)) {
+		g_propagate_error(error, ierror);
+		return NULL;
+	}
+
+	return g_steal_pointer(&key_file);
+}
+
+/**
+ * Returns a new GKeyFile optionally pre-populated form a (shared) key file.
+ *
+ * With keep_prefix, one can define groups to keep in the returned GKeyFile.
+ * All other groups will be removed and can be newly populated.
+ *
+ * @param path Path to key file
+ * @param keep_prefix prefix for groups to keep when loading the file
+ * @param error Return location for a GError, or NULL
+ *
+ * @return newly-allocated GKeyFile or NULL on error
+ */
+static GKeyFile* key_file_init_from_shared_status_file(const gchar *keep_prefix, GError **error)
+{
+	g_autoptr(GKeyFile) key_file = NULL;
+	g_auto(GStrv) groups = NULL;
+	GError *ierror = NULL;
+	goffset journal_size;
+	gboolean rewrite;
+
+	key_file = load_shared_status_file(&journal_size, &rewrite, &ierror);
+	if (!key_file) {
+		g_propagate_error(error, ierror);
+		return NULL;
+	}
+
+	/* Merge a journal (left over from using statusfile-journal) before
+	 * making any changes which are not recorded in it. */
+	if (journal_size > 0) {
+		g_debug("Merging status journal into %s", r_context()->config->statusfile_path);
+		if (!status_file_write(r_context()->config->statusfile_path, key_file, &ierror)) {
+			g_propagate_error(error, ierror);
+			return NULL;
+		}
+	}
+
 	groups = g_key_file_get_groups(key_file, NULL);
 	for (gchar **group = groups; *group != NULL; group++) {
 		if (!g_str_has_prefix(*group, keep_prefix))
@@ -363,6 +741,48 @@ static GKeyFile* key_file_init_from_shared_status_file(const gchar *keep_prefix,
 	return g_steal_pointer(&key_file);
 }
 
+/* Records the slot status groups which changed compared to the stored state
+ * in the status journal */
+static gboolean save_slot_status_journal(GError **error)
+{
+	g_autoptr(GKeyFile) key_file = NULL;
+	g_autoptr(GKeyFile) new_key_file = g_key_file_new();
+	g_autoptr(GKeyFile) record = g_key_file_new();
+	g_auto(GStrv) groups = NULL;
+	GError *ierror = NULL;
+	GHashTableIter iter;
+	RaucSlot *slot;
+	goffset journal_size;
+	gboolean rewrite;
+
+	key_file = load_shared_status_file(&journal_size, &rewrite, &ierror);
+	if (!key_file) {
+		g_propagate_error(error, ierror);
+		return FALSE;
+	}
+
+	g_hash_table_iter_init(&iter, r_context()->config->slots);
+	while (g_hash_table_iter_next(&iter, NULL, (gpointer*) &slot)) {
+		g_autofree gchar *group = g_strdup_printf(RAUC_SLOT_PREFIX ".%s", slot->name);
+
+		if (slot->status)
+			status_file_set_slot_status(new_key_file, group, slot->status);
+		status_journal_record_group(record, key_file, new_key_file, group);
+	}
+
+	/* drop status of slots which are not configured anymore */
+	groups = g_key_file_get_groups(key_file, NULL);
+	for (gchar **group = groups; *group != NULL; group++) {
+		if (!g_str_has_prefix(*group, RAUC_SLOT_PREFIX "."))
+			continue;
+		if (g_hash_table_contains(r_context()->config->slots, *group + strlen(RAUC_SLOT_PREFIX ".")))
+			continue;
+		status_journal_record_group(record, key_file, new_key_file, *group);
+	}
+
+	return status_journal_commit(key_file, record, journal_size, rewrite, error);
+}
+
 /* Updates slot status information in status file while leaving system status
  * information untouched */
 static gboolean save_slot_status_globally(GError **error)
@@ -377,6 +797,9 @@ static gboolean save_slot_status_globally(GError **error)
 
 	g_debug("Saving global slot status");
 
+	if (r_context()->config->statusfile_journal)
+		return save_slot_status_journal(error);
+
 	key_file = key_file_init_from_shared_status_file(RAUC_SLOT_PREFIX ".", &ierror);
 	if (!key_file) {
 		g_propagate_error(error, ierror);
@@ -395,7 +818,7 @@ static gboolean save_slot_status_globally(GError **error)
 		status_file_set_slot_status(key_file, group, slot->status);
 	}
 
-	if (!g_key_file_save_to_file(key_file, r_context()->config->statusfile_path, &ierror)) {
+	if (!status_file_write(r_context()->config->statusfile_path, key_file, &ierror)) {
 		g_propagate_error(error, ierror);
 		return FALSE;
 	}
@@ -432,6 +855,11 @@ gboolean r_system_status_load(const gchar *filename, RSystemStatus *status, GErr
 		return FALSE;
 	}
 
+	if (!status_journal_replay(filename, key_file, NULL, &ierror)) {
+		g_propagate_error(error, ierror);
+		return FALSE;
+	}
+
 	status->boot_id = g_key_file_get_string(key_file, "system", "boot-id", NULL);
 
 	return TRUE;
@@ -450,6 +878,24 @@ gboolean r_system_status_save(GError **error)
 		return TRUE;
 	}
 
+	if (r_context()->config->statusfile_journal) {
+		g_autoptr(GKeyFile) new_key_file = g_key_file_new();
+		g_autoptr(GKeyFile) record = g_key_file_new();
+		goffset journal_size;
+		gboolean rewrite;
+
+		key_file = load_shared_status_file(&journal_size, &rewrite, &ierror);
+		if (!key_file) {
+			g_propagate_error(error, ierror);
+			return FALSE;
+		}
+
+		g_key_file_set_string(new_key_file, "system", "boot-id", r_context()->system_status->boot_id);
+		status_journal_record_group(record, key_file, new_key_file, "system");
+
+		return status_journal_commit(key_file, record, journal_size, rewrite, error);
+	}
+
 	key_file = key_file_init_from_shared_status_file("system", &ierror);
 	if (!key_file) {
 		g_propagate_error(error, ierror);
@@ -458,7 +904,7 @@ gboolean r_system_status_save(GError **error)
 
 	g_key_file_set_string(key_file, "system", "boot-id", r_context()->system_status->boot_id);
 
-	if (!g_key_file_save_to_file(key_file, r_context()->config->statusfile_path, &ierror)) {
+	if (!status_file_write(r_context()->config->statusfile_path, key_file, &ierror)) {
 		g_propagate_error(error, ierror);
 		return FALSE;
 	}
@@ -0,0 +1,377 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <glib/gstdio.h>
+
+#include "trace.h"
+#include "utils.h"
+
+/* upper limit to keep the memory usage bounded for long operations */
+#define R_TRACE_MAX_EVENTS (1024 * 1024)
+
+#define R_TRACE_BINARY_MAGIC "RTRACE01"
+
+typedef struct {
+	const gchar *category; /* static */
+	const gchar *name; /* interned */
+	gint64 begin;
+	gint64 end;
+	guint64 bytes;
+	guint32 tid;
+} RTraceEvent;
+
+static struct {
+	gint enabled; /* atomic, only changed while holding the lock */
+	int fd;
+	gchar *path;
+	guint aux_files; /* number of additional files for subprocesses */
+	RTraceFormat format;
+	gint64 start; /* monotonic */
+	gint64 start_real;
+	GArray *events;
+	guint64 dropped;
+	guint64 bytes;
+} trace = {
+	.fd = -1,
+};
+G_LOCK_DEFINE_STATIC(trace);
+
+G_DEFINE_QUARK(r-trace-error-quark, r_trace_error)
+
+RTraceFormat r_trace_format_for_path(const gchar *path)
+{
+	g_return_val_if_fail(path, R_TRACE_FORMAT_JSON);
+
+	if (g_str_has_suffix(path, ".rtrace"))
+		return R_TRACE_FORMAT_BINARY;
+
+	return R_TRACE_FORMAT_JSON;
+}
+
+gboolean r_trace_start_fd(int fd, RTraceFormat format, GError **error)
+{
+	g_return_val_if_fail(fd >= 0, FALSE);
+	g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
+
+	G_LOCK(trace);
+	if (g_atomic_int_get(&trace.enabled)) {
+		G_UNLOCK(trace);
+		g_set_error(error, R_TRACE_ERROR, R_TRACE_ERROR_ACTIVE,
+				"Tracing is already active");
+		return FALSE;
+	}
+
+	trace.fd = fd;
+	trace.format = format;
+	trace.start = g_get_monotonic_time();
+	trace.start_real = g_get_real_time();
+	trace.events = g_array_new(FALSE, FALSE, sizeof(RTraceEvent));
+	trace.dropped = 0;
+	trace.bytes = 0;
+	g_atomic_int_set(&trace.enabled, TRUE);
+	G_UNLOCK(trace);
+
+	return TRUE;
+}
+
+gboolean r_trace_start(const gchar *path, GError **error)
+{
+	GError *ierror = NULL;
+	int fd;
+
+	g_return_val_if_fail(path, FALSE);
+	g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
+
+	fd = g_open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd < 0) {
+		int err = errno;
+		g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(err),
+				"Failed to open trace file %s: %s", path, g_strerror(err));
+		return FALSE;
+	}
+
+	if (!r_trace_start_fd(fd, r_trace_format_for_path(path), &ierror)) {
+		g_close(fd, NULL);
+		g_propagate_error(error, ierror);
+		return FALSE;
+	}
+
+	G_LOCK(trace);
+	trace.path = g_strdup(path);
+	trace.aux_files = 0;
+	G_UNLOCK(trace);
+
+	g_message("Recording trace to %s", path);
+
+	return TRUE;
+}
+
+gboolean r_trace_is_enabled(void)
+{
+	/* called for each span, so avoid taking the lock */
+	return g_atomic_int_get(&trace.enabled);
+}
+
+gchar *r_trace_get_path(void)
+{
+	gchar *path;
+
+	G_LOCK(trace);
+	path = g_strdup(trace.path);
+	G_UNLOCK(trace);
+
+	return path;
+}
+
+gchar *r_trace_get_aux_path(const gchar *suffix)
+{
+	gchar *path = NULL;
+
+	g_return_val_if_fail(suffix, NULL);
+
+	G_LOCK(trace);
+	if (trace.path)
+		path = g_strdup_printf("%s.%s.%u", trace.path, suffix, ++trace.aux_files);
+	G_UNLOCK(trace);
+
+	return path;
+}
+
+RTraceFormat r_trace_get_format(void)
+{
+	RTraceFormat format;
+
+	G_LOCK(trace);
+	format = trace.format;
+	G_UNLOCK(trace);
+
+	return format;
+}
+
+gint64 r_trace_begin(void)
+{
+	if (!r_trace_is_enabled())
+		return 0;
+
+	return g_get_monotonic_time();
+}
+
+void r_trace_end(const gchar *category, const gchar *name, gint64 begin, guint64 bytes)
+{
+	RTraceEvent event = {0};
+
+	g_return_if_fail(category);
+	g_return_if_fail(name);
+
+	if (!begin)
+		return;
+
+	event.category = category;
+	event.name = g_intern_string(name);
+	event.begin = begin;
+	event.end = g_get_monotonic_time();
+	event.bytes = bytes;
+	event.tid = (guint32) syscall(SYS_gettid);
+
+	G_LOCK(trace);
+	/* ignore spans started before the current trace */
+	if (trace.enabled && begin >= trace.start) {
+		if (trace.events->len < R_TRACE_MAX_EVENTS)
+			g_array_append_val(trace.events, event);
+		else
+			trace.dropped++;
+	}
+	G_UNLOCK(trace);
+}
+
+void r_trace_add_bytes(guint64 bytes)
+{
+	if (!r_trace_is_enabled())
+		return;
+
+	G_LOCK(trace);
+	if (trace.enabled)
+		trace.bytes += bytes;
+	G_UNLOCK(trace);
+}
+
+guint64 r_trace_get_bytes(void)
+{
+	guint64 bytes;
+
+	G_LOCK(trace);
+	bytes = trace.bytes;
+	G_UNLOCK(trace);
+
+	return bytes;
+}
+
+typedef struct {
+	gchar *name;
+	gint64 begin;
+} RTraceSubprocess;
+
+static void trace_subprocess_finalized(gpointer data, GObject *where_the_object_was)
+{
+	RTraceSubprocess *sub = data;
+
+	r_trace_end(R_TRACE_CAT_SUBPROCESS, sub->name, sub->begin, 0);
+
+	g_free(sub->name);
+	g_free(sub);
+}
+
+void r_trace_subprocess(GSubprocess *sproc, const gchar *argv0, gint64 begin)
+{
+	RTraceSubprocess *sub = NULL;
+
+	g_return_if_fail(argv0);
+
+	if (!sproc || !begin)
+		return;
+
+	sub = g_new0(RTraceSubprocess, 1);
+	sub->name = g_path_get_basename(argv0);
+	sub->begin = begin;
+
+	g_object_weak_ref(G_OBJECT(sproc), trace_subprocess_finalized, sub);
+}
+
+static void append_json_string(GString *str, const gchar *value)
+{
+	g_string_append_c(str, '"');
+	for (const gchar *c = value; *c; c++) {
+		switch (*c) {
+			case '"':
+				g_string_append(str, "\\\"");
+				break;
+			case '\\':
+				g_string_append(str, "\\\\");
+				break;
+			default:
+				if ((guchar)*c < 0x20)
+					g_string_append_printf(str, "\\u%04x", (guchar)*c);
+				else
+					g_string_append_c(str, *c);
+				break;
+		}
+	}
+	g_string_append_c(str, '"');
+}
+
+static GBytes *format_json(void)
+{
+	GString *str = g_string_sized_new(128 + trace.events->len * 128);
+	guint pid = getpid();
+
+	g_string_append(str, "{\"traceEvents\":[");
+	for (guint i = 0; i < trace.events->len; i++) {
+		const RTraceEvent *event = &g_array_index(trace.events, RTraceEvent, i);
+
+		if (i)
+			g_string_append_c(str, ',');
+		g_string_append(str, "\n{\"name\":");
+		append_json_string(str, event->name);
+		g_string_append_printf(str,
+				",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%"G_GINT64_FORMAT ",\"dur\":%"G_GINT64_FORMAT
+				",\"pid\":%u,\"tid\":%"G_GUINT32_FORMAT ",\"args\":{\"bytes\":%"G_GUINT64_FORMAT "}}",
+				event->category, event->begin - trace.start, event->end - event->begin,
+				pid, event->tid, event->bytes);
+	}
+	g_string_append_printf(str,
+			"\n],\"displayTimeUnit\":\"ms\",\"otherData\":{\"start_time_us\":%"G_GINT64_FORMAT ",\"dropped_events\":%"G_GUINT64_FORMAT "}}\n",
+			trace.start_real, trace.dropped);
+
+	return g_string_free_to_bytes(str);
+}
+
+static void append_le16(GByteArray *buf, guint16 value)
+{
+	value = GUINT16_TO_LE(value);
+	g_byte_array_append(buf, (const guint8 *)&value, sizeof(value));
+}
+
+static void append_le32(GByteArray *buf, guint32 value)
+{
+	value = GUINT32_TO_LE(value);
+	g_byte_array_append(buf, (const guint8 *)&value, sizeof(value));
+}
+
+static void append_le64(GByteArray *buf, guint64 value)
+{
+	value = GUINT64_TO_LE(value);
+	g_byte_array_append(buf, (const guint8 *)&value, sizeof(value));
+}
+
+static GBytes *format_binary(void)
+{
+	GByteArray *buf = g_byte_array_sized_new(32 + trace.events->len * 48);
+
+	g_byte_array_append(buf, (const guint8 *)R_TRACE_BINARY_MAGIC, 8);
+	append_le32(buf, getpid());
+	append_le32(buf, trace.events->len);
+	append_le64(buf, trace.start_real);
+	append_le64(buf, trace.dropped);
+
+	for (guint i = 0; i < trace.events->len; i++) {
+		const RTraceEvent *event = &g_array_index(trace.events, RTraceEvent, i);
+		gsize category_len = MIN(strlen(event->category), G_MAXUINT16);
+		gsize name_len = MIN(strlen(event->name), G_MAXUINT16);
+
+		append_le64(buf, event->begin - trace.start);
+		append_le64(buf, event->end - event->begin);
+		append_le64(buf, event->bytes);
+		append_le32(buf, event->tid);
+		append_le16(buf, category_len);
+		append_le16(buf, name_len);
+		g_byte_array_append(buf, (const guint8 *)event->category, category_len);
+		g_byte_array_append(buf, (const guint8 *)event->name, name_len);
+	}
+
+	return g_byte_array_free_to_bytes(buf);
+}
+
+gboolean r_trace_stop(GError **error)
+{
+	GError *ierror = NULL;
+	g_autoptr(GBytes) data = NULL;
+	g_autofree gchar *path = NULL;
+	g_auto(filedesc) fd = -1;
+	gsize size;
+
+	g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
+
+	G_LOCK(trace);
+	if (!g_atomic_int_get(&trace.enabled)) {
+		G_UNLOCK(trace);
+		return TRUE;
+	}
+
+	if (trace.format == R_TRACE_FORMAT_BINARY)
+		data = format_binary();
+	else
+		data = format_json();
+
+	if (trace.dropped)
+		g_warning("Trace event limit reached, dropped %"G_GUINT64_FORMAT " events", trace.dropped);
+
+	g_atomic_int_set(&trace.enabled, FALSE);
+	fd = trace.fd;
+	trace.fd = -1;
+	path = g_steal_pointer(&trace.path);
+	g_clear_pointer(&trace.events, g_array_unref);
+	G_UNLOCK(trace);
+
+	if (!r_write_exact(fd, g_bytes_get_data(data, &size), size, &ierror)) {
+		g_propagate_prefixed_error(error, ierror,
+				"Failed to write trace file: ");
+		return FALSE;
+	}
+
+	if (path)
+		g_message("Trace written to %s", path);
+
+	return TRUE;
+}
@@ -17,9 +17,11 @@
 #include "update_utils.h"
 #include "emmc.h"
 #include "mbr.h"
+#include "mtd.h"
 #include "gpt.h"
 #include "utils.h"
 #include "hash_index.h"
+#include "metrics.h"
 
 #define R_SLOT_HOOK_PRE_INSTALL "slot-pre-install"
 #define R_SLOT_HOOK_POST_INSTALL "slot-post-install"
@@ -262,12 +264,15 @@ static gboolean splice_with_progress(GUnixInputStream *image_stream,
 		}
 
 		sum_size += out_size;
+		r_metrics_add_bytes(R_METRICS_SOURCE_BUNDLE, out_size);
 
 		/* emit progress info (but only when in progress context) */
 		if (r_context()->progress)
 			r_context_set_step_percentage("copy_image", sum_size * 100 / stat.st_size);
 	} while (out_size);
 
+	r_trace_add_bytes(sum_size);
+
 	return TRUE;
 }
 
@@ -331,20 +336,42 @@ static gboolean copy_raw_image(RaucImage *image, GUnixOutputStream *outstream, g
 	int out_fd = -1;
 	g_autofree void *header = NULL;
 	g_autoptr(GInputStream) instream = NULL;
+	gboolean from_payload;
+	gint64 trace_begin;
 
 	g_return_val_if_fail(image, FALSE);
 	g_return_val_if_fail(image->checksum.size >= 0, FALSE);
 	g_return_val_if_fail(outstream, FALSE);
 	g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
 
-	srcimagefile = g_file_new_for_path(image->filename);
+	from_payload = image->payload_device && image->payload_offset;
 	out_fd = g_unix_output_stream_get_fd(outstream);
 
-	instream = G_INPUT_STREAM(g_file_read(srcimagefile, NULL, &ierror));
-	if (instream == NULL) {
-		g_propagate_prefixed_error(error, ierror,
-				"Failed to open file for reading: ");
-		return FALSE;
+	if (from_payload) {
+		/* uncompressed image, read it directly from the bundle payload */
+		int in_fd = g_open(image->payload_device, O_RDONLY | O_CLOEXEC);
+
+		if (in_fd < 0) {
+			int err = errno;
+			g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(err),
+					"Failed to open payload device %s: %s", image->payload_device, g_strerror(err));
+			return FALSE;
+		}
+		instream = g_unix_input_stream_new(in_fd, TRUE);
+		if (lseek(in_fd, image->payload_offset, SEEK_SET) != (off_t)image->payload_offset) {
+			g_set_error(error, R_UPDATE_ERROR, R_UPDATE_ERROR_FAILED,
+					"Failed to seek to image payload offset %"G_GUINT64_FORMAT ": %s", image->payload_offset, strerror(errno));
+			return FALSE;
+		}
+		g_debug("Reading %s from offset %"G_GUINT64_FORMAT " of %s", image->filename, image->payload_offset, image->payload_device);
+	} else {
+		srcimagefile = g_file_new_for_path(image->filename);
+		instream = G_INPUT_STREAM(g_file_read(srcimagefile, NULL, &ierror));
+		if (instream == NULL) {
+			g_propagate_prefixed_error(error, ierror,
+					"Failed to open file for reading: ");
+			return FALSE;
+		}
 	}
 
 	if (len_header_last) {
@@ -370,13 +397,24 @@ static gboolean copy_raw_image(RaucImage *image, GUnixOutputStream *outstream, g
 		}
 	}
 
-	if (!r_copy_stream_with_progress(instream, G_OUTPUT_STREAM(outstream), image->checksum.size, &ierror)) {
-		g_propagate_prefixed_error(error, ierror,
-				"Failed to copy data: ");
-		return FALSE;
-	}
+	if (!from_payload) {
+		if (!r_copy_stream_with_progress(instream, G_OUTPUT_STREAM(outstream), image->checksum.size, &ierror)) {
+			g_propagate_prefixed_error(error, ierror,
+					"Failed to copy data: ");
+			return FALSE;
+		}
 
-	seeksize = g_seekable_tell(G_SEEKABLE(instream));
+		seeksize = g_seekable_tell(G_SEEKABLE(instream));
+	} else {
+		/* the payload device continues after the image */
+		if (!r_copy_stream_range_with_progress(instream, G_OUTPUT_STREAM(outstream), MAX(image->checksum.size - (goffset)len_header_last, 0), &ierror)) {
+			g_propagate_prefixed_error(error, ierror,
+					"Failed to copy data: ");
+			return FALSE;
+		}
+
+		seeksize = image->checksum.size;
+	}
 
 	if (seeksize != (goffset)image->checksum.size) {
 		g_set_error(error, R_UPDATE_ERROR, R_UPDATE_ERROR_FAILED,
@@ -410,10 +448,12 @@ static gboolean copy_raw_image(RaucImage *image, GUnixOutputStream *outstream, g
 	}
 
 	/* flush to block device before closing to assure content is written to disk */
+	trace_begin = r_trace_begin();
 	if (fsync(out_fd) == -1) {
 		g_set_error(error, R_UPDATE_ERROR, R_UPDATE_ERROR_FAILED, "Syncing content to disk failed: %s", strerror(errno));
 		return FALSE;
 	}
+	r_trace_end(R_TRACE_CAT_IO, "fsync", trace_begin, 0);
 
 	return TRUE;
 }
@@ -644,6 +684,7 @@ extract:
 		g_debug("Using casync tmp path: '%s'", tmpdir);
 
 	/* Call casync to extract */
+	r_metrics_mark_untracked();
 	res = casync_extract(image, dest, out_fd, seed, store, tmpdir, &ierror);
 	if (!res) {
 		g_propagate_error(error, ierror);
@@ -739,6 +780,7 @@ static gboolean copy_block_hash_index_image_to_dev(RaucImage *image, RaucSlot *s
 	off_t offset = 0;
 	int target_fd = -1;
 	g_autoptr(RaucStats) zero_stats = NULL;
+	gint64 trace_begin = 0;
 
 	g_return_val_if_fail(image, FALSE);
 	g_return_val_if_fail(slot, FALSE);
@@ -827,6 +869,17 @@ static gboolean copy_block_hash_index_image_to_dev(RaucImage *image, RaucSlot *s
 	 */
 	g_assert(sources->len <= 4);
 
+	{
+		guint64 limit = r_context()->config->hash_index_memory_limit;
+		g_autofree gchar *memory_str = g_format_size_full(r_hash_index_get_memory(), G_FORMAT_SIZE_IEC_UNITS);
+		g_autofree gchar *limit_str = g_format_size_full(limit, G_FORMAT_SIZE_IEC_UNITS);
+
+		if (limit)
+			g_message("Hash indices use %s of memory (limit %s, compact mode)", memory_str, limit_str);
+		else
+			g_message("Hash indices use %s of memory", memory_str);
+	}
+
 	{
 		const RaucHashIndex *target = g_ptr_array_index(sources, 0);
 		const RaucHashIndex *source = g_ptr_array_index(sources, sources->len-1);
@@ -847,6 +900,7 @@ static gboolean copy_block_hash_index_image_to_dev(RaucImage *image, RaucSlot *s
 	chunk = g_new0(RaucHashIndexChunk, 1);
 
 	/* Iterate over chunks in source image */
+	trace_begin = r_trace_begin();
 	for (guint32 c = 0; c < chunk_count; c++) {
 		gboolean found = FALSE;
 
@@ -855,6 +909,7 @@ static gboolean copy_block_hash_index_image_to_dev(RaucImage *image, RaucSlot *s
 			memset(chunk->data, 0, sizeof(chunk->data));
 			found = TRUE;
 			r_stats_add(zero_stats, 1);
+			r_metrics_add_bytes(R_METRICS_SOURCE_ZERO, sizeof(chunk->data));
 		} else {
 			/* Iterate over indices and call get chunk */
 			for (guint s = 0; s < sources->len; s++) {
@@ -863,6 +918,9 @@ static gboolean copy_block_hash_index_image_to_dev(RaucImage *image, RaucSlot *s
 					//g_autofree gchar *hash = r_hex_encode(chunk_hashes[c], sizeof(chunk_hashes[c]));
 					//g_debug("found chunk %"G_GUINT32_FORMAT" [%s] in index %u [%s]", c, hash, s, source->label);
 					found = TRUE;
+					/* the last index is the source image in the bundle */
+					r_metrics_add_bytes(s == sources->len - 1 ? R_METRICS_SOURCE_BUNDLE : R_METRICS_SOURCE_SEED,
+							sizeof(chunk->data));
 					break;
 				} else {
 					//g_autofree gchar *hash = r_hex_encode(chunk_hashes[c], sizeof(chunk_hashes[c]));
@@ -918,12 +976,17 @@ static gboolean copy_block_hash_index_image_to_dev(RaucImage *image, RaucSlot *s
 		goto out;
 	}
 
+	r_trace_end(R_TRACE_CAT_HASH_INDEX, "lookup", trace_begin, (guint64)chunk_count * sizeof(chunk->data));
+	r_trace_add_bytes((guint64)chunk_count * sizeof(chunk->data));
+
 	/* Flush to block device before closing to assure content is written to disk */
+	trace_begin = r_trace_begin();
 	if (fsync(target_fd) == -1) {
 		g_set_error(error, R_UPDATE_ERROR, R_UPDATE_ERROR_FAILED, "Syncing content to slot failed: %s", strerror(errno));
 		res = FALSE;
 		goto out;
 	}
+	r_trace_end(R_TRACE_CAT_IO, "fsync", trace_begin, 0);
 
 	/* Write new index to slot data dir. */
 	{
@@ -934,9 +997,11 @@ static gboolean copy_block_hash_index_image_to_dev(RaucImage *image, RaucSlot *s
 	}
 
 	r_stats_show(zero_stats, "access stats for");
+	r_stats_publish(zero_stats);
 	for (guint s = 0; s < sources->len; s++) {
 		const RaucHashIndex *source = g_ptr_array_index(sources, s);
 		r_stats_show(source->match_stats, "access stats for");
+		r_stats_publish(source->match_stats);
 	}
 
 	res = TRUE;
@@ -1181,99 +1246,19 @@ out:
 	return res;
 }
 
-static gboolean nor_write_slot(const gchar *image, const gchar *device, GError **error)
-{
-	GError *ierror = NULL;
-	gboolean res = FALSE;
-	g_autoptr(GPtrArray) args = g_ptr_array_new_full(5, g_free);
-
-	g_ptr_array_add(args, g_strdup("flashcp"));
-	g_ptr_array_add(args, g_strdup(image));
-	g_ptr_array_add(args, g_strdup(device));
-	g_ptr_array_add(args, NULL);
-
-	res = r_subprocess_runv(args, G_SUBPROCESS_FLAGS_NONE, &ierror);
-	if (!res) {
-		g_propagate_prefixed_error(
-				error,
-				ierror,
-				"failed to run flashcp: ");
-		goto out;
-	}
-
-out:
-	return res;
-}
-
 static gboolean flash_format_slot(const gchar *device, GError **error)
 {
 	GError *ierror = NULL;
-	gboolean res = FALSE;
-	g_autoptr(GPtrArray) args = g_ptr_array_new_full(5, g_free);
 
-	g_ptr_array_add(args, g_strdup("flash_erase"));
-	g_ptr_array_add(args, g_strdup("--quiet"));
-	g_ptr_array_add(args, g_strdup(device));
-	g_ptr_array_add(args, g_strdup("0"));
-	g_ptr_array_add(args, g_strdup("0"));
-	g_ptr_array_add(args, NULL);
-
-	res = r_subprocess_runv(args, G_SUBPROCESS_FLAGS_NONE, &ierror);
-	if (!res) {
+	if (!r_mtd_erase(device, &ierror)) {
 		g_propagate_prefixed_error(
 				error,
 				ierror,
-				"failed to run flash_erase: ");
-		goto out;
-	}
-
-out:
-	return res;
-}
-
-static gboolean nand_write_slot(const gchar *image, const gchar *device, GError **error)
-{
-	g_autoptr(GSubprocess) sproc = NULL;
-	GError *ierror = NULL;
-	gboolean res = FALSE;
-	g_autoptr(GPtrArray) args = g_ptr_array_new_full(5, g_free);
-
-	g_ptr_array_add(args, g_strdup("nandwrite"));
-	g_ptr_array_add(args, g_strdup("--pad"));
-	g_ptr_array_add(args, g_strdup("--quiet"));
-	g_ptr_array_add(args, g_strdup(device));
-	g_ptr_array_add(args, g_strdup("-"));
-	g_ptr_array_add(args, NULL);
-
-	sproc = r_subprocess_newv(args, G_SUBPROCESS_FLAGS_STDIN_PIPE, &ierror);
-	if (sproc == NULL) {
-		g_propagate_prefixed_error(
-				error,
-				ierror,
-				"failed to start nandwrite: ");
-		goto out;
-	}
-
-	res = splice_file_to_process_stdin(image, sproc, &ierror);
-	if (!res) {
-		g_propagate_prefixed_error(
-				error,
-				ierror,
-				"failed to splice data to nandwrite: ");
-		goto out;
-	}
-
-	res = g_subprocess_wait_check(sproc, NULL, &ierror);
-	if (!res) {
-		g_propagate_prefixed_error(
-				error,
-				ierror,
-				"failed to run nandwrite: ");
-		goto out;
+				"failed to erase %s: ", device);
+		return FALSE;
 	}
 
-out:
-	return res;
+	return TRUE;
 }
 
 struct suffix_tar_flag {
@@ -1965,17 +1950,13 @@ static gboolean img_to_nor_handler(RaucImage *image, RaucSlot *dest_slot, const
 		}
 	}
 
-	/* erase */
-	g_message("erasing slot device %s", dest_slot->device);
-	if (!flash_format_slot(dest_slot->device, &ierror)) {
-		g_propagate_error(error, ierror);
-		return FALSE;
-	}
-
-	/* write */
+	/* erase and write */
 	g_message("writing slot device %s", dest_slot->device);
-	if (!nor_write_slot(image->filename, dest_slot->device, &ierror)) {
-		g_propagate_error(error, ierror);
+	if (!r_mtd_write_image(image->filename, dest_slot->device, &ierror)) {
+		g_propagate_prefixed_error(
+				error,
+				ierror,
+				"failed to write %s: ", dest_slot->device);
 		return FALSE;
 	}
 
@@ -2002,17 +1983,13 @@ static gboolean img_to_nand_handler(RaucImage *image, RaucSlot *dest_slot, const
 		}
 	}
 
-	/* erase */
-	g_message("erasing slot device %s", dest_slot->device);
-	if (!flash_format_slot(dest_slot->device, &ierror)) {
-		g_propagate_error(error, ierror);
-		return FALSE;
-	}
-
-	/* write */
+	/* erase and write */
 	g_message("writing slot device %s", dest_slot->device);
-	if (!nand_write_slot(image->filename, dest_slot->device, &ierror)) {
-		g_propagate_error(error, ierror);
+	if (!r_mtd_write_image(image->filename, dest_slot->device, &ierror)) {
+		g_propagate_prefixed_error(
+				error,
+				ierror,
+				"failed to write %s: ", dest_slot->device);
 		return FALSE;
 	}
 
@@ -2429,65 +2406,6 @@ static gboolean img_to_boot_emmc_handler(RaucImage *image, RaucSlot *dest_slot,
 }
 #endif
 
-static gboolean check_if_area_is_clear(const gchar *device, guint64 start, gsize size, gboolean *clear, GError **error)
-{
-	gboolean res = FALSE;
-	g_autofree guchar *read_buf = NULL;
-	gint read_size = 512;
-	gint fd;
-
-	g_return_val_if_fail(device, FALSE);
-	g_return_val_if_fail(clear, FALSE);
-	g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
-
-	read_buf = g_malloc0(read_size);
-
-	fd = g_open(device, O_RDONLY);
-	if (fd == -1) {
-		g_set_error(error, R_UPDATE_ERROR, R_UPDATE_ERROR_FAILED,
-				"Opening device failed: %s",
-				g_strerror(errno));
-		goto out;
-	}
-
-	if (lseek(fd, start, SEEK_SET) != (off_t) start) {
-		g_set_error(error, R_UPDATE_ERROR, R_UPDATE_ERROR_FAILED,
-				"Failed to set file to position %"G_GUINT64_FORMAT ": %s",
-				start, g_strerror(errno));
-		goto out;
-	}
-
-	*clear = TRUE;
-
-	while (size && *clear) {
-		gint read_count = 0;
-
-		if (size < (gsize) read_size)
-			read_size = size;
-
-		read_count = read(fd, read_buf, read_size);
-		if (read_count < 0)
-			goto out;
-
-		for (gint i = 0; i < read_count; i++) {
-			if ((read_buf[i] != 0x00) && (read_buf[i] != 0xFF)) {
-				*clear = FALSE;
-				break;
-			}
-		}
-
-		size -= read_count;
-	}
-
-	res = TRUE;
-
-out:
-	if (fd >= 0)
-		g_close(fd, NULL);
-
-	return res;
-}
-
 static gboolean img_to_boot_raw_fallback_handler(RaucImage *image, RaucSlot *dest_slot, const gchar *hook_name, GError **error)
 {
 	GError *ierror = NULL;
@@ -2557,9 +2475,9 @@ static gboolean img_to_boot_raw_fallback_handler(RaucImage *image, RaucSlot *des
 	 * partition was used to boot and is therefore valid. To avoid ending up with two broken partitions,
 	 * upgrade the primary partition first.
 	 */
-	if (!check_if_area_is_clear(dest_slot->device, dest_slot->region_start, header_size, &primary_clear, &ierror)) {
-		g_set_error(error, R_UPDATE_ERROR, R_UPDATE_ERROR_FAILED,
-				"Failed to check area at %"G_GUINT64_FORMAT " on %s",
+	if (!r_check_area_is_clear(dest_slot->device, dest_slot->region_start, header_size, &primary_clear, &ierror)) {
+		g_propagate_prefixed_error(error, ierror,
+				"Failed to check area at %"G_GUINT64_FORMAT " on %s: ",
 				dest_slot->region_start, dest_slot->device);
 		return FALSE;
 	}
@@ -2629,6 +2547,7 @@ static gboolean hook_install_handler(RaucImage *image, RaucSlot *dest_slot, cons
 	GError *ierror = NULL;
 
 	/* run slot install hook */
+	r_metrics_mark_untracked();
 	if (!run_slot_hook(hook_name, R_SLOT_HOOK_INSTALL, image, dest_slot, &ierror)) {
 		g_propagate_error(error, ierror);
 		return FALSE;
@@ -5,11 +5,16 @@
 #include <glib/gstdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
 #include "update_handler.h"
 #include "update_utils.h"
 #include "context.h"
+#include "metrics.h"
+#include "utils.h"
+
+#define CLEAR_CHECK_BUFFER_SIZE (256*1024)
 
 static GUnixOutputStream* open_unix_output_stream(const gchar *filename, int flags, int mode, int *fd, GError **error)
 {
@@ -120,11 +125,125 @@ gboolean r_copy_stream_with_progress(GInputStream *in_stream, GOutputStream *out
 		}
 
 		sum_size += out_size;
+		r_metrics_add_bytes(R_METRICS_SOURCE_BUNDLE, out_size);
 
 		/* emit progress info (but only when in progress context) */
 		if (r_context()->progress)
 			r_context_set_step_percentage("copy_image", sum_size * 100 / size);
 	} while (out_size);
 
+	r_trace_add_bytes(sum_size);
+
+	return TRUE;
+}
+
+gboolean r_copy_stream_range_with_progress(GInputStream *in_stream, GOutputStream *out_stream,
+		goffset size, GError **error)
+{
+	GError *ierror = NULL;
+	goffset sum_size = 0;
+	gchar buffer[8192];
+
+	g_return_val_if_fail(in_stream, FALSE);
+	g_return_val_if_fail(out_stream, FALSE);
+	g_return_val_if_fail(size >= 0, FALSE);
+	g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
+
+	while (sum_size < size) {
+		gsize in_size = 0;
+
+		if (!g_input_stream_read_all(in_stream, buffer,
+				MIN((goffset)sizeof(buffer), size - sum_size), &in_size, NULL, &ierror)) {
+			g_propagate_error(error, ierror);
+			return FALSE;
+		}
+		if (!in_size) {
+			g_set_error(error, G_IO_ERROR, G_IO_ERROR_PARTIAL_INPUT,
+					"Input ended after %"G_GOFFSET_FORMAT " of %"G_GOFFSET_FORMAT " bytes", sum_size, size);
+			return FALSE;
+		}
+		if (!g_output_stream_write_all(out_stream, buffer, in_size, NULL, NULL, &ierror)) {
+			g_propagate_error(error, ierror);
+			return FALSE;
+		}
+
+		sum_size += in_size;
+		r_metrics_add_bytes(R_METRICS_SOURCE_BUNDLE, in_size);
+
+		/* emit progress info (but only when in progress context) */
+		if (r_context()->progress)
+			r_context_set_step_percentage("copy_image", sum_size * 100 / size);
+	}
+
+	r_trace_add_bytes(sum_size);
+
+	return TRUE;
+}
+
+gboolean r_check_area_is_clear(const gchar *device, goffset start, goffset size, gboolean *clear, GError **error)
+{
+	GError *ierror = NULL;
+	g_autofree guint8 *buf = NULL;
+	goffset pos = start;
+	goffset end = start + size;
+	struct stat st;
+
+	g_return_val_if_fail(device, FALSE);
+	g_return_val_if_fail(start >= 0, FALSE);
+	g_return_val_if_fail(size >= 0, FALSE);
+	g_return_val_if_fail(clear, FALSE);
+	g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
+
+	g_auto(filedesc) fd = g_open(device, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		int err = errno;
+		g_set_error(error, R_UPDATE_ERROR, R_UPDATE_ERROR_FAILED,
+				"Opening device failed: %s", g_strerror(err));
+		return FALSE;
+	}
+
+	if (fstat(fd, &st) != 0) {
+		int err = errno;
+		g_set_error(error, R_UPDATE_ERROR, R_UPDATE_ERROR_FAILED,
+				"Failed to stat %s: %s", device, g_strerror(err));
+		return FALSE;
+	}
+
+	buf = g_malloc(CLEAR_CHECK_BUFFER_SIZE);
+
+	while (pos < end) {
+		gsize chunk_size;
+
+		/* holes in files read as zeros, so skip them */
+		if (S_ISREG(st.st_mode)) {
+			off_t data = lseek(fd, pos, SEEK_DATA);
+			if (data < 0 && errno == ENXIO)
+				break; /* only a hole until the end of the file */
+			else if (data > pos)
+				pos = data;
+			/* on other errors (such as EINVAL), just read everything */
+
+			if (pos >= end)
+				break;
+		}
+
+		chunk_size = MIN(CLEAR_CHECK_BUFFER_SIZE, end - pos);
+
+		if (!r_pread_exact(fd, buf, chunk_size, pos, &ierror)) {
+			g_propagate_prefixed_error(error, ierror,
+					"Failed to read %s at position %"G_GOFFSET_FORMAT ": ",
+					device, pos);
+			return FALSE;
+		}
+
+		if (!r_buffer_is_cleared(buf, chunk_size)) {
+			*clear = FALSE;
+			return TRUE;
+		}
+
+		pos += chunk_size;
+	}
+
+	*clear = TRUE;
 	return TRUE;
 }
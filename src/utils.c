@@ -542,6 +542,59 @@ gchar *r_hex_encode(const guint8 *raw, size_t len)
 	return hex;
 }
 
+gboolean r_buffer_is_zero(const guint8 *data, gsize size)
+{
+	gsize pos = 0;
+
+	g_return_val_if_fail(data || size == 0, FALSE);
+
+	/* handle unaligned start byte-wise */
+	for (; pos < size && ((guintptr)(data + pos) % sizeof(guint64)); pos++)
+		if (data[pos])
+			return FALSE;
+
+	/* check 4 words per iteration to allow the compiler to vectorize */
+	for (; pos + 4 * sizeof(guint64) <= size; pos += 4 * sizeof(guint64)) {
+		const guint64 *w = (const guint64 *)(const void *)(data + pos);
+		if (w[0] | w[1] | w[2] | w[3])
+			return FALSE;
+	}
+
+	for (; pos < size; pos++)
+		if (data[pos])
+			return FALSE;
+
+	return TRUE;
+}
+
+gboolean r_buffer_is_cleared(const guint8 *data, gsize size)
+{
+	/* masks bit 0 of each byte, so bits are only compared within a byte */
+	const guint64 mask = G_GUINT64_CONSTANT(0xfefefefefefefefe);
+	gsize pos = 0;
+
+	g_return_val_if_fail(data || size == 0, FALSE);
+
+	for (; pos < size && ((guintptr)(data + pos) % sizeof(guint64)); pos++)
+		if (data[pos] != 0x00 && data[pos] != 0xFF)
+			return FALSE;
+
+	/* A byte is either 0x00 or 0xFF if all of its bits are equal, which is
+	 * the case if each bit equals its lower neighbor. */
+	for (; pos + 4 * sizeof(guint64) <= size; pos += 4 * sizeof(guint64)) {
+		const guint64 *w = (const guint64 *)(const void *)(data + pos);
+		if (((w[0] ^ (w[0] << 1)) | (w[1] ^ (w[1] << 1)) |
+		     (w[2] ^ (w[2] << 1)) | (w[3] ^ (w[3] << 1))) & mask)
+			return FALSE;
+	}
+
+	for (; pos < size; pos++)
+		if (data[pos] != 0x00 && data[pos] != 0xFF)
+			return FALSE;
+
+	return TRUE;
+}
+
 gboolean r_read_exact(const int fd, guint8 *data, size_t size, GError **error)
 {
 	g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
@@ -675,6 +728,69 @@ gboolean r_pwrite_lazy(const int fd, const guint8 *data, size_t size, off_t offs
 	return r_pwrite_exact(fd, data, size, offset, error);
 }
 
+gboolean r_copy_fd_data(int src_fd, int dst_fd, goffset size, GError **error)
+{
+	GError *ierror = NULL;
+	g_autofree guint8 *buf = NULL;
+	loff_t copied = 0;
+
+	g_return_val_if_fail(src_fd >= 0, FALSE);
+	g_return_val_if_fail(dst_fd >= 0, FALSE);
+	g_return_val_if_fail(size >= 0, FALSE);
+	g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
+
+	/* a reflink shares all extents, so cut off anything past size */
+	if (ioctl(dst_fd, FICLONE, src_fd) == 0) {
+		if (ftruncate(dst_fd, size) != 0) {
+			int err = errno;
+			g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(err),
+					"Failed to truncate: %s", g_strerror(err));
+			return FALSE;
+		}
+		return TRUE;
+	}
+
+	while (copied < size) {
+		loff_t in_off = copied;
+		loff_t out_off = copied;
+		ssize_t ret = copy_file_range(src_fd, &in_off, dst_fd, &out_off, size - copied, 0);
+		if (ret < 0) {
+			int err = errno;
+			if (err == EINTR)
+				continue;
+			/* not supported for this combination of file systems */
+			if (err == EXDEV || err == EINVAL || err == ENOSYS || err == EOPNOTSUPP)
+				break;
+			g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(err),
+					"copy_file_range failed: %s", g_strerror(err));
+			return FALSE;
+		}
+		if (ret == 0)
+			break;
+		copied += ret;
+	}
+
+	if (copied == size)
+		return TRUE;
+
+	/* continue with plain reads and writes where copy_file_range stopped */
+	buf = g_malloc(64 * 1024);
+	while (copied < size) {
+		gsize chunk = MIN(size - copied, 64 * 1024);
+
+		if (!r_pread_exact(src_fd, buf, chunk, copied, &ierror) ||
+		    !r_pwrite_exact(dst_fd, buf, chunk, copied, &ierror)) {
+			if (!ierror)
+				g_set_error(&ierror, G_FILE_ERROR, G_FILE_ERROR_FAILED, "Source ended unexpectedly");
+			g_propagate_error(error, ierror);
+			return FALSE;
+		}
+		copied += chunk;
+	}
+
+	return TRUE;
+}
+
 guint get_sectorsize(gint fd)
 {
 	guint sector_size = 512;
@@ -0,0 +1,218 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <glib/gstdio.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "utils.h"
+
+#include "benchmark.h"
+
+guint64 bench_param(const gchar *name, guint64 default_value)
+{
+	g_autofree gchar *var = g_strdup_printf("RAUC_BENCH_%s", name);
+	const gchar *value = g_getenv(var);
+	guint64 result;
+
+	if (!value)
+		return default_value;
+
+	if (!g_ascii_string_to_unsigned(value, 10, 0, G_MAXUINT64, &result, NULL))
+		g_error("Invalid value '%s' for %s", value, var);
+
+	return result;
+}
+
+gchar *bench_write_random_file(const gchar *dir, const gchar *filename, guint64 size, guint32 seed, gchar **sha256)
+{
+	g_autoptr(GError) ierror = NULL;
+	g_autoptr(GRand) rand = g_rand_new_with_seed(seed);
+	g_autoptr(GChecksum) checksum = g_checksum_new(G_CHECKSUM_SHA256);
+	g_autofree guint8 *block = g_malloc(1024 * 1024);
+	g_autofree gchar *path = g_build_filename(dir, filename, NULL);
+	int fd;
+
+	fd = g_open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd < 0)
+		g_error("Failed to create %s: %s", path, g_strerror(errno));
+
+	for (guint64 written = 0; written < size;) {
+		gsize len = MIN(size - written, 1024 * 1024);
+
+		for (gsize i = 0; i < len; i++)
+			block[i] = g_rand_int(rand) & 0xFF;
+		if (!r_write_exact(fd, block, len, &ierror))
+			g_error("Failed to write %s: %s", path, ierror->message);
+		g_checksum_update(checksum, block, len);
+		written += len;
+	}
+	g_close(fd, NULL);
+
+	if (sha256)
+		*sha256 = g_strdup(g_checksum_get_string(checksum));
+
+	return g_steal_pointer(&path);
+}
+
+gchar *bench_file_sha256(const gchar *path, guint64 size)
+{
+	g_autoptr(GError) ierror = NULL;
+	g_autoptr(GChecksum) checksum = g_checksum_new(G_CHECKSUM_SHA256);
+	g_autofree guint8 *block = g_malloc(1024 * 1024);
+	int fd;
+
+	fd = g_open(path, O_RDONLY | O_CLOEXEC, 0);
+	if (fd < 0)
+		g_error("Failed to open %s: %s", path, g_strerror(errno));
+
+	for (guint64 offset = 0; offset < size;) {
+		gsize len = MIN(size - offset, 1024 * 1024);
+
+		if (!r_pread_exact(fd, block, len, offset, &ierror))
+			g_error("Failed to read %s: %s", path, ierror ? ierror->message : "unexpected end of file");
+		g_checksum_update(checksum, block, len);
+		offset += len;
+	}
+	g_close(fd, NULL);
+
+	return g_strdup(g_checksum_get_string(checksum));
+}
+
+/* Resets VmHWM of this process to the current RSS (since Linux 4.0). */
+static gboolean reset_peak_rss(void)
+{
+	int fd = g_open("/proc/self/clear_refs", O_WRONLY | O_CLOEXEC, 0);
+	gboolean res;
+
+	if (fd < 0)
+		return FALSE;
+	res = r_write_exact(fd, (const guint8 *)"5", 1, NULL);
+	g_close(fd, NULL);
+
+	return res;
+}
+
+/* Returns VmHWM of this process in KiB, or -1 if unavailable. */
+static glong read_peak_rss(void)
+{
+	g_autofree gchar *status = NULL;
+	const gchar *line;
+	glong value;
+
+	if (!g_file_get_contents("/proc/self/status", &status, NULL, NULL))
+		return -1;
+
+	line = strstr(status, "\nVmHWM:");
+	if (!line || sscanf(line + 1, "VmHWM: %ld", &value) != 1)
+		return -1;
+
+	return value;
+}
+
+void bench_start(RBenchmark *bench)
+{
+	g_return_if_fail(bench);
+
+	bench->hwm_reset = reset_peak_rss();
+	getrusage(RUSAGE_SELF, &bench->self);
+	getrusage(RUSAGE_CHILDREN, &bench->children);
+	bench->start = g_get_monotonic_time();
+}
+
+static gdouble timeval_diff(const struct timeval *start, const struct timeval *end)
+{
+	return (end->tv_sec - start->tv_sec) + (end->tv_usec - start->tv_usec) / 1e6;
+}
+
+static gdouble cpu_time(const struct rusage *start, const struct rusage *end)
+{
+	return timeval_diff(&start->ru_utime, &end->ru_utime) +
+	       timeval_diff(&start->ru_stime, &end->ru_stime);
+}
+
+static void append_params(GString *json, const gchar *params)
+{
+	g_auto(GStrv) pairs = g_strsplit(params ?: "", " ", -1);
+	gboolean first = TRUE;
+
+	g_string_append_c(json, '{');
+	for (gchar **pair = pairs; *pair; pair++) {
+		g_auto(GStrv) kv = g_strsplit(*pair, "=", 2);
+		gchar *end = NULL;
+
+		if (!kv[0] || !kv[0][0] || !kv[1])
+			continue;
+
+		g_string_append_printf(json, "%s\"%s\":", first ? "" : ",", kv[0]);
+		g_ascii_strtod(kv[1], &end);
+		if (kv[1][0] && end && !*end)
+			g_string_append(json, kv[1]);
+		else
+			g_string_append_printf(json, "\"%s\"", kv[1]);
+		first = FALSE;
+	}
+	g_string_append_c(json, '}');
+}
+
+void bench_report(const RBenchmark *bench, const gchar *name, const gchar *params, guint64 bytes, guint64 items)
+{
+	g_autoptr(GString) json = g_string_new(NULL);
+	struct rusage self, children;
+	gdouble seconds, cpu;
+	gdouble mb_per_s = 0.0, items_per_s = 0.0;
+	glong peak_rss = -1;
+	gboolean peak_rss_reset = FALSE;
+	const gchar *output;
+	gchar buf[G_ASCII_DTOSTR_BUF_SIZE];
+
+	g_return_if_fail(bench);
+	g_return_if_fail(name);
+
+	seconds = (g_get_monotonic_time() - bench->start) / 1e6;
+	getrusage(RUSAGE_SELF, &self);
+	getrusage(RUSAGE_CHILDREN, &children);
+	cpu = cpu_time(&bench->self, &self) + cpu_time(&bench->children, &children);
+	/* in KiB, the lifetime maximum is only used as a fallback */
+	if (bench->hwm_reset)
+		peak_rss = read_peak_rss();
+	if (peak_rss >= 0)
+		peak_rss_reset = TRUE;
+	else
+		peak_rss = self.ru_maxrss;
+	/* only grows if a larger subprocess finished since bench_start() */
+	if (children.ru_maxrss > bench->children.ru_maxrss)
+		peak_rss = MAX(peak_rss, children.ru_maxrss);
+
+	if (seconds > 0) {
+		mb_per_s = bytes / seconds / 1e6;
+		items_per_s = items / seconds;
+	}
+
+	g_test_message("%s (%s): %.3f s, %.3f s CPU, %.1f MB/s, %.0f items/s, peak RSS %ld KiB",
+			name, params ?: "", seconds, cpu, mb_per_s, items_per_s, peak_rss);
+
+	/* use locale-independent formatting for the machine-readable output */
+	g_string_append_printf(json, "{\"benchmark\":\"%s\",\"params\":", name);
+	append_params(json, params);
+	g_string_append_printf(json, ",\"bytes\":%"G_GUINT64_FORMAT ",\"items\":%"G_GUINT64_FORMAT, bytes, items);
+	g_string_append_printf(json, ",\"seconds\":%s", g_ascii_dtostr(buf, sizeof(buf), seconds));
+	g_string_append_printf(json, ",\"cpu_seconds\":%s", g_ascii_dtostr(buf, sizeof(buf), cpu));
+	g_string_append_printf(json, ",\"mb_per_s\":%s", g_ascii_dtostr(buf, sizeof(buf), mb_per_s));
+	g_string_append_printf(json, ",\"items_per_s\":%s", g_ascii_dtostr(buf, sizeof(buf), items_per_s));
+	g_string_append_printf(json, ",\"peak_rss_kib\":%ld", peak_rss);
+	g_string_append_printf(json, ",\"peak_rss_scope\":\"%s\"}\n", peak_rss_reset ? "benchmark" : "process");
+
+	output = g_getenv("RAUC_BENCH_OUTPUT");
+	if (output) {
+		g_autoptr(GError) ierror = NULL;
+		int fd = g_open(output, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+
+		if (fd < 0)
+			g_error("Failed to open %s: %s", output, g_strerror(errno));
+		if (!r_write_exact(fd, (const guint8 *)json->str, json->len, &ierror))
+			g_error("Failed to write %s: %s", output, ierror->message);
+		g_close(fd, NULL);
+	} else {
+		g_test_message("%s", g_strchomp(json->str));
+	}
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <glib.h>
+#include <sys/resource.h>
+
+/**
+ * Helpers for the benchmark executables (run with 'meson test --benchmark').
+ *
+ * Each result is reported as a test message and, if RAUC_BENCH_OUTPUT is set,
+ * appended as one JSON object per line to that file, so results can be
+ * collected and compared across releases.
+ */
+
+typedef struct {
+	gint64 start; /* monotonic */
+	struct rusage self;
+	struct rusage children;
+	gboolean hwm_reset; /* whether the peak RSS of this process was reset */
+} RBenchmark;
+
+/**
+ * Returns a numeric benchmark parameter from the environment.
+ *
+ * @param name parameter name, read from RAUC_BENCH_<name>
+ * @param default_value value used if the variable is unset
+ *
+ * @return the parameter value
+ */
+guint64 bench_param(const gchar *name, guint64 default_value);
+
+/**
+ * Writes a file of random data, one block at a time.
+ *
+ * The content is the same as from write_random_file() with the same seed, but
+ * the data is not held in memory as a whole.
+ *
+ * @param dir directory to create the file in
+ * @param filename name of the file
+ * @param size size of the file in bytes
+ * @param seed seed for the random data
+ * @param sha256 return location for the hex-encoded SHA-256 of the data, or
+ *        NULL
+ *
+ * @return the newly allocated path of the file
+ */
+gchar *bench_write_random_file(const gchar *dir, const gchar *filename, guint64 size, guint32 seed, gchar **sha256);
+
+/**
+ * Computes the SHA-256 of the beginning of a file, one block at a time.
+ *
+ * @param path path of the file (or block device)
+ * @param size number of bytes to hash, the file must not be shorter
+ *
+ * @return the newly allocated hex-encoded SHA-256
+ */
+gchar *bench_file_sha256(const gchar *path, guint64 size);
+
+/**
+ * Starts measuring wall-clock time and CPU time (including subprocesses).
+ *
+ * Also resets the peak RSS of this process (via /proc/self/clear_refs), so
+ * that memory used for preparing the benchmark is not reported.
+ *
+ * @param bench benchmark state to initialize
+ */
+void bench_start(RBenchmark *bench);
+
+/**
+ * Reports the measurement started by bench_start().
+ *
+ * The report contains the wall-clock and CPU time, the throughput in MB/s
+ * (if bytes is not 0), the rate of items per second (if items is not 0) and
+ * the peak RSS since bench_start().
+ *
+ * The peak RSS is the high-water mark of this process since bench_start(). A
+ * subprocess which finished during the measurement is only included if it
+ * used more memory than all earlier subprocesses, as the kernel does not
+ * allow resetting that value. If the peak RSS of this process could not be
+ * reset, the value covers its whole lifetime and "peak_rss_scope" is
+ * reported as "process" instead of "benchmark".
+ *
+ * @param bench benchmark state
+ * @param name name of the benchmark
+ * @param params space separated key=value pairs describing the parameters
+ * @param bytes number of bytes processed
+ * @param items number of items (chunks, requests, ...) processed
+ */
+void bench_report(const RBenchmark *bench, const gchar *name, const gchar *params, guint64 bytes, guint64 items);
@@ -1191,6 +1191,92 @@ STATE_B=bad\n\
 	g_clear_error(&error);
 }
 
+static void bootchooser_custom_persistent(BootchooserFixture *fixture,
+		gconstpointer user_data)
+{
+	RaucSlot *rootfs0 = NULL;
+	RaucSlot *rootfs1 = NULL;
+	RaucSlot *primary = NULL;
+	gboolean good;
+	GError *error = NULL;
+	gboolean res;
+
+	const gchar *cfg_file = "\
+[system]\n\
+compatible=FooCorp Super BarBazzer\n\
+bootloader=custom\n\
+mountprefix=/mnt/myrauc/\n\
+\n\
+[handlers]\n\
+bootloader-custom-backend=custom-bootloader-script\n\
+bootloader-custom-backend-persistent=true\n\
+\n\
+[keyring]\n\
+path=/etc/rauc/keyring/\n\
+\n\
+[slot.rootfs.0]\n\
+device=/dev/rootfs-0\n\
+type=ext4\n\
+bootname=A\n\
+\n\
+[slot.rootfs.1]\n\
+device=/dev/rootfs-1\n\
+type=ext4\n\
+bootname=B\n";
+
+	gchar* pathname = write_tmp_file(fixture->tmpdir, "custom.conf", cfg_file, NULL);
+	g_assert_nonnull(pathname);
+
+	/* the worker inherits the environment on start */
+	test_custom_initialize_state(fixture, "\
+PRIMARY=A\n\
+STATE_A=good\n\
+STATE_B=good\n\
+");
+
+	g_clear_pointer(&r_context_conf()->configpath, g_free);
+	r_context_conf()->configpath = pathname;
+	r_context();
+
+	g_assert_true(r_context()->config->custom_bootloader_persistent);
+
+	rootfs0 = find_config_slot_by_device(r_context()->config, "/dev/rootfs-0");
+	g_assert_nonnull(rootfs0);
+	rootfs1 = find_config_slot_by_device(r_context()->config, "/dev/rootfs-1");
+	g_assert_nonnull(rootfs1);
+
+	res = r_boot_get_state(rootfs0, &good, &error);
+	g_assert_no_error(error);
+	g_assert_true(res);
+	g_assert_true(good);
+
+	res = r_boot_set_state(rootfs0, FALSE, &error);
+	g_assert_no_error(error);
+	g_assert_true(res);
+	res = r_boot_get_state(rootfs0, &good, &error);
+	g_assert_no_error(error);
+	g_assert_true(res);
+	g_assert_false(good);
+
+	primary = r_boot_get_primary(&error);
+	g_assert_null(primary);
+	g_assert_error(error, R_BOOTCHOOSER_ERROR, R_BOOTCHOOSER_ERROR_PARSE_FAILED);
+	g_clear_error(&error);
+
+	res = r_boot_set_primary(rootfs1, &error);
+	g_assert_no_error(error);
+	g_assert_true(res);
+	primary = r_boot_get_primary(&error);
+	g_assert_no_error(error);
+	g_assert(primary == rootfs1);
+
+	g_assert_true(test_custom_post_state(fixture, "\
+PRIMARY=B\n\
+STATE_A=bad\n\
+STATE_B=good\n\
+"));
+}
+
 int main(int argc, char *argv[])
 {
 	gchar *path;
@@ -1240,5 +1326,9 @@ int main(int argc, char *argv[])
 			custom_bootchooser_fixture_set_up, bootchooser_custom,
 			bootchooser_fixture_tear_down);
 
+	g_test_add("/bootchooser/custom-persistent", BootchooserFixture, NULL,
+			custom_bootchooser_fixture_set_up, bootchooser_custom_persistent,
+			bootchooser_fixture_tear_down);
+
 	return g_test_run();
 }
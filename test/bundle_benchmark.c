@@ -0,0 +1,155 @@
+#include <locale.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include <bundle.h>
+#include <context.h>
+#include <manifest.h>
+#include <utils.h>
+
+#include "benchmark.h"
+#include "common.h"
+
+/* Benchmarks for creating and checking bundles.
+ *
+ * The bundles contain a single image of random (incompressible) data:
+ *
+ * RAUC_BENCH_SIZE_MIB: image size (default 64)
+ * RAUC_BENCH_SEED:     seed for the generated image (default 1)
+ *
+ * The creation time includes building the squashfs, the verity hash tree (for
+ * the verity format) and signing. The stages are also logged by
+ * create_bundle() itself. The check time includes the signature and payload
+ * verification.
+ */
+
+static struct {
+	gchar *tmpdir;
+	gchar *params;
+	guint64 size;
+} bench_bundle;
+
+static void prepare_content(const gchar *format)
+{
+	g_autofree gchar *contentdir = g_build_filename(bench_bundle.tmpdir, format, NULL);
+	g_autofree gchar *manifest = NULL;
+	g_autofree gchar *image = NULL;
+	g_autofree gchar *manifestpath = NULL;
+
+	if (g_file_test(contentdir, G_FILE_TEST_IS_DIR))
+		return;
+
+	g_assert_cmpint(g_mkdir(contentdir, 0777), ==, 0);
+	image = bench_write_random_file(contentdir, "rootfs.img", bench_bundle.size, bench_param("SEED", 1), NULL);
+
+	manifest = g_strdup_printf("\
+[update]\n\
+compatible=Test Config\n\
+version=2011.03-2\n\
+\n\
+[bundle]\n\
+format=%s\n\
+\n\
+[image.rootfs]\n\
+filename=rootfs.img\n\
+", format);
+	manifestpath = write_tmp_file(contentdir, "manifest.raucm", manifest, NULL);
+	g_assert_nonnull(manifestpath);
+}
+
+static gchar *create(const gchar *format, RBenchmark *bench)
+{
+	g_autoptr(GError) error = NULL;
+	g_autofree gchar *contentdir = g_build_filename(bench_bundle.tmpdir, format, NULL);
+	g_autofree gchar *bundlename = g_strdup_printf("%s.raucb", contentdir);
+	gboolean res;
+
+	prepare_content(format);
+	if (g_file_test(bundlename, G_FILE_TEST_EXISTS))
+		g_assert_cmpint(g_unlink(bundlename), ==, 0);
+
+	/* disable crl checking during bundle creation */
+	r_context()->config->keyring_check_crl = FALSE;
+	g_test_expect_message(G_LOG_DOMAIN, G_LOG_LEVEL_WARNING,
+			"Detected CRL but CRL checking is disabled!");
+	if (bench)
+		bench_start(bench);
+	res = create_bundle(bundlename, contentdir, &error);
+	g_assert_no_error(error);
+	g_assert_true(res);
+	r_context()->config->keyring_check_crl = TRUE;
+	g_test_assert_expected_messages();
+
+	return g_steal_pointer(&bundlename);
+}
+
+static void bench_create(gconstpointer user_data)
+{
+	const gchar *format = user_data;
+	g_autofree gchar *name = g_strdup_printf("bundle/create/%s", format);
+	g_autofree gchar *bundlename = NULL;
+	RBenchmark bench;
+
+	bundlename = create(format, &bench);
+	bench_report(&bench, name, bench_bundle.params, bench_bundle.size, 1);
+
+	g_test_message("bundle size: %"G_GSIZE_FORMAT, get_file_size(bundlename, NULL));
+}
+
+static void bench_check(gconstpointer user_data)
+{
+	const gchar *format = user_data;
+	g_autofree gchar *name = g_strdup_printf("bundle/check/%s", format);
+	g_autofree gchar *bundlename = g_strdup_printf("%s/%s.raucb", bench_bundle.tmpdir, format);
+	g_autoptr(RaucBundle) bundle = NULL;
+	g_autoptr(GError) error = NULL;
+	gboolean res;
+	RBenchmark bench;
+
+	/* reuse the bundle from the creation benchmark if it ran before */
+	if (!g_file_test(bundlename, G_FILE_TEST_EXISTS))
+		g_free(create(format, NULL));
+
+	bench_start(&bench);
+	/* the exclusive access checks are not part of the measurement */
+	res = check_bundle(bundlename, &bundle, CHECK_BUNDLE_TRUST_ENV, NULL, &error);
+	g_assert_no_error(error);
+	g_assert_true(res);
+	res = check_bundle_payload(bundle, &error);
+	g_assert_no_error(error);
+	g_assert_true(res);
+	bench_report(&bench, name, bench_bundle.params, bundle->size, 1);
+}
+
+int main(int argc, char *argv[])
+{
+	guint64 size_mib = bench_param("SIZE_MIB", 64);
+	int ret;
+
+	setlocale(LC_ALL, "C");
+
+	g_assert(g_setenv("GIO_USE_VFS", "local", TRUE));
+
+	r_context_conf()->configpath = g_strdup("test/test.conf");
+	r_context_conf()->certpath = g_strdup("test/openssl-ca/dev/autobuilder-1.cert.pem");
+	r_context_conf()->keypath = g_strdup("test/openssl-ca/dev/private/autobuilder-1.pem");
+	r_context();
+
+	g_test_init(&argc, &argv, NULL);
+
+	bench_bundle.size = size_mib * 1024 * 1024;
+	bench_bundle.params = g_strdup_printf("size_mib=%"G_GUINT64_FORMAT, size_mib);
+	bench_bundle.tmpdir = g_dir_make_tmp("rauc-bench-XXXXXX", NULL);
+	g_assert_nonnull(bench_bundle.tmpdir);
+
+	g_test_add_data_func("/bundle/create/plain", "plain", bench_create);
+	g_test_add_data_func("/bundle/create/verity", "verity", bench_create);
+	g_test_add_data_func("/bundle/check/plain", "plain", bench_check);
+	g_test_add_data_func("/bundle/check/verity", "verity", bench_check);
+
+	ret = g_test_run();
+
+	g_assert_true(rm_tree(bench_bundle.tmpdir, NULL));
+
+	return ret;
+}
@@ -190,6 +190,8 @@ variant-name=Default Variant\n\
 ");
 	if (options && options->min_bundle_version)
 		g_string_append_printf(config, "min-bundle-version=%s\n", options->min_bundle_version);
+	if (options && options->perform_pre_check)
+		g_string_append(config, "perform-pre-check=true\n");
 	g_string_append(config, "\n");
 
 	g_string_append(config, "[handlers]\n\
@@ -22,6 +22,7 @@ typedef struct {
 typedef struct {
 	const gchar *min_bundle_version;
 	gboolean artifact_repos;
+	gboolean perform_pre_check;
 } SystemTestOptions;
 
 guint8* random_bytes(gsize size, guint32 seed);
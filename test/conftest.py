@@ -164,6 +164,9 @@ needs_emmc = pytest.mark.skipif("RAUC_TEST_EMMC" not in os.environ, reason="Miss
 
 
 needs_composefs = pytest.mark.skipif(not string_in_config_h("ENABLE_COMPOSEFS 1"), reason="Missing composefs support")
+needs_squashfs_writer = pytest.mark.skipif(
+    not string_in_config_h("ENABLE_SQUASHFS_WRITER 1"), reason="Missing built-in squashfs writer"
+)
 
 
 def softhsm2_load_key_pair(cert, privkey, label, id_, softhsm2_mod, tmp_path):
@@ -0,0 +1,95 @@
+#include <locale.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include <crypt.h>
+#include <utils.h>
+
+#include "benchmark.h"
+#include "common.h"
+
+/* Benchmarks for the bundle payload encryption used by the crypt format.
+ *
+ * RAUC_BENCH_SIZE_MIB: size of the encrypted data (default 256)
+ */
+
+static struct {
+	gchar *tmpdir;
+	gchar *plain;
+	gchar *encrypted;
+	gchar *params;
+	guint64 size;
+	gchar *digest; /* SHA-256 of the plain data */
+	guint8 *key;
+} bench_crypt;
+
+static void bench_encrypt(void)
+{
+	g_autoptr(GError) error = NULL;
+	gboolean res;
+	RBenchmark bench;
+
+	bench_start(&bench);
+	res = r_crypt_encrypt(bench_crypt.plain, bench_crypt.encrypted, bench_crypt.key, &error);
+	g_assert_no_error(error);
+	g_assert_true(res);
+	bench_report(&bench, "crypt/encrypt", bench_crypt.params, bench_crypt.size, 1);
+}
+
+static void bench_decrypt(void)
+{
+	g_autoptr(GError) error = NULL;
+	g_autofree gchar *decrypted = g_build_filename(bench_crypt.tmpdir, "decrypted", NULL);
+	g_autofree gchar *digest = NULL;
+	GStatBuf st;
+	gboolean res;
+	RBenchmark bench;
+
+	if (!g_file_test(bench_crypt.encrypted, G_FILE_TEST_EXISTS)) {
+		res = r_crypt_encrypt(bench_crypt.plain, bench_crypt.encrypted, bench_crypt.key, &error);
+		g_assert_no_error(error);
+		g_assert_true(res);
+	}
+
+	bench_start(&bench);
+	res = r_crypt_decrypt(bench_crypt.encrypted, decrypted, bench_crypt.key, 0, &error);
+	g_assert_no_error(error);
+	g_assert_true(res);
+	bench_report(&bench, "crypt/decrypt", bench_crypt.params, bench_crypt.size, 1);
+
+	g_assert_cmpint(g_stat(decrypted, &st), ==, 0);
+	g_assert_cmpuint(st.st_size, ==, bench_crypt.size);
+	digest = bench_file_sha256(decrypted, bench_crypt.size);
+	g_assert_cmpstr(digest, ==, bench_crypt.digest);
+
+	g_assert_cmpint(g_unlink(decrypted), ==, 0);
+}
+
+int main(int argc, char *argv[])
+{
+	guint64 size_mib = bench_param("SIZE_MIB", 256);
+	int ret;
+
+	setlocale(LC_ALL, "C");
+
+	g_assert(g_setenv("GIO_USE_VFS", "local", TRUE));
+
+	g_test_init(&argc, &argv, NULL);
+
+	bench_crypt.size = size_mib * 1024 * 1024;
+	bench_crypt.params = g_strdup_printf("size_mib=%"G_GUINT64_FORMAT, size_mib);
+	bench_crypt.key = random_bytes(32, 0x5ec2e7);
+	bench_crypt.tmpdir = g_dir_make_tmp("rauc-bench-XXXXXX", NULL);
+	g_assert_nonnull(bench_crypt.tmpdir);
+	bench_crypt.plain = bench_write_random_file(bench_crypt.tmpdir, "plain", bench_crypt.size, 0x1, &bench_crypt.digest);
+	bench_crypt.encrypted = g_build_filename(bench_crypt.tmpdir, "encrypted", NULL);
+
+	g_test_add_func("/crypt/encrypt", bench_encrypt);
+	g_test_add_func("/crypt/decrypt", bench_decrypt);
+
+	ret = g_test_run();
+
+	g_assert_true(rm_tree(bench_crypt.tmpdir, NULL));
+
+	return ret;
+}
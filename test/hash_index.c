@@ -7,6 +7,7 @@
 
 #include "context.h"
 #include "hash_index.h"
+#include "manifest.h"
 #include "stats.h"
 #include "utils.h"
 
@@ -283,6 +284,188 @@ static void test_ranges(Fixture *fixture, gconstpointer user_data)
 	g_clear_pointer(&hash, g_free);
 }
 
+/* Tests the compact mode used when a memory limit is configured */
+static void test_compact(Fixture *fixture, gconstpointer user_data)
+{
+	g_autoptr(GError) error = NULL;
+	g_autoptr(RaucHashIndex) index = NULL;
+	g_autoptr(RaucHashIndex) slot_index = NULL;
+	g_autoptr(RaucSlot) slot = NULL;
+	g_autofree RaucHashIndexChunk *chunk = g_new0(RaucHashIndexChunk, 1);
+	g_autofree gchar *data_filename = NULL;
+	g_autofree guint8 *hash = NULL;
+	gboolean res = FALSE;
+	int datafd = -1;
+	guint32 tmp_u32 = 0;
+
+	r_context()->config->hash_index_memory_limit = 132 * (32 + 8) + 132 * 8;
+
+	// image index keeps the hashes
+	datafd = g_open("test/dummy.verity", O_RDONLY|O_CLOEXEC, 0);
+	g_assert_cmpint(datafd, >, 0);
+	index = r_hash_index_open("test", datafd, NULL, &error);
+	g_assert_no_error(error);
+	g_assert_nonnull(index);
+	g_assert_cmpuint(index->count, ==, 132);
+	g_assert_nonnull(index->hashes);
+	g_assert_nonnull(index->entries);
+	g_assert_null(index->lookup);
+	g_assert_cmpuint(index->memory, ==, 132 * (32 + 8));
+	g_assert_cmpuint(r_hash_index_get_memory(), ==, 132 * (32 + 8));
+
+	// chunk 4
+	hash = r_hex_decode("9573e6bd3320b3c85ef09743583ed1af87aa479bff046b32762f935b8ffd5ee8", 32);
+	res = r_hash_index_get_chunk(index, hash, chunk, &error);
+	g_assert_no_error(error);
+	g_assert_true(res);
+	g_assert_cmpmem(hash, 32, chunk->hash, 32);
+	memcpy(&tmp_u32, chunk->data, sizeof(tmp_u32));
+	g_assert_cmphex(4, ==, GUINT32_FROM_BE(tmp_u32));
+	g_clear_pointer(&hash, g_free);
+
+	// not in file
+	hash = r_hex_decode("e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855", 32);
+	res = r_hash_index_get_chunk(index, hash, chunk, &error);
+	g_assert_error(error, R_HASH_INDEX_ERROR, R_HASH_INDEX_ERROR_NOT_FOUND);
+	g_assert_false(res);
+	g_clear_pointer(&hash, g_free);
+	g_clear_error(&error);
+
+	// slot index only keeps the prefixes
+	data_filename = g_build_filename(fixture->tmpdir, "slot.img", NULL);
+	g_assert_true(test_copy_file("test/dummy.verity", NULL, fixture->tmpdir, "slot.img"));
+	slot = g_new0(RaucSlot, 1);
+	slot->name = g_intern_string("rootfs.0");
+	slot->device = g_strdup(data_filename);
+	slot->data_directory = g_build_filename(fixture->tmpdir, "datadir", NULL);
+
+	slot_index = r_hash_index_open_slot("slot", slot, O_RDWR, &error);
+	g_assert_no_error(error);
+	g_assert_nonnull(slot_index);
+	g_assert_null(slot_index->hashes);
+	g_assert_nonnull(slot_index->entries);
+	g_assert_cmpuint(slot_index->memory, ==, 132 * 8);
+	g_assert_cmpuint(r_hash_index_get_memory(), ==, 132 * (32 + 8) + 132 * 8);
+
+	// chunk 4 (verified by hashing the data)
+	hash = r_hex_decode("9573e6bd3320b3c85ef09743583ed1af87aa479bff046b32762f935b8ffd5ee8", 32);
+	res = r_hash_index_get_chunk(slot_index, hash, chunk, &error);
+	g_assert_no_error(error);
+	g_assert_true(res);
+	memcpy(&tmp_u32, chunk->data, sizeof(tmp_u32));
+	g_assert_cmphex(4, ==, GUINT32_FROM_BE(tmp_u32));
+
+	// excluded by range
+	slot_index->invalid_below = 5;
+	res = r_hash_index_get_chunk(slot_index, hash, chunk, &error);
+	g_assert_error(error, R_HASH_INDEX_ERROR, R_HASH_INDEX_ERROR_NOT_FOUND);
+	g_assert_false(res);
+	g_clear_error(&error);
+	slot_index->invalid_below = 0;
+
+	// overwrite chunk 4, which cannot be distinguished from a prefix collision
+	memset(chunk->data, 0xff, 4096);
+	datafd = g_open(data_filename, O_RDWR|O_CLOEXEC, 0);
+	g_assert_cmpint(datafd, >, 0);
+	g_assert_true(r_pwrite_exact(datafd, chunk->data, 4096, 4*4096, NULL));
+	g_assert_true(g_close(datafd, NULL));
+	res = r_hash_index_get_chunk(slot_index, hash, chunk, &error);
+	g_assert_error(error, R_HASH_INDEX_ERROR, R_HASH_INDEX_ERROR_NOT_FOUND);
+	g_assert_false(res);
+	g_clear_error(&error);
+	g_clear_pointer(&hash, g_free);
+
+	g_clear_pointer(&slot_index, r_hash_index_free);
+	g_assert_cmpuint(r_hash_index_get_memory(), ==, 132 * (32 + 8));
+
+	// the limit is exceeded by a second image index
+	datafd = g_open("test/dummy.verity", O_RDONLY|O_CLOEXEC, 0);
+	g_assert_cmpint(datafd, >, 0);
+	slot_index = r_hash_index_open("test2", datafd, NULL, &error);
+	g_assert_error(error, R_HASH_INDEX_ERROR, R_HASH_INDEX_ERROR_MEMORY);
+	g_assert_null(slot_index);
+	g_assert_true(g_close(datafd, NULL));
+
+	g_clear_pointer(&index, r_hash_index_free);
+	g_assert_cmpuint(r_hash_index_get_memory(), ==, 0);
+
+	r_context()->config->hash_index_memory_limit = 0;
+}
+
+/* Tests opening the hash index of an image stored uncompressed at an offset in
+ * the bundle payload, using a regular file in place of the payload device */
+static void test_image_payload_offset(Fixture *fixture, gconstpointer user_data)
+{
+	g_autoptr(GError) error = NULL;
+	g_autoptr(RaucHashIndex) index = NULL;
+	g_autoptr(RaucImage) image = NULL;
+	g_autofree RaucHashIndexChunk *chunk = g_new0(RaucHashIndexChunk, 1);
+	g_autofree gchar *image_data = NULL;
+	g_autofree guint8 *padding = random_bytes(8192, 0x6b3d54a1);
+	g_autofree guint8 *hash = NULL;
+	g_autoptr(GByteArray) payload = g_byte_array_new();
+	gsize image_len = 0;
+	gboolean res = FALSE;
+	int datafd = -1;
+	guint32 tmp_u32 = 0;
+
+	g_assert_true(g_file_get_contents("test/dummy.verity", &image_data, &image_len, NULL));
+
+	image = r_new_image();
+	image->filename = g_build_filename(fixture->tmpdir, "dummy.img", NULL);
+	image->checksum.size = image_len;
+	image->payload_device = g_build_filename(fixture->tmpdir, "payload", NULL);
+	image->payload_offset = 8192;
+
+	/* the image is surrounded by unrelated data */
+	g_byte_array_append(payload, padding, 8192);
+	g_byte_array_append(payload, (guint8 *) image_data, image_len);
+	g_byte_array_append(payload, padding, 4096);
+	g_assert_true(g_file_set_contents(image->payload_device, (gchar *) payload->data, payload->len, NULL));
+
+	/* the index is created from the image alone */
+	datafd = g_open("test/dummy.verity", O_RDONLY|O_CLOEXEC, 0);
+	g_assert_cmpint(datafd, >, 0);
+	index = r_hash_index_open("test", datafd, NULL, &error);
+	g_assert_no_error(error);
+	g_assert_nonnull(index);
+	{
+		g_autofree gchar *hashes_filename = g_strdup_printf("%s.block-hash-index", image->filename);
+		res = r_hash_index_export(index, hashes_filename, &error);
+		g_assert_no_error(error);
+		g_assert_true(res);
+	}
+	g_clear_pointer(&index, r_hash_index_free);
+
+	/* the image file itself does not exist */
+	index = r_hash_index_open_image("source_image", image, &error);
+	g_assert_no_error(error);
+	g_assert_nonnull(index);
+
+	g_assert_cmpint(index->data_offset, ==, 8192);
+	g_assert_cmpuint(index->count, ==, 132);
+	/* check the data read from the payload against the index */
+	index->skip_hash_check = FALSE;
+
+	// chunk 1
+	hash = r_hex_decode("d4df50ce982e30f82228d5d69096b6fd6875b921fd6bf64c7d9d4d9e7d785d0a", 32);
+	res = r_hash_index_get_chunk(index, hash, chunk, &error);
+	g_assert_no_error(error);
+	g_assert_true(res);
+	memcpy(&tmp_u32, chunk->data, sizeof(tmp_u32));
+	g_assert_cmphex(1, ==, GUINT32_FROM_BE(tmp_u32));
+	g_clear_pointer(&hash, g_free);
+
+	// chunk 131
+	hash = r_hex_decode("4a136f4f52f4403771a09f695b91c139a98898a64a6b5e8fffd3cc26edd095e0", 32);
+	res = r_hash_index_get_chunk(index, hash, chunk, &error);
+	g_assert_no_error(error);
+	g_assert_true(res);
+	memcpy(&tmp_u32, chunk->data, sizeof(tmp_u32));
+	g_assert_cmphex(0xf94b2aeb, ==, GUINT32_FROM_BE(tmp_u32));
+	g_clear_pointer(&hash, g_free);
+}
+
 /* Tests error handling when opening hash index for a file size that is not a
  * multiple of 4096 */
 static void test_invalid_size(Fixture *fixture, gconstpointer user_data)
@@ -314,6 +497,8 @@ int main(int argc, char *argv[])
 
 	g_test_add("/hash_index/basic", Fixture, NULL, fixture_set_up, test_basic, fixture_tear_down);
 	g_test_add("/hash_index/ranges", Fixture, NULL, fixture_set_up, test_ranges, fixture_tear_down);
+	g_test_add("/hash_index/compact", Fixture, NULL, fixture_set_up, test_compact, fixture_tear_down);
+	g_test_add("/hash_index/image-payload-offset", Fixture, NULL, fixture_set_up, test_image_payload_offset, fixture_tear_down);
 	g_test_add("/hash_index/invalid-size", Fixture, NULL, fixture_set_up, test_invalid_size, fixture_tear_down);
 
 	return g_test_run();
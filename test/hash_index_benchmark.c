@@ -0,0 +1,305 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <locale.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "context.h"
+#include "hash_index.h"
+#include "update_handler.h"
+#include "utils.h"
+
+#include "benchmark.h"
+#include "common.h"
+
+/* Benchmarks for the block-hash-index and the adaptive update method.
+ *
+ * An old and a new slot image are generated from a seed. The new image
+ * differs from the old one by a configurable percentage of new, duplicated
+ * and zero chunks:
+ *
+ * RAUC_BENCH_SIZE_MIB:      image size (default 64)
+ * RAUC_BENCH_CHANGE_PCT:    percentage of chunks with new data (default 10)
+ * RAUC_BENCH_DUPLICATE_PCT: percentage of chunks duplicating an earlier
+ *                           chunk of the new image (default 5)
+ * RAUC_BENCH_ZERO_PCT:      percentage of zero chunks (default 5)
+ * RAUC_BENCH_SEED:          seed for the generated images (default 1)
+ *
+ * By default, the target slot is a file in the temporary directory. To
+ * measure the copy to a block device (such as a loop device), set
+ * RAUC_BENCH_TARGET_DEVICE. Its content is overwritten!
+ */
+
+#define CHUNK_SIZE 4096
+
+static struct {
+	gchar *tmpdir;
+	gchar *old_path;
+	gchar *new_path;
+	gchar *params;
+	guint64 size;
+	guint32 count;
+} bench_images;
+
+static void fill_random(GRand *rand, guint8 *data, gsize size)
+{
+	for (gsize i = 0; i < size; i += sizeof(guint32)) {
+		guint32 value = g_rand_int(rand);
+		memcpy(&data[i], &value, sizeof(value));
+	}
+}
+
+static void write_chunk(int fd, const guint8 *chunk)
+{
+	g_autoptr(GError) error = NULL;
+
+	g_assert_true(r_write_exact(fd, chunk, CHUNK_SIZE, &error));
+	g_assert_no_error(error);
+}
+
+/* The images are written chunk by chunk, so that generating them does not
+ * dominate the memory usage of the process. */
+static void generate_images(void)
+{
+	guint64 size_mib = bench_param("SIZE_MIB", 64);
+	guint64 change = bench_param("CHANGE_PCT", 10);
+	guint64 duplicate = bench_param("DUPLICATE_PCT", 5);
+	guint64 zero = bench_param("ZERO_PCT", 5);
+	guint64 seed = bench_param("SEED", 1);
+	g_autoptr(GRand) rand = NULL;
+	g_autofree guint8 *old_chunk = g_malloc(CHUNK_SIZE);
+	g_autofree guint8 *new_chunk = g_malloc(CHUNK_SIZE);
+	int old_fd, new_fd;
+
+	g_assert_cmpuint(size_mib, >, 0);
+	g_assert_cmpuint(change + duplicate + zero, <=, 100);
+
+	bench_images.size = size_mib * 1024 * 1024;
+	bench_images.count = bench_images.size / CHUNK_SIZE;
+	bench_images.params = g_strdup_printf("size_mib=%"G_GUINT64_FORMAT " change_pct=%"G_GUINT64_FORMAT
+			" duplicate_pct=%"G_GUINT64_FORMAT " zero_pct=%"G_GUINT64_FORMAT,
+			size_mib, change, duplicate, zero);
+
+	bench_images.tmpdir = g_dir_make_tmp("rauc-bench-XXXXXX", NULL);
+	g_assert_nonnull(bench_images.tmpdir);
+	bench_images.old_path = g_build_filename(bench_images.tmpdir, "old.img", NULL);
+	bench_images.new_path = g_build_filename(bench_images.tmpdir, "image.img", NULL);
+	old_fd = g_open(bench_images.old_path, O_WRONLY|O_CREAT|O_EXCL|O_CLOEXEC, 0644);
+	g_assert_cmpint(old_fd, >=, 0);
+	new_fd = g_open(bench_images.new_path, O_RDWR|O_CREAT|O_EXCL|O_CLOEXEC, 0644);
+	g_assert_cmpint(new_fd, >=, 0);
+
+	rand = g_rand_new_with_seed(seed);
+	for (guint32 i = 0; i < bench_images.count; i++) {
+		guint32 pick;
+
+		fill_random(rand, old_chunk, CHUNK_SIZE);
+		write_chunk(old_fd, old_chunk);
+
+		pick = g_rand_int_range(rand, 0, 100);
+		if (pick < zero) {
+			memset(new_chunk, 0, CHUNK_SIZE);
+		} else if (pick < zero + duplicate && i > 0) {
+			g_autoptr(GError) error = NULL;
+			off_t offset = (off_t)g_rand_int_range(rand, 0, i) * CHUNK_SIZE;
+
+			/* earlier chunks have already been written */
+			g_assert_true(r_pread_exact(new_fd, new_chunk, CHUNK_SIZE, offset, &error));
+			g_assert_no_error(error);
+		} else if (pick < zero + duplicate + change) {
+			fill_random(rand, new_chunk, CHUNK_SIZE);
+		} else {
+			memcpy(new_chunk, old_chunk, CHUNK_SIZE);
+		}
+		write_chunk(new_fd, new_chunk);
+	}
+
+	g_assert_true(g_close(old_fd, NULL));
+	g_assert_true(g_close(new_fd, NULL));
+}
+
+static RaucHashIndex *open_index(const gchar *label, const gchar *path, const gchar *hashes_filename)
+{
+	g_autoptr(GError) error = NULL;
+	RaucHashIndex *index = NULL;
+	int fd;
+
+	fd = g_open(path, O_RDONLY|O_CLOEXEC, 0);
+	g_assert_cmpint(fd, >=, 0);
+
+	index = r_hash_index_open(label, fd, hashes_filename, &error);
+	g_assert_no_error(error);
+	g_assert_nonnull(index);
+
+	return index;
+}
+
+/* Hashing the data and building the lookup table */
+static void bench_open(void)
+{
+	g_autoptr(RaucHashIndex) index = NULL;
+	RBenchmark bench;
+
+	bench_start(&bench);
+	index = open_index("old", bench_images.old_path, NULL);
+	bench_report(&bench, "hash_index/open", bench_images.params, bench_images.size, index->count);
+
+	g_assert_cmpuint(index->count, ==, bench_images.count);
+}
+
+/* Loading the stored hashes, so mainly building the lookup table */
+static void bench_open_file(void)
+{
+	g_autoptr(GError) error = NULL;
+	g_autoptr(RaucHashIndex) index = NULL;
+	g_autofree gchar *hashes_filename = g_build_filename(bench_images.tmpdir, "old.hashes", NULL);
+	gboolean res;
+	RBenchmark bench;
+
+	index = open_index("old", bench_images.old_path, NULL);
+	res = r_hash_index_export(index, hashes_filename, &error);
+	g_assert_no_error(error);
+	g_assert_true(res);
+	g_clear_pointer(&index, r_hash_index_free);
+
+	bench_start(&bench);
+	index = open_index("old", bench_images.old_path, hashes_filename);
+	bench_report(&bench, "hash_index/open_file", bench_images.params, bench_images.count * 32ULL, index->count);
+
+	g_assert_cmpuint(index->count, ==, bench_images.count);
+	g_assert_true(g_unlink(hashes_filename) == 0);
+}
+
+/* Searching each chunk of the new image in the index of the old image */
+static void bench_get_chunk(void)
+{
+	g_autoptr(RaucHashIndex) old_index = NULL;
+	g_autoptr(RaucHashIndex) new_index = NULL;
+	g_autofree RaucHashIndexChunk *chunk = g_new0(RaucHashIndexChunk, 1);
+	const guint8 *hashes;
+	guint32 found = 0;
+	RBenchmark bench;
+
+	old_index = open_index("old", bench_images.old_path, NULL);
+	new_index = open_index("new", bench_images.new_path, NULL);
+	hashes = g_bytes_get_data(new_index->hashes, NULL);
+
+	bench_start(&bench);
+	for (guint32 i = 0; i < new_index->count; i++) {
+		g_autoptr(GError) error = NULL;
+
+		if (r_hash_index_get_chunk(old_index, &hashes[(gsize)i * 32], chunk, &error))
+			found++;
+		else
+			g_assert_error(error, R_HASH_INDEX_ERROR, R_HASH_INDEX_ERROR_NOT_FOUND);
+	}
+	bench_report(&bench, "hash_index/get_chunk", bench_images.params, (guint64)found * CHUNK_SIZE, new_index->count);
+
+	g_test_message("found %u of %u chunks", found, new_index->count);
+}
+
+static void prepare_target(const gchar *target)
+{
+	g_autoptr(GError) error = NULL;
+	g_auto(filedesc) src_fd = -1;
+	g_auto(filedesc) dst_fd = -1;
+	gboolean res;
+
+	/* the target slot contains the old image, O_TRUNC is ignored for
+	 * block devices */
+	src_fd = g_open(bench_images.old_path, O_RDONLY | O_CLOEXEC, 0);
+	g_assert_cmpint(src_fd, >=, 0);
+	dst_fd = g_open(target, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	g_assert_cmpint(dst_fd, >=, 0);
+
+	res = r_copy_fd_data(src_fd, dst_fd, bench_images.size, &error);
+	g_assert_no_error(error);
+	g_assert_true(res);
+
+	g_assert_cmpint(fsync(dst_fd), ==, 0);
+}
+
+/* Installing the new image to a slot containing the old image */
+static void bench_copy(void)
+{
+	g_autoptr(GError) error = NULL;
+	g_autoptr(RaucImage) image = NULL;
+	g_autoptr(RaucSlot) slot = NULL;
+	g_autofree gchar *target = NULL;
+	g_autofree gchar *params = NULL;
+	g_autofree gchar *expected = NULL;
+	g_autofree gchar *actual = NULL;
+	img_to_slot_handler handler;
+	gboolean res;
+	RBenchmark bench;
+
+	target = g_strdup(g_getenv("RAUC_BENCH_TARGET_DEVICE"));
+	if (!target)
+		target = g_build_filename(bench_images.tmpdir, "target.img", NULL);
+	prepare_target(target);
+
+	image = r_new_image();
+	image->slotclass = g_strdup("rootfs");
+	image->filename = g_strdup(bench_images.new_path);
+	image->type = g_strdup("raw");
+	image->checksum.size = bench_images.size;
+	image->checksum.digest = g_strdup("0xdeadbeef");
+	image->adaptive = g_strsplit("block-hash-index", " ", 0);
+
+	slot = g_new0(RaucSlot, 1);
+	slot->name = g_intern_string("rootfs.0");
+	slot->sclass = g_intern_string("rootfs");
+	slot->device = g_strdup(target);
+	slot->type = g_strdup("raw");
+	slot->state = ST_INACTIVE;
+	slot->data_directory = g_build_filename(bench_images.tmpdir, "rootfs-0-datadir", NULL);
+
+	handler = get_update_handler(image, slot, &error);
+	g_assert_no_error(error);
+	g_assert_nonnull(handler);
+
+	bench_start(&bench);
+	res = handler(image, slot, NULL, &error);
+	g_assert_no_error(error);
+	g_assert_true(res);
+	params = g_strdup_printf("%s target=%s", bench_images.params,
+			g_getenv("RAUC_BENCH_TARGET_DEVICE") ? "device" : "file");
+	bench_report(&bench, "hash_index/copy", params, bench_images.size, bench_images.count);
+
+	/* a block device may be larger than the image */
+	expected = bench_file_sha256(bench_images.new_path, bench_images.size);
+	actual = bench_file_sha256(target, bench_images.size);
+	g_assert_cmpstr(actual, ==, expected);
+
+	if (!g_getenv("RAUC_BENCH_TARGET_DEVICE"))
+		g_assert_true(g_unlink(target) == 0);
+}
+
+int main(int argc, char *argv[])
+{
+	int ret;
+
+	setlocale(LC_ALL, "C");
+
+	g_assert(g_setenv("GIO_USE_VFS", "local", TRUE));
+
+	r_context_conf()->configmode = R_CONTEXT_CONFIG_MODE_NONE;
+	r_context();
+
+	g_test_init(&argc, &argv, NULL);
+
+	generate_images();
+
+	g_test_add_func("/hash_index/open", bench_open);
+	g_test_add_func("/hash_index/open_file", bench_open_file);
+	g_test_add_func("/hash_index/get_chunk", bench_get_chunk);
+	g_test_add_func("/hash_index/copy", bench_copy);
+
+	ret = g_test_run();
+
+	g_assert_true(rm_tree(bench_images.tmpdir, NULL));
+
+	return ret;
+}
@@ -0,0 +1,176 @@
+#include <locale.h>
+#include <utime.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include "common.h"
+#include "context.h"
+#include "inspect_cache.h"
+#include "manifest.h"
+#include "utils.h"
+
+typedef struct {
+	gchar *tmpdir;
+	gchar *bundle;
+	gchar *keyring;
+	RaucManifest *manifest;
+} InspectCacheFixture;
+
+static void inspect_cache_fixture_set_up(InspectCacheFixture *fixture, gconstpointer user_data)
+{
+	g_autofree gchar *contents = NULL;
+	GError *error = NULL;
+	gboolean res;
+
+	fixture->tmpdir = g_dir_make_tmp("rauc-XXXXXX", NULL);
+	g_assert_nonnull(fixture->tmpdir);
+
+	fixture->bundle = write_tmp_file(fixture->tmpdir, "bundle.raucb", "not a real bundle", NULL);
+	g_assert_nonnull(fixture->bundle);
+
+	g_assert_true(g_file_get_contents("test/openssl-ca/dev-ca.pem", &contents, NULL, NULL));
+	fixture->keyring = write_tmp_file(fixture->tmpdir, "keyring.pem", contents, NULL);
+	g_assert_nonnull(fixture->keyring);
+	r_replace_strdup(&r_context()->config->keyring_path, fixture->keyring);
+	g_clear_pointer(&r_context()->config->keyring_directory, g_free);
+
+	res = load_manifest_file("test/manifest.raucm", &fixture->manifest, &error);
+	g_assert_no_error(error);
+	g_assert_true(res);
+
+	r_inspect_cache_clear();
+}
+
+static void inspect_cache_fixture_tear_down(InspectCacheFixture *fixture, gconstpointer user_data)
+{
+	r_inspect_cache_clear();
+
+	g_clear_pointer(&fixture->manifest, free_manifest);
+	g_assert_true(rm_tree(fixture->tmpdir, NULL));
+	g_free(fixture->tmpdir);
+	g_free(fixture->bundle);
+	g_free(fixture->keyring);
+}
+
+/* inserts the manifest for the current state of the bundle and keyring */
+static void inspect_cache_fixture_insert(InspectCacheFixture *fixture)
+{
+	RaucInspectCacheEntry identity = {0};
+
+	g_assert_true(r_inspect_cache_identity(fixture->bundle, &identity));
+	r_inspect_cache_insert(fixture->bundle, &identity, fixture->manifest);
+	r_inspect_cache_identity_clear(&identity);
+}
+
+static void assert_counters(guint64 expected_hits, guint64 expected_misses)
+{
+	guint64 hits, misses;
+
+	r_inspect_cache_get_counters(&hits, &misses);
+	g_assert_cmpuint(hits, ==, expected_hits);
+	g_assert_cmpuint(misses, ==, expected_misses);
+}
+
+static void test_inspect_cache_hit(InspectCacheFixture *fixture, gconstpointer user_data)
+{
+	const RaucInspectCacheEntry *entry;
+
+	g_assert_null(r_inspect_cache_lookup(fixture->bundle));
+	assert_counters(0, 1);
+
+	inspect_cache_fixture_insert(fixture);
+
+	entry = r_inspect_cache_lookup(fixture->bundle);
+	g_assert_nonnull(entry);
+	g_assert_cmpstr(entry->compatible, ==, fixture->manifest->update_compatible);
+	g_assert_cmpstr(entry->version, ==, fixture->manifest->update_version);
+	g_assert_nonnull(entry->info);
+	assert_counters(1, 1);
+
+	entry = r_inspect_cache_lookup(fixture->bundle);
+	g_assert_nonnull(entry);
+	assert_counters(2, 1);
+}
+
+static void test_inspect_cache_bundle_changed(InspectCacheFixture *fixture, gconstpointer user_data)
+{
+	struct utimbuf times = {
+		.actime = 1000000000,
+		.modtime = 1000000000,
+	};
+
+	inspect_cache_fixture_insert(fixture);
+	g_assert_nonnull(r_inspect_cache_lookup(fixture->bundle));
+
+	/* a changed mtime invalidates the result */
+	g_assert_cmpint(g_utime(fixture->bundle, &times), ==, 0);
+	g_assert_null(r_inspect_cache_lookup(fixture->bundle));
+	assert_counters(1, 1);
+
+	/* the new result is cached again */
+	inspect_cache_fixture_insert(fixture);
+	g_assert_nonnull(r_inspect_cache_lookup(fixture->bundle));
+	assert_counters(2, 1);
+
+	/* a removed bundle is not counted, as it is not a local file anymore */
+	g_assert_cmpint(g_unlink(fixture->bundle), ==, 0);
+	g_assert_null(r_inspect_cache_lookup(fixture->bundle));
+	assert_counters(2, 1);
+}
+
+static void test_inspect_cache_keyring_changed(InspectCacheFixture *fixture, gconstpointer user_data)
+{
+	g_autofree gchar *contents = NULL;
+
+	inspect_cache_fixture_insert(fixture);
+	g_assert_nonnull(r_inspect_cache_lookup(fixture->bundle));
+
+	/* a replaced keyring invalidates the result */
+	g_assert_true(g_file_get_contents("test/openssl-ca/dir/a.cert.pem", &contents, NULL, NULL));
+	g_assert_cmpint(g_unlink(fixture->keyring), ==, 0);
+	g_free(write_tmp_file(fixture->tmpdir, "keyring.pem", contents, NULL));
+	g_assert_null(r_inspect_cache_lookup(fixture->bundle));
+	assert_counters(1, 1);
+
+	/* as do changed keyring options */
+	inspect_cache_fixture_insert(fixture);
+	g_assert_nonnull(r_inspect_cache_lookup(fixture->bundle));
+	r_context()->config->keyring_allow_partial_chain = !r_context()->config->keyring_allow_partial_chain;
+	g_assert_null(r_inspect_cache_lookup(fixture->bundle));
+	r_context()->config->keyring_allow_partial_chain = !r_context()->config->keyring_allow_partial_chain;
+	assert_counters(2, 2);
+}
+
+static void test_inspect_cache_remote(InspectCacheFixture *fixture, gconstpointer user_data)
+{
+	RaucInspectCacheEntry identity = {0};
+
+	g_assert_false(r_inspect_cache_identity("https://example.com/bundle.raucb", &identity));
+	g_assert_null(r_inspect_cache_lookup("https://example.com/bundle.raucb"));
+	assert_counters(0, 0);
+}
+
+int main(int argc, char *argv[])
+{
+	setlocale(LC_ALL, "C");
+
+	g_test_init(&argc, &argv, NULL);
+
+	r_context_conf()->configpath = g_strdup("test/test.conf");
+	r_context();
+
+	g_test_add("/inspect_cache/hit", InspectCacheFixture, NULL,
+			inspect_cache_fixture_set_up, test_inspect_cache_hit,
+			inspect_cache_fixture_tear_down);
+	g_test_add("/inspect_cache/bundle-changed", InspectCacheFixture, NULL,
+			inspect_cache_fixture_set_up, test_inspect_cache_bundle_changed,
+			inspect_cache_fixture_tear_down);
+	g_test_add("/inspect_cache/keyring-changed", InspectCacheFixture, NULL,
+			inspect_cache_fixture_set_up, test_inspect_cache_keyring_changed,
+			inspect_cache_fixture_tear_down);
+	g_test_add("/inspect_cache/remote", InspectCacheFixture, NULL,
+			inspect_cache_fixture_set_up, test_inspect_cache_remote,
+			inspect_cache_fixture_tear_down);
+
+	return g_test_run();
+}
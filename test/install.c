@@ -18,6 +18,8 @@ typedef struct {
 	const gchar **message_needles;
 	GQuark install_err_domain;
 	gint install_err_code;
+	/* read the complete payload while mounting verity/crypt bundles */
+	gboolean pre_check;
 	SystemTestOptions system_test_options;
 	ManifestTestOptions manifest_test_options;
 } InstallData;
@@ -179,6 +181,32 @@ adaptive=adaptive-test-method;block-hash-index";
 	fixture_helper_set_up_bundle(fixture->tmpdir, manifest_file, &data->manifest_test_options);
 }
 
+/* Stores both images uncompressed so that they are read from the dm device of
+ * the mounted bundle at their payload offset. The rootfs additionally uses the
+ * block-hash-index, which reads the source chunks from the same range. */
+static void install_fixture_set_up_bundle_uncompressed(InstallFixture *fixture,
+		gconstpointer user_data)
+{
+	InstallData *data = (InstallData*) user_data;
+	const gchar *manifest_file = "\
+[update]\n\
+compatible=Test Config\n\
+\n\
+[image.rootfs]\n\
+filename=rootfs.ext4\n\
+uncompressed=true\n\
+adaptive=block-hash-index\n\
+\n\
+[image.appfs]\n\
+filename=appfs.ext4\n\
+uncompressed=true";
+
+	fixture->tmpdir = g_dir_make_tmp("rauc-XXXXXX", NULL);
+
+	fixture_helper_set_up_system(fixture->tmpdir, "test/test-datadir.conf", NULL);
+	fixture_helper_set_up_bundle(fixture->tmpdir, manifest_file, &data->manifest_test_options);
+}
+
 static void install_fixture_set_up_slot_skipping(InstallFixture *fixture,
 		gconstpointer user_data)
 {
@@ -1104,6 +1132,7 @@ static void install_test_bundle(InstallFixture *fixture,
 	g_assert_nonnull(mountprefix);
 	replace_strdup(&r_context_conf()->mountprefix, mountprefix);
 	r_context();
+	r_context()->config->perform_pre_check = data->pre_check;
 
 	bundlepath = g_build_filename(fixture->tmpdir, "bundle.raucb", NULL);
 	g_assert_nonnull(bundlepath);
@@ -1146,6 +1175,8 @@ static void install_test_bundle(InstallFixture *fixture,
 
 	args->status_result = 0;
 	args->cleanup(args);
+
+	r_context()->config->perform_pre_check = FALSE;
 }
 
 static void install_test_bundle_twice(InstallFixture *fixture,
@@ -1158,6 +1189,33 @@ static void install_test_bundle_twice(InstallFixture *fixture,
 	install_test_bundle(fixture, user_data);
 }
 
+static void assert_slot_matches_image(const gchar *tmpdir, const gchar *slotfile, const gchar *imagefile)
+{
+	g_autofree gchar *slotpath = g_build_filename(tmpdir, slotfile, NULL);
+	g_autofree gchar *imagepath = g_build_filename(tmpdir, imagefile, NULL);
+	g_autofree gchar *slot_data = NULL;
+	g_autofree gchar *image_data = NULL;
+	gsize slot_len, image_len;
+
+	g_assert_true(g_file_get_contents(slotpath, &slot_data, &slot_len, NULL));
+	g_assert_true(g_file_get_contents(imagepath, &image_data, &image_len, NULL));
+	g_assert_cmpmem(slot_data, slot_len, image_data, image_len);
+}
+
+static void install_test_bundle_uncompressed(InstallFixture *fixture,
+		gconstpointer user_data)
+{
+	/* needs to run as root */
+	if (!test_running_as_root())
+		return;
+
+	install_test_bundle(fixture, user_data);
+
+	/* both images must have been copied from their offset in the payload */
+	assert_slot_matches_image(fixture->tmpdir, "images/rootfs-1", "content/rootfs.ext4");
+	assert_slot_matches_image(fixture->tmpdir, "images/appfs-1", "content/appfs.ext4");
+}
+
 static void install_test_bundle_thread(InstallFixture *fixture,
 		gconstpointer user_data)
 {
@@ -1543,6 +1601,20 @@ int main(int argc, char *argv[])
 				install_fixture_set_up_bundle, install_test_bundle_thread,
 				install_fixture_tear_down);
 
+		/* the payload is only read while mounting verity bundles, but the
+		 * installation needs to complete its steps for all formats */
+		install_data = dup_test_data(ptrs, (&(InstallData) {
+			.pre_check = TRUE,
+			.manifest_test_options = {
+				.format = format,
+				.slots = TRUE,
+			},
+		}));
+		g_test_add(dup_test_printf(ptrs, "/install/bundle-pre-check/%s", format_name),
+				InstallFixture, install_data,
+				install_fixture_set_up_bundle, install_test_bundle,
+				install_fixture_tear_down);
+
 		install_data = dup_test_data(ptrs, (&(InstallData) {
 			.message_needles = dup_test_data(ptrs, (&(const gchar *[]) {
 				"Checking and mounting bundle...",
@@ -1627,6 +1699,13 @@ int main(int argc, char *argv[])
 			install_fixture_set_up_bundle_adaptive, install_test_bundle,
 			install_fixture_tear_down);
 
+	if (ENABLE_SQUASHFS_WRITER) {
+		g_test_add("/install/uncompressed",
+				InstallFixture, install_data,
+				install_fixture_set_up_bundle_uncompressed, install_test_bundle_uncompressed,
+				install_fixture_tear_down);
+	}
+
 	g_test_add("/install/slot-skipping",
 			InstallFixture, install_data,
 			install_fixture_set_up_slot_skipping, install_test_bundle_twice,
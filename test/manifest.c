@@ -739,6 +739,51 @@ hooks=install;pre-install\n\
 	g_assert_false(res);
 }
 
+static void test_manifest_uncompressed_converted(void)
+{
+	const gchar *mffile = "\
+[update]\n\
+compatible=FooCorp Super BarBazzer\n\
+version=2015.04-1\n\
+\n\
+[bundle]\n\
+format=verity\n\
+\n\
+[image.rootfs]\n\
+filename=rootfs.tar\n\
+convert=tar-extract\n\
+uncompressed=true\n\
+";
+
+	g_autofree gchar *tmpdir = g_dir_make_tmp("rauc-XXXXXX", NULL);
+	g_assert_nonnull(tmpdir);
+
+	g_autofree gchar *manifestpath = write_tmp_file(tmpdir, "manifest.raucm", mffile, NULL);
+	g_assert_nonnull(manifestpath);
+
+	g_autoptr(RaucManifest) rm = NULL;
+	g_autoptr(GError) error = NULL;
+	RaucImage *image;
+	gboolean res = load_manifest_file(manifestpath, &rm, &error);
+	g_assert_no_error(error);
+	g_assert_true(res);
+	g_assert_cmpuint(g_list_length(rm->images), ==, 1);
+	image = rm->images->data;
+
+	/* the image file would be removed after conversion */
+	res = check_manifest_input(rm, &error);
+	g_assert_error(error, R_MANIFEST_ERROR, R_MANIFEST_CHECK_ERROR);
+	g_assert_nonnull(g_strstr_len(error->message, -1, "add 'keep' to 'convert'"));
+	g_assert_false(res);
+	g_clear_error(&error);
+
+	g_strfreev(image->convert);
+	image->convert = g_strsplit("tar-extract;keep", ";", 0);
+	res = check_manifest_input(rm, &error);
+	g_assert_no_error(error);
+	g_assert_true(res);
+}
+
 static void test_manifest_missing_hook_name(void)
 {
 	g_autofree gchar *tmpdir = NULL;
@@ -990,6 +1035,7 @@ int main(int argc, char *argv[])
 	g_test_add_func("/manifest/invalid_hook_name", test_manifest_invalid_hook_name);
 	g_test_add_func("/manifest/invalid_hook_combination", test_manifest_invalid_hook_combination);
 	g_test_add_func("/manifest/missing_hook_name", test_manifest_missing_hook_name);
+	g_test_add_func("/manifest/uncompressed_converted", test_manifest_uncompressed_converted);
 	g_test_add_func("/manifest/missing_image_size", test_manifest_missing_image_size);
 	g_test_add_func("/manifest/invalid_data", test_invalid_data);
 
@@ -0,0 +1,149 @@
+#include <locale.h>
+#include <glib.h>
+
+#include "metrics.h"
+
+static void test_metrics_empty(void)
+{
+	g_autoptr(GVariant) v = NULL;
+
+	/* nothing was started yet in this process */
+	v = g_variant_ref_sink(r_metrics_to_variant());
+	g_assert_true(g_variant_is_of_type(v, G_VARIANT_TYPE_VARDICT));
+	g_assert_cmpuint(g_variant_n_children(v), ==, 0);
+}
+
+static void test_metrics_install(void)
+{
+	g_autoptr(GVariant) v = NULL;
+	g_autoptr(GVariant) phases = NULL;
+	gboolean active;
+	guint64 bytes;
+	gdouble value;
+
+	r_metrics_start();
+	r_metrics_set_total(4096 * 4);
+
+	r_metrics_phase_begin("update_slots");
+	r_metrics_phase_begin("copy_image");
+	r_metrics_add_bytes(R_METRICS_SOURCE_BUNDLE, 4096);
+	r_metrics_add_bytes(R_METRICS_SOURCE_SEED, 4096);
+	g_usleep(10000);
+	r_metrics_phase_end("copy_image");
+	r_metrics_phase_begin("copy_image");
+	r_metrics_add_bytes(R_METRICS_SOURCE_ZERO, 4096);
+	r_metrics_phase_end("copy_image");
+
+	v = g_variant_ref_sink(r_metrics_to_variant());
+	g_assert_true(g_variant_lookup(v, "active", "b", &active));
+	g_assert_true(active);
+	g_assert_true(g_variant_lookup(v, "bytes-total", "t", &bytes));
+	g_assert_cmpuint(bytes, ==, 4096 * 4);
+	g_assert_true(g_variant_lookup(v, "bytes-written", "t", &bytes));
+	g_assert_cmpuint(bytes, ==, 4096 * 3);
+	g_assert_true(g_variant_lookup(v, "bytes-bundle", "t", &bytes));
+	g_assert_cmpuint(bytes, ==, 4096);
+	g_assert_true(g_variant_lookup(v, "bytes-seed", "t", &bytes));
+	g_assert_cmpuint(bytes, ==, 4096);
+	g_assert_true(g_variant_lookup(v, "bytes-zero", "t", &bytes));
+	g_assert_cmpuint(bytes, ==, 4096);
+	g_assert_true(g_variant_lookup(v, "bytes-network", "t", &bytes));
+	g_assert_cmpuint(bytes, ==, 0);
+	g_assert_true(g_variant_lookup(v, "dedup-ratio", "d", &value));
+	g_assert_cmpfloat_with_epsilon(value, 2.0 / 3.0, 1e-10);
+	g_assert_true(g_variant_lookup(v, "throughput", "d", &value));
+	g_assert_cmpfloat(value, >, 0.0);
+	g_assert_true(g_variant_lookup(v, "eta", "d", &value));
+	g_assert_cmpfloat(value, >=, 0.0);
+
+	phases = g_variant_lookup_value(v, "phases", G_VARIANT_TYPE("a{sd}"));
+	g_assert_nonnull(phases);
+	g_assert_cmpuint(g_variant_n_children(phases), ==, 2);
+	g_assert_true(g_variant_lookup(phases, "copy_image", "d", &value));
+	g_assert_cmpfloat(value, >=, 0.01);
+	g_assert_true(g_variant_lookup(phases, "update_slots", "d", &value));
+	g_assert_cmpfloat(value, >=, 0.01);
+	g_clear_pointer(&phases, g_variant_unref);
+	g_clear_pointer(&v, g_variant_unref);
+
+	/* the open phase is closed when stopping */
+	r_metrics_stop();
+
+	/* ignored after stopping */
+	r_metrics_add_bytes(R_METRICS_SOURCE_BUNDLE, 4096);
+	r_metrics_phase_begin("other");
+
+	v = g_variant_ref_sink(r_metrics_to_variant());
+	g_assert_true(g_variant_lookup(v, "active", "b", &active));
+	g_assert_false(active);
+	g_assert_true(g_variant_lookup(v, "bytes-written", "t", &bytes));
+	g_assert_cmpuint(bytes, ==, 4096 * 3);
+	g_assert_false(g_variant_lookup(v, "eta", "d", &value));
+	phases = g_variant_lookup_value(v, "phases", G_VARIANT_TYPE("a{sd}"));
+	g_assert_cmpuint(g_variant_n_children(phases), ==, 2);
+	g_clear_pointer(&phases, g_variant_unref);
+	g_clear_pointer(&v, g_variant_unref);
+
+	/* a new installation starts from scratch */
+	r_metrics_start();
+	v = g_variant_ref_sink(r_metrics_to_variant());
+	g_assert_true(g_variant_lookup(v, "bytes-written", "t", &bytes));
+	g_assert_cmpuint(bytes, ==, 0);
+	g_assert_false(g_variant_lookup(v, "bytes-total", "t", &bytes));
+	g_assert_false(g_variant_lookup(v, "dedup-ratio", "d", &value));
+	phases = g_variant_lookup_value(v, "phases", G_VARIANT_TYPE("a{sd}"));
+	g_assert_cmpuint(g_variant_n_children(phases), ==, 0);
+	r_metrics_stop();
+}
+
+static void test_metrics_untracked(void)
+{
+	g_autoptr(GVariant) v = NULL;
+	guint64 bytes;
+	gdouble value;
+
+	r_metrics_start();
+	r_metrics_set_total(4096 * 2);
+	r_metrics_add_bytes(R_METRICS_SOURCE_BUNDLE, 4096);
+
+	/* e.g. an install hook writes the second image */
+	r_metrics_mark_untracked();
+
+	v = g_variant_ref_sink(r_metrics_to_variant());
+	g_assert_true(g_variant_lookup(v, "bytes-total", "t", &bytes));
+	g_assert_cmpuint(bytes, ==, 4096 * 2);
+	g_assert_true(g_variant_lookup(v, "bytes-bundle", "t", &bytes));
+	g_assert_cmpuint(bytes, ==, 4096);
+	g_assert_false(g_variant_lookup(v, "bytes-written", "t", &bytes));
+	g_assert_false(g_variant_lookup(v, "throughput", "d", &value));
+	g_assert_false(g_variant_lookup(v, "eta", "d", &value));
+	g_assert_false(g_variant_lookup(v, "dedup-ratio", "d", &value));
+	g_clear_pointer(&v, g_variant_unref);
+
+	/* still unknown once the installation is done */
+	r_metrics_stop();
+	v = g_variant_ref_sink(r_metrics_to_variant());
+	g_assert_false(g_variant_lookup(v, "bytes-written", "t", &bytes));
+	g_assert_false(g_variant_lookup(v, "throughput", "d", &value));
+	g_clear_pointer(&v, g_variant_unref);
+
+	/* a new installation is tracked again */
+	r_metrics_start();
+	v = g_variant_ref_sink(r_metrics_to_variant());
+	g_assert_true(g_variant_lookup(v, "bytes-written", "t", &bytes));
+	g_assert_cmpuint(bytes, ==, 0);
+	r_metrics_stop();
+}
+
+int main(int argc, char *argv[])
+{
+	setlocale(LC_ALL, "C");
+
+	g_test_init(&argc, &argv, NULL);
+
+	g_test_add_func("/metrics/empty", test_metrics_empty);
+	g_test_add_func("/metrics/install", test_metrics_install);
+	g_test_add_func("/metrics/untracked", test_metrics_untracked);
+
+	return g_test_run();
+}
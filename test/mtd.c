@@ -0,0 +1,173 @@
+#include <locale.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include "common.h"
+#include "context.h"
+#include "mtd.h"
+#include "utils.h"
+
+typedef struct {
+	gchar *tmpdir;
+	/* MTD device from the environment variable given as user_data */
+	const gchar *device;
+} MtdFixture;
+
+#define IMAGE_SIZE (200 * 1024 + 123)
+
+static void mtd_fixture_set_up(MtdFixture *fixture, gconstpointer user_data)
+{
+	fixture->tmpdir = g_dir_make_tmp("rauc-XXXXXX", NULL);
+	g_assert_nonnull(fixture->tmpdir);
+
+	fixture->device = g_getenv(user_data);
+}
+
+static void mtd_fixture_tear_down(MtdFixture *fixture, gconstpointer user_data)
+{
+	g_assert_true(rm_tree(fixture->tmpdir, NULL));
+	g_free(fixture->tmpdir);
+}
+
+static gboolean mtd_fixture_check(MtdFixture *fixture, gconstpointer user_data)
+{
+	/* needs to run as root */
+	if (!test_running_as_root())
+		return FALSE;
+
+	if (!fixture->device) {
+		g_test_message("no MTD device for testing found (define %s)", (const gchar *)user_data);
+		g_test_skip("MTD device undefined");
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+/* Checks that the device starts with the image and is erased after it. */
+static void assert_device_contents(const gchar *device, const gchar *image)
+{
+	g_autofree gchar *expected = NULL;
+	g_autofree gchar *contents = NULL;
+	gsize expected_size;
+	gsize size;
+
+	if (image) {
+		g_assert_true(g_file_get_contents(image, &expected, &expected_size, NULL));
+	} else {
+		expected_size = 0;
+	}
+	g_assert_true(g_file_get_contents(device, &contents, &size, NULL));
+
+	g_assert_cmpuint(size, >=, expected_size);
+	g_assert_cmpmem(contents, expected_size, expected, expected_size);
+	for (gsize i = expected_size; i < size; i++)
+		g_assert_cmphex((guint8)contents[i], ==, 0xff);
+}
+
+static void test_mtd_write(MtdFixture *fixture, gconstpointer user_data)
+{
+	g_autofree gchar *image = NULL;
+	g_autofree gchar *image2 = NULL;
+	GError *error = NULL;
+	gboolean res;
+
+	if (!mtd_fixture_check(fixture, user_data))
+		return;
+
+	image = write_random_file(fixture->tmpdir, "image", IMAGE_SIZE, 0x1);
+	g_assert_nonnull(image);
+
+	res = r_mtd_write_image(image, fixture->device, &error);
+	g_assert_no_error(error);
+	g_assert_true(res);
+	assert_device_contents(fixture->device, image);
+
+	/* unchanged blocks are only skipped on NOR */
+	if (g_strcmp0(user_data, "RAUC_TEST_MTD_NAND") == 0)
+		g_test_expect_message(G_LOG_DOMAIN, G_LOG_LEVEL_MESSAGE, "Wrote * (* blocks written, 0 blocks unchanged)");
+	else
+		g_test_expect_message(G_LOG_DOMAIN, G_LOG_LEVEL_MESSAGE, "Wrote * (0 blocks written, * blocks unchanged)");
+	res = r_mtd_write_image(image, fixture->device, &error);
+	g_assert_no_error(error);
+	g_assert_true(res);
+	g_test_assert_expected_messages();
+	assert_device_contents(fixture->device, image);
+
+	/* a shorter image leaves the remaining blocks erased */
+	image2 = write_random_file(fixture->tmpdir, "image2", IMAGE_SIZE / 3, 0x2);
+	g_assert_nonnull(image2);
+
+	res = r_mtd_write_image(image2, fixture->device, &error);
+	g_assert_no_error(error);
+	g_assert_true(res);
+	assert_device_contents(fixture->device, image2);
+}
+
+static void test_mtd_erase(MtdFixture *fixture, gconstpointer user_data)
+{
+	g_autofree gchar *image = NULL;
+	GError *error = NULL;
+	gboolean res;
+
+	if (!mtd_fixture_check(fixture, user_data))
+		return;
+
+	image = write_random_file(fixture->tmpdir, "image", IMAGE_SIZE, 0x3);
+	g_assert_nonnull(image);
+
+	res = r_mtd_write_image(image, fixture->device, &error);
+	g_assert_no_error(error);
+	g_assert_true(res);
+
+	res = r_mtd_erase(fixture->device, &error);
+	g_assert_no_error(error);
+	g_assert_true(res);
+	assert_device_contents(fixture->device, NULL);
+}
+
+static void test_mtd_too_large(MtdFixture *fixture, gconstpointer user_data)
+{
+	g_autofree gchar *contents = NULL;
+	g_autofree gchar *image = NULL;
+	GError *error = NULL;
+	gsize size;
+	gboolean res;
+
+	if (!mtd_fixture_check(fixture, user_data))
+		return;
+
+	g_assert_true(g_file_get_contents(fixture->device, &contents, &size, NULL));
+	image = write_random_file(fixture->tmpdir, "image", size + 1, 0x4);
+	g_assert_nonnull(image);
+
+	res = r_mtd_write_image(image, fixture->device, &error);
+	g_assert_error(error, R_MTD_ERROR, R_MTD_ERROR_NO_SPACE);
+	g_assert_false(res);
+	g_clear_error(&error);
+}
+
+int main(int argc, char *argv[])
+{
+	setlocale(LC_ALL, "C");
+
+	g_test_init(&argc, &argv, NULL);
+
+	r_context_conf();
+	r_context();
+
+	g_test_add("/mtd/nor/write", MtdFixture, "RAUC_TEST_MTD_NOR",
+			mtd_fixture_set_up, test_mtd_write, mtd_fixture_tear_down);
+	g_test_add("/mtd/nor/erase", MtdFixture, "RAUC_TEST_MTD_NOR",
+			mtd_fixture_set_up, test_mtd_erase, mtd_fixture_tear_down);
+	g_test_add("/mtd/nor/too-large", MtdFixture, "RAUC_TEST_MTD_NOR",
+			mtd_fixture_set_up, test_mtd_too_large, mtd_fixture_tear_down);
+	g_test_add("/mtd/nand/write", MtdFixture, "RAUC_TEST_MTD_NAND",
+			mtd_fixture_set_up, test_mtd_write, mtd_fixture_tear_down);
+	g_test_add("/mtd/nand/erase", MtdFixture, "RAUC_TEST_MTD_NAND",
+			mtd_fixture_set_up, test_mtd_erase, mtd_fixture_tear_down);
+	g_test_add("/mtd/nand/too-large", MtdFixture, "RAUC_TEST_MTD_NAND",
+			mtd_fixture_set_up, test_mtd_too_large, mtd_fixture_tear_down);
+
+	return g_test_run();
+}
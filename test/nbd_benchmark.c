@@ -0,0 +1,149 @@
+#include <locale.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include <context.h>
+#include <nbd.h>
+#include <utils.h>
+
+#include "benchmark.h"
+#include "common.h"
+
+/* Benchmarks for the NBD server used for streaming.
+ *
+ * The data is served by the aiohttp backend (test/nginx_backend.py), which
+ * can add latency to each response and limit the bandwidth. The data is read
+ * sequentially via the NBD socket, as the kernel would do for a streamed
+ * bundle. The SHA-256 of the received data is compared to the served file,
+ * hashing is part of the measurement.
+ *
+ * RAUC_BENCH_SIZE_MIB:      size of the served data (default 16)
+ * RAUC_BENCH_REQUEST_KIB:   size of each NBD read request (default 128)
+ * RAUC_BENCH_LATENCY_MS:    latency added to each HTTP response for the
+ *                           shaped benchmark (default 50)
+ * RAUC_BENCH_BANDWIDTH_KIB: bandwidth limit in KiB/s for the shaped
+ *                           benchmark (default 8192, 0 for unlimited)
+ *
+ * The backend is expected at http://127.0.0.1/backend (as set up by
+ * qemu-test, see RAUC_TEST_HTTP_BACKEND), or at RAUC_BENCH_HTTP_BASE (such
+ * as http://127.0.0.1:8080 when running nginx_backend.py directly).
+ */
+
+static struct {
+	gchar *tmpdir;
+	gchar *data;
+	gchar *digest;
+	guint64 size;
+	guint64 request_size;
+} bench_nbd;
+
+static const gchar *get_http_base(void)
+{
+	const gchar *base = g_getenv("RAUC_BENCH_HTTP_BASE");
+
+	if (base)
+		return base;
+
+	if (!g_getenv("RAUC_TEST_HTTP_BACKEND")) {
+		g_test_message("no aiohttp backend for testing found (define RAUC_TEST_HTTP_BACKEND or RAUC_BENCH_HTTP_BASE)");
+		g_test_skip("RAUC_TEST_HTTP_BACKEND undefined");
+		return NULL;
+	}
+
+	return "http://127.0.0.1/backend";
+}
+
+static void bench_read(guint64 latency_ms, guint64 bandwidth_kib)
+{
+	g_autoptr(RaucNBDServer) nbd_srv = NULL;
+	g_autoptr(GChecksum) checksum = g_checksum_new(G_CHECKSUM_SHA256);
+	g_autoptr(GError) error = NULL;
+	g_autofree guint8 *buffer = NULL;
+	g_autofree gchar *params = NULL;
+	const gchar *base = get_http_base();
+	guint64 requests = 0;
+	gboolean res;
+	RBenchmark bench;
+
+	if (!base)
+		return;
+
+	params = g_strdup_printf("size_mib=%"G_GUINT64_FORMAT " request_kib=%"G_GUINT64_FORMAT
+			" latency_ms=%"G_GUINT64_FORMAT " bandwidth_kib=%"G_GUINT64_FORMAT,
+			bench_nbd.size / (1024 * 1024), bench_nbd.request_size / 1024,
+			latency_ms, bandwidth_kib);
+
+	nbd_srv = r_nbd_new_server();
+	/* the data path is absolute, so it starts with a '/' */
+	nbd_srv->url = g_strdup_printf("%s/shaped/%"G_GUINT64_FORMAT "/%"G_GUINT64_FORMAT "%s",
+			base, latency_ms, bandwidth_kib, bench_nbd.data);
+	buffer = g_malloc(bench_nbd.request_size);
+
+	/* includes starting the server process and the initial request */
+	bench_start(&bench);
+	res = r_nbd_start_server(nbd_srv, &error);
+	g_assert_no_error(error);
+	g_assert_true(res);
+	g_assert_cmpuint(nbd_srv->data_size, ==, bench_nbd.size);
+
+	for (guint64 offset = 0; offset < nbd_srv->data_size; offset += bench_nbd.request_size) {
+		gsize size = MIN(bench_nbd.request_size, nbd_srv->data_size - offset);
+
+		res = r_nbd_read(nbd_srv->sock, buffer, size, offset, &error);
+		g_assert_no_error(error);
+		g_assert_true(res);
+		g_checksum_update(checksum, buffer, size);
+		requests++;
+	}
+
+	/* wait for the server process to include it in the CPU time */
+	res = r_nbd_stop_server(nbd_srv, &error);
+	g_assert_no_error(error);
+	g_assert_true(res);
+	bench_report(&bench, "nbd/read", params, bench_nbd.size, requests);
+
+	g_assert_cmpstr(g_checksum_get_string(checksum), ==, bench_nbd.digest);
+}
+
+static void bench_read_unshaped(void)
+{
+	bench_read(0, 0);
+}
+
+static void bench_read_shaped(void)
+{
+	bench_read(bench_param("LATENCY_MS", 50), bench_param("BANDWIDTH_KIB", 8192));
+}
+
+int main(int argc, char *argv[])
+{
+	int ret;
+
+	setlocale(LC_ALL, "C");
+
+	g_assert(g_setenv("GIO_USE_VFS", "local", TRUE));
+
+	r_context_conf()->configpath = g_strdup("test/test.conf");
+	r_context();
+
+	g_test_init(&argc, &argv, NULL);
+
+	bench_nbd.size = bench_param("SIZE_MIB", 16) * 1024 * 1024;
+	bench_nbd.request_size = bench_param("REQUEST_KIB", 128) * 1024;
+	g_assert_cmpuint(bench_nbd.size, >, 0);
+	g_assert_cmpuint(bench_nbd.request_size, >, 0);
+	bench_nbd.tmpdir = g_dir_make_tmp("rauc-bench-XXXXXX", NULL);
+	g_assert_nonnull(bench_nbd.tmpdir);
+	/* the backend needs to be able to read it */
+	g_assert_cmpint(g_chmod(bench_nbd.tmpdir, 0755), ==, 0);
+	bench_nbd.data = bench_write_random_file(bench_nbd.tmpdir, "data", bench_nbd.size, 0x1, &bench_nbd.digest);
+
+	g_test_add_func("/nbd/read/unshaped", bench_read_unshaped);
+	g_test_add_func("/nbd/read/shaped", bench_read_shaped);
+
+	ret = g_test_run();
+
+	g_assert_true(rm_tree(bench_nbd.tmpdir, NULL));
+
+	return ret;
+}
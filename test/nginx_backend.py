@@ -1,10 +1,12 @@
 #!/usr/bin/python3
 
 import argparse
+import asyncio
 import json
 import os
 import socket
 import sys
+import tempfile
 
 try:
     from aiohttp import web
@@ -60,6 +62,70 @@ async def token_get(request):
         return web.FileResponse(path="test/good-verity-bundle.raucb")
 
 
+def shaped_path(request):
+    """Returns the file requested from shaped_get(). Only files in a benchmark
+    directory (rauc-bench-*) directly below the shaped root are served."""
+    root = os.path.realpath(request.app["rauc"]["shaped_root"])
+    path = os.path.realpath("/" + request.match_info["path"])
+
+    parts = os.path.relpath(path, root).split(os.sep)
+    if len(parts) != 2 or not parts[0].startswith("rauc-bench-") or parts[1] in (os.curdir, os.pardir):
+        raise web.HTTPForbidden(text="only files in benchmark directories are served")
+
+    return path
+
+
+@routes.get("/shaped/{latency}/{bandwidth}/{path:.+}")
+async def shaped_get(request):
+    """Serves a benchmark file (given by its absolute path) with the latency
+    (in ms) added to each response and the bandwidth (in KiB/s, 0 for
+    unlimited) limited per response."""
+    latency = int(request.match_info["latency"]) / 1000
+    bandwidth = int(request.match_info["bandwidth"]) * 1024
+    path = shaped_path(request)
+
+    try:
+        size = os.path.getsize(path)
+    except FileNotFoundError:
+        raise web.HTTPNotFound()
+
+    start = request.http_range.start or 0
+    stop = request.http_range.stop
+    if start < 0:
+        start = max(size + start, 0)
+    if stop is None or stop > size:
+        stop = size
+    if start >= stop:
+        raise web.HTTPRequestRangeNotSatisfiable(headers={"Content-Range": f"bytes */{size}"})
+
+    await asyncio.sleep(latency)
+
+    response = web.StreamResponse()
+    response.headers["Accept-Ranges"] = "bytes"
+    if "Range" in request.headers:
+        response.set_status(206)
+        response.headers["Content-Range"] = f"bytes {start}-{stop - 1}/{size}"
+    response.content_length = stop - start
+    await response.prepare(request)
+
+    loop = asyncio.get_running_loop()
+    begin = loop.time()
+    sent = 0
+    with open(path, "rb") as f:
+        f.seek(start)
+        while sent < stop - start:
+            data = f.read(min(64 * 1024, stop - start - sent))
+            await response.write(data)
+            sent += len(data)
+            if bandwidth:
+                delay = begin + sent / bandwidth - loop.time()
+                if delay > 0:
+                    await asyncio.sleep(delay)
+
+    await response.write_eof()
+    return response
+
+
 def reset_summary(request):
     request.app["rauc"]["summary"] = {
         "first_request_headers": {},
@@ -117,6 +183,11 @@ if __name__ == "__main__":
     parser = argparse.ArgumentParser(description="Run aiohttp server with optional socket and daemon mode.")
     parser.add_argument("-s", "--socket", help="Path to Unix domain socket")
     parser.add_argument("-d", "--daemon", action="store_true", help="Run as daemon")
+    parser.add_argument(
+        "--shaped-root",
+        default=tempfile.gettempdir(),
+        help="Directory containing the rauc-bench-* directories served by /shaped (default: %(default)s)",
+    )
 
     args = parser.parse_args()
 
@@ -134,6 +205,7 @@ if __name__ == "__main__":
     app = web.Application()
     app["rauc"] = {
         "sporadic_counter": -1,
+        "shaped_root": args.shaped_root,
     }
     app.add_routes(routes)
     web.run_app(app, **app_args)
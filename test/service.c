@@ -1,5 +1,6 @@
 #include <stdio.h>
 #include <locale.h>
+#include <utime.h>
 #include <glib.h>
 #include <glib/gstdio.h>
 #include <gio/gio.h>
@@ -31,7 +32,8 @@ static void service_fixture_set_up(ServiceFixture *fixture, gconstpointer user_d
 
 	fixture->tmpdir = g_dir_make_tmp("rauc-XXXXXX", NULL);
 
-	fixture_helper_set_up_system(fixture->tmpdir, NULL, NULL);
+	/* user_data may point to SystemTestOptions */
+	fixture_helper_set_up_system(fixture->tmpdir, NULL, user_data);
 
 	/* Write a D-Bus service file with current tmpdir */
 	contents = g_strdup_printf("\
@@ -58,6 +60,20 @@ static void service_install_fixture_set_up(ServiceFixture *fixture, gconstpointe
 	});
 }
 
+static void service_session_fixture_set_up(ServiceFixture *fixture, gconstpointer user_data)
+{
+	service_fixture_set_up(fixture, user_data);
+
+	/* sessions are not supported for plain bundles */
+	fixture_helper_set_up_bundle(fixture->tmpdir, NULL,
+			&(ManifestTestOptions) {
+		.custom_handler = FALSE,
+		.hooks = FALSE,
+		.slots = TRUE,
+		.format = R_MANIFEST_FORMAT_VERITY,
+	});
+}
+
 static void service_fixture_tear_down(ServiceFixture *fixture, gconstpointer user_data)
 {
 	GError *error = NULL;
@@ -264,6 +280,92 @@ static void service_test_install_bundle(ServiceFixture *fixture, gconstpointer u
 	service_test_install(fixture, user_data, FALSE);
 }
 
+static gboolean install_with_session(const gchar *bundlepath, const gchar *session, GError **error)
+{
+	g_auto(GVariantDict) dict = G_VARIANT_DICT_INIT(NULL);
+
+	g_variant_dict_insert(&dict, "session", "s", session);
+
+	return r_installer_call_install_bundle_sync(
+			installer,
+			bundlepath,
+			g_variant_dict_end(&dict), /* floating, no unref needed */
+			NULL,
+			error);
+}
+
+/* Hands over a bundle from InspectBundle to InstallBundle and checks that
+ * unknown or already used sessions are rejected */
+static void service_test_install_session(ServiceFixture *fixture, gconstpointer user_data)
+{
+	g_auto(GVariantDict) dict = G_VARIANT_DICT_INIT(NULL);
+	g_autoptr(GVariant) info = NULL;
+	g_autofree gchar *bundlepath = NULL;
+	g_autofree gchar *session = NULL;
+	GError *error = NULL;
+	gboolean ret = FALSE;
+
+	if (!ENABLE_SERVICE) {
+		g_test_skip("Test requires RAUC being configured with \"-Dservice=true\".");
+		return;
+	}
+
+	/* needs to run as root */
+	if (!test_running_as_root())
+		return;
+
+	testloop = g_main_loop_new(NULL, FALSE);
+
+	installer = r_installer_proxy_new_for_bus_sync(G_BUS_TYPE_SESSION,
+			G_DBUS_PROXY_FLAGS_GET_INVALIDATED_PROPERTIES,
+			"de.pengutronix.rauc", "/", NULL, &error);
+	g_assert_no_error(error);
+	g_assert_nonnull(installer);
+
+	bundlepath = g_build_filename(fixture->tmpdir, "bundle.raucb", NULL);
+
+	/* an unknown session is rejected */
+	ret = install_with_session(bundlepath, "00000000-0000-0000-0000-000000000000", &error);
+	g_assert_error(error, G_IO_ERROR, G_IO_ERROR_FAILED_HANDLED);
+	g_assert_nonnull(g_strstr_len(error->message, -1, "Unknown or expired session"));
+	g_assert_false(ret);
+	g_clear_error(&error);
+
+	g_variant_dict_insert(&dict, "open-session", "b", TRUE);
+	ret = r_installer_call_inspect_bundle_sync(installer,
+			bundlepath,
+			g_variant_dict_end(&dict), /* floating, no unref needed */
+			&info,
+			NULL,
+			&error);
+	g_assert_no_error(error);
+	g_assert_true(ret);
+	g_assert_true(g_variant_lookup(info, "session", "s", &session));
+
+	/* the session only applies to the inspected source */
+	ret = install_with_session("/nonexistent/bundle.raucb", session, &error);
+	g_assert_error(error, G_IO_ERROR, G_IO_ERROR_FAILED_HANDLED);
+	g_assert_false(ret);
+	g_clear_error(&error);
+
+	g_assert_cmpint(g_signal_connect(installer, "completed",
+			G_CALLBACK(on_installer_completed), NULL), !=, 0);
+
+	ret = install_with_session(bundlepath, session, &error);
+	g_assert_no_error(error);
+	g_assert_true(ret);
+
+	g_main_loop_run(testloop);
+
+	/* the session was used up by the installation */
+	ret = install_with_session(bundlepath, session, &error);
+	g_assert_error(error, G_IO_ERROR, G_IO_ERROR_FAILED_HANDLED);
+	g_assert_false(ret);
+	g_clear_error(&error);
+
+	g_clear_object(&installer);
+}
+
 static void service_test_install_api(ServiceFixture *fixture, gconstpointer user_data)
 {
 	GError *error = NULL;
@@ -416,6 +518,80 @@ static void service_test_info_deprecated(ServiceFixture *fixture, gconstpointer
 	service_test_info(fixture, user_data, TRUE);
 }
 
+static void inspect_bundle(const gchar *bundlepath, GVariant **info)
+{
+	GError *error = NULL;
+
+	r_installer_call_inspect_bundle_sync(installer,
+			bundlepath,
+			g_variant_new("a{sv}", NULL), /* floating, no unref needed */
+			info,
+			NULL,
+			&error);
+	g_assert_no_error(error);
+	g_assert_nonnull(*info);
+}
+
+/* Inspecting the same bundle twice must return the same (cached) result, the
+ * cache itself is tested in test/inspect_cache.c */
+static void service_test_info_cached(ServiceFixture *fixture, gconstpointer user_data)
+{
+	GError *error = NULL;
+	g_autofree gchar *bundlepath = NULL;
+	g_autoptr(GVariant) first = NULL;
+	g_autoptr(GVariant) second = NULL;
+	g_autoptr(GVariant) third = NULL;
+	struct utimbuf times = {0};
+
+	if (!ENABLE_SERVICE) {
+		g_test_skip("Test requires RAUC being configured with \"-Dservice=true\".");
+		return;
+	}
+
+	/* needs to run as root */
+	if (!test_running_as_root())
+		return;
+
+	bundlepath = g_build_filename(fixture->tmpdir, "good-bundle.raucb", NULL);
+	g_assert_true(test_copy_file("test", "good-bundle.raucb", fixture->tmpdir, "good-bundle.raucb"));
+
+	installer = r_installer_proxy_new_for_bus_sync(G_BUS_TYPE_SESSION,
+			G_DBUS_PROXY_FLAGS_NONE,
+			"de.pengutronix.rauc",
+			"/",
+			NULL,
+			&error);
+	g_assert_no_error(error);
+	g_assert_nonnull(installer);
+
+	inspect_bundle(bundlepath, &first);
+
+	/* the second call uses the cached result */
+	inspect_bundle(bundlepath, &second);
+	g_assert_true(g_variant_equal(first, second));
+
+	/* changing the mtime must invalidate the cached result */
+	times.actime = 1000000000;
+	times.modtime = 1000000000;
+	g_assert_cmpint(g_utime(bundlepath, &times), ==, 0);
+	inspect_bundle(bundlepath, &third);
+	g_assert_true(g_variant_equal(first, third));
+
+	/* removing the bundle must invalidate the cached result */
+	g_assert_cmpint(g_unlink(bundlepath), ==, 0);
+	g_clear_pointer(&second, g_variant_unref);
+	r_installer_call_inspect_bundle_sync(installer,
+			bundlepath,
+			g_variant_new("a{sv}", NULL),
+			&second,
+			NULL,
+			&error);
+	g_assert_error(error, G_IO_ERROR, G_IO_ERROR_FAILED_HANDLED);
+	g_clear_error(&error);
+
+	g_clear_object(&installer);
+}
+
 static void service_test_slot_status(ServiceFixture *fixture, gconstpointer user_data)
 {
 	GError *error = NULL;
@@ -456,6 +632,48 @@ out:
 	g_variant_unref(slot_status_array);
 }
 
+static void service_test_statistics(ServiceFixture *fixture, gconstpointer user_data)
+{
+	GError *error = NULL;
+	GVariant *statistics = NULL;
+
+	if (!ENABLE_SERVICE) {
+		g_test_skip("Test requires RAUC being configured with \"-Dservice=true\".");
+		return;
+	}
+
+	/* needs to run as root */
+	if (!test_running_as_root())
+		return;
+
+	installer = r_installer_proxy_new_for_bus_sync(G_BUS_TYPE_SESSION,
+			G_DBUS_PROXY_FLAGS_NONE,
+			"de.pengutronix.rauc",
+			"/",
+			NULL,
+			&error);
+	g_assert_no_error(error);
+
+	if (installer == NULL) {
+		g_error("failed to install proxy");
+		goto out;
+	}
+
+	r_installer_call_get_statistics_sync(installer,
+			&statistics,
+			NULL,
+			&error);
+	g_assert_no_error(error);
+	g_assert_nonnull(statistics);
+	g_assert_true(g_variant_is_of_type(statistics, G_VARIANT_TYPE("a{sa{sv}}")));
+	/* no installation was performed */
+	g_assert_cmpint(g_variant_n_children(statistics), ==, 0);
+
+out:
+	g_clear_object(&installer);
+	g_clear_pointer(&statistics, g_variant_unref);
+}
+
 int main(int argc, char *argv[])
 {
 	setlocale(LC_ALL, "C");
@@ -472,6 +690,19 @@ int main(int argc, char *argv[])
 			service_install_fixture_set_up, service_test_install_deprecated,
 			service_fixture_tear_down);
 
+	g_test_add("/service/install-session", ServiceFixture, NULL,
+			service_session_fixture_set_up, service_test_install_session,
+			service_fixture_tear_down);
+
+	/* the bundle is not read again while installing, which must still
+	 * complete all progress steps */
+	g_test_add("/service/install-session/pre-check", ServiceFixture,
+			&(SystemTestOptions) {
+		.perform_pre_check = TRUE,
+	},
+			service_session_fixture_set_up, service_test_install_session,
+			service_fixture_tear_down);
+
 	g_test_add("/service/install-api", ServiceFixture, NULL,
 			service_install_fixture_set_up, service_test_install_api,
 			service_fixture_tear_down);
@@ -484,9 +715,17 @@ int main(int argc, char *argv[])
 			service_fixture_set_up, service_test_info_deprecated,
 			service_fixture_tear_down);
 
+	g_test_add("/service/info-cached", ServiceFixture, NULL,
+			service_fixture_set_up, service_test_info_cached,
+			service_fixture_tear_down);
+
 	g_test_add("/service/slot-status", ServiceFixture, NULL,
 			service_fixture_set_up, service_test_slot_status,
 			service_fixture_tear_down);
 
+	g_test_add("/service/statistics", ServiceFixture, NULL,
+			service_fixture_set_up, service_test_statistics,
+			service_fixture_tear_down);
+
 	return g_test_run();
 }
@@ -867,6 +867,81 @@ static void signature_cmsverify_pathdir_path(SignatureFixture *fixture,
 	g_assert_nonnull(fixture->cms);
 }
 
+/* returns the first certificate in the store */
+static X509 *store_get0_cert(X509_STORE *store)
+{
+	STACK_OF(X509_OBJECT) *objects = X509_STORE_get0_objects(store);
+
+	g_assert_cmpint(sk_X509_OBJECT_num(objects), >, 0);
+
+	return X509_OBJECT_get0_X509(sk_X509_OBJECT_value(objects, 0));
+}
+
+static void signature_keyring_cache(SignatureFixture *fixture,
+		gconstpointer user_data)
+{
+	g_autofree gchar *tmpdir = g_dir_make_tmp("rauc-keyring-XXXXXX", NULL);
+	g_autofree gchar *keyring = NULL;
+	g_autofree gchar *contents = NULL;
+	g_autoptr(X509_STORE) store1 = NULL;
+	g_autoptr(X509_STORE) store2 = NULL;
+	g_autoptr(X509_STORE) store3 = NULL;
+	gboolean res;
+
+	g_assert_nonnull(tmpdir);
+	g_assert_true(g_file_get_contents("test/openssl-ca/dir/a.cert.pem", &contents, NULL, NULL));
+	keyring = write_tmp_file(tmpdir, "keyring.pem", contents, NULL);
+	g_assert_nonnull(keyring);
+	r_replace_strdup(&r_context()->config->keyring_path, keyring);
+	g_clear_pointer(&r_context()->config->keyring_directory, g_free);
+
+	fixture->sig = cms_sign(fixture->content,
+			TRUE,
+			"test/openssl-ca/dir/a.cert.pem",
+			"test/openssl-ca/dir/private/a.key.pem",
+			NULL,
+			&fixture->error);
+	g_assert_no_error(fixture->error);
+	g_assert_nonnull(fixture->sig);
+
+	r_signature_set_keyring_cache(TRUE);
+
+	/* unchanged keyring is reused, but each caller gets its own store */
+	store1 = setup_x509_store(NULL, NULL, &fixture->error);
+	g_assert_no_error(fixture->error);
+	g_assert_nonnull(store1);
+	store2 = setup_x509_store(NULL, NULL, &fixture->error);
+	g_assert_no_error(fixture->error);
+	g_assert_true(store1 != store2);
+	g_assert_true(store_get0_cert(store1) == store_get0_cert(store2));
+
+	/* verification parameters are not shared */
+	X509_VERIFY_PARAM_set_flags(X509_STORE_get0_param(store1), X509_V_FLAG_NO_CHECK_TIME);
+	g_assert_false(X509_VERIFY_PARAM_get_flags(X509_STORE_get0_param(store2)) & X509_V_FLAG_NO_CHECK_TIME);
+
+	res = cms_verify_bytes(fixture->content, fixture->sig, store2, &fixture->cms, NULL, &fixture->error);
+	g_assert_no_error(fixture->error);
+	g_assert_true(res);
+	g_clear_pointer(&fixture->cms, CMS_ContentInfo_free);
+
+	/* replaced keyring is reloaded */
+	g_clear_pointer(&contents, g_free);
+	g_assert_true(g_file_get_contents("test/openssl-ca/dir/b.cert.pem", &contents, NULL, NULL));
+	g_assert_cmpint(g_unlink(keyring), ==, 0);
+	g_free(write_tmp_file(tmpdir, "keyring.pem", contents, NULL));
+	store3 = setup_x509_store(NULL, NULL, &fixture->error);
+	g_assert_no_error(fixture->error);
+	g_assert_nonnull(store3);
+	g_assert_true(store_get0_cert(store3) != store_get0_cert(store1));
+
+	res = cms_verify_bytes(fixture->content, fixture->sig, store3, &fixture->cms, NULL, &fixture->error);
+	g_assert_error(fixture->error, R_SIGNATURE_ERROR, R_SIGNATURE_ERROR_INVALID);
+	g_assert_false(res);
+
+	r_signature_set_keyring_cache(FALSE);
+	g_assert_true(rm_tree(tmpdir, NULL));
+}
+
 static void signature_append_detached(SignatureFixture *fixture, gconstpointer user_data)
 {
 	gboolean res;
@@ -1070,6 +1145,7 @@ int main(int argc, char *argv[])
 	g_test_add("/signature/cmsverify_dir_single_fail", SignatureFixture, NULL, signature_set_up, signature_cmsverify_dir_single_fail, signature_tear_down);
 	g_test_add("/signature/cmsverify_pathdir_dir", SignatureFixture, NULL, signature_set_up, signature_cmsverify_pathdir_dir, signature_tear_down);
 	g_test_add("/signature/cmsverify_pathdir_path", SignatureFixture, NULL, signature_set_up, signature_cmsverify_pathdir_path, signature_tear_down);
+	g_test_add("/signature/keyring_cache", SignatureFixture, NULL, signature_set_up, signature_keyring_cache, signature_tear_down);
 	g_test_add("/signature/append_detached", SignatureFixture, NULL, signature_set_up, signature_append_detached, signature_tear_down);
 	g_test_add("/signature/append_inline", SignatureFixture, NULL, signature_set_up, signature_append_inline, signature_tear_down);
 	g_test_add("/signature/append_partial", SignatureFixture, NULL, signature_set_up, signature_append_partial, signature_tear_down);
@@ -1,7 +1,12 @@
+#include <fcntl.h>
 #include <glib.h>
+#include <glib/gstdio.h>
 #include <locale.h>
 
 #include <slot.h>
+#include <utils.h>
+
+#include "common.h"
 
 static void test_slot_get_all_children(void)
 {
@@ -164,6 +169,63 @@ static void test_slot_get_root_classes(void)
 	g_assert_false(string_array_contains(root_classes, "appfs"));
 }
 
+static void test_slot_fingerprint(void)
+{
+	GError *ierror = NULL;
+	g_autofree gchar *tmpdir = NULL;
+	g_autofree gchar *fingerprint = NULL;
+	RaucChecksum checksum = {
+		.type = G_CHECKSUM_SHA256,
+		.digest = (gchar *) "e437ab217356ee47cd338be0ffe33a3cb6dc1ce679475ea59ff8a8f7f6242b27",
+		.size = 4 * 1024 * 1024,
+	};
+	RaucChecksum other = checksum;
+	g_autoptr(RaucSlot) slot = g_new0(RaucSlot, 1);
+	g_autofree guint8 *block = g_malloc0(4096);
+	g_auto(filedesc) fd = -1;
+	gboolean res;
+
+	tmpdir = g_dir_make_tmp("rauc-slot-XXXXXX", NULL);
+	g_assert_nonnull(tmpdir);
+
+	slot->name = g_intern_string("rootfs.0");
+	slot->device = write_random_file(tmpdir, "rootfs-0", 4 * 1024 * 1024, 0x2a);
+	g_assert_nonnull(slot->device);
+	slot->data_directory = g_build_filename(tmpdir, "data", "slot.rootfs.0", NULL);
+	fingerprint = g_build_filename(slot->data_directory, "fingerprint", NULL);
+
+	/* nothing recorded yet */
+	g_assert_false(r_slot_fingerprint_matches(slot, &checksum));
+
+	res = r_slot_fingerprint_save(slot, &checksum, &ierror);
+	g_assert_no_error(ierror);
+	g_assert_true(res);
+	g_assert_true(g_file_test(fingerprint, G_FILE_TEST_IS_REGULAR));
+	g_assert_true(r_slot_fingerprint_matches(slot, &checksum));
+
+	/* a different image must not match */
+	other.digest = (gchar *) "dc626520dcd53a22f727af3ee42c770e56c97a64fe3adb063799d8ab032fe551";
+	g_assert_false(r_slot_fingerprint_matches(slot, &other));
+
+	/* modifying the last block of the slot must be detected */
+	fd = g_open(slot->device, O_WRONLY | O_CLOEXEC, 0);
+	g_assert_cmpint(fd, >=, 0);
+	res = r_pwrite_exact(fd, block, 4096, checksum.size - 4096, &ierror);
+	g_assert_no_error(ierror);
+	g_assert_true(res);
+	g_assert_false(r_slot_fingerprint_matches(slot, &checksum));
+
+	/* clearing removes the record */
+	res = r_slot_fingerprint_save(slot, &checksum, &ierror);
+	g_assert_no_error(ierror);
+	g_assert_true(res);
+	r_slot_fingerprint_clear(slot);
+	g_assert_false(g_file_test(fingerprint, G_FILE_TEST_EXISTS));
+	g_assert_false(r_slot_fingerprint_matches(slot, &checksum));
+
+	g_assert_true(rm_tree(tmpdir, NULL));
+}
+
 int main(int argc, char *argv[])
 {
 	setlocale(LC_ALL, "C");
@@ -175,6 +237,7 @@ int main(int argc, char *argv[])
 	g_test_add_func("/slot/get-all-children", test_slot_get_all_children);
 	g_test_add_func("/slot/get-all-of-class", test_slot_get_all_of_class);
 	g_test_add_func("/slot/get-root-classes", test_slot_get_root_classes);
+	g_test_add_func("/slot/fingerprint", test_slot_fingerprint);
 
 	return g_test_run();
 }
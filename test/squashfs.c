@@ -0,0 +1,176 @@
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <locale.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "squashfs.h"
+#include "utils.h"
+
+#include "common.h"
+
+typedef struct {
+	gchar *tmpdir;
+	gchar *contentdir;
+} SquashfsFixture;
+
+static void squashfs_fixture_set_up(SquashfsFixture *fixture, gconstpointer user_data)
+{
+	g_autofree gchar *subdir = NULL;
+	g_autofree gchar *file = NULL;
+	g_autofree gchar *link_path = NULL;
+
+	fixture->tmpdir = g_dir_make_tmp("rauc-squashfs-XXXXXX", NULL);
+	g_assert_nonnull(fixture->tmpdir);
+
+	fixture->contentdir = g_build_filename(fixture->tmpdir, "content", NULL);
+	subdir = g_build_filename(fixture->contentdir, "subdir", NULL);
+	g_assert_cmpint(g_mkdir_with_parents(subdir, 0755), ==, 0);
+
+	/* larger than one block, incompressible */
+	g_free(write_random_file(fixture->contentdir, "rootfs.img", 300 * 1024, 0x1234));
+	g_free(write_random_file(fixture->contentdir, "appfs.img", 5000, 0x4321));
+	g_free(write_random_file(subdir, "data", 2 * 1024 * 1024, 0xabcd));
+	file = write_tmp_file(fixture->contentdir, "manifest.raucm", "[update]\ncompatible=Test Config\n", NULL);
+	g_assert_nonnull(file);
+
+	/* hardlinked files are stored only once */
+	link_path = g_build_filename(subdir, "manifest.raucm", NULL);
+	g_assert_cmpint(link(file, link_path), ==, 0);
+	g_clear_pointer(&link_path, g_free);
+	link_path = g_build_filename(fixture->contentdir, "link", NULL);
+	g_assert_cmpint(symlink("subdir/data", link_path), ==, 0);
+}
+
+static void squashfs_fixture_tear_down(SquashfsFixture *fixture, gconstpointer user_data)
+{
+	g_assert_true(rm_tree(fixture->tmpdir, NULL));
+	g_free(fixture->contentdir);
+	g_free(fixture->tmpdir);
+}
+
+static void test_squashfs_write(SquashfsFixture *fixture, gconstpointer user_data)
+{
+	GError *ierror = NULL;
+	g_autofree gchar *image = g_build_filename(fixture->tmpdir, "image.sqfs", NULL);
+	g_autofree gchar *contents = NULL;
+	gsize length = 0;
+	guint32 magic;
+	guint64 bytes_used;
+	gboolean res;
+
+	res = r_squashfs_write(fixture->contentdir, image, 2, NULL, &ierror);
+	g_assert_no_error(ierror);
+	g_assert_true(res);
+
+	res = g_file_get_contents(image, &contents, &length, &ierror);
+	g_assert_no_error(ierror);
+	g_assert_true(res);
+
+	g_assert_cmpuint(length, >, 96);
+	g_assert_cmpuint(length % 4096, ==, 0);
+	memcpy(&magic, contents, sizeof(magic));
+	g_assert_cmphex(GUINT32_FROM_LE(magic), ==, 0x73717368);
+	memcpy(&bytes_used, contents + 40, sizeof(bytes_used));
+	g_assert_cmpuint(GUINT64_FROM_LE(bytes_used), <=, length);
+	g_assert_cmpuint(GUINT64_FROM_LE(bytes_used), >, length - 4096);
+
+	/* must not overwrite an existing file */
+	res = r_squashfs_write(fixture->contentdir, image, 2, NULL, &ierror);
+	g_assert_error(ierror, G_FILE_ERROR, G_FILE_ERROR_EXIST);
+	g_assert_false(res);
+	g_clear_error(&ierror);
+}
+
+static void test_squashfs_reproducible(SquashfsFixture *fixture, gconstpointer user_data)
+{
+	GError *ierror = NULL;
+	g_autofree gchar *image1 = g_build_filename(fixture->tmpdir, "image1.sqfs", NULL);
+	g_autofree gchar *image2 = g_build_filename(fixture->tmpdir, "image2.sqfs", NULL);
+	g_autofree gchar *touched = g_build_filename(fixture->contentdir, "appfs.img", NULL);
+	g_autoptr(GBytes) contents1 = NULL;
+	g_autoptr(GBytes) contents2 = NULL;
+	gboolean res;
+
+	res = r_squashfs_write(fixture->contentdir, image1, 1, NULL, &ierror);
+	g_assert_no_error(ierror);
+	g_assert_true(res);
+
+	/* neither timestamps nor the number of threads may change the output */
+	g_assert_cmpint(g_utime(touched, NULL), ==, 0);
+	res = r_squashfs_write(fixture->contentdir, image2, 4, NULL, &ierror);
+	g_assert_no_error(ierror);
+	g_assert_true(res);
+
+	contents1 = read_file(image1, &ierror);
+	g_assert_no_error(ierror);
+	contents2 = read_file(image2, &ierror);
+	g_assert_no_error(ierror);
+	g_assert_true(g_bytes_equal(contents1, contents2));
+}
+
+static void test_squashfs_uncompressed(SquashfsFixture *fixture, gconstpointer user_data)
+{
+	GError *ierror = NULL;
+	g_autofree gchar *image = g_build_filename(fixture->tmpdir, "image.sqfs", NULL);
+	const gchar *uncompressed[] = {"appfs.img", "rootfs.img", NULL};
+	guint64 offsets[2] = {0};
+	g_autoptr(GBytes) contents = NULL;
+	gboolean res;
+
+	res = r_squashfs_plan_uncompressed(fixture->contentdir, uncompressed, offsets, &ierror);
+	g_assert_no_error(ierror);
+	g_assert_true(res);
+	g_assert_cmpuint(offsets[0], ==, 4096);
+	g_assert_cmpuint(offsets[1], ==, 12288);
+
+	res = r_squashfs_write(fixture->contentdir, image, 2, uncompressed, &ierror);
+	g_assert_no_error(ierror);
+	g_assert_true(res);
+
+	contents = read_file(image, &ierror);
+	g_assert_no_error(ierror);
+
+	/* the files are stored as-is at the planned offsets */
+	for (guint i = 0; uncompressed[i]; i++) {
+		g_autofree gchar *path = g_build_filename(fixture->contentdir, uncompressed[i], NULL);
+		g_autoptr(GBytes) file = read_file(path, &ierror);
+		g_autoptr(GBytes) stored = NULL;
+
+		g_assert_no_error(ierror);
+		g_assert_cmpuint(offsets[i] + g_bytes_get_size(file), <=, g_bytes_get_size(contents));
+		stored = g_bytes_new_from_bytes(contents, offsets[i], g_bytes_get_size(file));
+		g_assert_true(g_bytes_equal(file, stored));
+	}
+	g_clear_pointer(&contents, g_bytes_unref);
+	g_assert_cmpint(g_unlink(image), ==, 0);
+
+	/* only regular files in the top-level directory can be stored uncompressed */
+	uncompressed[0] = "subdir";
+	res = r_squashfs_write(fixture->contentdir, image, 2, uncompressed, &ierror);
+	g_assert_error(ierror, R_SQUASHFS_ERROR, R_SQUASHFS_ERROR_FAILED);
+	g_assert_false(res);
+	g_clear_error(&ierror);
+	g_assert_false(g_file_test(image, G_FILE_TEST_EXISTS));
+}
+
+int main(int argc, char *argv[])
+{
+	setlocale(LC_ALL, "C");
+
+	g_test_init(&argc, &argv, NULL);
+
+	g_test_add("/squashfs/write", SquashfsFixture, NULL,
+			squashfs_fixture_set_up, test_squashfs_write,
+			squashfs_fixture_tear_down);
+
+	g_test_add("/squashfs/reproducible", SquashfsFixture, NULL,
+			squashfs_fixture_set_up, test_squashfs_reproducible,
+			squashfs_fixture_tear_down);
+
+	g_test_add("/squashfs/uncompressed", SquashfsFixture, NULL,
+			squashfs_fixture_set_up, test_squashfs_uncompressed,
+			squashfs_fixture_tear_down);
+
+	return g_test_run();
+}
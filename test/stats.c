@@ -59,6 +59,173 @@ static void test_queue(void)
 	r_test_stats_stop();
 }
 
+static void test_percentile(void)
+{
+	g_autoptr(RaucStats) stats = r_stats_new("test");
+
+	g_assert_cmpfloat(r_stats_get_percentile(stats, 50), ==, 0.0);
+	g_assert_cmpfloat(r_stats_get_rate(stats), ==, 0.0);
+
+	for (guint i = 1; i <= 100; i++) {
+		r_stats_add(stats, i);
+	}
+
+	/* the histogram buckets have a relative width of at most 12.5% */
+	g_assert_cmpfloat_with_epsilon(r_stats_get_percentile(stats, 50), 50.0, 50.0 / 8);
+	g_assert_cmpfloat_with_epsilon(r_stats_get_percentile(stats, 90), 90.0, 90.0 / 8);
+	g_assert_cmpfloat_with_epsilon(r_stats_get_percentile(stats, 99), 99.0, 99.0 / 8);
+	/* limited to the range of added values */
+	g_assert_cmpfloat(r_stats_get_percentile(stats, 100), <=, 100.0);
+	g_assert_cmpfloat(r_stats_get_percentile(stats, 0), >=, 1.0);
+
+	/* a single large value only affects the tail */
+	r_stats_add(stats, 1e6);
+	g_assert_cmpfloat_with_epsilon(r_stats_get_percentile(stats, 50), 50.0, 50.0 / 8);
+	g_assert_cmpfloat(r_stats_get_percentile(stats, 100), ==, 1e6);
+}
+
+static void test_percentile_special(void)
+{
+	g_autoptr(RaucStats) stats = r_stats_new("test");
+
+	/* zero and negative values share the first bucket */
+	r_stats_add(stats, 0.0);
+	r_stats_add(stats, -1.0);
+	g_assert_cmpfloat(r_stats_get_percentile(stats, 50), ==, 0.0);
+	g_assert_cmpfloat(stats->min, ==, -1.0);
+	g_clear_pointer(&stats, r_stats_free);
+
+	/* a single value is reported exactly */
+	stats = r_stats_new("test");
+	r_stats_add(stats, 1000.0);
+	g_assert_cmpfloat(r_stats_get_percentile(stats, 50), ==, 1000.0);
+	g_assert_cmpfloat(r_stats_get_percentile(stats, 99), ==, 1000.0);
+	g_assert_cmpfloat(r_stats_get_rate(stats), ==, 0.0);
+}
+
+static void test_merge(void)
+{
+	g_autoptr(RaucStats) all = r_stats_new("all");
+	g_autoptr(RaucStats) low = r_stats_new("low");
+	g_autoptr(RaucStats) high = r_stats_new("high");
+	g_autoptr(RaucStats) empty = r_stats_new("empty");
+
+	for (guint i = 1; i <= 100; i++) {
+		r_stats_add(all, i);
+		r_stats_add(i <= 50 ? low : high, i);
+	}
+
+	r_stats_merge(low, high);
+	r_stats_merge(low, empty);
+
+	g_assert_cmpuint(low->count, ==, 100);
+	g_assert_cmpfloat_with_epsilon(low->sum, 5050.0, 1e-10);
+	g_assert_cmpfloat(low->min, ==, 1.0);
+	g_assert_cmpfloat(low->max, ==, 100.0);
+	g_assert_cmpmem(low->histogram, sizeof(low->histogram), all->histogram, sizeof(all->histogram));
+	g_assert_cmpfloat(r_stats_get_percentile(low, 90), ==, r_stats_get_percentile(all, 90));
+
+	r_stats_merge(empty, all);
+	g_assert_cmpuint(empty->count, ==, 100);
+	g_assert_cmpfloat(empty->min, ==, 1.0);
+	g_assert_cmpint(empty->first_time, ==, all->first_time);
+	g_assert_cmpint(empty->last_time, ==, all->last_time);
+}
+
+static void test_variant(void)
+{
+	GError *ierror = NULL;
+	g_autoptr(RaucStats) stats = r_stats_new("test");
+	g_autoptr(RaucStats) restored = NULL;
+	g_autoptr(GVariant) v = NULL;
+	g_auto(GVariantDict) dict = G_VARIANT_DICT_INIT(NULL);
+	gdouble p99;
+
+	for (guint i = 1; i <= 100; i++) {
+		r_stats_add(stats, i);
+	}
+
+	/* without histogram */
+	v = g_variant_ref_sink(r_stats_to_variant(stats, FALSE));
+	g_variant_dict_init(&dict, v);
+	g_assert_true(g_variant_dict_lookup(&dict, "p99", "d", &p99));
+	g_assert_cmpfloat(p99, ==, r_stats_get_percentile(stats, 99));
+	g_assert_false(g_variant_dict_contains(&dict, "histogram"));
+
+	restored = r_stats_from_variant(v, &ierror);
+	g_assert_error(ierror, R_STATS_ERROR, R_STATS_ERROR_INVALID);
+	g_assert_null(restored);
+	g_clear_error(&ierror);
+	g_clear_pointer(&v, g_variant_unref);
+
+	/* with histogram */
+	v = g_variant_ref_sink(r_stats_to_variant(stats, TRUE));
+	restored = r_stats_from_variant(v, &ierror);
+	g_assert_no_error(ierror);
+	g_assert_nonnull(restored);
+
+	g_assert_cmpstr(restored->label, ==, "test");
+	g_assert_cmpuint(restored->count, ==, stats->count);
+	g_assert_cmpfloat(restored->sum, ==, stats->sum);
+	g_assert_cmpfloat(restored->min, ==, stats->min);
+	g_assert_cmpfloat(restored->max, ==, stats->max);
+	g_assert_cmpint(restored->first_time, ==, stats->first_time);
+	g_assert_cmpint(restored->last_time, ==, stats->last_time);
+	g_assert_cmpmem(restored->histogram, sizeof(restored->histogram), stats->histogram, sizeof(stats->histogram));
+	g_clear_pointer(&restored, r_stats_free);
+	g_clear_pointer(&v, g_variant_unref);
+
+	/* histogram not matching the count */
+	stats->count++;
+	v = g_variant_ref_sink(r_stats_to_variant(stats, TRUE));
+	restored = r_stats_from_variant(v, &ierror);
+	g_assert_error(ierror, R_STATS_ERROR, R_STATS_ERROR_INVALID);
+	g_assert_null(restored);
+	g_clear_error(&ierror);
+}
+
+static void test_publish(void)
+{
+	g_autoptr(RaucStats) stats = r_stats_new("test");
+	g_autoptr(RaucStats) other = r_stats_new("other");
+	g_autoptr(GVariant) published = NULL;
+	g_autoptr(GVariant) dict = NULL;
+	guint64 count;
+
+	r_stats_clear_published();
+
+	r_stats_add(stats, 1.0);
+	r_stats_add(stats, 2.0);
+	r_stats_add(other, 3.0);
+
+	/* stats with the same label are merged */
+	r_stats_publish(stats);
+	r_stats_publish(stats);
+	r_stats_publish(other);
+
+	published = g_variant_ref_sink(r_stats_get_published(FALSE));
+	g_assert_cmpuint(g_variant_n_children(published), ==, 2);
+
+	dict = g_variant_lookup_value(published, "test", G_VARIANT_TYPE_VARDICT);
+	g_assert_nonnull(dict);
+	g_assert_true(g_variant_lookup(dict, "count", "t", &count));
+	g_assert_cmpuint(count, ==, 4);
+	g_assert_false(g_variant_lookup(dict, "histogram", "*", NULL));
+	g_clear_pointer(&dict, g_variant_unref);
+	g_clear_pointer(&published, g_variant_unref);
+
+	published = g_variant_ref_sink(r_stats_get_published(TRUE));
+	dict = g_variant_lookup_value(published, "other", G_VARIANT_TYPE_VARDICT);
+	g_assert_nonnull(dict);
+	g_assert_true(g_variant_lookup(dict, "histogram", "*", NULL));
+	g_clear_pointer(&dict, g_variant_unref);
+	g_clear_pointer(&published, g_variant_unref);
+
+	r_stats_clear_published();
+	published = g_variant_ref_sink(r_stats_get_published(FALSE));
+	g_assert_cmpuint(g_variant_n_children(published), ==, 0);
+}
+
 int main(int argc, char *argv[])
 {
 	setlocale(LC_ALL, "C");
@@ -69,6 +236,11 @@ int main(int argc, char *argv[])
 
 	g_test_add_func("/stats/basic", test_basic);
 	g_test_add_func("/stats/queue", test_queue);
+	g_test_add_func("/stats/percentile", test_percentile);
+	g_test_add_func("/stats/percentile-special", test_percentile_special);
+	g_test_add_func("/stats/merge", test_merge);
+	g_test_add_func("/stats/variant", test_variant);
+	g_test_add_func("/stats/publish", test_publish);
 
 	return g_test_run();
 }
@@ -1,5 +1,7 @@
 #include <glib.h>
+#include <glib/gstdio.h>
 #include <locale.h>
+#include <unistd.h>
 
 #include "common.h"
 #include "context.h"
@@ -131,6 +133,58 @@ static void status_file_test_global_slot_status(StatusFileFixture *fixture,
 	}
 }
 
+/* Loads per-slot status from an ext4 image without mounting it */
+static void status_file_test_per_slot_unmounted(StatusFileFixture *fixture,
+		gconstpointer user_data)
+{
+	GError *ierror = NULL;
+	g_autoptr(GSubprocess) sub = NULL;
+	g_autofree gchar *contentdir = NULL;
+	g_autofree gchar *imagepath = NULL;
+	g_autofree gchar *statuspath = NULL;
+	RaucSlot *slot;
+	gboolean res;
+
+	if (!g_file_test("/sbin/mkfs.ext4", G_FILE_TEST_IS_EXECUTABLE)) {
+		g_test_skip("mkfs.ext4 not available");
+		return;
+	}
+
+	contentdir = g_build_filename(fixture->tmpdir, "content", NULL);
+	g_assert_cmpint(g_mkdir(contentdir, 0777), ==, 0);
+	statuspath = g_build_filename(contentdir, "slot.raucs", NULL);
+	g_assert_true(g_file_set_contents(statuspath,
+			"[slot]\n"
+			"bundle.compatible=Test Config\n"
+			"status=ok\n"
+			"sha256=dc626520dcd53a22f727af3ee42c770e56c97a64fe3adb063799d8ab032fe551\n"
+			"size=42\n", -1, NULL));
+
+	/* mkfs.ext4 can populate the filesystem without requiring root */
+	imagepath = g_build_filename(fixture->tmpdir, "rootfs-1.ext4", NULL);
+	sub = g_subprocess_new(G_SUBPROCESS_FLAGS_STDOUT_SILENCE, &ierror,
+			"/sbin/mkfs.ext4", "-q", "-F", "-d", contentdir, imagepath, "8M", NULL);
+	g_assert_no_error(ierror);
+	res = g_subprocess_wait_check(sub, NULL, &ierror);
+	g_assert_no_error(ierror);
+	g_assert_true(res);
+
+	replace_strdup(&r_context()->config->statusfile_path, "per-slot");
+	slot = g_hash_table_lookup(r_context()->config->slots, "rootfs.1");
+	g_assert_nonnull(slot);
+	replace_strdup(&slot->device, imagepath);
+	g_clear_pointer(&slot->status, r_slot_free_status);
+
+	/* mounting would fail when not running as root */
+	r_slot_status_load(slot);
+	g_assert_nonnull(slot->status);
+	g_assert_cmpstr(slot->status->status, ==, "ok");
+	g_assert_cmpint(slot->status->checksum.type, ==, G_CHECKSUM_SHA256);
+	g_assert_cmpstr(slot->status->checksum.digest, ==,
+			"dc626520dcd53a22f727af3ee42c770e56c97a64fe3adb063799d8ab032fe551");
+	g_assert_cmpuint(slot->status->checksum.size, ==, 42);
+}
+
 /* Loads system status from a file containing only system status information */
 static void status_file_test_load_system_status(StatusFileFixture *fixture,
 		gconstpointer user_data)
@@ -365,6 +419,147 @@ boot-id=e02a2afe-cf45-4d50-a3f3-c223ca0f480a\n\
 	g_assert_true(g_strv_contains((const gchar * const *)groups, "slot.rootfs.0"));
 }
 
+/* Saves slot status changes to the status journal and checks that loading
+ * replays them, also after a torn append */
+static void status_file_test_journal(StatusFileFixture *fixture,
+		gconstpointer user_data)
+{
+	g_autofree gchar *pathname = NULL;
+	g_autofree gchar *journal = NULL;
+	g_autofree gchar *contents = NULL;
+	g_autoptr(GString) torn = NULL;
+	RaucSlot *slot = NULL;
+	GError *ierror = NULL;
+	GStatBuf st;
+	goffset journal_size;
+	gboolean res;
+
+	pathname = g_build_filename(fixture->tmpdir, "journal.raucs", NULL);
+	journal = g_strconcat(pathname, ".journal", NULL);
+	replace_strdup(&r_context()->config->statusfile_path, pathname);
+	r_context()->config->statusfile_journal = TRUE;
+
+	slot = g_hash_table_lookup(r_context()->config->slots, "rootfs.0");
+	g_assert_nonnull(slot);
+	g_assert_nonnull(slot->status);
+	replace_strdup(&slot->status->status, "ok");
+
+	/* the first save creates the status file */
+	res = r_slot_status_save(slot, &ierror);
+	g_assert_no_error(ierror);
+	g_assert_true(res);
+	g_assert_true(g_file_test(pathname, G_FILE_TEST_IS_REGULAR));
+	g_assert_false(g_file_test(journal, G_FILE_TEST_EXISTS));
+
+	/* further changes are appended to the journal */
+	replace_strdup(&slot->status->status, "failed");
+	res = r_slot_status_save(slot, &ierror);
+	g_assert_no_error(ierror);
+	g_assert_true(res);
+	g_assert_cmpint(g_stat(journal, &st), ==, 0);
+	journal_size = st.st_size;
+	g_assert_cmpint(journal_size, >, 0);
+
+	/* unchanged status is not written again */
+	res = r_slot_status_save(slot, &ierror);
+	g_assert_no_error(ierror);
+	g_assert_true(res);
+	g_assert_cmpint(g_stat(journal, &st), ==, 0);
+	g_assert_cmpint(st.st_size, ==, journal_size);
+
+	/* simulate a torn append */
+	g_assert_true(g_file_get_contents(journal, &contents, NULL, NULL));
+	torn = g_string_new_len(contents, journal_size);
+	g_string_append_len(torn, "RSJ1\xff\x00", 6);
+	g_assert_true(g_file_set_contents(journal, torn->str, torn->len, NULL));
+
+	g_clear_pointer(&slot->status, r_slot_free_status);
+	r_slot_status_load_globally(pathname, r_context()->config->slots);
+	g_assert_nonnull(slot->status);
+	g_assert_cmpstr(slot->status->status, ==, "failed");
+
+	/* the next append replaces the torn record */
+	replace_strdup(&slot->status->status, "ok");
+	res = r_slot_status_save(slot, &ierror);
+	g_assert_no_error(ierror);
+	g_assert_true(res);
+
+	g_clear_pointer(&slot->status, r_slot_free_status);
+	r_slot_status_load_globally(pathname, r_context()->config->slots);
+	g_assert_cmpstr(slot->status->status, ==, "ok");
+}
+
+/* Simulates an interruption after merging the journal into the status file
+ * but before removing the journal and checks that replaying the leftover
+ * journal does not revert the latest change */
+static void status_file_test_journal_leftover(StatusFileFixture *fixture,
+		gconstpointer user_data)
+{
+	g_autofree gchar *pathname = NULL;
+	g_autofree gchar *journal = NULL;
+	g_autofree gchar *leftover = NULL;
+	g_autofree gchar *expected = NULL;
+	RaucSlot *slot = NULL;
+	GError *ierror = NULL;
+	gboolean res;
+
+	pathname = g_build_filename(fixture->tmpdir, "journal.raucs", NULL);
+	journal = g_strconcat(pathname, ".journal", NULL);
+	leftover = g_strconcat(pathname, ".leftover", NULL);
+	replace_strdup(&r_context()->config->statusfile_path, pathname);
+	r_context()->config->statusfile_journal = TRUE;
+
+	slot = g_hash_table_lookup(r_context()->config->slots, "rootfs.0");
+	g_assert_nonnull(slot);
+	g_assert_nonnull(slot->status);
+
+	replace_strdup(&slot->status->status, "ok");
+	res = r_slot_status_save(slot, &ierror);
+	g_assert_no_error(ierror);
+	g_assert_true(res);
+
+	/* Change the status until the journal is merged. The hard link keeps
+	 * the content of the journal at the time it was removed. */
+	for (guint i = 0; i < 1000; i++) {
+		if (g_file_test(leftover, G_FILE_TEST_EXISTS))
+			g_assert_cmpint(g_unlink(leftover), ==, 0);
+		if (g_file_test(journal, G_FILE_TEST_EXISTS))
+			g_assert_cmpint(link(journal, leftover), ==, 0);
+
+		g_free(expected);
+		expected = g_strdup_printf("status-%u", i);
+		replace_strdup(&slot->status->status, expected);
+		res = r_slot_status_save(slot, &ierror);
+		g_assert_no_error(ierror);
+		g_assert_true(res);
+
+		if (!g_file_test(journal, G_FILE_TEST_EXISTS))
+			break;
+	}
+	g_assert_false(g_file_test(journal, G_FILE_TEST_EXISTS));
+	g_assert_true(g_file_test(leftover, G_FILE_TEST_EXISTS));
+
+	/* restore the journal as if removing it was interrupted */
+	g_assert_cmpint(g_rename(leftover, journal), ==, 0);
+
+	g_clear_pointer(&slot->status, r_slot_free_status);
+	r_slot_status_load_globally(pathname, r_context()->config->slots);
+	g_assert_nonnull(slot->status);
+	g_assert_cmpstr(slot->status->status, ==, expected);
+
+	/* saving without the journal merges it first */
+	r_context()->config->statusfile_journal = FALSE;
+	replace_strdup(&slot->status->status, "ok");
+	res = r_slot_status_save(slot, &ierror);
+	g_assert_no_error(ierror);
+	g_assert_true(res);
+	g_assert_false(g_file_test(journal, G_FILE_TEST_EXISTS));
+
+	g_clear_pointer(&slot->status, r_slot_free_status);
+	r_slot_status_load_globally(pathname, r_context()->config->slots);
+	g_assert_cmpstr(slot->status->status, ==, "ok");
+}
+
 #define DIGEST_INITIAL "9a0218f0dbfed28d5b35e441668952100128d7bdec667f3f0e1f7cbbff6d11e7"
 #define DIGEST_OTHER "20ea715f2807da0cccda2a4874898a55b38bdf0473fc2fdcab0d28fdbc96b770"
 #define DIGEST_UPDATED "839127aa5fcd9e5f988934e2d727fb14feb5cec9435dd2548bf1a778ba44549a"
@@ -504,6 +699,9 @@ int main(int argc, char *argv[])
 	g_test_add("/status-file/slot-status/global", StatusFileFixture, NULL,
 			status_file_fixture_set_up_global, status_file_test_global_slot_status,
 			status_file_fixture_tear_down);
+	g_test_add("/status-file/slot-status/per-slot-unmounted", StatusFileFixture, NULL,
+			status_file_fixture_set_up_global, status_file_test_per_slot_unmounted,
+			status_file_fixture_tear_down);
 	/* Tests for system status only */
 	g_test_add("/status-file/system-status/load", StatusFileFixture, NULL,
 			status_file_fixture_set_up_global,
@@ -535,6 +733,16 @@ int main(int argc, char *argv[])
 			status_file_test_save_slot_status_existing_system_status,
 			status_file_fixture_tear_down);
 
+	g_test_add("/status-file/combined/journal", StatusFileFixture, NULL,
+			status_file_fixture_set_up_global,
+			status_file_test_journal,
+			status_file_fixture_tear_down);
+
+	g_test_add("/status-file/combined/journal-leftover", StatusFileFixture, NULL,
+			status_file_fixture_set_up_global,
+			status_file_test_journal_leftover,
+			status_file_fixture_tear_down);
+
 	g_test_add("/datadir/installation", StatusFileFixture, NULL,
 			status_file_fixture_set_up_datadir,
 			status_file_test_datadir,
@@ -644,3 +644,84 @@ def test_composefs_install(rauc_dbus_service_with_system_composefs, tmp_path):
     artifact_path = repo.path / "artifact-1"
     assert not artifact_path.exists()
     assert not Path("/run/rauc/artifacts/composefs/artifact-1").exists()
+
+
+@needs_composefs
+def test_composefs_install_many_objects(rauc_dbus_service_with_system_composefs, tmp_path):
+    # enough objects to share fan-out directories and keep all copy threads busy
+    contents = {f"file-{i:03}": f"content-{i}".encode() * 512 for i in range(300)}
+    do_install_composefs(tmp_path, "a", "composefs", "artifact-1", contents)
+
+    repo = get_status().repos["composefs"]
+    objects = [p for p in (repo.path / ".rauc-cfs-store").glob("*/*") if p.is_file()]
+    assert len(objects) == len(contents)
+
+    with mounted_composefs(tmp_path, repo.path / "artifact-1" / "image.cfs", repo.path / ".rauc-cfs-store") as mount_path:
+        for name, data in contents.items():
+            with open(mount_path / name, "rb") as f:
+                assert f.read() == data
+
+
+@needs_composefs
+def test_composefs_object_index(rauc_dbus_service_with_system_composefs, tmp_path):
+    data_a = b"content-a" * 1024
+    data_b = b"content-b" * 1024
+    data_c = b"content-c" * 1024
+    do_install_composefs(tmp_path, "a", "composefs", "artifact-1", {"file-a": data_a, "file-c": data_c})
+    # the old instance is removed, so only the object for file-c becomes unused
+    do_install_composefs(tmp_path, "b", "composefs", "artifact-1", {"file-a": data_a, "file-b": data_b})
+
+    repo = get_status().repos["composefs"]
+    store_path = repo.path / ".rauc-cfs-store"
+    index_path = repo.path / ".rauc-cfs-index"
+    lines = (index_path / "objects").read_text().splitlines()
+    assert lines[0] == "# rauc composefs object index v1"
+
+    artifacts = [line.split()[1] for line in lines if line.startswith("artifact ")]
+    assert len(artifacts) == 1
+    assert artifacts[0].startswith("artifact-1-")
+    assert [p.name for p in (index_path / "artifacts").iterdir()] == artifacts
+
+    counts = {line.split()[2]: int(line.split()[1]) for line in lines if line.startswith("object ")}
+    assert set(counts) == {str(p.relative_to(store_path)) for p in store_path.glob("*/*")}
+    assert list(counts.values()) == [1, 1]
+
+
+@needs_composefs
+def test_composefs_object_store_repair(rauc_dbus_service_with_system_composefs, tmp_path):
+    data_a = b"content-a" * 1024
+    data_b = b"content-b" * 1024
+    data_d = b"content-d" * 1024
+    do_install_composefs(tmp_path, "a", "composefs", "artifact-1", {"file-a": data_a, "file-b": data_b})
+
+    repo = get_status().repos["composefs"]
+    store_path = repo.path / ".rauc-cfs-store"
+    objects = sorted(p for p in store_path.glob("*/*") if p.is_file())
+    assert len(objects) == 2
+
+    # an indexed object lost from the store and one left over from an
+    # interrupted installation, which is only recorded as pending
+    lost = objects[0]
+    lost.unlink()
+    leftover = store_path / "00" / ("0" * 62)
+    leftover.parent.mkdir(exist_ok=True)
+    leftover.write_bytes(b"leftover")
+    (repo.path / ".rauc-cfs-index" / "pending").write_text(f"{leftover.relative_to(store_path)}\n")
+
+    do_install_composefs(
+        tmp_path, "b", "composefs", "artifact-1", {"file-a": data_a, "file-b": data_b, "file-d": data_d}
+    )
+
+    assert lost.is_file()
+    assert not leftover.exists()
+    assert not (repo.path / ".rauc-cfs-index" / "pending").exists()
+
+    lines = (repo.path / ".rauc-cfs-index" / "objects").read_text().splitlines()
+    counts = {line.split()[2]: int(line.split()[1]) for line in lines if line.startswith("object ")}
+    assert set(counts) == {str(p.relative_to(store_path)) for p in store_path.glob("*/*")}
+    assert list(counts.values()) == [1, 1, 1]
+
+    with mounted_composefs(tmp_path, repo.path / "artifact-1" / "image.cfs", store_path) as mount_path:
+        for name, data in {"file-a": data_a, "file-b": data_b, "file-d": data_d}.items():
+            with open(mount_path / name, "rb") as f:
+                assert f.read() == data
@@ -1,6 +1,8 @@
+import json
 import os
 import shutil
 
+from conftest import needs_squashfs_writer
 from helper import run
 
 
@@ -66,6 +68,125 @@ def test_bundle_mksquashfs_extra_args(tmp_path):
     assert exitcode == 0
 
 
+def test_bundle_jobs(tmp_path, bundle):
+    for i in range(4):
+        bundle.manifest[f"image.rootfs-{i}"] = {
+            "filename": f"rootfs-{i}.img",
+            "adaptive": "block-hash-index",
+        }
+        bundle.make_random_image(f"rootfs-{i}", 8192, f"random rootfs {i}")
+    bundle.manifest["image.appfs"] = {
+        "filename": "appfs.img",
+    }
+    bundle.make_random_image("appfs", 4096, "random appfs")
+    # images using the same file are processed by the same worker
+    bundle.manifest["image.recovery"] = {
+        "filename": "rootfs-0.img",
+        "adaptive": "block-hash-index",
+    }
+
+    with open(bundle.content / "manifest.raucm", "w") as f:
+        bundle.manifest.write(f, space_around_delimiters=False)
+
+    out, err, exitcode = run(
+        "rauc bundle "
+        "--cert openssl-ca/dev/autobuilder-1.cert.pem "
+        "--key openssl-ca/dev/private/autobuilder-1.pem "
+        "--jobs=2 "
+        f"{bundle.content} {bundle.output}"
+    )
+    assert exitcode == 0
+    assert "Bundle creation took" in err
+    assert bundle.output.is_file()
+
+    out, err, exitcode = run(f"rauc -c test.conf info --output-format=json {bundle.output}")
+    assert exitcode == 0
+    info = json.loads(out)
+    assert len(info["images"]) == 6
+    for image in info["images"]:
+        (name,) = image.keys()
+        assert image[name]["size"] in (4096, 8192)
+        assert len(image[name]["checksum"]) == 64
+
+
+def test_bundle_jobs_invalid(tmp_path, bundle):
+    out, err, exitcode = run(
+        "rauc bundle "
+        "--cert openssl-ca/dev/autobuilder-1.cert.pem "
+        "--key openssl-ca/dev/private/autobuilder-1.pem "
+        "--jobs=-1 "
+        f"{bundle.content} {bundle.output}"
+    )
+    assert exitcode == 1
+    assert "Invalid number of jobs: -1" in err
+    assert not bundle.output.exists()
+
+
+@needs_squashfs_writer
+def test_bundle_builtin_squashfs(tmp_path):
+    shutil.copytree("install-content", tmp_path / "install-content")
+
+    out, err, exitcode = run(
+        "rauc bundle "
+        "--cert openssl-ca/dev/autobuilder-1.cert.pem "
+        "--key openssl-ca/dev/private/autobuilder-1.pem "
+        "--builtin-squashfs "
+        f"{tmp_path}/install-content {tmp_path}/out.raucb"
+    )
+    assert exitcode == 0
+    assert os.path.exists(f"{tmp_path}/out.raucb")
+
+    out, err, exitcode = run(f"rauc -c test.conf info {tmp_path}/out.raucb")
+    assert exitcode == 0
+
+    out, err, exitcode = run(f"rauc -c test.conf extract {tmp_path}/out.raucb {tmp_path}/extracted")
+    assert exitcode == 0
+    for name in os.listdir(f"{tmp_path}/install-content"):
+        if name == "manifest.raucm":
+            continue
+        with open(f"{tmp_path}/install-content/{name}", "rb") as a, open(f"{tmp_path}/extracted/{name}", "rb") as b:
+            assert a.read() == b.read()
+
+
+@needs_squashfs_writer
+def test_bundle_builtin_squashfs_mksquashfs_args(tmp_path):
+    shutil.copytree("install-content", tmp_path / "install-content")
+
+    out, err, exitcode = run(
+        "rauc bundle "
+        "--cert openssl-ca/dev/autobuilder-1.cert.pem "
+        "--key openssl-ca/dev/private/autobuilder-1.pem "
+        "--builtin-squashfs "
+        '--mksquashfs-args="-comp xz" '
+        f"{tmp_path}/install-content {tmp_path}/out.raucb"
+    )
+    assert exitcode == 1
+    assert "cannot be used with the built-in squashfs writer" in err
+    assert not os.path.exists(f"{tmp_path}/out.raucb")
+
+
+@needs_squashfs_writer
+def test_bundle_uncompressed_image(tmp_path, bundle):
+    bundle.manifest["image.rootfs"] = {
+        "filename": "rootfs.img",
+        "uncompressed": "true",
+    }
+    bundle.make_random_image("rootfs", 16384, "random rootfs")
+    bundle.build()
+
+    out, err, exitcode = run(f"rauc -c test.conf info --output-format=json {bundle.output}")
+    assert exitcode == 0
+    info = json.loads(out)
+    (rootfs,) = [image["rootfs"] for image in info["images"] if "rootfs" in image]
+    offset = rootfs["payload-offset"]
+    assert offset % 4096 == 0
+
+    # the verity payload starts at the beginning of the bundle
+    with open(bundle.content / "rootfs.img", "rb") as a, open(bundle.output, "rb") as b:
+        b.seek(offset)
+        assert a.read() == b.read(rootfs["size"])
+
+
 def test_bundle_pkcs11_key1(tmp_path, pkcs11):
     "A bundle signed with autobuilder-1 key must verify against keyring"
 
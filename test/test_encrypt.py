@@ -87,3 +87,49 @@ def test_encrypt_verity_bundle(tmp_path):
     assert "Refused to encrypt input bundle" in err
 
     assert not os.path.exists(f"{tmp_path}/encrypted.raucb")
+
+
+def test_encrypt_batch(tmp_path):
+    batch = tmp_path / "batch.txt"
+    batch.write_text(
+        "# output recipients...\n"
+        f"{tmp_path}/device-0.raucb openssl-enc/keys/rsa-4096/cert-000.pem\n"
+        "\n"
+        f"{tmp_path}/device-1.raucb openssl-enc/keys/rsa-4096/cert-001.pem\n"
+        f"{tmp_path}/device-2.raucb openssl-enc/keys/rsa-4096/cert-000.pem openssl-enc/keys/rsa-4096/cert-002.pem\n"
+    )
+
+    out, err, exitcode = run(
+        f"rauc encrypt --batch {batch} --keyring openssl-ca/dev-ca.pem good-crypt-bundle-unencrypted.raucb"
+    )
+
+    assert exitcode == 0
+    assert "3 encrypted bundles written" in out
+
+    # each output can only be decrypted by its own recipients
+    for index, key, expected in [(0, 0, 0), (1, 1, 0), (1, 0, 1), (2, 2, 0)]:
+        out, err, exitcode = run(
+            "rauc --keyring openssl-ca/dev-ca.pem "
+            f"--key openssl-enc/keys/rsa-4096/private-key-{key:03}.pem "
+            f"info {tmp_path}/device-{index}.raucb"
+        )
+        assert exitcode == expected
+
+
+def test_encrypt_batch_failure(tmp_path):
+    batch = tmp_path / "batch.txt"
+    batch.write_text(
+        f"{tmp_path}/device-0.raucb openssl-enc/keys/rsa-4096/cert-000.pem\n"
+        f"{tmp_path}/device-1.raucb openssl-enc/keys/rsa-4096/private-key-001.pem\n"
+    )
+
+    out, err, exitcode = run(
+        f"rauc encrypt --batch {batch} --keyring openssl-ca/dev-ca.pem good-crypt-bundle-unencrypted.raucb"
+    )
+
+    assert exitcode == 1
+    assert "Expecting: CERTIFICATE" in err
+
+    # no partial results
+    assert not os.path.exists(f"{tmp_path}/device-0.raucb")
+    assert not os.path.exists(f"{tmp_path}/device-1.raucb")
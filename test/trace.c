@@ -0,0 +1,174 @@
+#include <locale.h>
+#include <string.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include "context.h"
+#include "trace.h"
+#include "utils.h"
+
+#include "common.h"
+
+typedef struct {
+	gchar *tmpdir;
+} TraceFixture;
+
+static void trace_fixture_set_up(TraceFixture *fixture, gconstpointer user_data)
+{
+	fixture->tmpdir = g_dir_make_tmp("rauc-trace-XXXXXX", NULL);
+	g_assert_nonnull(fixture->tmpdir);
+}
+
+static void trace_fixture_tear_down(TraceFixture *fixture, gconstpointer user_data)
+{
+	g_assert_true(rm_tree(fixture->tmpdir, NULL));
+	g_free(fixture->tmpdir);
+}
+
+static void trace_record(void)
+{
+	gint64 begin;
+
+	r_context_begin_step("outer", "Outer step", 1);
+	r_context_begin_step("inner", "Inner step", 0);
+	r_trace_add_bytes(4096);
+	r_context_end_step("inner", TRUE);
+	r_context_end_step("outer", TRUE);
+
+	begin = r_trace_begin();
+	r_trace_end(R_TRACE_CAT_IO, "quote\"d", begin, 123);
+}
+
+static void test_trace_disabled(void)
+{
+	g_assert_false(r_trace_is_enabled());
+	g_assert_cmpint(r_trace_begin(), ==, 0);
+
+	/* recording is a no-op */
+	r_trace_end(R_TRACE_CAT_IO, "ignored", 0, 0);
+	r_trace_add_bytes(1);
+	g_assert_cmpuint(r_trace_get_bytes(), ==, 0);
+	g_assert_true(r_trace_stop(NULL));
+}
+
+static void test_trace_json(TraceFixture *fixture, gconstpointer user_data)
+{
+	GError *ierror = NULL;
+	g_autofree gchar *path = g_build_filename(fixture->tmpdir, "trace.json", NULL);
+	g_autofree gchar *trace_path = NULL;
+	g_autofree gchar *contents = NULL;
+	gboolean res;
+
+	g_assert_cmpint(r_trace_format_for_path(path), ==, R_TRACE_FORMAT_JSON);
+
+	res = r_trace_start(path, &ierror);
+	g_assert_no_error(ierror);
+	g_assert_true(res);
+	g_assert_true(r_trace_is_enabled());
+	trace_path = r_trace_get_path();
+	g_assert_cmpstr(trace_path, ==, path);
+	g_clear_pointer(&trace_path, g_free);
+
+	/* each subprocess gets its own file */
+	trace_path = r_trace_get_aux_path("nbd");
+	g_assert_true(g_str_has_suffix(trace_path, "trace.json.nbd.1"));
+	g_clear_pointer(&trace_path, g_free);
+	trace_path = r_trace_get_aux_path("nbd");
+	g_assert_true(g_str_has_suffix(trace_path, "trace.json.nbd.2"));
+
+	/* only one trace can be active */
+	res = r_trace_start(path, &ierror);
+	g_assert_error(ierror, R_TRACE_ERROR, R_TRACE_ERROR_ACTIVE);
+	g_assert_false(res);
+	g_clear_error(&ierror);
+
+	trace_record();
+
+	res = r_trace_stop(&ierror);
+	g_assert_no_error(ierror);
+	g_assert_true(res);
+	g_assert_false(r_trace_is_enabled());
+
+	res = g_file_get_contents(path, &contents, NULL, &ierror);
+	g_assert_no_error(ierror);
+	g_assert_true(res);
+
+	g_assert_true(g_str_has_prefix(contents, "{\"traceEvents\":["));
+	/* inner steps end first */
+	g_assert_nonnull(strstr(contents, "{\"name\":\"inner\",\"cat\":\"step\",\"ph\":\"X\""));
+	g_assert_nonnull(strstr(contents, "{\"name\":\"outer\",\"cat\":\"step\",\"ph\":\"X\""));
+	g_assert_cmpint(strstr(contents, "\"inner\"") - strstr(contents, "\"outer\""), <, 0);
+	g_assert_nonnull(strstr(contents, "\"args\":{\"bytes\":4096}"));
+	g_assert_nonnull(strstr(contents, "{\"name\":\"quote\\\"d\",\"cat\":\"io\""));
+	g_assert_nonnull(strstr(contents, "\"args\":{\"bytes\":123}"));
+	g_assert_nonnull(strstr(contents, "\"dropped_events\":0"));
+}
+
+static void test_trace_binary(TraceFixture *fixture, gconstpointer user_data)
+{
+	GError *ierror = NULL;
+	g_autofree gchar *path = g_build_filename(fixture->tmpdir, "trace.rtrace", NULL);
+	g_autoptr(GBytes) contents = NULL;
+	const guint8 *data;
+	gsize size;
+	guint32 count;
+	guint64 bytes;
+	guint16 category_len, name_len;
+	gboolean res;
+
+	g_assert_cmpint(r_trace_format_for_path(path), ==, R_TRACE_FORMAT_BINARY);
+
+	res = r_trace_start(path, &ierror);
+	g_assert_no_error(ierror);
+	g_assert_true(res);
+
+	trace_record();
+
+	res = r_trace_stop(&ierror);
+	g_assert_no_error(ierror);
+	g_assert_true(res);
+
+	contents = read_file(path, &ierror);
+	g_assert_no_error(ierror);
+	data = g_bytes_get_data(contents, &size);
+
+	/* header */
+	g_assert_cmpuint(size, >, 32);
+	g_assert_cmpmem(data, 8, "RTRACE01", 8);
+	memcpy(&count, data + 12, sizeof(count));
+	g_assert_cmpuint(GUINT32_FROM_LE(count), ==, 3);
+	data += 32;
+
+	/* first event is the inner step */
+	memcpy(&bytes, data + 16, sizeof(bytes));
+	g_assert_cmpuint(GUINT64_FROM_LE(bytes), ==, 4096);
+	memcpy(&category_len, data + 28, sizeof(category_len));
+	memcpy(&name_len, data + 30, sizeof(name_len));
+	g_assert_cmpuint(GUINT16_FROM_LE(category_len), ==, 4);
+	g_assert_cmpuint(GUINT16_FROM_LE(name_len), ==, 5);
+	g_assert_cmpmem(data + 32, 9, "stepinner", 9);
+}
+
+int main(int argc, char *argv[])
+{
+	setlocale(LC_ALL, "C");
+
+	g_assert(g_setenv("GIO_USE_VFS", "local", TRUE));
+
+	r_context_conf()->configmode = R_CONTEXT_CONFIG_MODE_NONE;
+	r_context();
+
+	g_test_init(&argc, &argv, NULL);
+
+	g_test_add_func("/trace/disabled", test_trace_disabled);
+
+	g_test_add("/trace/json", TraceFixture, NULL,
+			trace_fixture_set_up, test_trace_json,
+			trace_fixture_tear_down);
+
+	g_test_add("/trace/binary", TraceFixture, NULL,
+			trace_fixture_set_up, test_trace_binary,
+			trace_fixture_tear_down);
+
+	return g_test_run();
+}
@@ -2,6 +2,7 @@
 #include <glib.h>
 #include <glib/gstdio.h>
 #include <fcntl.h>
+#include <string.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 
@@ -565,6 +566,83 @@ static void boottime_test(void)
 	g_assert_cmpint(diff, <=, 110000);
 }
 
+static void buffer_is_zero_test(void)
+{
+	g_autofree guint8 *buf = g_malloc0(4096 + 1);
+
+	g_assert_true(r_buffer_is_zero(buf, 0));
+	g_assert_true(r_buffer_is_zero(buf, 4096 + 1));
+	/* check unaligned start and odd sizes */
+	g_assert_true(r_buffer_is_zero(buf + 1, 4096));
+	g_assert_true(r_buffer_is_zero(buf + 3, 37));
+
+	/* check every position, covering the head, word and tail loops */
+	for (gsize i = 0; i < 4096 + 1; i++) {
+		buf[i] = 0x01;
+		g_assert_false(r_buffer_is_zero(buf, 4096 + 1));
+		g_assert_true(r_buffer_is_zero(buf, i));
+		buf[i] = 0x00;
+	}
+}
+
+static void buffer_is_cleared_test(void)
+{
+	g_autofree guint8 *buf = g_malloc0(4096 + 1);
+
+	g_assert_true(r_buffer_is_cleared(buf, 4096 + 1));
+	memset(buf, 0xff, 4096 + 1);
+	g_assert_true(r_buffer_is_cleared(buf, 4096 + 1));
+	g_assert_true(r_buffer_is_cleared(buf + 1, 4096));
+
+	/* mixed 0x00 and 0xff bytes are considered cleared as well */
+	for (gsize i = 0; i < 4096 + 1; i += 3)
+		buf[i] = 0x00;
+	g_assert_true(r_buffer_is_cleared(buf, 4096 + 1));
+
+	for (gsize i = 0; i < 4096 + 1; i++) {
+		guint8 old = buf[i];
+
+		buf[i] = 0x80;
+		g_assert_false(r_buffer_is_cleared(buf, 4096 + 1));
+		buf[i] = 0x01;
+		g_assert_false(r_buffer_is_cleared(buf, 4096 + 1));
+		buf[i] = 0x7f;
+		g_assert_false(r_buffer_is_cleared(buf, 4096 + 1));
+		buf[i] = old;
+	}
+}
+
+static void copy_fd_data_test(void)
+{
+	g_autofree gchar *tmpdir = g_dir_make_tmp("rauc-XXXXXX", NULL);
+	g_autofree gchar *src = g_build_filename(tmpdir, "src", NULL);
+	g_autofree gchar *dst = g_build_filename(tmpdir, "dst", NULL);
+	g_autofree guint8 *data = g_malloc(300 * 1024);
+	g_autofree gchar *contents = NULL;
+	g_auto(filedesc) src_fd = -1;
+	g_auto(filedesc) dst_fd = -1;
+	GError *error = NULL;
+	gsize length = 0;
+
+	for (gsize i = 0; i < 300 * 1024; i++)
+		data[i] = g_random_int();
+	g_assert_true(g_file_set_contents(src, (gchar *)data, 300 * 1024, NULL));
+
+	/* only the first part is copied, whichever method is used */
+	src_fd = g_open(src, O_RDONLY|O_CLOEXEC, 0);
+	g_assert_cmpint(src_fd, >=, 0);
+	dst_fd = g_open(dst, O_WRONLY|O_CLOEXEC|O_CREAT|O_EXCL, 0600);
+	g_assert_cmpint(dst_fd, >=, 0);
+	g_assert_true(r_copy_fd_data(src_fd, dst_fd, 200 * 1024 + 17, &error));
+	g_assert_no_error(error);
+
+	g_assert_true(g_file_get_contents(dst, &contents, &length, NULL));
+	g_assert_cmpuint(length, ==, 200 * 1024 + 17);
+	g_assert_cmpmem(contents, length, data, 200 * 1024 + 17);
+
+	g_assert_true(rm_tree(tmpdir, NULL));
+}
+
 int main(int argc, char *argv[])
 {
 	setlocale(LC_ALL, "C");
@@ -586,6 +664,9 @@ int main(int argc, char *argv[])
 	g_test_add_func("/utils/regex_match", regex_match_test);
 	g_test_add_func("/utils/tempfile_cleanup", tempfile_cleanup_test);
 	g_test_add_func("/utils/boottime", boottime_test);
+	g_test_add_func("/utils/buffer_is_zero", buffer_is_zero_test);
+	g_test_add_func("/utils/buffer_is_cleared", buffer_is_cleared_test);
+	g_test_add_func("/utils/copy_fd_data", copy_fd_data_test);
 
 	return g_test_run();
 }